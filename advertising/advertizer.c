@@ -1,12 +1,23 @@
 /******************************************************************************/
 /* File: advertizer.c
    Author: N.Kim
-   Abstract: Simple C DBus/BlueZ advertising example */
+   Abstract: Simple C DBus/BlueZ advertising example
+
+   Usage: advertizer [-b socket] [-T tenths] [-H tenths]
+     -b advertises the readings the sensor sends to 'socket' (see
+     ../dht11/monitor.c and ../common/env_bridge.h) rather than the
+     names, as Environmental Sensing service data. A reading goes on the
+     air only if its temperature (humidity) is more than -T (-H) tenths
+     off the one advertised, half a degree (one and a half percent) by
+     default */
 /******************************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -15,6 +26,9 @@
 #include <gio/gio.h>
 #include <gio/gnetworking.h>
 #include <glib.h>
+#include <glib-unix.h>
+
+#include "env_bridge.h"
 
 /* bluez and GDBus paths and interfaces */
 #define BLUEZ_OBJECT_ROOT "/org/bluez/"
@@ -30,6 +44,14 @@
    extract it */
 #define ADAPTER_PATH "/org/bluez/hci0"
 
+/* bridge mode service data: sequence, GPIO, then temperature and
+   humidity as the Environmental Sensing characteristics have them */
+#define BRIDGE_PAYLOAD_LENGTH 6
+#define BRIDGE_MAX_SENSORS 64
+
+#define BRIDGE_DEADBAND_T 5
+#define BRIDGE_DEADBAND_H 15
+
 /******************************************************************************/
 
 struct advertisement_data {
@@ -60,6 +82,44 @@ struct advertisement_data {
   0,
 };
 
+/******************************************************************************/
+
+struct bridge_data {
+  struct env_bridge bridge;
+  int enabled;
+
+  /* a value moving by more than that (tenths) is advertised again */
+  int deadband_t;
+  int deadband_h;
+
+  /* on the air: one uuid (4 bytes with the list header), the service
+     data (10 bytes with its header), 17 bytes with the flags */
+  char *uuid;
+  guint8 payload[BRIDGE_PAYLOAD_LENGTH];
+  int have_payload;
+
+  /* what was advertised last, by sensor */
+  int have[BRIDGE_MAX_SENSORS];
+  int temperature[BRIDGE_MAX_SENSORS];
+  int humidity[BRIDGE_MAX_SENSORS];
+
+  unsigned long readings;
+  unsigned long adverts;
+
+  /* microseconds from the last edge of an answer to its advert being
+     sent, and of them until the sensor sent it */
+  double latency_sum;
+  double latency_min;
+  double latency_max;
+  double sensor_sum;
+
+} bridge_data = {
+  .bridge = { .fd = -1 },
+  .deadband_t = BRIDGE_DEADBAND_T,
+  .deadband_h = BRIDGE_DEADBAND_H,
+  .uuid = "0x181a"
+};
+
 /******************************************************************************/
 /* Interfaces we implement
 
@@ -117,9 +177,39 @@ static GVariant *get_service_uuids(void)
 {
   GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("as"));
 
-  g_variant_builder_add(builder, "s", adv_data.uuids[0]);
-  g_variant_builder_add(builder, "s", adv_data.uuids[1]);
-  g_variant_builder_add(builder, "s", adv_data.uuids[2]);
+  if (bridge_data.enabled)
+  {
+    g_variant_builder_add(builder, "s", bridge_data.uuid);
+  }
+  else
+  {
+    g_variant_builder_add(builder, "s", adv_data.uuids[0]);
+    g_variant_builder_add(builder, "s", adv_data.uuids[1]);
+    g_variant_builder_add(builder, "s", adv_data.uuids[2]);
+  }
+
+  GVariant *result = g_variant_builder_end(builder);
+  g_variant_builder_unref(builder);
+
+  return result;
+}
+
+/******************************************************************************/
+/* Pack maintained service data into a GVariant */
+
+static GVariant *get_service_bridge_data(void)
+{
+  GVariantBuilder *builder =
+    g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+
+  /* nothing before the first reading */
+  if (bridge_data.have_payload)
+  {
+    GVariant *data = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+      bridge_data.payload, BRIDGE_PAYLOAD_LENGTH, 1);
+
+    g_variant_builder_add(builder, "{sv}", bridge_data.uuid, data);
+  }
 
   GVariant *result = g_variant_builder_end(builder);
   g_variant_builder_unref(builder);
@@ -134,6 +224,8 @@ static GVariant *get_service_data(void)
 {
   int i;
 
+  if (bridge_data.enabled) return get_service_bridge_data();
+
   /* remember the size limit of 31 bytes in total (i.e.
      including uuids) */
   if (adv_data.curr_uuid == 0) adv_data.service_data = "Stan";
@@ -212,6 +304,111 @@ static void on_method_call(GDBusConnection *con,
   }
 }
 
+/******************************************************************************/
+/* Tell BlueZ the service data changed, it will advertise 'data' from now
+   on */
+
+static gboolean emit_service_data(GVariant *data)
+{
+  /* builder for the second argument to 'PropertiesChanged' */
+  GVariantBuilder *prop_builder =
+    g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+
+  /* builder for the third argument to 'PropertiesChanged' */
+  GVariantBuilder *inv_prop_builder =
+    g_variant_builder_new(G_VARIANT_TYPE("as"));
+
+  g_variant_builder_add(prop_builder, "{sv}", "ServiceData", data);
+
+  GVariant *args[3] = {
+    g_variant_new_string(BLUEZ_ADVERT_IFACE),
+    g_variant_builder_end(prop_builder),
+    g_variant_builder_end(inv_prop_builder)
+  };
+
+  gboolean sig = g_dbus_connection_emit_signal(
+    conn,
+    BLUEZ_BUS_NAME,               /* org.bluez */
+    ADVERT_OBJECT_PATH,           /* /org/bitzap/dev/advertising */
+    DBUS_PROPERTIES_IFACE,        /* org.freedesktop.DBus.Properties */
+    "PropertiesChanged",          /* signal 'PropertiesChanged'... */
+    g_variant_new_tuple(args, 3), /* ...with 3 arguments */
+    NULL);
+
+  g_variant_builder_unref(prop_builder);
+  g_variant_builder_unref(inv_prop_builder);
+
+  return sig;
+}
+
+/******************************************************************************/
+/* A reading came in over the bridge, advertise it if it moved enough */
+
+static void on_bridge_reading(const struct env_bridge_msg *msg)
+{
+  struct bridge_data *b = &bridge_data;
+  const unsigned int s = msg->sensor % BRIDGE_MAX_SENSORS;
+
+  b->readings++;
+
+  /* within the deadband of what is on the air, no traffic at all */
+  if (b->have[s] &&
+      abs(msg->temperature - b->temperature[s]) <= b->deadband_t &&
+      abs(msg->humidity - b->humidity[s]) <= b->deadband_h)
+    return;
+
+  b->have[s] = 1;
+  b->temperature[s] = msg->temperature;
+  b->humidity[s] = msg->humidity;
+
+  /* a new sequence tells scanners it is a new reading */
+  b->payload[0]++;
+  b->payload[1] = msg->sensor;
+  env_ess_put_temperature(&b->payload[2], msg->temperature);
+  env_ess_put_humidity(&b->payload[4], msg->humidity);
+  b->have_payload = 1;
+
+  /* out on the bus rather than queued, BlueZ takes it from there */
+  emit_service_data(get_service_data());
+  g_dbus_connection_flush_sync(conn, NULL, NULL);
+
+  const double latency = (env_bridge_now_ns() - msg->edge_ns) / 1e3;
+  const double sensor = (msg->sent_ns - msg->edge_ns) / 1e3;
+
+  if (b->adverts == 0 || latency < b->latency_min) b->latency_min = latency;
+  if (latency > b->latency_max) b->latency_max = latency;
+
+  b->latency_sum += latency;
+  b->sensor_sum += sensor;
+  b->adverts++;
+
+  g_print("advertising GPIO %u: %.1f C, %.1f %%, %.0f us after the edge "
+          "(%.0f us in the sensor)\n", msg->sensor,
+          msg->temperature / 10.0, msg->humidity / 10.0, latency, sensor);
+}
+
+/******************************************************************************/
+
+static gboolean on_bridge_readable(gint fd, GIOCondition cond,
+                                   gpointer udata)
+{
+  struct env_bridge_msg msg;
+  int got;
+
+  /* all there is, they may come faster than one per loop iteration */
+  while ((got = env_bridge_recv(&bridge_data.bridge, &msg)) == 1)
+    on_bridge_reading(&msg);
+
+  if (got < 0)
+  {
+    g_printerr("Failed reading the bridge: %s\n", g_strerror(errno));
+    loop_done = 1;
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
 /******************************************************************************/
 /* Provide a simple user interaction */
 
@@ -224,46 +421,23 @@ static gboolean on_loop_idle(gpointer udata)
     return G_SOURCE_REMOVE;
   }
 
-  if (adv_changed)
+  /* the readings decide what is advertised in bridge mode */
+  if (adv_changed && !bridge_data.enabled)
   {
     /* cycle through uuids */
     adv_data.curr_uuid = (adv_data.curr_uuid + 1) % 3;
 
-    /* builder for the second argument to 'PropertiesChanged' */
-    GVariantBuilder *prop_builder =
-      g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
-
-    /* builder for the third argument to 'PropertiesChanged' */
-    GVariantBuilder *inv_prop_builder =
-      g_variant_builder_new(G_VARIANT_TYPE("as"));
-
-    g_variant_builder_add(
-      prop_builder, "{sv}", "ServiceData", get_service_data());
+    GVariant *data = get_service_data();
 
     g_print("\nadvertising service data:\n");
     g_print("  uuid: %s\n", adv_data.uuids[adv_data.curr_uuid]);
     g_print("  data: %s\n\n", adv_data.service_data);
 
-    GVariant *args[3] = {
-      g_variant_new_string(BLUEZ_ADVERT_IFACE),
-      g_variant_builder_end(prop_builder),
-      g_variant_builder_end(inv_prop_builder)
-    };
-
-    gboolean sig = g_dbus_connection_emit_signal(
-      conn,
-      BLUEZ_BUS_NAME,               /* org.bluez */
-      ADVERT_OBJECT_PATH,           /* /org/bitzap/dev/advertising */
-      DBUS_PROPERTIES_IFACE,        /* org.freedesktop.DBus.Properties */
-      "PropertiesChanged",          /* signal 'PropertiesChanged'... */
-      g_variant_new_tuple(args, 3), /* ...with 3 arguments */
-      NULL);
-
-    g_variant_builder_unref(prop_builder);
-    g_variant_builder_unref(inv_prop_builder);
-    adv_changed = 0;
+    emit_service_data(data);
   }
 
+  adv_changed = 0;
+
   return G_SOURCE_CONTINUE;
 }
 
@@ -321,10 +495,30 @@ static void register_service(gboolean enable)
 int main(int argc, char **argv)
 {
   GError *err = NULL;
+  const char *bridge_path = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:T:H:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': bridge_path = optarg; break;
+      case 'T': bridge_data.deadband_t = atoi(optarg); break;
+      case 'H': bridge_data.deadband_h = atoi(optarg); break;
+      default:
+        g_printerr("Usage: advertizer [-b socket] [-T tenths] "
+                   "[-H tenths]\n");
+        return 1;
+    }
+  }
 
   g_print("\nUse the following commands:\n");
   g_print("  SIGQUIT (e.g. Ctrl-\\) to quit\n");
-  g_print("  SIGINT (e.g. Ctrl-C ) to cycle advertisement data\n\n");
+
+  if (bridge_path == NULL)
+    g_print("  SIGINT (e.g. Ctrl-C ) to cycle advertisement data\n\n");
+  else
+    g_print("  (the sensor's readings are advertised as they come)\n\n");
 
   conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &err);
   g_print("Connecting to the system D-Bus...");
@@ -384,6 +578,20 @@ int main(int argc, char **argv)
   signal(SIGINT, on_signal_received);
   signal(SIGQUIT, on_signal_received);
 
+  /* before registering, the first reading may come any time */
+  if (bridge_path != NULL)
+  {
+    g_print("Opening the bridge %s...", bridge_path);
+
+    if (env_bridge_receiver(&bridge_data.bridge, bridge_path) < 0)
+    {
+      g_print("failed\n");
+      goto done;
+    } else g_print("ok\n");
+
+    bridge_data.enabled = 1;
+  }
+
   /* now actually try to register our exported object as a service.
      This will trigger the extraction of properties via 'GetAll' 
      and start broadcasting the data */
@@ -397,8 +605,27 @@ int main(int argc, char **argv)
      blocking in 'on_loop_idle' */
   loop = g_main_loop_new(NULL, FALSE);
   g_idle_add(on_loop_idle, NULL);
+
+  if (bridge_data.enabled)
+  {
+    g_unix_fd_add(bridge_data.bridge.fd, G_IO_IN, on_bridge_readable, NULL);
+  }
+
   g_main_loop_run(loop);
 
+  if (bridge_data.enabled)
+  {
+    struct bridge_data *b = &bridge_data;
+    const double adverts = b->adverts ? b->adverts : 1;
+
+    g_print("\n%lu readings, %lu advertised, %lu lost on the way\n",
+            b->readings, b->adverts, b->bridge.lost);
+    g_print("edge to advert: %.0f us min, %.0f us mean, %.0f us max "
+            "(%.0f us mean in the sensor)\n", b->latency_min,
+            b->latency_sum / adverts, b->latency_max,
+            b->sensor_sum / adverts);
+  }
+
   /* we are done, tear everything down now */
   g_print("\nUnregistering advertising object...");
 
@@ -419,7 +646,8 @@ int main(int argc, char **argv)
 
 /* housekeeping target */
 done:
-  g_main_loop_unref(loop);
+  env_bridge_close(&bridge_data.bridge);
+  if (loop != NULL) g_main_loop_unref(loop);
   g_dbus_node_info_unref(introspect_data);
   g_object_unref(conn);
 
@@ -0,0 +1,167 @@
+/******************************************************************************/
+/* File: bench_io.c
+   Author: N.Kim
+   Abstract: Benchmark of the socket I/O backends (epoll vs. io_uring)
+
+   Description:
+     UNIX socket pairs stand in for the Bluetooth links. A writer thread
+     spreads small messages round-robin across all connections while
+     the I/O loop on the main thread receives them. Reports messages
+     and system calls per second as well as the CPU time spent on the
+     receiving side for 1, 64 and 512 connections. */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+
+#include "io_loop.h"
+
+#define BENCH_MESSAGES 400000
+#define BENCH_MESSAGE_SIZE 64
+
+struct writer_args {
+  int *fds;
+  int count;
+};
+
+static unsigned long received = 0;
+
+/******************************************************************************/
+
+static double now(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static void *writer_thread(void *data)
+{
+  struct writer_args *args = data;
+  char msg[BENCH_MESSAGE_SIZE];
+
+  memset(msg, 'x', sizeof(msg));
+
+  for (int i = 0; i < BENCH_MESSAGES; ++i)
+  {
+    if (write(args->fds[i % args->count], msg, sizeof(msg)) < 0)
+    {
+      perror("write");
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+static void on_recv(struct io_loop *loop,
+                    int fd,
+                    const char *data,
+                    ssize_t len,
+                    void *udata)
+{
+  if (len > 0) received += len;
+  else io_loop_remove(loop, fd);
+}
+
+/******************************************************************************/
+
+static void run(const char *backend, int count)
+{
+  struct io_loop *loop = io_loop_new(backend, count);
+  int *readers = calloc(count, sizeof(int));
+  int *writers = calloc(count, sizeof(int));
+
+  if (!loop || !readers || !writers)
+  {
+    fprintf(stderr, "setup failed\n");
+    exit(1);
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+      perror("socketpair");
+      exit(1);
+    }
+
+    readers[i] = sv[0];
+    writers[i] = sv[1];
+    io_loop_add(loop, readers[i], on_recv, NULL);
+  }
+
+  struct writer_args args = { writers, count };
+  pthread_t thread;
+
+  received = 0;
+  memset(&loop->stats, 0, sizeof(loop->stats));
+
+  double start = now(CLOCK_MONOTONIC);
+  double cpu_start = now(CLOCK_THREAD_CPUTIME_ID);
+
+  pthread_create(&thread, NULL, writer_thread, &args);
+
+  const unsigned long total =
+    (unsigned long)BENCH_MESSAGES * BENCH_MESSAGE_SIZE;
+
+  while (received < total)
+  {
+    if (io_loop_run_once(loop, 1000) < 0) break;
+  }
+
+  double cpu = now(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+  double elapsed = now(CLOCK_MONOTONIC) - start;
+
+  pthread_join(thread, NULL);
+
+  printf("%-8s %6d %12.0f %12.0f %10.3f %10.3f\n",
+         io_loop_backend_name(loop),
+         count,
+         BENCH_MESSAGES / elapsed,
+         loop->stats.syscalls / elapsed,
+         (double)loop->stats.syscalls / BENCH_MESSAGES,
+         cpu * 1e6 / BENCH_MESSAGES);
+
+  for (int i = 0; i < count; ++i)
+  {
+    io_loop_remove(loop, readers[i]);
+    close(readers[i]);
+    close(writers[i]);
+  }
+
+  io_loop_free(loop);
+  free(readers);
+  free(writers);
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const int counts[] = { 1, 64, 512 };
+  const char *backends[] = { "epoll", "uring" };
+
+  printf("%-8s %6s %12s %12s %10s %10s\n",
+         "backend", "conns", "msgs/s", "syscalls/s", "sc/msg", "cpu us/msg");
+
+  for (int b = 0; b < 2; ++b)
+    for (int i = 0; i < 3; ++i)
+      run(backends[b], counts[i]);
+
+  return 0;
+}
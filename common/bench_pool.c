@@ -0,0 +1,226 @@
+/******************************************************************************/
+/* File: bench_pool.c
+   Author: N.Kim
+   Abstract: Scaling benchmark of the work-stealing pool
+
+   Description:
+     Synthetic stand-in for inbound profile traffic: the main thread
+     plays the I/O thread and submits frames round-robin across many
+     connections (strands), the workers checksum each frame a number of
+     times. Every frame carries a per-connection sequence number, thus,
+     any reordering within a connection is detected and reported.
+
+     A second run floods a single worker with the frames of one hot
+     connection and checks that a few light connections get their turn
+     long before the hot one is through. */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "work_pool.h"
+
+#define BENCH_CONNECTIONS 256
+#define BENCH_FRAMES 200000
+#define BENCH_FRAME_SIZE 256
+#define BENCH_ROUNDS 8
+
+/* the fairness run */
+#define BENCH_HOT_FRAMES 50000
+#define BENCH_LIGHT 8
+
+struct conn_state {
+  unsigned long expected;
+  unsigned long errors;
+  uint32_t crc;
+
+  /* light connections, when their frame was through */
+  unsigned long hot_seen;
+  double done;
+};
+
+static struct conn_state hot;
+
+struct frame {
+  unsigned long seq;
+  char payload[BENCH_FRAME_SIZE];
+};
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static void process_frame(struct work_strand *strand,
+                          const char *data,
+                          size_t len,
+                          void *udata)
+{
+  struct conn_state *conn = udata;
+  const struct frame *f = (const struct frame *)data;
+
+  /* per-connection ordering guarantee */
+  if (f->seq != conn->expected) conn->errors++;
+  conn->expected = f->seq + 1;
+
+  /* stand-in for decoding/validation */
+  for (int i = 0; i < BENCH_ROUNDS; ++i)
+    conn->crc = crc32_update(conn->crc, f->payload, sizeof(f->payload));
+}
+
+/******************************************************************************/
+
+static void process_light(struct work_strand *strand,
+                          const char *data,
+                          size_t len,
+                          void *udata)
+{
+  struct conn_state *conn = udata;
+
+  process_frame(strand, data, len, udata);
+
+  /* a single worker, the hot connection does not move meanwhile */
+  conn->hot_seen = hot.expected;
+  conn->done = now();
+}
+
+/******************************************************************************/
+
+static void run_fairness(void)
+{
+  struct work_pool *pool = work_pool_new(1, BENCH_LIGHT + 1);
+  struct work_strand *hot_strand, *light[BENCH_LIGHT];
+  struct conn_state conns[BENCH_LIGHT];
+  struct frame f;
+
+  memset(&hot, 0, sizeof(hot));
+  memset(conns, 0, sizeof(conns));
+  memset(&f, 0, sizeof(f));
+
+  hot_strand = work_pool_strand_new(pool, process_frame, &hot);
+
+  for (int i = 0; i < BENCH_LIGHT; ++i)
+    light[i] = work_pool_strand_new(pool, process_light, &conns[i]);
+
+  for (unsigned long i = 0; i < BENCH_HOT_FRAMES; ++i)
+  {
+    f.seq = i;
+    work_pool_submit(hot_strand, &f, sizeof(f));
+  }
+
+  f.seq = 0;
+  double start = now();
+
+  for (int i = 0; i < BENCH_LIGHT; ++i)
+    work_pool_submit(light[i], &f, sizeof(f));
+
+  work_pool_drain(pool);
+
+  double elapsed = now() - start;
+  unsigned long hot_seen = 0;
+  double latency = 0;
+
+  for (int i = 0; i < BENCH_LIGHT; ++i)
+  {
+    if (conns[i].hot_seen > hot_seen) hot_seen = conns[i].hot_seen;
+    if (conns[i].done - start > latency) latency = conns[i].done - start;
+  }
+
+  printf("\n1 worker, %d frames on a hot connection, 1 on %d light ones\n",
+         BENCH_HOT_FRAMES, BENCH_LIGHT);
+  printf("light ones through after %lu of the hot frames in %.3f ms, "
+         "all after %.3f ms\n", hot_seen, latency * 1e3, elapsed * 1e3);
+
+  work_pool_strand_free(hot_strand);
+
+  for (int i = 0; i < BENCH_LIGHT; ++i)
+    work_pool_strand_free(light[i]);
+
+  work_pool_free(pool);
+}
+
+/******************************************************************************/
+
+static double run(unsigned int workers, double baseline)
+{
+  struct work_pool *pool = work_pool_new(workers, BENCH_CONNECTIONS);
+  struct work_strand *strands[BENCH_CONNECTIONS];
+  struct conn_state conns[BENCH_CONNECTIONS];
+  struct frame f;
+
+  memset(conns, 0, sizeof(conns));
+  memset(&f, 0, sizeof(f));
+
+  for (int i = 0; i < BENCH_CONNECTIONS; ++i)
+    strands[i] = work_pool_strand_new(pool, process_frame, &conns[i]);
+
+  double start = now();
+
+  for (unsigned long i = 0; i < BENCH_FRAMES; ++i)
+  {
+    f.seq = i / BENCH_CONNECTIONS;
+    f.payload[0] = (char)i;
+
+    work_pool_submit(strands[i % BENCH_CONNECTIONS], &f, sizeof(f));
+  }
+
+  work_pool_drain(pool);
+
+  double elapsed = now() - start;
+  unsigned long errors = 0;
+  unsigned long steals = 0;
+
+  for (int i = 0; i < BENCH_CONNECTIONS; ++i)
+  {
+    errors += conns[i].errors;
+    work_pool_strand_free(strands[i]);
+  }
+
+  for (unsigned int i = 0; i < workers; ++i)
+    steals += atomic_load(&pool->workers[i].steals);
+
+  double rate = BENCH_FRAMES / elapsed;
+
+  printf("%8u %12.0f %8.2f %10lu %8lu\n",
+         workers, rate, baseline > 0 ? rate / baseline : 1.0,
+         steals, errors);
+
+  work_pool_free(pool);
+  return rate;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int max_workers = argc > 1 ? atoi(argv[1]) : cpus;
+
+  if (max_workers < 1) max_workers = 1;
+
+  printf("%ld online CPUs, %d connections, %d frames of %d bytes\n\n",
+         cpus, BENCH_CONNECTIONS, BENCH_FRAMES, BENCH_FRAME_SIZE);
+
+  printf("%8s %12s %8s %10s %8s\n",
+         "workers", "frames/s", "speedup", "steals", "reorder");
+
+  double baseline = run(1, 0);
+
+  for (unsigned int n = 2; n <= max_workers; n *= 2)
+    run(n, baseline);
+
+  run_fairness();
+  return 0;
+}
@@ -0,0 +1,283 @@
+/******************************************************************************/
+/* File: bench_store.c
+   Author: N.Kim
+   Abstract: Throughput of the time series store
+
+   Description:
+     Appends 'days' of readings of 'sensors' sensors, one every 2 seconds
+     each, to a new store, then queries it: the readings of random hours,
+     min/max/mean of random days out of the summaries (checked against
+     going through the readings) and of random weeks, far beyond the
+     readings kept. Finally reopens the store and checks the open buckets
+     came back.
+
+     bench_store [-d days] [-s sensors] [-q queries] file */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ts_store.h"
+
+#define BENCH_START 1700000000u
+#define BENCH_PERIOD 2
+#define BENCH_DAY 86400u
+#define BENCH_WEEK (7 * BENCH_DAY)
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static void reading(uint32_t time, unsigned int sensor, struct ts_record *r)
+{
+  /* a day/night swing, different for every sensor, and some noise */
+  const double phase = 2 * M_PI * (time % BENCH_DAY) / BENCH_DAY + sensor;
+
+  r->time = time;
+  r->sensor = sensor;
+  r->temperature = 220 + 40 * sin(phase) + rand() % 7 - 3;
+  r->humidity = 550 - 150 * sin(phase) + rand() % 11 - 5;
+}
+
+/******************************************************************************/
+
+static void summarize_records(const struct ts_store *store,
+                              unsigned int sensor,
+                              uint32_t from,
+                              uint32_t to,
+                              struct ts_summary *summary)
+{
+  /* the hard way, through every reading */
+  static struct ts_record batch[4096];
+  int64_t temperature = 0, humidity = 0;
+
+  memset(summary, 0, sizeof(*summary));
+  summary->temperature_min = INT16_MAX;
+  summary->temperature_max = INT16_MIN;
+  summary->humidity_min = UINT16_MAX;
+
+  for (;;)
+  {
+    const size_t got = ts_store_records(store, from, to, batch, 4096);
+    size_t n = got;
+
+    /* the readings of the last second may go on in the next batch */
+    if (got == 4096)
+    {
+      from = batch[got - 1].time;
+      while (n > 0 && batch[n - 1].time == from) n--;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      const struct ts_record *r = &batch[i];
+
+      if (r->sensor != sensor) continue;
+
+      summary->count++;
+      temperature += r->temperature;
+      humidity += r->humidity;
+
+      if (r->temperature < summary->temperature_min)
+        summary->temperature_min = r->temperature;
+      if (r->temperature > summary->temperature_max)
+        summary->temperature_max = r->temperature;
+      if (r->humidity < summary->humidity_min)
+        summary->humidity_min = r->humidity;
+      if (r->humidity > summary->humidity_max)
+        summary->humidity_max = r->humidity;
+    }
+
+    if (got < 4096) break;
+  }
+
+  if (summary->count)
+  {
+    summary->temperature_mean = lround((double)temperature / summary->count);
+    summary->humidity_mean = lround((double)humidity / summary->count);
+  }
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  struct ts_store store;
+  int days = 14, sensors = 24, queries = 1000, opt;
+
+  while ((opt = getopt(argc, argv, "d:s:q:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'd': days = atoi(optarg); break;
+      case 's': sensors = atoi(optarg); break;
+      case 'q': queries = atoi(optarg); break;
+      default: days = 0; break;
+    }
+  }
+
+  if (optind + 1 != argc || days < 8 || sensors < 1 ||
+      sensors > TS_MAX_SENSORS || queries < 1)
+  {
+    fprintf(stderr, "usage: %s [-d days (8 at least)] [-s sensors] "
+            "[-q queries] file\n", argv[0]);
+    return 1;
+  }
+
+  const char *path = argv[optind];
+
+  unlink(path);
+  srand(1);
+
+  if (ts_store_open(&store, path, 0, 0, 0) < 0)
+  {
+    perror(path);
+    return 1;
+  }
+
+  /* appends, the readings of a period at the same second */
+  const uint32_t end = BENCH_START + days * BENCH_DAY;
+  unsigned long appended = 0;
+  struct ts_record r;
+  double start = now();
+
+  for (uint32_t t = BENCH_START; t < end; t += BENCH_PERIOD)
+  {
+    for (int s = 0; s < sensors; ++s)
+    {
+      reading(t, s, &r);
+      ts_store_append(&store, &r);
+    }
+
+    appended += sensors;
+  }
+
+  double elapsed = now() - start;
+
+  printf("append:    %lu readings, %.2f M/s, %.0f ns each\n", appended,
+         appended / elapsed / 1e6, elapsed / appended * 1e9);
+
+  start = now();
+  ts_store_sync(&store);
+  printf("sync:      %.1f ms\n", (now() - start) * 1e3);
+
+  /* the readings of random hours, within what is kept */
+  const struct ts_ring *raw = &store.rings[TS_TIER_RAW];
+  const uint32_t oldest = ((struct ts_record *)raw->entries)
+    [raw->tail % raw->capacity].time;
+  static struct ts_record hour[3600 / BENCH_PERIOD * TS_MAX_SENSORS];
+  unsigned long records = 0;
+
+  start = now();
+
+  for (int q = 0; q < queries; ++q)
+  {
+    const uint32_t from = oldest + rand() % (end - oldest - 3600);
+
+    records += ts_store_records(&store, from, from + 3600, hour,
+                                sizeof(hour) / sizeof(hour[0]));
+  }
+
+  elapsed = now() - start;
+  printf("hours:     %.0f queries/s, %.1f M readings/s\n",
+         queries / elapsed, records / elapsed / 1e6);
+
+  /* days, out of the summaries and the hard way. Less if there are not
+     that many readings kept */
+  const uint32_t window = end - oldest >= 2 * BENCH_DAY ?
+    BENCH_DAY : (end - oldest) / 2;
+  struct ts_summary fast, slow;
+  unsigned long visited = 0, mismatches = 0, scanned = 0;
+  int worst = 0;
+  double tiers = 0, scans = 0;
+
+  for (int q = 0; q < queries; ++q)
+  {
+    const uint32_t from = oldest + rand() % (end - oldest - window);
+    const unsigned int sensor = rand() % sensors;
+
+    start = now();
+    visited += ts_store_summarize(&store, sensor, from, from + window, &fast);
+    tiers += now() - start;
+
+    /* the scans take a while, a few of them do */
+    if (q % 50) continue;
+
+    start = now();
+    summarize_records(&store, sensor, from, from + window, &slow);
+    scans += now() - start;
+    scanned++;
+
+    /* the means of hours are those of their minutes, rounded */
+    const int off = abs(fast.temperature_mean - slow.temperature_mean) +
+      abs(fast.humidity_mean - slow.humidity_mean);
+
+    if (off > worst) worst = off;
+
+    if (fast.count != slow.count ||
+        fast.temperature_min != slow.temperature_min ||
+        fast.temperature_max != slow.temperature_max ||
+        fast.humidity_min != slow.humidity_min ||
+        fast.humidity_max != slow.humidity_max || off > 2)
+      mismatches++;
+  }
+
+  printf("%2u hours:  %.0f queries/s, %.0f entries each, through the "
+         "readings %.0f queries/s, %lu mismatches, means off by %d at "
+         "most\n", window / 3600, queries / tiers,
+         (double)visited / queries, scanned / scans, mismatches, worst);
+
+  /* weeks, only the summaries go back that far */
+  visited = 0;
+  start = now();
+
+  for (int q = 0; q < queries; ++q)
+  {
+    const uint32_t from = BENCH_START + rand() % (end - BENCH_START -
+                                                  BENCH_WEEK);
+
+    visited += ts_store_summarize(&store, rand() % sensors, from,
+                                  from + BENCH_WEEK, &fast);
+  }
+
+  elapsed = now() - start;
+  printf("weeks:     %.0f queries/s, %.0f entries each\n",
+         queries / elapsed, (double)visited / queries);
+
+  /* the open buckets are to be rebuilt as they were */
+  static struct ts_accumulator minutes[TS_MAX_SENSORS], hours[TS_MAX_SENSORS];
+  uint32_t open[TS_TIERS];
+
+  memcpy(minutes, store.minutes, sizeof(minutes));
+  memcpy(hours, store.hours, sizeof(hours));
+  memcpy(open, store.open, sizeof(open));
+  ts_store_close(&store);
+
+  if (ts_store_open(&store, path, 0, 0, 0) < 0)
+  {
+    perror(path);
+    return 1;
+  }
+
+  const int reopened = memcmp(minutes, store.minutes, sizeof(minutes)) == 0 &&
+    memcmp(hours, store.hours, sizeof(hours)) == 0 &&
+    memcmp(open, store.open, sizeof(open)) == 0;
+
+  printf("reopen:    %s\n", reopened ? "ok" : "open buckets differ");
+  ts_store_close(&store);
+
+  return mismatches || !reopened ? 1 : 0;
+}
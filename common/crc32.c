@@ -0,0 +1,44 @@
+/******************************************************************************/
+/* File: crc32.c
+   Author: N.Kim
+   Abstract: CRC-32 (IEEE 802.3) checksum */
+/******************************************************************************/
+
+#include "crc32.h"
+
+static uint32_t crc_table[256];
+static int crc_table_ready = 0;
+
+/******************************************************************************/
+
+static void setup_crc_table(void)
+{
+  for (uint32_t i = 0; i < 256; ++i)
+  {
+    uint32_t c = i;
+
+    for (int k = 0; k < 8; ++k)
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+
+    crc_table[i] = c;
+  }
+
+  __atomic_store_n(&crc_table_ready, 1, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************/
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+  /* the table is idempotent, racing initializations are harmless */
+  if (!__atomic_load_n(&crc_table_ready, __ATOMIC_ACQUIRE))
+    setup_crc_table();
+
+  crc = ~crc;
+
+  while (len--) crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
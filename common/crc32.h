@@ -0,0 +1,16 @@
+/******************************************************************************/
+/* File: crc32.h
+   Author: N.Kim
+   Abstract: CRC-32 (IEEE 802.3) checksum */
+/******************************************************************************/
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* pass 0 as 'crc' for the first chunk, the previous result afterwards */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+#endif
@@ -0,0 +1,149 @@
+/******************************************************************************/
+/* File: env_bridge.c
+   Author: N.Kim
+   Abstract: Passing temperature/humidity readings between processes */
+/******************************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "env_bridge.h"
+
+/******************************************************************************/
+
+uint64_t env_bridge_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/******************************************************************************/
+
+static int bridge_socket(struct env_bridge *bridge, const char *path)
+{
+  memset(bridge, 0, sizeof(*bridge));
+  bridge->fd = -1;
+
+  if (strlen(path) >= sizeof(bridge->addr.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  bridge->addr.sun_family = AF_UNIX;
+  strcpy(bridge->addr.sun_path, path);
+
+  bridge->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  return bridge->fd;
+}
+
+/******************************************************************************/
+
+int env_bridge_sender(struct env_bridge *bridge, const char *path)
+{
+  /* not connected, the receiver may come and go */
+  return bridge_socket(bridge, path) < 0 ? -1 : 0;
+}
+
+/******************************************************************************/
+
+int env_bridge_receiver(struct env_bridge *bridge, const char *path)
+{
+  if (bridge_socket(bridge, path) < 0) return -1;
+
+  unlink(path);
+
+  if (bind(bridge->fd, (struct sockaddr *)&bridge->addr,
+           sizeof(bridge->addr)) < 0)
+  {
+    env_bridge_close(bridge);
+    return -1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void env_bridge_close(struct env_bridge *bridge)
+{
+  if (bridge->fd >= 0) close(bridge->fd);
+  bridge->fd = -1;
+}
+
+/******************************************************************************/
+
+int env_bridge_send(struct env_bridge *bridge, struct env_bridge_msg *msg)
+{
+  msg->magic = ENV_BRIDGE_MAGIC;
+  msg->seq = bridge->seq++;
+  msg->sent_ns = env_bridge_now_ns();
+
+  /* nobody listening, or not keeping up: the next reading will do */
+  if (sendto(bridge->fd, msg, sizeof(*msg), 0,
+             (struct sockaddr *)&bridge->addr, sizeof(bridge->addr)) !=
+      sizeof(*msg))
+  {
+    bridge->dropped++;
+    return -1;
+  }
+
+  bridge->sent++;
+  return 0;
+}
+
+/******************************************************************************/
+
+int env_bridge_recv(struct env_bridge *bridge, struct env_bridge_msg *msg)
+{
+  for (;;)
+  {
+    const ssize_t got = recv(bridge->fd, msg, sizeof(*msg), MSG_DONTWAIT);
+
+    if (got < 0)
+    {
+      if (errno == EINTR) continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+
+    if (got != sizeof(*msg) || msg->magic != ENV_BRIDGE_MAGIC)
+    {
+      bridge->bad++;
+      continue;
+    }
+
+    /* a sender starting over begins anew */
+    if (bridge->have_seq && msg->seq != 0)
+      bridge->lost += (uint16_t)(msg->seq - bridge->seq);
+
+    bridge->seq = msg->seq + 1;
+    bridge->have_seq = 1;
+    bridge->received++;
+    return 1;
+  }
+}
+
+/******************************************************************************/
+
+void env_ess_put_temperature(uint8_t *value, int tenths)
+{
+  const int16_t hundredths = tenths * 10;
+
+  value[0] = (uint16_t)hundredths & 0xff;
+  value[1] = (uint16_t)hundredths >> 8;
+}
+
+/******************************************************************************/
+
+void env_ess_put_humidity(uint8_t *value, unsigned int tenths)
+{
+  const uint16_t hundredths = tenths * 10;
+
+  value[0] = hundredths & 0xff;
+  value[1] = hundredths >> 8;
+}
@@ -0,0 +1,81 @@
+/******************************************************************************/
+/* File: env_bridge.h
+   Author: N.Kim
+   Abstract: Passing temperature/humidity readings between processes
+
+   Description:
+     The sensor sends every good reading as a datagram to a unix socket,
+     whoever puts the readings on the air (the advertizer) binds it. The
+     sender never blocks: without a receiver, or with its queue full, the
+     reading is dropped and counted. Both sides stamp the messages with
+     the monotonic clock, the receiver tells how long a reading took from
+     the last edge of the sensor's answer.
+
+     Also the Environmental Sensing encodings of the values, as the
+     Bluetooth SIG assigned them (GATT Specification Supplement): little
+     endian, hundredths of a degree and of a percent. */
+/******************************************************************************/
+
+#ifndef ENV_BRIDGE_H
+#define ENV_BRIDGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/un.h>
+
+#define ENV_BRIDGE_MAGIC 0x31564e45    /* "ENV1" */
+
+/* the Environmental Sensing service and the characteristics of ours */
+#define ENV_ESS_UUID 0x181a
+#define ENV_ESS_TEMPERATURE_UUID 0x2a6e
+#define ENV_ESS_HUMIDITY_UUID 0x2a6f
+
+struct env_bridge_msg {
+  uint64_t edge_ns;       /* the last edge of the answer */
+  uint64_t sent_ns;
+  uint32_t magic;
+  uint16_t seq;           /* by sender, gaps are readings lost */
+  int16_t temperature;    /* tenths of a degree Celsius */
+  uint16_t humidity;      /* tenths of a percent */
+  uint8_t sensor;         /* the GPIO */
+  uint8_t frame[5];       /* as it came from the sensor */
+};
+
+_Static_assert(sizeof(struct env_bridge_msg) == 32, "env_bridge_msg size");
+
+struct env_bridge {
+  int fd;
+  struct sockaddr_un addr;
+  uint16_t seq;
+
+  /* sender: sent, dropped. Receiver: received, lost on the way (seen
+     by the sequence), not a reading at all */
+  unsigned long sent;
+  unsigned long dropped;
+  unsigned long received;
+  unsigned long lost;
+  unsigned long bad;
+  int have_seq;
+};
+
+/* CLOCK_MONOTONIC in nanoseconds, what the messages are stamped with */
+uint64_t env_bridge_now_ns(void);
+
+/* both return -1 with errno set on failure. The receiver takes over the
+   socket file, removing any left behind */
+int env_bridge_sender(struct env_bridge *bridge, const char *path);
+int env_bridge_receiver(struct env_bridge *bridge, const char *path);
+void env_bridge_close(struct env_bridge *bridge);
+
+/* stamps 'msg' (magic, sequence, send time) and sends it. Returns -1 if
+   it was dropped */
+int env_bridge_send(struct env_bridge *bridge, struct env_bridge_msg *msg);
+
+/* the next message queued: 1 if there was one, 0 if not, -1 on errors */
+int env_bridge_recv(struct env_bridge *bridge, struct env_bridge_msg *msg);
+
+/* the characteristic values, 2 bytes each */
+void env_ess_put_temperature(uint8_t *value, int tenths);
+void env_ess_put_humidity(uint8_t *value, unsigned int tenths);
+
+#endif
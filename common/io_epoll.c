@@ -0,0 +1,186 @@
+/******************************************************************************/
+/* File: io_epoll.c
+   Author: N.Kim
+   Abstract: Portable epoll backend of the socket I/O interface
+
+   Description:
+     Readiness based, i.e. one epoll_wait per batch plus one recv (or
+     accept) per ready socket. */
+
+/******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "io_loop.h"
+
+/* number of events handled per epoll_wait */
+#define EPOLL_BATCH 256
+
+struct epoll_priv {
+  int epfd;
+  struct epoll_event events[EPOLL_BATCH];
+  char *buf;
+};
+
+/******************************************************************************/
+
+static int epoll_init(struct io_loop *loop, unsigned int max_conns)
+{
+  struct epoll_priv *priv = calloc(1, sizeof(*priv));
+
+  if (!priv) return -ENOMEM;
+
+  /* one buffer is enough, it is done with once the callback returns */
+  priv->buf = malloc(loop->buffer_size);
+
+  if (!priv->buf)
+  {
+    free(priv);
+    return -ENOMEM;
+  }
+
+  priv->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (priv->epfd < 0)
+  {
+    const int error = errno;
+
+    free(priv->buf);
+    free(priv);
+    return -error;
+  }
+
+  loop->priv = priv;
+  return 0;
+}
+
+/******************************************************************************/
+
+static void epoll_destroy(struct io_loop *loop)
+{
+  struct epoll_priv *priv = loop->priv;
+
+  close(priv->epfd);
+  free(priv->buf);
+  free(priv);
+}
+
+/******************************************************************************/
+
+static int epoll_add(struct io_loop *loop, struct io_conn *conn)
+{
+  struct epoll_priv *priv = loop->priv;
+  struct epoll_event ev = { 0 };
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = conn;
+
+  if (epoll_ctl(priv->epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0)
+    return -errno;
+
+  return 0;
+}
+
+/******************************************************************************/
+
+static void epoll_remove(struct io_loop *loop, struct io_conn *conn)
+{
+  struct epoll_priv *priv = loop->priv;
+
+  epoll_ctl(priv->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+  io_loop_release(loop, conn);
+}
+
+/******************************************************************************/
+
+static void handle_accept(struct io_loop *loop, struct io_conn *conn)
+{
+  /* drain the accept queue, bursts of connections are common */
+  while (!conn->removed)
+  {
+    int fd = accept4(conn->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    loop->stats.syscalls++;
+
+    if (fd < 0) break;
+
+    conn->on_accept(loop, conn->fd, fd, conn->udata);
+  }
+}
+
+/******************************************************************************/
+
+static void handle_recv(struct io_loop *loop, struct io_conn *conn)
+{
+  struct epoll_priv *priv = loop->priv;
+
+  /* level triggered, thus, a single recv per wakeup is sufficient. Any
+     remainder shows up in the next batch again */
+  ssize_t len = recv(conn->fd, priv->buf, loop->buffer_size, 0);
+
+  loop->stats.syscalls++;
+
+  if (len < 0)
+  {
+    if (errno == EAGAIN || errno == EINTR) return;
+    len = -errno;
+  }
+  else loop->stats.bytes += len;
+
+  conn->on_recv(loop, conn->fd, priv->buf, len, conn->udata);
+}
+
+/******************************************************************************/
+
+static int epoll_run_once(struct io_loop *loop, int timeout_ms)
+{
+  struct epoll_priv *priv = loop->priv;
+
+  int num = epoll_wait(priv->epfd, priv->events, EPOLL_BATCH, timeout_ms);
+
+  loop->stats.syscalls++;
+
+  if (num < 0) return errno == EINTR ? 0 : -errno;
+
+  for (int i = 0; i < num; ++i)
+  {
+    struct io_conn *conn = priv->events[i].data.ptr;
+
+    /* removed by a callback earlier in this batch */
+    if (conn->removed) continue;
+
+    loop->stats.events++;
+
+    if (conn->listening) handle_accept(loop, conn);
+    else handle_recv(loop, conn);
+  }
+
+  return num;
+}
+
+/******************************************************************************/
+
+static int epoll_get_fd(struct io_loop *loop)
+{
+  struct epoll_priv *priv = loop->priv;
+  return priv->epfd;
+}
+
+/******************************************************************************/
+
+const struct io_backend io_epoll_backend = {
+  "epoll",
+  epoll_init,
+  epoll_destroy,
+  epoll_add,
+  epoll_remove,
+  epoll_run_once,
+  epoll_get_fd
+};
@@ -0,0 +1,252 @@
+/******************************************************************************/
+/* File: io_loop.c
+   Author: N.Kim
+   Abstract: Small socket I/O interface with epoll and io_uring backends
+
+   Description:
+     Backend independent part, i.e. backend selection and bookkeeping
+     of the watched connections. */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io_loop.h"
+
+/******************************************************************************/
+
+static int set_nonblocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+
+  if (flags < 0) return -errno;
+  if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -errno;
+
+  return 0;
+}
+
+/******************************************************************************/
+
+struct io_loop *io_loop_new(const char *backend, unsigned int max_conns)
+{
+  return io_loop_new_sized(backend, max_conns, IO_LOOP_BUFFER_SIZE);
+}
+
+/******************************************************************************/
+
+struct io_loop *io_loop_new_sized(const char *backend,
+                                  unsigned int max_conns,
+                                  unsigned int buffer_size)
+{
+  struct io_loop *loop;
+
+  if (buffer_size == 0) return NULL;
+
+  loop = calloc(1, sizeof(*loop));
+
+  if (!loop) return NULL;
+
+  loop->buffer_size = buffer_size;
+
+  if (!backend) backend = getenv("IO_BACKEND");
+
+  loop->backend = &io_epoll_backend;
+
+  if (backend && strcmp(backend, "uring") == 0)
+    loop->backend = &io_uring_backend;
+
+  if (loop->backend->init(loop, max_conns) < 0)
+  {
+    /* io_uring might be missing or disabled, always have a fallback */
+    if (loop->backend == &io_epoll_backend) goto fail;
+
+    fprintf(stderr, "io_uring not available, falling back to epoll\n");
+    loop->backend = &io_epoll_backend;
+
+    if (loop->backend->init(loop, max_conns) < 0) goto fail;
+  }
+
+  return loop;
+
+fail:
+  free(loop);
+  return NULL;
+}
+
+/******************************************************************************/
+
+void io_loop_free(struct io_loop *loop)
+{
+  if (!loop) return;
+
+  for (unsigned int i = 0; i < loop->num_conns; ++i)
+    free(loop->conns[i]);
+
+  while (loop->graveyard)
+  {
+    struct io_conn *next = loop->graveyard->next_free;
+    free(loop->graveyard);
+    loop->graveyard = next;
+  }
+
+  /* connections removed but still referenced by pending requests are
+     owned by the backend, it drops them on destruction */
+  loop->backend->destroy(loop);
+
+  free(loop->conns);
+  free(loop);
+}
+
+/******************************************************************************/
+
+const char *io_loop_backend_name(struct io_loop *loop)
+{
+  return loop->backend->name;
+}
+
+/******************************************************************************/
+
+static int insert_conn(struct io_loop *loop, struct io_conn *conn)
+{
+  if (conn->fd < 0) return -EBADF;
+
+  /* grow the table in steps, descriptors are small integers */
+  if ((unsigned int)conn->fd >= loop->num_conns)
+  {
+    unsigned int num = loop->num_conns ? loop->num_conns : 64;
+
+    while (num <= (unsigned int)conn->fd) num *= 2;
+
+    struct io_conn **conns = realloc(loop->conns, num * sizeof(*conns));
+
+    if (!conns) return -ENOMEM;
+
+    memset(conns + loop->num_conns, 0,
+           (num - loop->num_conns) * sizeof(*conns));
+
+    loop->conns = conns;
+    loop->num_conns = num;
+  }
+
+  if (loop->conns[conn->fd]) return -EEXIST;
+
+  int status = set_nonblocking(conn->fd);
+
+  if (status < 0) return status;
+
+  status = loop->backend->add(loop, conn);
+
+  if (status < 0) return status;
+
+  loop->conns[conn->fd] = conn;
+  return 0;
+}
+
+/******************************************************************************/
+
+int io_loop_add(struct io_loop *loop, int fd, io_recv_cb cb, void *udata)
+{
+  struct io_conn *conn = calloc(1, sizeof(*conn));
+
+  if (!conn) return -ENOMEM;
+
+  conn->fd = fd;
+  conn->on_recv = cb;
+  conn->udata = udata;
+
+  int status = insert_conn(loop, conn);
+
+  if (status < 0) free(conn);
+  return status;
+}
+
+/******************************************************************************/
+
+int io_loop_add_listener(struct io_loop *loop,
+                         int fd,
+                         io_accept_cb cb,
+                         void *udata)
+{
+  struct io_conn *conn = calloc(1, sizeof(*conn));
+
+  if (!conn) return -ENOMEM;
+
+  conn->fd = fd;
+  conn->listening = 1;
+  conn->on_accept = cb;
+  conn->udata = udata;
+
+  int status = insert_conn(loop, conn);
+
+  if (status < 0) free(conn);
+  return status;
+}
+
+/******************************************************************************/
+
+void io_loop_remove(struct io_loop *loop, int fd)
+{
+  struct io_conn *conn = io_loop_lookup(loop, fd);
+
+  if (!conn) return;
+
+  loop->conns[fd] = NULL;
+  conn->removed = 1;
+
+  /* the backend calls 'io_loop_release' once it is safe to do so */
+  loop->backend->remove(loop, conn);
+}
+
+/******************************************************************************/
+
+struct io_conn *io_loop_lookup(struct io_loop *loop, int fd)
+{
+  if (fd < 0 || (unsigned int)fd >= loop->num_conns) return NULL;
+  return loop->conns[fd];
+}
+
+/******************************************************************************/
+
+void io_loop_release(struct io_loop *loop, struct io_conn *conn)
+{
+  /* events of the current batch may still point to the connection,
+     thus, defer releasing it until the batch is through */
+  if (loop->dispatching)
+  {
+    conn->next_free = loop->graveyard;
+    loop->graveyard = conn;
+  }
+  else free(conn);
+}
+
+/******************************************************************************/
+
+int io_loop_run_once(struct io_loop *loop, int timeout_ms)
+{
+  loop->dispatching = 1;
+
+  int status = loop->backend->run_once(loop, timeout_ms);
+
+  loop->dispatching = 0;
+
+  while (loop->graveyard)
+  {
+    struct io_conn *next = loop->graveyard->next_free;
+    free(loop->graveyard);
+    loop->graveyard = next;
+  }
+
+  return status;
+}
+
+/******************************************************************************/
+
+int io_loop_get_fd(struct io_loop *loop)
+{
+  return loop->backend->get_fd(loop);
+}
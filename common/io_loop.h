@@ -0,0 +1,130 @@
+/******************************************************************************/
+/* File: io_loop.h
+   Author: N.Kim
+   Abstract: Small socket I/O interface with epoll and io_uring backends */
+/******************************************************************************/
+
+#ifndef IO_LOOP_H
+#define IO_LOOP_H
+
+#include <sys/types.h>
+
+/* default size of a single receive buffer, large enough for any
+   L2CAP/RFCOMM MTU we are going to negotiate by default */
+#define IO_LOOP_BUFFER_SIZE 4096
+
+struct io_loop;
+
+/* data received on 'fd'. 'len' is 0 on orderly shutdown and -errno on
+   errors. The data is only valid for the duration of the call */
+typedef void (*io_recv_cb)(struct io_loop *loop,
+                           int fd,
+                           const char *data,
+                           ssize_t len,
+                           void *udata);
+
+/* a new connection has been accepted on the listening socket 'lfd' */
+typedef void (*io_accept_cb)(struct io_loop *loop,
+                             int lfd,
+                             int fd,
+                             void *udata);
+
+struct io_conn {
+  int fd;
+  int listening;
+
+  io_recv_cb on_recv;
+  io_accept_cb on_accept;
+  void *udata;
+
+  /* removed by the user, the backend drops it once it is sure that no
+     more completions refer to it */
+  int removed;
+  int inflight;
+  int cancelled;
+
+  struct io_conn *next_free;
+};
+
+/* counters kept by the backends, 'syscalls' includes every system call
+   issued on the data path (waits, reads, accepts, submissions) */
+struct io_stats {
+  unsigned long syscalls;
+  unsigned long events;
+  unsigned long bytes;
+};
+
+struct io_backend {
+  const char *name;
+
+  int (*init)(struct io_loop *loop, unsigned int max_conns);
+  void (*destroy)(struct io_loop *loop);
+
+  int (*add)(struct io_loop *loop, struct io_conn *conn);
+  void (*remove)(struct io_loop *loop, struct io_conn *conn);
+
+  int (*run_once)(struct io_loop *loop, int timeout_ms);
+  int (*get_fd)(struct io_loop *loop);
+};
+
+struct io_loop {
+  const struct io_backend *backend;
+  void *priv;
+
+  /* active connections indexed by file descriptor */
+  struct io_conn **conns;
+  unsigned int num_conns;
+
+  /* removed connections, released at the end of 'run_once' */
+  struct io_conn *graveyard;
+  int dispatching;
+
+  /* size of the receive buffers, a single recv never returns more */
+  unsigned int buffer_size;
+
+  struct io_stats stats;
+};
+
+extern const struct io_backend io_epoll_backend;
+extern const struct io_backend io_uring_backend;
+
+/* 'backend' is either "epoll" or "uring". If NULL, the IO_BACKEND
+   environment variable is consulted, epoll being the default. When
+   io_uring is not supported by the kernel, epoll is used instead */
+struct io_loop *io_loop_new(const char *backend, unsigned int max_conns);
+
+/* the same, with receive buffers of 'buffer_size' bytes rather than
+   IO_LOOP_BUFFER_SIZE, e.g. sized from a negotiated MTU */
+struct io_loop *io_loop_new_sized(const char *backend,
+                                  unsigned int max_conns,
+                                  unsigned int buffer_size);
+void io_loop_free(struct io_loop *loop);
+
+const char *io_loop_backend_name(struct io_loop *loop);
+
+/* watch a connected socket, the socket is switched to non-blocking */
+int io_loop_add(struct io_loop *loop, int fd, io_recv_cb cb, void *udata);
+
+/* watch a listening socket, accepted sockets are non-blocking */
+int io_loop_add_listener(struct io_loop *loop,
+                         int fd,
+                         io_accept_cb cb,
+                         void *udata);
+
+/* stop watching 'fd', the socket is NOT closed. It is safe to call this
+   from within a callback */
+void io_loop_remove(struct io_loop *loop, int fd);
+
+/* wait at most 'timeout_ms' (-1 blocks) for events and dispatch them,
+   returns the number of events dispatched or -errno */
+int io_loop_run_once(struct io_loop *loop, int timeout_ms);
+
+/* file descriptor becoming readable once events are pending, allows to
+   embed the loop into other loops, e.g. a GMainLoop */
+int io_loop_get_fd(struct io_loop *loop);
+
+/* used by the backends */
+struct io_conn *io_loop_lookup(struct io_loop *loop, int fd);
+void io_loop_release(struct io_loop *loop, struct io_conn *conn);
+
+#endif
@@ -0,0 +1,607 @@
+/******************************************************************************/
+/* File: io_uring.c
+   Author: N.Kim
+   Abstract: io_uring backend of the socket I/O interface
+
+   Description:
+     Completion based, talks to the kernel via the raw system calls, no
+     liburing required. Each socket gets a single multishot recv (or
+     accept) request, received data lands in a ring of provided buffers
+     registered with the kernel up front. Re-arms, cancellations and the
+     wait for completions are batched into one io_uring_enter call.
+
+     Requires Linux 6.0 or later (multishot recv), 'io_loop_new' falls
+     back to epoll if the ring or the buffer ring cannot be set up. */
+
+/******************************************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include "io_loop.h"
+
+#define URING_ENTRIES 1024
+#define URING_NUM_BUFFERS 1024
+#define URING_BUFFER_GROUP 0
+
+struct uring_priv {
+  int ring_fd;
+  int event_fd;
+
+  /* submission queue */
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int sq_mask;
+  unsigned int sq_entries;
+  unsigned int sq_local_tail;
+  unsigned int to_submit;
+  struct io_uring_sqe *sqes;
+
+  /* completion queue */
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ptr;
+  void *cq_ptr;
+  size_t sq_size;
+  size_t cq_size;
+  size_t sqes_size;
+
+  /* ring of provided buffers, multishot recv picks from here */
+  struct io_uring_buf_ring *br;
+  size_t br_size;
+  char *bufs;
+  unsigned short br_tail;
+
+  /* removed connections with requests still in flight, for some the
+     cancellation did not fit into the submission queue yet */
+  struct io_conn *zombies;
+  unsigned int uncancelled;
+};
+
+/******************************************************************************/
+
+static int sys_setup(unsigned int entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned int to_submit, unsigned int min,
+                     unsigned int flags, void *arg, size_t argsz)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned int op, void *arg,
+                        unsigned int num)
+{
+  return syscall(__NR_io_uring_register, fd, op, arg, num);
+}
+
+/******************************************************************************/
+
+static int submit(struct io_loop *loop,
+                  unsigned int min_complete,
+                  int timeout_ms)
+{
+  struct uring_priv *priv = loop->priv;
+  struct io_uring_getevents_arg arg = { 0 };
+  struct __kernel_timespec ts;
+
+  unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+  void *argp = NULL;
+  size_t argsz = 0;
+
+  if (min_complete && timeout_ms >= 0)
+  {
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    argsz = sizeof(arg);
+  }
+
+  /* publish the new submissions to the kernel */
+  __atomic_store_n(priv->sq_tail, priv->sq_local_tail, __ATOMIC_RELEASE);
+
+  int num = sys_enter(priv->ring_fd, priv->to_submit, min_complete,
+                      flags, argp, argsz);
+
+  loop->stats.syscalls++;
+
+  if (num < 0)
+  {
+    /* timeouts and signals are no errors */
+    if (errno == ETIME || errno == EINTR) return 0;
+    return -errno;
+  }
+
+  priv->to_submit -= num;
+  return num;
+}
+
+/******************************************************************************/
+
+static struct io_uring_sqe *get_sqe(struct io_loop *loop)
+{
+  struct uring_priv *priv = loop->priv;
+
+  unsigned int head = __atomic_load_n(priv->sq_head, __ATOMIC_ACQUIRE);
+
+  /* queue full, push what we have got so far */
+  if (priv->sq_local_tail - head >= priv->sq_entries)
+  {
+    if (submit(loop, 0, 0) < 0) return NULL;
+  }
+
+  struct io_uring_sqe *sqe =
+    &priv->sqes[priv->sq_local_tail & priv->sq_mask];
+
+  memset(sqe, 0, sizeof(*sqe));
+
+  priv->sq_local_tail++;
+  priv->to_submit++;
+  return sqe;
+}
+
+/******************************************************************************/
+
+static int arm(struct io_loop *loop, struct io_conn *conn)
+{
+  struct io_uring_sqe *sqe = get_sqe(loop);
+
+  if (!sqe) return -EBUSY;
+
+  sqe->fd = conn->fd;
+  sqe->user_data = (uint64_t)(uintptr_t)conn;
+
+  if (conn->listening)
+  {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  }
+  else
+  {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+  }
+
+  conn->inflight = 1;
+  return 0;
+}
+
+/******************************************************************************/
+
+static void recycle_buffer(struct io_loop *loop,
+                           struct uring_priv *priv,
+                           unsigned short bid)
+{
+  struct io_uring_buf *buf =
+    &priv->br->bufs[priv->br_tail & (URING_NUM_BUFFERS - 1)];
+
+  buf->addr = (uint64_t)(uintptr_t)(priv->bufs +
+                                    (size_t)bid * loop->buffer_size);
+  buf->len = loop->buffer_size;
+  buf->bid = bid;
+
+  priv->br_tail++;
+}
+
+/******************************************************************************/
+
+static void publish_buffers(struct uring_priv *priv)
+{
+  __atomic_store_n(&priv->br->tail, priv->br_tail, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************/
+
+static int setup_buffers(struct io_loop *loop, struct uring_priv *priv)
+{
+  struct io_uring_buf_reg reg = { 0 };
+
+  priv->br_size = URING_NUM_BUFFERS * sizeof(struct io_uring_buf);
+
+  /* the buffer ring needs to be page aligned */
+  priv->br = mmap(NULL, priv->br_size, PROT_READ | PROT_WRITE,
+                  MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+  if (priv->br == MAP_FAILED) return -errno;
+
+  priv->bufs = malloc((size_t)URING_NUM_BUFFERS * loop->buffer_size);
+
+  if (!priv->bufs) return -ENOMEM;
+
+  reg.ring_addr = (uint64_t)(uintptr_t)priv->br;
+  reg.ring_entries = URING_NUM_BUFFERS;
+  reg.bgid = URING_BUFFER_GROUP;
+
+  if (sys_register(priv->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    return -errno;
+
+  for (unsigned int i = 0; i < URING_NUM_BUFFERS; ++i)
+    recycle_buffer(loop, priv, i);
+
+  publish_buffers(priv);
+  return 0;
+}
+
+/******************************************************************************/
+
+static void uring_destroy(struct io_loop *loop)
+{
+  struct uring_priv *priv = loop->priv;
+
+  if (priv->ring_fd >= 0) close(priv->ring_fd);
+  if (priv->event_fd >= 0) close(priv->event_fd);
+
+  if (priv->sq_ptr && priv->sq_ptr != MAP_FAILED)
+    munmap(priv->sq_ptr, priv->sq_size);
+
+  if (priv->cq_ptr && priv->cq_ptr != MAP_FAILED &&
+      priv->cq_ptr != priv->sq_ptr)
+    munmap(priv->cq_ptr, priv->cq_size);
+
+  if (priv->sqes && priv->sqes != MAP_FAILED)
+    munmap(priv->sqes, priv->sqes_size);
+
+  if (priv->br && priv->br != MAP_FAILED)
+    munmap(priv->br, priv->br_size);
+
+  while (priv->zombies)
+  {
+    struct io_conn *next = priv->zombies->next_free;
+    free(priv->zombies);
+    priv->zombies = next;
+  }
+
+  free(priv->bufs);
+  free(priv);
+}
+
+/******************************************************************************/
+
+static int uring_init(struct io_loop *loop, unsigned int max_conns)
+{
+  struct uring_priv *priv = calloc(1, sizeof(*priv));
+  struct io_uring_params p = { 0 };
+
+  if (!priv) return -ENOMEM;
+
+  priv->event_fd = -1;
+  loop->priv = priv;
+
+  /* the completion queue has to hold a burst of data for every single
+     connection, size it accordingly */
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = max_conns * 4 > URING_ENTRIES * 2 ?
+                 max_conns * 4 : URING_ENTRIES * 2;
+
+  priv->ring_fd = sys_setup(URING_ENTRIES, &p);
+
+  if (priv->ring_fd < 0) goto fail;
+
+  priv->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  priv->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (priv->cq_size > priv->sq_size) priv->sq_size = priv->cq_size;
+    priv->cq_size = priv->sq_size;
+  }
+
+  priv->sq_ptr = mmap(NULL, priv->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, priv->ring_fd,
+                      IORING_OFF_SQ_RING);
+
+  if (priv->sq_ptr == MAP_FAILED) goto fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) priv->cq_ptr = priv->sq_ptr;
+  else
+  {
+    priv->cq_ptr = mmap(NULL, priv->cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, priv->ring_fd,
+                        IORING_OFF_CQ_RING);
+
+    if (priv->cq_ptr == MAP_FAILED) goto fail;
+  }
+
+  priv->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  priv->sqes = mmap(NULL, priv->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, priv->ring_fd,
+                    IORING_OFF_SQES);
+
+  if (priv->sqes == MAP_FAILED) goto fail;
+
+  char *sq = priv->sq_ptr;
+  char *cq = priv->cq_ptr;
+
+  priv->sq_head = (unsigned int *)(sq + p.sq_off.head);
+  priv->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+  priv->sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+  priv->sq_entries = p.sq_entries;
+  priv->sq_local_tail = *priv->sq_tail;
+
+  /* identity mapping, slot i of the array always refers to sqe i */
+  unsigned int *array = (unsigned int *)(sq + p.sq_off.array);
+
+  for (unsigned int i = 0; i < p.sq_entries; ++i) array[i] = i;
+
+  priv->cq_head = (unsigned int *)(cq + p.cq_off.head);
+  priv->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+  priv->cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+  priv->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  if (setup_buffers(loop, priv) < 0) goto fail;
+
+  return 0;
+
+fail:
+  {
+    int status = errno ? -errno : -EINVAL;
+
+    uring_destroy(loop);
+    loop->priv = NULL;
+    return status;
+  }
+}
+
+/******************************************************************************/
+
+static int uring_add(struct io_loop *loop, struct io_conn *conn)
+{
+  int status = arm(loop, conn);
+
+  if (status < 0) return status;
+
+  /* outside of 'run_once' nobody would submit the request for us */
+  if (!loop->dispatching) submit(loop, 0, 0);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+static int cancel(struct io_loop *loop, struct io_conn *conn)
+{
+  struct io_uring_sqe *sqe = get_sqe(loop);
+
+  if (!sqe) return -EBUSY;
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t)(uintptr_t)conn;
+  sqe->user_data = 0;
+
+  conn->cancelled = 1;
+  return 0;
+}
+
+/******************************************************************************/
+
+static void retry_cancels(struct io_loop *loop)
+{
+  struct uring_priv *priv = loop->priv;
+
+  for (struct io_conn *conn = priv->zombies;
+       conn && priv->uncancelled > 0; conn = conn->next_free)
+  {
+    if (conn->cancelled) continue;
+    if (cancel(loop, conn) < 0) break;
+
+    priv->uncancelled--;
+  }
+}
+
+/******************************************************************************/
+
+static void uring_remove(struct io_loop *loop, struct io_conn *conn)
+{
+  struct uring_priv *priv = loop->priv;
+
+  if (!conn->inflight)
+  {
+    io_loop_release(loop, conn);
+    return;
+  }
+
+  /* cancel the multishot request, the connection is released once its
+     final completion has been reaped. Without room for the request, the
+     next dispatch tries again */
+  conn->next_free = priv->zombies;
+  priv->zombies = conn;
+
+  if (cancel(loop, conn) < 0) priv->uncancelled++;
+
+  if (!loop->dispatching) submit(loop, 0, 0);
+}
+
+/******************************************************************************/
+
+static void bury_zombie(struct io_loop *loop, struct io_conn *conn)
+{
+  struct uring_priv *priv = loop->priv;
+  struct io_conn **pp = &priv->zombies;
+
+  while (*pp && *pp != conn) pp = &(*pp)->next_free;
+
+  if (*pp) *pp = conn->next_free;
+
+  /* the request ended on its own before it could be cancelled */
+  if (!conn->cancelled) priv->uncancelled--;
+
+  io_loop_release(loop, conn);
+}
+
+/******************************************************************************/
+
+static int accept_failed_for_now(int res)
+{
+  /* the listening socket itself is fine, e.g. the descriptor limit has
+     been hit under load or a connection went away before its accept */
+  return res == -EMFILE || res == -ENFILE || res == -ENOMEM ||
+         res == -ENOBUFS || res == -ECONNABORTED || res == -EINTR ||
+         res == -EAGAIN;
+}
+
+/******************************************************************************/
+
+static void handle_cqe(struct io_loop *loop, struct io_uring_cqe *cqe)
+{
+  struct uring_priv *priv = loop->priv;
+  struct io_conn *conn = (struct io_conn *)(uintptr_t)cqe->user_data;
+
+  const int more = cqe->flags & IORING_CQE_F_MORE;
+  const int has_buf = cqe->flags & IORING_CQE_F_BUFFER;
+  const unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+  /* completion of a cancellation request */
+  if (!conn) return;
+
+  if (!more) conn->inflight = 0;
+
+  if (conn->removed)
+  {
+    if (has_buf) recycle_buffer(loop, priv, bid);
+    if (!more) bury_zombie(loop, conn);
+    return;
+  }
+
+  loop->stats.events++;
+
+  if (conn->listening)
+  {
+    if (cqe->res >= 0) conn->on_accept(loop, conn->fd, cqe->res, conn->udata);
+  }
+  else if (has_buf)
+  {
+    loop->stats.bytes += cqe->res;
+
+    conn->on_recv(loop, conn->fd,
+                  priv->bufs + (size_t)bid * loop->buffer_size,
+                  cqe->res, conn->udata);
+
+    recycle_buffer(loop, priv, bid);
+  }
+  else if (cqe->res != -ENOBUFS)
+  {
+    /* end of stream or a real error, no re-arming */
+    conn->on_recv(loop, conn->fd, NULL, cqe->res, conn->udata);
+    return;
+  }
+
+  /* the multishot request has terminated (e.g. ran out of buffers),
+     put it back unless the callback removed the connection. Listeners
+     out of descriptors keep trying, as they do with epoll */
+  if (!more && !conn->removed && !conn->inflight &&
+      (cqe->res >= 0 || cqe->res == -ENOBUFS ||
+       (conn->listening && accept_failed_for_now(cqe->res))))
+    arm(loop, conn);
+}
+
+/******************************************************************************/
+
+static int uring_run_once(struct io_loop *loop, int timeout_ms)
+{
+  struct uring_priv *priv = loop->priv;
+
+  unsigned int head = *priv->cq_head;
+  unsigned int tail = __atomic_load_n(priv->cq_tail, __ATOMIC_ACQUIRE);
+
+  /* consume the eventfd notification, if we are embedded */
+  if (priv->event_fd >= 0)
+  {
+    uint64_t value;
+
+    if (read(priv->event_fd, &value, sizeof(value)) > 0)
+      loop->stats.syscalls++;
+  }
+
+  if (priv->uncancelled > 0) retry_cancels(loop);
+
+  /* nothing pending yet, submit and wait in one go */
+  if (head == tail && (timeout_ms != 0 || priv->to_submit > 0))
+  {
+    int status = submit(loop, timeout_ms != 0, timeout_ms);
+
+    if (status < 0) return status;
+
+    tail = __atomic_load_n(priv->cq_tail, __ATOMIC_ACQUIRE);
+  }
+
+  int num = 0;
+
+  while (head != tail)
+  {
+    handle_cqe(loop, &priv->cqes[head & priv->cq_mask]);
+
+    head++;
+    num++;
+
+    if (head == tail)
+      tail = __atomic_load_n(priv->cq_tail, __ATOMIC_ACQUIRE);
+  }
+
+  __atomic_store_n(priv->cq_head, head, __ATOMIC_RELEASE);
+  publish_buffers(priv);
+
+  /* re-arms and cancellations issued while dispatching go out with the
+     next wait, unless we are embedded and nobody waits on the ring */
+  if (priv->to_submit > 0 && priv->event_fd >= 0) submit(loop, 0, 0);
+
+  return num;
+}
+
+/******************************************************************************/
+
+static int uring_get_fd(struct io_loop *loop)
+{
+  struct uring_priv *priv = loop->priv;
+
+  /* only needed when embedded, thus, set up on first use */
+  if (priv->event_fd < 0)
+  {
+    priv->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (priv->event_fd < 0) return -1;
+
+    if (sys_register(priv->ring_fd, IORING_REGISTER_EVENTFD,
+                     &priv->event_fd, 1) < 0)
+    {
+      close(priv->event_fd);
+      priv->event_fd = -1;
+    }
+  }
+
+  return priv->event_fd;
+}
+
+/******************************************************************************/
+
+const struct io_backend io_uring_backend = {
+  "uring",
+  uring_init,
+  uring_destroy,
+  uring_add,
+  uring_remove,
+  uring_run_once,
+  uring_get_fd
+};
@@ -0,0 +1,203 @@
+/******************************************************************************/
+/* File: sock_url.c
+   Author: N.Kim
+   Abstract: Local stand-ins for the Bluetooth links, picked by URL */
+/******************************************************************************/
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "sock_url.h"
+
+static const struct {
+  const char *scheme;
+  enum sock_url_type type;
+} schemes[] = {
+  { "unix://", SOCK_URL_UNIX },
+  { "unix-stream://", SOCK_URL_UNIX_STREAM },
+  { "tcp://", SOCK_URL_TCP }
+};
+
+#define NUM_SCHEMES (sizeof(schemes) / sizeof(schemes[0]))
+
+/******************************************************************************/
+
+int sock_url_parse(const char *url, struct sock_url *su)
+{
+  *su = (struct sock_url){0};
+
+  for (size_t i = 0; i < NUM_SCHEMES; ++i)
+  {
+    const size_t len = strlen(schemes[i].scheme);
+    const char *rest = url + len;
+
+    if (strncmp(url, schemes[i].scheme, len) != 0) continue;
+
+    su->type = schemes[i].type;
+
+    if (*rest == '\0' || strlen(rest) >= SOCK_URL_PATH_MAX) return -1;
+
+    strcpy(su->path, rest);
+
+    if (su->type != SOCK_URL_TCP) return 0;
+
+    /* host:port, the host being optional for servers */
+    char *colon = strrchr(su->path, ':');
+    char *end;
+
+    if (!colon) return -1;
+
+    unsigned long port = strtoul(colon + 1, &end, 10);
+
+    if (end == colon + 1 || *end != '\0' || port == 0 || port > 0xffff)
+      return -1;
+
+    *colon = '\0';
+    su->port = port;
+    return 0;
+  }
+
+  return -1;
+}
+
+/******************************************************************************/
+
+const char *sock_url_name(const struct sock_url *su, char *buf, size_t len)
+{
+  if (su->type == SOCK_URL_TCP)
+    snprintf(buf, len, "tcp://%s:%u", su->path, su->port);
+  else
+    snprintf(buf, len, "%s%s", su->type == SOCK_URL_UNIX ?
+             "unix://" : "unix-stream://", su->path);
+
+  return buf;
+}
+
+/******************************************************************************/
+
+int sock_url_is_stream(const struct sock_url *su)
+{
+  return su->type != SOCK_URL_UNIX;
+}
+
+/******************************************************************************/
+
+static int open_socket(const struct sock_url *su,
+                       int listening,
+                       int nonblocking,
+                       struct sockaddr_storage *addr,
+                       socklen_t *addr_len)
+{
+  const int flags = SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0);
+
+  memset(addr, 0, sizeof(*addr));
+
+  if (su->type != SOCK_URL_TCP)
+  {
+    struct sockaddr_un *un = (struct sockaddr_un *)addr;
+
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, su->path);
+    *addr_len = sizeof(*un);
+
+    return socket(AF_UNIX, (su->type == SOCK_URL_UNIX ?
+                            SOCK_SEQPACKET : SOCK_STREAM) | flags, 0);
+  }
+
+  struct addrinfo hints = { 0 }, *res;
+  char port[8];
+
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listening ? AI_PASSIVE : 0;
+  snprintf(port, sizeof(port), "%u", su->port);
+
+  /* no host listens on any address, connects to the loopback */
+  if (getaddrinfo(su->path[0] ? su->path : NULL, port, &hints, &res) != 0)
+  {
+    errno = EHOSTUNREACH;
+    return -1;
+  }
+
+  memcpy(addr, res->ai_addr, res->ai_addrlen);
+  *addr_len = res->ai_addrlen;
+
+  int s = socket(res->ai_family, SOCK_STREAM | flags, 0);
+  const int one = 1;
+
+  freeaddrinfo(res);
+
+  /* small packets, send them right away */
+  if (s >= 0)
+  {
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (listening)
+      setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  }
+
+  return s;
+}
+
+/******************************************************************************/
+
+static int fail(int s)
+{
+  const int error = errno;
+
+  close(s);
+  errno = error;
+  return -1;
+}
+
+/******************************************************************************/
+
+int sock_url_listen(const struct sock_url *su, int backlog)
+{
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+
+  int s = open_socket(su, 1, 0, &addr, &addr_len);
+
+  if (s < 0) return -1;
+
+  sock_url_unlink(su);
+
+  if (bind(s, (struct sockaddr *)&addr, addr_len) < 0 ||
+      listen(s, backlog) < 0)
+    return fail(s);
+
+  return s;
+}
+
+/******************************************************************************/
+
+int sock_url_connect(const struct sock_url *su, int nonblocking)
+{
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+
+  int s = open_socket(su, 0, nonblocking, &addr, &addr_len);
+
+  if (s < 0) return -1;
+
+  if (connect(s, (struct sockaddr *)&addr, addr_len) < 0 &&
+      !(nonblocking && errno == EINPROGRESS))
+    return fail(s);
+
+  return s;
+}
+
+/******************************************************************************/
+
+void sock_url_unlink(const struct sock_url *su)
+{
+  if (su->type != SOCK_URL_TCP) unlink(su->path);
+}
@@ -0,0 +1,55 @@
+/******************************************************************************/
+/* File: sock_url.h
+   Author: N.Kim
+   Abstract: Local stand-ins for the Bluetooth links, picked by URL */
+/******************************************************************************/
+
+#ifndef SOCK_URL_H
+#define SOCK_URL_H
+
+#include <stddef.h>
+
+/* supported URLs:
+
+     unix://path           sequential packets, stands in for L2CAP
+     unix-stream://path    byte stream, stands in for RFCOMM
+     tcp://host:port       byte stream over the loopback, e.g. to put a
+                           server under load from another machine
+
+   The same as the morse tutorial takes, see morse_transport.h */
+enum sock_url_type {
+  SOCK_URL_UNIX,
+  SOCK_URL_UNIX_STREAM,
+  SOCK_URL_TCP
+};
+
+/* longest AF_UNIX path, see sockaddr_un */
+#define SOCK_URL_PATH_MAX 108
+
+struct sock_url {
+  enum sock_url_type type;
+  char path[SOCK_URL_PATH_MAX];   /* socket file or host name */
+  unsigned int port;
+};
+
+/* returns -1 if the URL is malformed */
+int sock_url_parse(const char *url, struct sock_url *su);
+
+/* URL of the endpoint, for the logs */
+const char *sock_url_name(const struct sock_url *su, char *buf, size_t len);
+
+/* byte streams lose the packet boundaries */
+int sock_url_is_stream(const struct sock_url *su);
+
+/* bound and listening socket, -1 on failure (errno is set). UNIX socket
+   files are replaced */
+int sock_url_listen(const struct sock_url *su, int backlog);
+
+/* connected socket, -1 on failure (errno is set). Non-blocking sockets
+   may still be connecting (EINPROGRESS is no failure then) */
+int sock_url_connect(const struct sock_url *su, int nonblocking);
+
+/* remove the socket file of a listener, if any */
+void sock_url_unlink(const struct sock_url *su);
+
+#endif
@@ -0,0 +1,210 @@
+/******************************************************************************/
+/* File: stress_pool.c
+   Author: N.Kim
+   Abstract: Ordering stress test of the work-stealing pool
+
+   Description:
+     Several producer threads play I/O threads, each feeding a set of
+     strands of its own with short bursts of numbered items, while the
+     workers take them from each other. Strands are closed and replaced
+     now and then. The workers check that the items of a strand arrive
+     in order and that no two workers ever run the same strand at once.
+
+     Meant for machines with several cores, the races it is after need
+     the producers and workers to run truly in parallel. Exits with 1 if
+     anything went wrong.
+
+     stress_pool [workers] [producers] [seconds] */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "work_pool.h"
+
+/* strands per producer */
+#define STRESS_STRANDS 16
+
+/* items submitted between two closed strands, per producer */
+#define STRESS_CLOSE_EVERY 5000
+
+struct stress_conn {
+  unsigned long expected;
+  atomic_int running;
+};
+
+struct producer {
+  pthread_t thread;
+  struct work_pool *pool;
+  unsigned int seed;
+
+  struct work_strand *strands[STRESS_STRANDS];
+  struct stress_conn *conns[STRESS_STRANDS];
+  unsigned long next[STRESS_STRANDS];
+
+  unsigned long submitted;
+  unsigned long closed;
+};
+
+static atomic_int stopping;
+static atomic_ulong processed;
+static atomic_ulong reordered;
+static atomic_ulong overlapped;
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static void process_item(struct work_strand *strand,
+                         const char *data,
+                         size_t len,
+                         void *udata)
+{
+  struct stress_conn *conn = udata;
+  unsigned long seq;
+
+  memcpy(&seq, data, sizeof(seq));
+
+  if (atomic_fetch_add(&conn->running, 1) != 0)
+    atomic_fetch_add(&overlapped, 1);
+
+  if (seq != conn->expected) atomic_fetch_add(&reordered, 1);
+  conn->expected = seq + 1;
+
+  /* widen the window for a second worker to step in */
+  for (volatile int i = 0; i < 64; ++i);
+
+  atomic_fetch_sub(&conn->running, 1);
+  atomic_fetch_add_explicit(&processed, 1, memory_order_relaxed);
+}
+
+/******************************************************************************/
+
+static void on_closed(void *udata)
+{
+  struct stress_conn *conn = udata;
+
+  /* nothing of the strand may run anymore */
+  if (atomic_load(&conn->running) != 0) atomic_fetch_add(&overlapped, 1);
+
+  free(conn);
+}
+
+/******************************************************************************/
+
+static void open_strand(struct producer *p, int i)
+{
+  p->conns[i] = calloc(1, sizeof(*p->conns[i]));
+  p->next[i] = 0;
+
+  /* the closed one might not be released yet */
+  while (!(p->strands[i] = work_pool_strand_new(p->pool, process_item,
+                                                p->conns[i])))
+    sched_yield();
+}
+
+/******************************************************************************/
+
+static void *producer_thread(void *data)
+{
+  struct producer *p = data;
+
+  for (int i = 0; i < STRESS_STRANDS; ++i) open_strand(p, i);
+
+  while (!atomic_load(&stopping))
+  {
+    const int i = rand_r(&p->seed) % STRESS_STRANDS;
+    const int burst = 1 + rand_r(&p->seed) % 4;
+
+    /* short bursts, so strands keep running dry and being rescheduled */
+    for (int n = 0; n < burst; ++n)
+    {
+      work_pool_submit(p->strands[i], &p->next[i], sizeof(p->next[i]));
+      p->next[i]++;
+      p->submitted++;
+    }
+
+    if (p->submitted / STRESS_CLOSE_EVERY > p->closed)
+    {
+      work_pool_strand_close(p->strands[i], on_closed, p->conns[i]);
+      open_strand(p, i);
+      p->closed++;
+    }
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned int workers = argc > 1 ? atoi(argv[1]) : (cpus > 4 ? cpus : 4);
+  unsigned int producers = argc > 2 ? atoi(argv[2]) : 2;
+  double seconds = argc > 3 ? atof(argv[3]) : 5;
+
+  if (workers < 1) workers = 1;
+  if (producers < 1) producers = 1;
+
+  printf("%ld online CPUs, %u workers, %u producers, %d strands each\n",
+         cpus, workers, producers, STRESS_STRANDS);
+
+  if (cpus < 2) printf("a single CPU hardly ever hits the races\n");
+
+  struct work_pool *pool = work_pool_new(workers,
+                                         producers * STRESS_STRANDS);
+  struct producer *prod = calloc(producers, sizeof(*prod));
+
+  for (unsigned int i = 0; i < producers; ++i)
+  {
+    prod[i].pool = pool;
+    prod[i].seed = i + 1;
+    pthread_create(&prod[i].thread, NULL, producer_thread, &prod[i]);
+  }
+
+  double start = now();
+
+  usleep(seconds * 1e6);
+  atomic_store(&stopping, 1);
+
+  unsigned long submitted = 0, closed = 0;
+
+  for (unsigned int i = 0; i < producers; ++i)
+  {
+    pthread_join(prod[i].thread, NULL);
+
+    for (int s = 0; s < STRESS_STRANDS; ++s)
+      work_pool_strand_close(prod[i].strands[s], on_closed, prod[i].conns[s]);
+
+    submitted += prod[i].submitted;
+    closed += prod[i].closed;
+  }
+
+  work_pool_free(pool);
+
+  double elapsed = now() - start;
+
+  printf("%lu items (%lu processed) in %.1f s, %.0f items/s, "
+         "%lu strands closed\n", submitted, atomic_load(&processed),
+         elapsed, submitted / elapsed, closed);
+  printf("reordered %lu, overlapped %lu\n",
+         atomic_load(&reordered), atomic_load(&overlapped));
+
+  free(prod);
+
+  return atomic_load(&reordered) || atomic_load(&overlapped) ||
+         atomic_load(&processed) != submitted;
+}
@@ -0,0 +1,645 @@
+/******************************************************************************/
+/* File: ts_store.c
+   Author: N.Kim
+   Abstract: Memory-mapped time series of temperature/humidity readings */
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crc32.h"
+#include "ts_store.h"
+
+#define TS_MAGIC "DHTSTORE"
+#define TS_VERSION 1
+
+/* the rings start on the page after the header */
+#define TS_HEADER_SIZE 4096
+
+/* entries written before a commit at most: a reading or the summaries
+   of every sensor. Rings leave that much room between head and tail */
+#define TS_RAW_RESERVE 1
+#define TS_SUMMARY_RESERVE TS_MAX_SENSORS
+
+struct ts_commit {
+  uint64_t seq;
+  uint64_t head[TS_TIERS];
+  uint64_t tail[TS_TIERS];
+  uint32_t crc;               /* of the above */
+  uint32_t reserved;
+};
+
+struct ts_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t summary_size;
+  uint32_t capacity[TS_TIERS];
+  struct ts_commit commits[2];
+};
+
+_Static_assert(sizeof(struct ts_header) <= TS_HEADER_SIZE,
+               "the header fits its page");
+
+static const uint32_t spans[TS_TIERS] = { 1, 60, 3600 };
+
+/******************************************************************************/
+
+static inline void *entry(const struct ts_ring *ring, uint64_t i)
+{
+  return ring->entries + (i % ring->capacity) * ring->size;
+}
+
+/******************************************************************************/
+
+static inline uint32_t entry_time(const struct ts_ring *ring, uint64_t i)
+{
+  /* readings and summaries start with it */
+  uint32_t time;
+
+  memcpy(&time, entry(ring, i), sizeof(time));
+  return time;
+}
+
+/******************************************************************************/
+
+static uint64_t reserve(enum ts_tier tier)
+{
+  return tier == TS_TIER_RAW ? TS_RAW_RESERVE : TS_SUMMARY_RESERVE;
+}
+
+/******************************************************************************/
+
+static void push(struct ts_ring *ring, enum ts_tier tier, const void *data)
+{
+  /* the room left by the reserve, not referred to by the last commit */
+  memcpy(entry(ring, ring->head), data, ring->size);
+
+  if (++ring->head - ring->tail > ring->capacity - reserve(tier))
+    ring->tail++;
+}
+
+/******************************************************************************/
+
+static uint64_t lower_bound(const struct ts_ring *ring, uint32_t time)
+{
+  /* the first entry at 'time' or later, entries are in time order */
+  uint64_t lo = ring->tail, hi = ring->head;
+
+  while (lo < hi)
+  {
+    const uint64_t mid = lo + (hi - lo) / 2;
+
+    if (entry_time(ring, mid) < time) lo = mid + 1;
+    else hi = mid;
+  }
+
+  return lo;
+}
+
+/******************************************************************************/
+
+static uint32_t commit_crc(const struct ts_commit *commit)
+{
+  return crc32_update(0, commit, offsetof(struct ts_commit, crc));
+}
+
+/******************************************************************************/
+
+static void commit(struct ts_store *store)
+{
+  struct ts_commit c;
+
+  memset(&c, 0, sizeof(c));
+  c.seq = store->seq + 1;
+
+  for (int t = 0; t < TS_TIERS; ++t)
+  {
+    c.head[t] = store->rings[t].head;
+    c.tail[t] = store->rings[t].tail;
+  }
+
+  c.crc = commit_crc(&c);
+
+  /* the entries before the indices referring to them, the other slot
+     stays as it was in case this one gets torn */
+  atomic_thread_fence(memory_order_release);
+  memcpy(&store->header->commits[c.seq & 1], &c, sizeof(c));
+  store->seq = c.seq;
+}
+
+/******************************************************************************/
+
+static void accumulate(struct ts_accumulator *acc,
+                       int temperature,
+                       unsigned int humidity,
+                       uint32_t count)
+{
+  if (acc->count == 0)
+  {
+    acc->temperature_min = acc->temperature_max = temperature;
+    acc->humidity_min = acc->humidity_max = humidity;
+  }
+
+  if (temperature < acc->temperature_min) acc->temperature_min = temperature;
+  if (temperature > acc->temperature_max) acc->temperature_max = temperature;
+  if (humidity < acc->humidity_min) acc->humidity_min = humidity;
+  if (humidity > acc->humidity_max) acc->humidity_max = humidity;
+
+  acc->count += count;
+  acc->temperature_sum += (int64_t)temperature * count;
+  acc->humidity_sum += (int64_t)humidity * count;
+}
+
+/******************************************************************************/
+
+static void add_record(struct ts_accumulator *acc, const struct ts_record *r)
+{
+  accumulate(acc, r->temperature, r->humidity, 1);
+}
+
+/******************************************************************************/
+
+static void add_summary(struct ts_accumulator *acc, const struct ts_summary *s)
+{
+  /* the means stand for the readings of the bucket, min and max are
+     folded in on their own */
+  if (s->count == 0) return;
+
+  accumulate(acc, s->temperature_mean, s->humidity_mean, s->count);
+
+  if (s->temperature_min < acc->temperature_min)
+    acc->temperature_min = s->temperature_min;
+  if (s->temperature_max > acc->temperature_max)
+    acc->temperature_max = s->temperature_max;
+  if (s->humidity_min < acc->humidity_min)
+    acc->humidity_min = s->humidity_min;
+  if (s->humidity_max > acc->humidity_max)
+    acc->humidity_max = s->humidity_max;
+}
+
+/******************************************************************************/
+
+static int64_t mean(int64_t sum, uint32_t count)
+{
+  /* rounded to the nearest tenth, either side of zero */
+  return sum >= 0 ? (sum + count / 2) / count : -((-sum + count / 2) / count);
+}
+
+/******************************************************************************/
+
+static void summarize_bucket(const struct ts_accumulator *acc,
+                             uint32_t time,
+                             unsigned int sensor,
+                             struct ts_summary *summary)
+{
+  memset(summary, 0, sizeof(*summary));
+  summary->time = time;
+  summary->sensor = sensor;
+  summary->count = acc->count;
+
+  if (acc->count == 0) return;
+
+  summary->temperature_min = acc->temperature_min;
+  summary->temperature_max = acc->temperature_max;
+  summary->temperature_mean = mean(acc->temperature_sum, acc->count);
+  summary->humidity_min = acc->humidity_min;
+  summary->humidity_max = acc->humidity_max;
+  summary->humidity_mean = mean(acc->humidity_sum, acc->count);
+}
+
+/******************************************************************************/
+
+static void close_buckets(struct ts_store *store, enum ts_tier tier)
+{
+  struct ts_accumulator *accs =
+    tier == TS_TIER_MINUTE ? store->minutes : store->hours;
+
+  for (unsigned int s = 0; s < TS_MAX_SENSORS; ++s)
+  {
+    struct ts_summary summary;
+
+    if (accs[s].count == 0) continue;
+
+    summarize_bucket(&accs[s], store->open[tier], s, &summary);
+    push(&store->rings[tier], tier, &summary);
+
+    /* the hours are made of minutes */
+    if (tier == TS_TIER_MINUTE) add_summary(&store->hours[s], &summary);
+
+    memset(&accs[s], 0, sizeof(accs[s]));
+  }
+
+  store->open[tier] = 0;
+}
+
+/******************************************************************************/
+
+static void rebuild(struct ts_store *store)
+{
+  /* the open buckets are those of the last reading. Their minute is in
+     the readings, their hour in the minutes closed since it began */
+  const struct ts_ring *raw = &store->rings[TS_TIER_RAW];
+  const struct ts_ring *minutes = &store->rings[TS_TIER_MINUTE];
+
+  if (raw->head == raw->tail) return;
+
+  const uint32_t last = entry_time(raw, raw->head - 1);
+
+  store->open[TS_TIER_MINUTE] = last - last % 60;
+  store->open[TS_TIER_HOUR] = last - last % 3600;
+
+  for (uint64_t i = raw->head; i-- > raw->tail;)
+  {
+    const struct ts_record *r = entry(raw, i);
+
+    if (r->time < store->open[TS_TIER_MINUTE]) break;
+
+    add_record(&store->minutes[r->sensor], r);
+  }
+
+  for (uint64_t i = minutes->head; i-- > minutes->tail;)
+  {
+    const struct ts_summary *s = entry(minutes, i);
+
+    if (s->time < store->open[TS_TIER_HOUR]) break;
+    if (s->sensor >= TS_MAX_SENSORS) continue;
+
+    add_summary(&store->hours[s->sensor], s);
+  }
+}
+
+/******************************************************************************/
+
+static size_t file_size(const uint32_t *capacity)
+{
+  return TS_HEADER_SIZE + (size_t)capacity[TS_TIER_RAW] *
+    sizeof(struct ts_record) + ((size_t)capacity[TS_TIER_MINUTE] +
+    capacity[TS_TIER_HOUR]) * sizeof(struct ts_summary);
+}
+
+/******************************************************************************/
+
+static int map_file(struct ts_store *store, size_t size)
+{
+  store->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    store->fd, 0);
+
+  if (store->map == MAP_FAILED)
+  {
+    store->map = NULL;
+    return -1;
+  }
+
+  store->map_size = size;
+  store->header = store->map;
+  return 0;
+}
+
+/******************************************************************************/
+
+static int create(struct ts_store *store, const uint32_t *capacity)
+{
+  const size_t size = file_size(capacity);
+  struct ts_header *h;
+
+  if (ftruncate(store->fd, size) < 0 || map_file(store, size) < 0)
+    return -1;
+
+  h = store->header;
+  h->version = TS_VERSION;
+  h->record_size = sizeof(struct ts_record);
+  h->summary_size = sizeof(struct ts_summary);
+  memcpy(h->capacity, capacity, sizeof(h->capacity));
+
+  /* empty rings, a valid first slot */
+  store->seq = 0;
+  commit(store);
+
+  /* the magic last, a file without it is created again */
+  memcpy(h->magic, TS_MAGIC, sizeof(h->magic));
+  return msync(store->map, TS_HEADER_SIZE, MS_SYNC);
+}
+
+/******************************************************************************/
+
+static int last_commit(struct ts_store *store)
+{
+  const struct ts_header *h = store->header;
+  struct ts_commit last = { 0 }, c;
+  int found = 0;
+
+  /* the newer of the slots that made it. Copied first, another process
+     may be writing one of them meanwhile */
+  for (int i = 0; i < 2; ++i)
+  {
+    memcpy(&c, &h->commits[i], sizeof(c));
+
+    if (c.crc != commit_crc(&c)) continue;
+    if (!found || c.seq > last.seq) last = c;
+
+    found = 1;
+  }
+
+  if (!found) return -1;
+
+  /* the entries written before the indices referring to them */
+  atomic_thread_fence(memory_order_acquire);
+
+  for (int t = 0; t < TS_TIERS; ++t)
+    if (last.head[t] < last.tail[t] ||
+        last.head[t] - last.tail[t] > h->capacity[t] - reserve(t))
+      return -1;
+
+  for (int t = 0; t < TS_TIERS; ++t)
+  {
+    store->rings[t].head = last.head[t];
+    store->rings[t].tail = last.tail[t];
+  }
+
+  store->seq = last.seq;
+  return 0;
+}
+
+/******************************************************************************/
+
+static int load(struct ts_store *store, size_t size)
+{
+  const struct ts_header *h;
+
+  if (size < TS_HEADER_SIZE || map_file(store, size) < 0) return -1;
+
+  h = store->header;
+
+  if (memcmp(h->magic, TS_MAGIC, sizeof(h->magic)) != 0 ||
+      h->version != TS_VERSION ||
+      h->record_size != sizeof(struct ts_record) ||
+      h->summary_size != sizeof(struct ts_summary) ||
+      file_size(h->capacity) > size)
+    return -1;
+
+  return last_commit(store);
+}
+
+/******************************************************************************/
+
+int ts_store_open(struct ts_store *store,
+                  const char *path,
+                  uint32_t raw_capacity,
+                  uint32_t minute_capacity,
+                  uint32_t hour_capacity)
+{
+  uint32_t capacity[TS_TIERS] = {
+    raw_capacity ? raw_capacity : TS_RAW_CAPACITY,
+    minute_capacity ? minute_capacity : TS_MINUTE_CAPACITY,
+    hour_capacity ? hour_capacity : TS_HOUR_CAPACITY
+  };
+  struct stat st;
+  int status;
+
+  memset(store, 0, sizeof(*store));
+
+  if ((store->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0)
+    return -1;
+
+  if (fstat(store->fd, &st) < 0) goto fail;
+
+  /* a new file, or one that never got its magic. Others are left alone */
+  if (st.st_size == 0) status = create(store, capacity);
+  else
+  {
+    char magic[sizeof(TS_MAGIC) - 1];
+    static const char none[sizeof(magic)];
+
+    if (pread(store->fd, magic, sizeof(magic), 0) != sizeof(magic))
+      goto fail;
+
+    if (memcmp(magic, TS_MAGIC, sizeof(magic)) == 0)
+      status = load(store, st.st_size);
+    else if (memcmp(magic, none, sizeof(magic)) == 0)
+      status = create(store, capacity);
+    else
+      goto fail;
+  }
+
+  if (status < 0) goto fail;
+
+  for (int t = 0; t < TS_TIERS; ++t)
+  {
+    struct ts_ring *ring = &store->rings[t];
+
+    ring->capacity = store->header->capacity[t];
+    ring->size = t == TS_TIER_RAW ?
+      sizeof(struct ts_record) : sizeof(struct ts_summary);
+  }
+
+  store->rings[TS_TIER_RAW].entries = (char *)store->map + TS_HEADER_SIZE;
+  store->rings[TS_TIER_MINUTE].entries = store->rings[TS_TIER_RAW].entries +
+    store->rings[TS_TIER_RAW].capacity * sizeof(struct ts_record);
+  store->rings[TS_TIER_HOUR].entries = store->rings[TS_TIER_MINUTE].entries +
+    store->rings[TS_TIER_MINUTE].capacity * sizeof(struct ts_summary);
+
+  rebuild(store);
+  return 0;
+
+fail:
+  ts_store_close(store);
+  return -1;
+}
+
+/******************************************************************************/
+
+void ts_store_close(struct ts_store *store)
+{
+  if (store->map) munmap(store->map, store->map_size);
+  if (store->fd >= 0) close(store->fd);
+
+  store->map = NULL;
+  store->fd = -1;
+}
+
+/******************************************************************************/
+
+int ts_store_append(struct ts_store *store, const struct ts_record *record)
+{
+  const uint32_t t = record->time;
+
+  if (t == 0) return -1;
+
+  /* a reading of a later minute closes the open one, of every sensor,
+     and possibly the open hour too */
+  for (int tier = TS_TIER_MINUTE; tier < TS_TIERS; ++tier)
+  {
+    const uint32_t bucket = t - t % spans[tier];
+
+    if (store->open[tier] && bucket > store->open[tier])
+      close_buckets(store, tier);
+
+    if (bucket > store->open[tier]) store->open[tier] = bucket;
+  }
+
+  add_record(&store->minutes[record->sensor], record);
+  push(&store->rings[TS_TIER_RAW], TS_TIER_RAW, record);
+
+  commit(store);
+  return 0;
+}
+
+/******************************************************************************/
+
+int ts_store_refresh(struct ts_store *store)
+{
+  const uint64_t seq = store->seq;
+
+  if (last_commit(store) < 0) return -1;
+
+  return store->seq != seq;
+}
+
+/******************************************************************************/
+
+int ts_store_sync(struct ts_store *store)
+{
+  /* the header is the first page, the entries referred to by a commit
+     get there before it */
+  char *map = store->map;
+
+  if (msync(map + TS_HEADER_SIZE, store->map_size - TS_HEADER_SIZE,
+            MS_SYNC) < 0)
+    return -1;
+
+  return msync(map, TS_HEADER_SIZE, MS_SYNC);
+}
+
+/******************************************************************************/
+
+size_t ts_store_records(const struct ts_store *store,
+                        uint32_t from,
+                        uint32_t to,
+                        struct ts_record *out,
+                        size_t max)
+{
+  const struct ts_ring *ring = &store->rings[TS_TIER_RAW];
+  size_t n = 0;
+
+  for (uint64_t i = lower_bound(ring, from); i < ring->head && n < max; ++i)
+  {
+    const struct ts_record *r = entry(ring, i);
+
+    if (r->time >= to) break;
+
+    out[n++] = *r;
+  }
+
+  return n;
+}
+
+/******************************************************************************/
+
+int ts_store_newest(const struct ts_store *store, struct ts_record *record)
+{
+  const struct ts_ring *ring = &store->rings[TS_TIER_RAW];
+
+  if (ring->head == ring->tail) return -1;
+
+  memcpy(record, entry(ring, ring->head - 1), sizeof(*record));
+  return 0;
+}
+
+/******************************************************************************/
+
+size_t ts_store_summaries(const struct ts_store *store,
+                          enum ts_tier tier,
+                          uint32_t from,
+                          uint32_t to,
+                          struct ts_summary *out,
+                          size_t max)
+{
+  const struct ts_ring *ring = &store->rings[tier];
+  size_t n = 0;
+
+  if (tier == TS_TIER_RAW) return 0;
+
+  for (uint64_t i = lower_bound(ring, from); i < ring->head && n < max; ++i)
+  {
+    const struct ts_summary *s = entry(ring, i);
+
+    if (s->time >= to) break;
+
+    out[n++] = *s;
+  }
+
+  return n;
+}
+
+/******************************************************************************/
+
+static size_t cover(const struct ts_store *store,
+                    enum ts_tier tier,
+                    unsigned int sensor,
+                    uint32_t from,
+                    uint32_t to,
+                    struct ts_accumulator *acc)
+{
+  const struct ts_ring *ring = &store->rings[tier];
+  const uint64_t span = spans[tier];
+  size_t visited = 0;
+
+  if (from >= to) return 0;
+
+  if (tier == TS_TIER_RAW)
+  {
+    for (uint64_t i = lower_bound(ring, from); i < ring->head; ++i, ++visited)
+    {
+      const struct ts_record *r = entry(ring, i);
+
+      if (r->time >= to) break;
+      if (r->sensor == sensor) add_record(acc, r);
+    }
+
+    return visited;
+  }
+
+  /* the whole buckets within the range, closed ones only */
+  uint64_t first = (from + span - 1) / span * span;
+  uint64_t last = to / span * span;
+
+  if (last > store->open[tier]) last = store->open[tier];
+
+  if (first >= last) return cover(store, tier - 1, sensor, from, to, acc);
+
+  for (uint64_t i = lower_bound(ring, first); i < ring->head; ++i, ++visited)
+  {
+    const struct ts_summary *s = entry(ring, i);
+
+    if (s->time >= last) break;
+    if (s->sensor == sensor) add_summary(acc, s);
+  }
+
+  /* the bits before and after, in finer ones */
+  return visited + cover(store, tier - 1, sensor, from, first, acc) +
+    cover(store, tier - 1, sensor, last, to, acc);
+}
+
+/******************************************************************************/
+
+size_t ts_store_summarize(const struct ts_store *store,
+                          unsigned int sensor,
+                          uint32_t from,
+                          uint32_t to,
+                          struct ts_summary *summary)
+{
+  struct ts_accumulator acc;
+  size_t visited;
+
+  memset(&acc, 0, sizeof(acc));
+  visited = cover(store, TS_TIER_HOUR, sensor, from, to, &acc);
+
+  summarize_bucket(&acc, from, sensor, summary);
+  return visited;
+}
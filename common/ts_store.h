@@ -0,0 +1,170 @@
+/******************************************************************************/
+/* File: ts_store.h
+   Author: N.Kim
+   Abstract: Memory-mapped time series of temperature/humidity readings
+
+   Description:
+     A fixed size file holding three rings: the readings themselves (8
+     bytes each), summaries of every minute and of every hour (min, max
+     and mean per sensor). Each ring drops its oldest entries once full,
+     the summaries last far longer than the readings. Range queries take
+     the coarsest summaries covering the range, weeks of readings come
+     down to a few hundred hours.
+
+     The indices of all rings are committed together, into one of two
+     checksummed slots of the header in turn. The entries are written
+     first and are not part of the store before the commit, the ring
+     never reuses an entry the committed indices refer to. Thus, a crash
+     loses an append at most and a torn commit falls back to the other
+     slot. ts_store_sync() takes the file to the disk in that order, what
+     reaches it without (the kernel writes back pages as it likes) may be
+     older on power losses.
+
+     Buckets are aligned to the wall clock and close for all sensors at
+     once, when the first reading of a later one comes in. Hours are made
+     of the summaries of their minutes, the open ones are rebuilt from the
+     rings when opening the file. */
+/******************************************************************************/
+
+#ifndef TS_STORE_H
+#define TS_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* sensors are told apart by 6 bits, their GPIO */
+#define TS_MAX_SENSORS 64
+
+/* default sizes of the rings of new files, about 8, 5 and 2 MB: a day of
+   24 sensors read every 2 seconds, a week of their minutes and three
+   months of their hours */
+#define TS_RAW_CAPACITY (1u << 20)
+#define TS_MINUTE_CAPACITY (1u << 18)
+#define TS_HOUR_CAPACITY (1u << 16)
+
+enum ts_tier {
+  TS_TIER_RAW,
+  TS_TIER_MINUTE,
+  TS_TIER_HOUR,
+  TS_TIERS
+};
+
+/* a reading, time 0 is none */
+struct ts_record {
+  uint32_t time;              /* seconds since the epoch */
+  int16_t temperature;        /* tenths of a degree Celsius */
+  uint16_t humidity : 10;     /* tenths of a percent */
+  uint16_t sensor : 6;
+};
+
+_Static_assert(sizeof(struct ts_record) == 8, "ts_record is 8 bytes");
+
+/* a minute or an hour of a sensor, in the units of ts_record */
+struct ts_summary {
+  uint32_t time;              /* start of the bucket */
+  uint32_t count;             /* readings */
+  uint8_t sensor;
+
+  int16_t temperature_min;
+  int16_t temperature_max;
+  int16_t temperature_mean;
+
+  uint16_t humidity_min;
+  uint16_t humidity_max;
+  uint16_t humidity_mean;
+};
+
+/* the open bucket of a sensor */
+struct ts_accumulator {
+  uint32_t count;
+  int64_t temperature_sum;
+  int64_t humidity_sum;
+  int16_t temperature_min;
+  int16_t temperature_max;
+  uint16_t humidity_min;
+  uint16_t humidity_max;
+};
+
+struct ts_header;
+
+struct ts_ring {
+  char *entries;
+  size_t size;                /* of an entry */
+  uint64_t capacity;
+  uint64_t head;
+  uint64_t tail;
+};
+
+struct ts_store {
+  int fd;
+  void *map;
+  size_t map_size;
+
+  struct ts_header *header;
+  struct ts_ring rings[TS_TIERS];
+
+  /* committed so far */
+  uint64_t seq;
+
+  /* the buckets being filled, 0 if none */
+  uint32_t open[TS_TIERS];
+  struct ts_accumulator minutes[TS_MAX_SENSORS];
+  struct ts_accumulator hours[TS_MAX_SENSORS];
+};
+
+/* opens 'path', or creates it with rings of the capacities given (0
+   takes the default). Returns -1 if the file cannot be mapped or is not
+   a store */
+int ts_store_open(struct ts_store *store,
+                  const char *path,
+                  uint32_t raw_capacity,
+                  uint32_t minute_capacity,
+                  uint32_t hour_capacity);
+
+void ts_store_close(struct ts_store *store);
+
+/* adds a reading, which should not be older than the ones before.
+   Returns -1 on bad sensors */
+int ts_store_append(struct ts_store *store, const struct ts_record *record);
+
+/* takes the readings another process appended to the file since, i.e.
+   its last commit. The open buckets stay as they were, this is for
+   reading the rings only. Returns 1 if there are new ones, -1 if no
+   commit is valid. Entries about to drop out of a full ring may be
+   overwritten while being read */
+int ts_store_refresh(struct ts_store *store);
+
+/* waits for the file to be on the disk, readings before the header */
+int ts_store_sync(struct ts_store *store);
+
+/* the readings of ['from', 'to'), oldest first, no more than 'max'.
+   Returns the number of them */
+size_t ts_store_records(const struct ts_store *store,
+                        uint32_t from,
+                        uint32_t to,
+                        struct ts_record *out,
+                        size_t max);
+
+/* the latest reading, returns -1 if there are none */
+int ts_store_newest(const struct ts_store *store, struct ts_record *record);
+
+/* the same for the summaries of a tier (minutes or hours) */
+size_t ts_store_summaries(const struct ts_store *store,
+                          enum ts_tier tier,
+                          uint32_t from,
+                          uint32_t to,
+                          struct ts_summary *out,
+                          size_t max);
+
+/* min, max and mean of 'sensor' over ['from', 'to'), out of as few
+   entries as possible: whole hours from their summaries, whole minutes
+   from theirs, only the rest from the readings. The bucket returned
+   starts at 'from', its count is 0 if there are no readings. Returns
+   the number of entries visited */
+size_t ts_store_summarize(const struct ts_store *store,
+                          unsigned int sensor,
+                          uint32_t from,
+                          uint32_t to,
+                          struct ts_summary *summary);
+
+#endif
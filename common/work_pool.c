@@ -0,0 +1,644 @@
+/******************************************************************************/
+/* File: work_pool.c
+   Author: N.Kim
+   Abstract: Work-stealing thread pool with per-connection ordering
+
+   Description:
+     The I/O thread hands items to strands (one per connection), strands
+     with pending items travel through the pool as the unit of work:
+     the shared injection queue takes strands scheduled from outside
+     and strands that used up their batch, each worker keeps strands it
+     re-schedules otherwise in its own deque, and idle workers steal
+     from the deques of busy ones. None of the hand over paths takes a
+     lock, idle workers sleep on a futex. */
+
+/******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "work_pool.h"
+
+/* number of items processed per strand before it has to queue up behind
+   the strands scheduled meanwhile */
+#define WORK_BATCH 64
+
+/* spin rounds before an idle worker goes to sleep */
+#define WORK_SPIN 64
+
+/******************************************************************************/
+
+static unsigned long round_pow2(unsigned long value)
+{
+  unsigned long result = 1;
+
+  while (result < value) result <<= 1;
+  return result;
+}
+
+/******************************************************************************/
+
+static void futex_wait(atomic_int *addr, int value)
+{
+  /* bounded wait, purely as a safety net */
+  struct timespec ts = { 0, 100 * 1000000L };
+
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, &ts, NULL, 0);
+}
+
+static void futex_wake(atomic_int *addr, int count)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/******************************************************************************/
+/* Strand item list (Vyukov's intrusive MPSC queue) */
+
+static void strand_push(struct work_strand *strand, struct work_item *item)
+{
+  atomic_store_explicit(&item->next, NULL, memory_order_relaxed);
+
+  struct work_item *prev =
+    atomic_exchange_explicit(&strand->tail, item, memory_order_acq_rel);
+
+  atomic_store_explicit(&prev->next, item, memory_order_release);
+}
+
+/******************************************************************************/
+
+static struct work_item *strand_pop(struct work_strand *strand)
+{
+  struct work_item *head = strand->head;
+  struct work_item *next =
+    atomic_load_explicit(&head->next, memory_order_acquire);
+
+  if (head == &strand->stub)
+  {
+    if (!next) return NULL;
+
+    strand->head = next;
+    head = next;
+    next = atomic_load_explicit(&next->next, memory_order_acquire);
+  }
+
+  if (next)
+  {
+    strand->head = next;
+    return head;
+  }
+
+  /* a producer is in the middle of a push, try again later */
+  if (atomic_load_explicit(&strand->tail, memory_order_acquire) != head)
+    return NULL;
+
+  /* 'head' is the last item, put the stub back behind it */
+  strand_push(strand, &strand->stub);
+
+  next = atomic_load_explicit(&head->next, memory_order_acquire);
+
+  if (next)
+  {
+    strand->head = next;
+    return head;
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/* Chase-Lev deque, memory orderings as in Le et al., "Correct and
+   Efficient Work-Stealing for Weak Memory Models" */
+
+static int deque_init(struct work_deque *dq, unsigned long size)
+{
+  dq->slots = calloc(size, sizeof(*dq->slots));
+
+  if (!dq->slots) return -ENOMEM;
+
+  dq->mask = size - 1;
+  atomic_init(&dq->top, 0);
+  atomic_init(&dq->bottom, 0);
+  return 0;
+}
+
+/******************************************************************************/
+
+static void deque_push(struct work_deque *dq, struct work_strand *strand)
+{
+  long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+
+  /* never overflows, a strand is queued in at most one place and the
+     deque holds as many slots as there are strands */
+  atomic_store_explicit(&dq->slots[b & dq->mask], strand,
+                        memory_order_relaxed);
+
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+}
+
+/******************************************************************************/
+
+static struct work_strand *deque_pop(struct work_deque *dq)
+{
+  long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+
+  atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+
+  long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+  if (t > b)
+  {
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+
+  struct work_strand *strand =
+    atomic_load_explicit(&dq->slots[b & dq->mask], memory_order_relaxed);
+
+  if (t == b)
+  {
+    /* last element, race against the thieves */
+    if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+      strand = NULL;
+
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+  }
+
+  return strand;
+}
+
+/******************************************************************************/
+
+static struct work_strand *deque_steal(struct work_deque *dq)
+{
+  long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+
+  atomic_thread_fence(memory_order_seq_cst);
+
+  long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+
+  if (t >= b) return NULL;
+
+  struct work_strand *strand =
+    atomic_load_explicit(&dq->slots[t & dq->mask], memory_order_relaxed);
+
+  if (!atomic_compare_exchange_strong_explicit(&dq->top, &t, t + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed))
+    return NULL;
+
+  return strand;
+}
+
+/******************************************************************************/
+/* Bounded MPMC queue (Vyukov), used for injecting strands */
+
+static int queue_init(struct work_queue *q, unsigned long size)
+{
+  q->cells = calloc(size, sizeof(*q->cells));
+
+  if (!q->cells) return -ENOMEM;
+
+  for (unsigned long i = 0; i < size; ++i)
+    atomic_init(&q->cells[i].seq, i);
+
+  q->mask = size - 1;
+  atomic_init(&q->enqueue_pos, 0);
+  atomic_init(&q->dequeue_pos, 0);
+  return 0;
+}
+
+/******************************************************************************/
+
+static int queue_push(struct work_queue *q, struct work_strand *strand)
+{
+  unsigned long pos =
+    atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+
+  for (;;)
+  {
+    struct work_cell *cell = &q->cells[pos & q->mask];
+    unsigned long seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    long diff = (long)seq - (long)pos;
+
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos,
+                                                pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        cell->strand = strand;
+        atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+        return 0;
+      }
+    }
+    else if (diff < 0) return -EAGAIN;
+    else pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+  }
+}
+
+/******************************************************************************/
+
+static struct work_strand *queue_pop(struct work_queue *q)
+{
+  unsigned long pos =
+    atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+
+  for (;;)
+  {
+    struct work_cell *cell = &q->cells[pos & q->mask];
+    unsigned long seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    long diff = (long)seq - (long)(pos + 1);
+
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos,
+                                                pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+      {
+        struct work_strand *strand = cell->strand;
+
+        atomic_store_explicit(&cell->seq, pos + q->mask + 1,
+                              memory_order_release);
+        return strand;
+      }
+    }
+    else if (diff < 0) return NULL;
+    else pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+  }
+}
+
+/******************************************************************************/
+
+static void wake_one(struct work_pool *pool)
+{
+  /* pairs with the fence in 'worker_sleep', either we see the sleeper
+     or the sleeper sees the work we have just published */
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (atomic_load_explicit(&pool->sleepers, memory_order_relaxed) > 0)
+  {
+    atomic_fetch_add(&pool->epoch, 1);
+    futex_wake(&pool->epoch, 1);
+  }
+}
+
+/******************************************************************************/
+
+static struct work_strand *find_work(struct work_worker *w)
+{
+  struct work_pool *pool = w->pool;
+  struct work_strand *strand = deque_pop(&w->deque);
+
+  if (strand) return strand;
+
+  strand = queue_pop(&pool->inject);
+
+  if (strand) return strand;
+
+  /* start at a random victim, so thieves do not pile up on worker 0 */
+  unsigned int start = rand_r(&w->seed) % pool->num_workers;
+
+  for (unsigned int i = 0; i < pool->num_workers; ++i)
+  {
+    struct work_worker *victim =
+      &pool->workers[(start + i) % pool->num_workers];
+
+    if (victim == w) continue;
+
+    strand = deque_steal(&victim->deque);
+
+    if (strand)
+    {
+      atomic_fetch_add_explicit(&w->steals, 1, memory_order_relaxed);
+      return strand;
+    }
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+static void release_strand(struct work_strand *strand)
+{
+  atomic_fetch_sub(&strand->pool->strands, 1);
+
+  free(strand->close_item);
+  free(strand);
+}
+
+/******************************************************************************/
+
+static void run_strand(struct work_worker *w, struct work_strand *strand)
+{
+  struct work_pool *pool = w->pool;
+  unsigned long done = 0;
+
+  while (done < WORK_BATCH)
+  {
+    struct work_item *item = strand_pop(strand);
+
+    /* counted as pending, but not linked in yet */
+    if (!item) break;
+
+    /* closed, nothing follows and nobody else refers to the strand */
+    if (item == strand->close_item)
+    {
+      atomic_fetch_add_explicit(&w->processed, done, memory_order_relaxed);
+
+      strand->on_closed(strand->closed_udata);
+      release_strand(strand);
+
+      atomic_fetch_add_explicit(&pool->completed, done + 1,
+                                memory_order_release);
+      return;
+    }
+
+    strand->fn(strand, item->data, item->len, strand->udata);
+    free(item);
+    done++;
+  }
+
+  atomic_fetch_add_explicit(&w->processed, done, memory_order_relaxed);
+  atomic_fetch_add_explicit(&pool->completed, done, memory_order_release);
+
+  /* the strand must not be touched once the count has dropped to zero,
+     a producer might reschedule it onto another worker right away */
+  if (atomic_fetch_sub(&strand->pending, done) != done)
+  {
+    /* a busy strand goes to the back of the injection queue, the own
+       deque is popped first and would run it again before anyone else.
+       The queue holds every strand, the deque is a mere fallback */
+    if (done < WORK_BATCH || queue_push(&pool->inject, strand) < 0)
+      deque_push(&w->deque, strand);
+
+    wake_one(pool);
+  }
+}
+
+/******************************************************************************/
+
+static void worker_sleep(struct work_worker *w)
+{
+  struct work_pool *pool = w->pool;
+  int epoch = atomic_load(&pool->epoch);
+
+  atomic_fetch_add(&pool->sleepers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+
+  /* re-check after announcing ourselves, see 'wake_one' */
+  struct work_strand *strand = find_work(w);
+
+  if (strand) run_strand(w, strand);
+  else if (!atomic_load(&pool->stopping)) futex_wait(&pool->epoch, epoch);
+
+  atomic_fetch_sub(&pool->sleepers, 1);
+}
+
+/******************************************************************************/
+
+static void *worker_thread(void *data)
+{
+  struct work_worker *w = data;
+  struct work_pool *pool = w->pool;
+  int idle = 0;
+
+  while (!atomic_load_explicit(&pool->stopping, memory_order_acquire))
+  {
+    struct work_strand *strand = find_work(w);
+
+    if (strand)
+    {
+      run_strand(w, strand);
+      idle = 0;
+    }
+    else if (++idle < WORK_SPIN) sched_yield();
+    else worker_sleep(w);
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+struct work_pool *work_pool_new(unsigned int num_workers,
+                                unsigned int max_strands)
+{
+  struct work_pool *pool = calloc(1, sizeof(*pool));
+
+  if (!pool) return NULL;
+
+  if (num_workers == 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = cpus > 0 ? cpus : 1;
+  }
+
+  unsigned long size = round_pow2(max_strands ? max_strands : 1);
+
+  if (queue_init(&pool->inject, size) < 0) goto fail;
+
+  pool->max_strands = max_strands ? max_strands : 1;
+
+  pool->workers = calloc(num_workers, sizeof(*pool->workers));
+
+  if (!pool->workers) goto fail;
+
+  pool->num_workers = num_workers;
+
+  for (unsigned int i = 0; i < num_workers; ++i)
+  {
+    struct work_worker *w = &pool->workers[i];
+
+    w->pool = pool;
+    w->index = i;
+    w->seed = i + 1;
+
+    if (deque_init(&w->deque, size) < 0) goto fail;
+  }
+
+  for (unsigned int i = 0; i < num_workers; ++i)
+  {
+    struct work_worker *w = &pool->workers[i];
+
+    if (pthread_create(&w->thread, NULL, worker_thread, w) != 0)
+    {
+      /* stop the ones already running */
+      pool->num_workers = i;
+      work_pool_free(pool);
+      return NULL;
+    }
+  }
+
+  return pool;
+
+fail:
+  if (pool->workers)
+  {
+    for (unsigned int i = 0; i < num_workers; ++i)
+      free(pool->workers[i].deque.slots);
+  }
+
+  free(pool->workers);
+  free(pool->inject.cells);
+  free(pool);
+  return NULL;
+}
+
+/******************************************************************************/
+
+void work_pool_free(struct work_pool *pool)
+{
+  if (!pool) return;
+
+  work_pool_drain(pool);
+
+  atomic_store_explicit(&pool->stopping, 1, memory_order_release);
+  atomic_fetch_add(&pool->epoch, 1);
+  futex_wake(&pool->epoch, INT_MAX);
+
+  for (unsigned int i = 0; i < pool->num_workers; ++i)
+    pthread_join(pool->workers[i].thread, NULL);
+
+  for (unsigned int i = 0; i < pool->num_workers; ++i)
+    free(pool->workers[i].deque.slots);
+
+  free(pool->workers);
+  free(pool->inject.cells);
+  free(pool);
+}
+
+/******************************************************************************/
+
+struct work_strand *work_pool_strand_new(struct work_pool *pool,
+                                         work_fn fn,
+                                         void *udata)
+{
+  struct work_strand *strand;
+
+  /* a strand is in one queue at most, thus, they never overflow */
+  if (atomic_fetch_add(&pool->strands, 1) >= pool->max_strands)
+  {
+    atomic_fetch_sub(&pool->strands, 1);
+    return NULL;
+  }
+
+  strand = calloc(1, sizeof(*strand));
+
+  if (strand) strand->close_item = calloc(1, sizeof(*strand->close_item));
+
+  if (!strand || !strand->close_item)
+  {
+    atomic_fetch_sub(&pool->strands, 1);
+    free(strand);
+    return NULL;
+  }
+
+  atomic_init(&strand->stub.next, NULL);
+  atomic_init(&strand->tail, &strand->stub);
+  atomic_init(&strand->pending, 0);
+
+  strand->head = &strand->stub;
+  strand->fn = fn;
+  strand->udata = udata;
+  strand->pool = pool;
+
+  return strand;
+}
+
+/******************************************************************************/
+
+void work_pool_strand_free(struct work_strand *strand)
+{
+  if (!strand) return;
+
+  while (atomic_load_explicit(&strand->pending, memory_order_acquire) > 0)
+    sched_yield();
+
+  release_strand(strand);
+}
+
+/******************************************************************************/
+
+void work_pool_strand_close(struct work_strand *strand,
+                            work_closed_fn fn,
+                            void *udata)
+{
+  struct work_pool *pool = strand->pool;
+
+  strand->on_closed = fn;
+  strand->closed_udata = udata;
+
+  atomic_fetch_add_explicit(&pool->submitted, 1, memory_order_relaxed);
+
+  /* counted before it is linked in, the worker frees the strand as soon
+     as it gets hold of the item. Unless the strand is ours to schedule,
+     it must not be touched after the push */
+  const int schedule = atomic_fetch_add(&strand->pending, 1) == 0;
+
+  strand_push(strand, strand->close_item);
+
+  if (!schedule) return;
+
+  while (queue_push(&pool->inject, strand) < 0) sched_yield();
+  wake_one(pool);
+}
+
+/******************************************************************************/
+
+int work_pool_submit(struct work_strand *strand,
+                     const void *data,
+                     size_t len)
+{
+  struct work_pool *pool = strand->pool;
+  struct work_item *item = malloc(sizeof(*item) + len);
+
+  if (!item) return -ENOMEM;
+
+  item->len = len;
+  memcpy(item->data, data, len);
+
+  atomic_fetch_add_explicit(&pool->submitted, 1, memory_order_relaxed);
+
+  /* counted before it is linked in, otherwise the worker draining the
+     strand could take the item and drop the count below zero. The first
+     pending item makes the strand ours to schedule */
+  const int schedule = atomic_fetch_add(&strand->pending, 1) == 0;
+
+  strand_push(strand, item);
+
+  if (!schedule) return 0;
+
+  /* the queue has room for every strand, this hardly ever has to wait */
+  while (queue_push(&pool->inject, strand) < 0) sched_yield();
+  wake_one(pool);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void work_pool_drain(struct work_pool *pool)
+{
+  unsigned long submitted = atomic_load(&pool->submitted);
+
+  while (atomic_load_explicit(&pool->completed, memory_order_acquire) <
+         submitted)
+    sched_yield();
+}
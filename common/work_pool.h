@@ -0,0 +1,145 @@
+/******************************************************************************/
+/* File: work_pool.h
+   Author: N.Kim
+   Abstract: Work-stealing thread pool with per-connection ordering */
+/******************************************************************************/
+
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+struct work_pool;
+struct work_strand;
+
+/* invoked on one of the worker threads. Items of the same strand are
+   processed one at a time and in submission order */
+typedef void (*work_fn)(struct work_strand *strand,
+                        const char *data,
+                        size_t len,
+                        void *udata);
+
+/* invoked on one of the worker threads once a closed strand is through */
+typedef void (*work_closed_fn)(void *udata);
+
+/* a unit of work, the payload is copied in right behind the header */
+struct work_item {
+  _Atomic(struct work_item *) next;
+  size_t len;
+  char data[];
+};
+
+/* ordering domain, usually one per connection. Items are queued in a
+   lock-free multi-producer/single-consumer list. Whoever raises the
+   number of pending items from zero schedules the strand onto the pool,
+   the worker processing it keeps it until the count drops back to zero,
+   thus, a strand is never processed by two workers at the same time */
+struct work_strand {
+  _Atomic(struct work_item *) tail;
+  struct work_item *head;
+  struct work_item stub;
+
+  atomic_ulong pending;
+
+  work_fn fn;
+  void *udata;
+  struct work_pool *pool;
+
+  /* queued last by 'work_pool_strand_close', allocated up front so
+     closing never fails */
+  struct work_item *close_item;
+  work_closed_fn on_closed;
+  void *closed_udata;
+};
+
+/* Chase-Lev deque, only the owning worker pushes and pops at the
+   bottom, all other workers steal from the top */
+struct work_deque {
+  atomic_long top;
+  atomic_long bottom;
+  long mask;
+  _Atomic(struct work_strand *) *slots;
+};
+
+/* bounded multi-producer/multi-consumer queue (sequence numbered
+   cells), strands scheduled from outside the pool (i.e. the I/O thread)
+   are handed over to whichever worker is free through this one */
+struct work_cell {
+  atomic_ulong seq;
+  struct work_strand *strand;
+};
+
+struct work_queue {
+  atomic_ulong enqueue_pos;
+  atomic_ulong dequeue_pos;
+  unsigned long mask;
+  struct work_cell *cells;
+};
+
+struct work_worker {
+  struct work_pool *pool;
+  pthread_t thread;
+  unsigned int index;
+  unsigned int seed;
+
+  struct work_deque deque;
+
+  /* statistics, only written by the worker itself */
+  atomic_ulong processed;
+  atomic_ulong steals;
+};
+
+struct work_pool {
+  struct work_worker *workers;
+  unsigned int num_workers;
+
+  struct work_queue inject;
+
+  /* the injection queue and the deques have room for all strands */
+  atomic_uint strands;
+  unsigned int max_strands;
+
+  /* sleeping workers wait on 'epoch' (futex) */
+  atomic_int epoch;
+  atomic_int sleepers;
+  atomic_int stopping;
+
+  atomic_ulong submitted;
+  atomic_ulong completed;
+};
+
+/* 'num_workers' of 0 uses one worker per online CPU. 'max_strands'
+   bounds the number of strands that exist at the same time */
+struct work_pool *work_pool_new(unsigned int num_workers,
+                                unsigned int max_strands);
+
+/* processes everything submitted so far, then stops the workers */
+void work_pool_free(struct work_pool *pool);
+
+/* returns NULL once there are 'max_strands' already */
+struct work_strand *work_pool_strand_new(struct work_pool *pool,
+                                         work_fn fn,
+                                         void *udata);
+
+/* waits until all items of the strand have been processed */
+void work_pool_strand_free(struct work_strand *strand);
+
+/* the same without waiting, the strand is freed right after its last
+   item and 'fn' is called from that worker. Nothing may be submitted
+   to the strand afterwards */
+void work_pool_strand_close(struct work_strand *strand,
+                            work_closed_fn fn,
+                            void *udata);
+
+/* copy 'data' into a new item and queue it on the strand. Safe to call
+   from any thread, usually the I/O thread */
+int work_pool_submit(struct work_strand *strand,
+                     const void *data,
+                     size_t len);
+
+/* wait until all items submitted so far have been processed */
+void work_pool_drain(struct work_pool *pool);
+
+#endif
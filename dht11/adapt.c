@@ -0,0 +1,131 @@
+/******************************************************************************/
+/* File: adapt.c
+   Author: N.Kim
+   Abstract: Adaptive sampling and outlier filtering of DHT11 readings */
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "adapt.h"
+
+/******************************************************************************/
+
+static int median(const int *values, unsigned int n)
+{
+  /* a handful of them, insertion sort will do */
+  int sorted[DHT_HAMPEL_WINDOW];
+
+  for (unsigned int i = 0; i < n; ++i)
+  {
+    unsigned int j = i;
+
+    for (; j > 0 && sorted[j - 1] > values[i]; --j) sorted[j] = sorted[j - 1];
+
+    sorted[j] = values[i];
+  }
+
+  return sorted[n / 2];
+}
+
+/******************************************************************************/
+
+int dht_hampel_filter(struct dht_hampel *filter, int value, int floor)
+{
+  const unsigned int n = filter->count;
+  int result = value;
+
+  /* too few to tell yet */
+  if (n >= 3)
+  {
+    const int med = median(filter->window, n);
+    int deviations[DHT_HAMPEL_WINDOW];
+
+    for (unsigned int i = 0; i < n; ++i)
+      deviations[i] = abs(filter->window[i] - med);
+
+    /* 1.4826 * K * MAD, in integers */
+    int threshold = median(deviations, n) * 14826 * DHT_HAMPEL_K / 10000;
+
+    if (threshold < floor) threshold = floor;
+    if (abs(value - med) > threshold) result = med;
+  }
+
+  filter->window[filter->next] = value;
+  filter->next = (filter->next + 1) % DHT_HAMPEL_WINDOW;
+  if (filter->count < DHT_HAMPEL_WINDOW) filter->count++;
+
+  return result;
+}
+
+/******************************************************************************/
+
+void dht_adapt_init(struct dht_adapt *adapt, unsigned int seed)
+{
+  memset(adapt, 0, sizeof(*adapt));
+  adapt->seed = seed;
+}
+
+/******************************************************************************/
+
+static uint32_t backoff(struct dht_adapt *adapt, unsigned int failures)
+{
+  /* doubling, then anywhere within half of it on top */
+  const unsigned int shift =
+    failures > DHT_ADAPT_BACKOFF_MAX ? DHT_ADAPT_BACKOFF_MAX : failures;
+  uint32_t delay = (uint32_t)DHT_ADAPT_MIN_US << (shift - 1);
+
+  if (delay > DHT_ADAPT_MAX_US) delay = DHT_ADAPT_MAX_US;
+
+  return delay + rand_r(&adapt->seed) % (delay / 2 + 1);
+}
+
+/******************************************************************************/
+
+int dht_adapt_reading(struct dht_adapt *adapt,
+                      struct dht_sensor *sensor,
+                      int status,
+                      struct dht_reading *reading)
+{
+  struct dht_adapt_sensor *s = &adapt->sensors[sensor->gpio];
+
+  if (status != DHT_DECODE_OK)
+  {
+    adapt->failed++;
+    sensor->interval_us = backoff(adapt, ++s->failures);
+    return 0;
+  }
+
+  s->failures = 0;
+
+  const int t = dht_hampel_filter(&s->temperature, reading->temperature,
+                                  DHT_HAMPEL_FLOOR_T);
+  const int h = dht_hampel_filter(&s->humidity, reading->humidity,
+                                  DHT_HAMPEL_FLOOR_H);
+  const int glitch = t != reading->temperature ||
+                     h != (int)reading->humidity;
+
+  /* glitches and transients are looked at again soon, stable values
+     less and less often */
+  if (glitch ||
+      (s->have_last && (abs(t - s->last_temperature) >= DHT_ADAPT_TRANSIENT_T ||
+                        abs(h - s->last_humidity) >= DHT_ADAPT_TRANSIENT_H)))
+    sensor->interval_us = DHT_ADAPT_MIN_US;
+  else if (sensor->interval_us < DHT_ADAPT_MAX_US / 2)
+    sensor->interval_us *= 2;
+  else
+    sensor->interval_us = DHT_ADAPT_MAX_US;
+
+  if (sensor->interval_us < DHT_ADAPT_MIN_US)
+    sensor->interval_us = DHT_ADAPT_MIN_US;
+
+  if (glitch) adapt->glitches++;
+  else adapt->valid++;
+
+  reading->temperature = t;
+  reading->humidity = h;
+  s->last_temperature = t;
+  s->last_humidity = h;
+  s->have_last = 1;
+  return 1;
+}
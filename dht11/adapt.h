@@ -0,0 +1,91 @@
+/******************************************************************************/
+/* File: adapt.h
+   Author: N.Kim
+   Abstract: Adaptive sampling and outlier filtering of DHT11 readings
+
+   Description:
+     Decides when the sampler (see sampler.h) reads a sensor next: soon
+     while the values change, then twice the interval after every stable
+     reading, up to a maximum. Failed readings are retried after a
+     backoff doubling with every failure in a row, jittered so sensors
+     failing together (e.g. a shared supply) do not retry together.
+
+     Readings pass a Hampel filter first: a value further from the median
+     of the last ones than a multiple of their median absolute deviation
+     is a glitch, the median stands in for it. A glitch gets the next
+     reading early, a real step is confirmed once the window has seen
+     enough of it. */
+/******************************************************************************/
+
+#ifndef ADAPT_H
+#define ADAPT_H
+
+#include <stdint.h>
+
+#include "sampler.h"
+
+/* the DHT11 wants a second between readings, a minute is the longest to
+   go without one */
+#define DHT_ADAPT_MIN_US 1000000
+#define DHT_ADAPT_MAX_US 60000000
+
+/* failures in a row double the retry backoff that often at most */
+#define DHT_ADAPT_BACKOFF_MAX 5
+
+/* a change that large (tenths) since the last reading is a transient.
+   The DHT11 resolves a degree and a percent */
+#define DHT_ADAPT_TRANSIENT_T 10
+#define DHT_ADAPT_TRANSIENT_H 20
+
+/* the filter window and threshold in scaled MADs (times 1.4826, the MAD
+   of normal noise being 0.6745 sigma). The floors keep a window of equal
+   values (a MAD of 0) from rejecting any change of a digit */
+#define DHT_HAMPEL_WINDOW 7
+#define DHT_HAMPEL_K 3
+#define DHT_HAMPEL_FLOOR_T 15
+#define DHT_HAMPEL_FLOOR_H 40
+
+/* the last values of a channel */
+struct dht_hampel {
+  int window[DHT_HAMPEL_WINDOW];
+  unsigned int count;
+  unsigned int next;
+};
+
+struct dht_adapt_sensor {
+  struct dht_hampel temperature;
+  struct dht_hampel humidity;
+
+  /* what was passed on last */
+  int last_temperature;
+  int last_humidity;
+  int have_last;
+
+  unsigned int failures;
+};
+
+struct dht_adapt {
+  struct dht_adapt_sensor sensors[DHT_SAMPLER_MAX_GPIO];
+  unsigned int seed;
+
+  /* by reading: passed on, replaced as glitches, failed */
+  unsigned long valid;
+  unsigned long glitches;
+  unsigned long failed;
+};
+
+void dht_adapt_init(struct dht_adapt *adapt, unsigned int seed);
+
+/* 'value' unless it is an outlier among the last ones, their median then.
+   The window takes 'value' either way */
+int dht_hampel_filter(struct dht_hampel *filter, int value, int floor);
+
+/* to be called by the sampler's callback with every reading, sets the
+   sensor's next interval. Returns 1 if 'reading' is to be passed on,
+   possibly with filtered values, 0 if it failed */
+int dht_adapt_reading(struct dht_adapt *adapt,
+                      struct dht_sensor *sensor,
+                      int status,
+                      struct dht_reading *reading);
+
+#endif
@@ -0,0 +1,334 @@
+/******************************************************************************/
+/* File: bench_adapt.c
+   Author: N.Kim
+   Abstract: Adaptive against fixed sampling of simulated DHT11 sensors
+
+   Description:
+     The simulated sensors answer with what a room would show at the time
+     asked: a slow daily swing, now and then a door opening (a drop of a
+     few degrees and a rise in humidity for some minutes), quantized to
+     the DHT11's degree and percent. Some answers lose edges or bits,
+     some are glitches passing the checksum (a flipped bit of the values,
+     checksum fixed).
+
+     Runs the sampler for the time given once the way monitor's loop reads
+     (settling every time, a reading every 3 seconds or so, no filter) and
+     once adaptive (see adapt.h). Reports for both: readings, how many
+     were passed on, glitches among them, sampler wakeups and CPU time per
+     reading passed on, and how far the values passed on were off the
+     room on average.
+
+     bench_adapt [-g sensors] [-t hours] [-s seed] */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sampler.h"
+#include "adapt.h"
+#include "dht_sim.h"
+
+/* a door opening: down and up in that many seconds, back over minutes */
+#define EVENT_MEAN_S 1800
+#define EVENT_RAMP_S 60
+#define EVENT_HOLD_S 120
+#define EVENT_DECAY_S 300
+#define EVENT_T (-40)
+#define EVENT_H 100
+
+#define MAX_EVENTS 1024
+
+/* how often an answer is a glitch */
+#define GLITCH_RATE 0.01
+
+/* the period of monitor's loop: settling, start signal, capture, sleep */
+#define FIXED_PERIOD_US \
+  (DHT_SETTLE_US + DHT_START_US + DHT_CAPTURE_US + DHT_INTERVAL_US)
+
+struct room {
+  double phase;
+  unsigned int num_events;
+  double events[MAX_EVENTS];
+};
+
+struct bench {
+  struct room rooms[DHT_SAMPLER_MAX_GPIO];
+  struct dht_sim_params params;
+
+  /* simulated seconds since the start, the tick they were taken at */
+  double clock;
+  uint32_t tick;
+
+  /* the answers being sent, and the values of the room in them */
+  struct dht_sim_reading answers[DHT_SAMPLER_MAX_GPIO];
+  int sent_t[DHT_SAMPLER_MAX_GPIO];
+  int sent_h[DHT_SAMPLER_MAX_GPIO];
+  int glitched[DHT_SAMPLER_MAX_GPIO];
+};
+
+struct run {
+  struct bench *bench;
+  struct dht_adapt *adapt;
+
+  /* what was passed on last, by pin */
+  int have[DHT_SAMPLER_MAX_GPIO];
+  int estimate_t[DHT_SAMPLER_MAX_GPIO];
+  int estimate_h[DHT_SAMPLER_MAX_GPIO];
+
+  unsigned long readings;
+  unsigned long passed;
+  unsigned long glitches;
+
+  double error_t;
+  double error_h;
+  unsigned long errors;
+};
+
+/******************************************************************************/
+
+static double cpu_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static double event_shape(double since)
+{
+  /* 0 to 1 and back */
+  if (since < 0) return 0;
+  if (since < EVENT_RAMP_S) return since / EVENT_RAMP_S;
+  if (since < EVENT_RAMP_S + EVENT_HOLD_S) return 1;
+
+  return exp(-(since - EVENT_RAMP_S - EVENT_HOLD_S) / EVENT_DECAY_S);
+}
+
+/******************************************************************************/
+
+static void room_at(const struct room *room, double t, int *temp, int *hum)
+{
+  /* in tenths, to the DHT11's whole degrees and percents */
+  double event = 0;
+
+  for (unsigned int i = 0; i < room->num_events; ++i)
+    event += event_shape(t - room->events[i]);
+
+  const double swing = sin(2 * M_PI * t / 86400 + room->phase);
+  const double temperature = 220 + 20 * swing + EVENT_T * event;
+  const double humidity = 550 - 50 * swing + EVENT_H * event;
+
+  *temp = lround(temperature / 10) * 10;
+  *hum = lround(humidity / 10) * 10;
+}
+
+/******************************************************************************/
+
+static const struct dht_sim_reading *answer(unsigned int gpio,
+                                            uint32_t tick,
+                                            void *data)
+{
+  struct bench *bench = data;
+  const double t = bench->clock + (uint32_t)(tick - bench->tick) / 1e6;
+  uint8_t frame[DHT_SIM_FRAME_LENGTH];
+
+  room_at(&bench->rooms[gpio], t, &bench->sent_t[gpio], &bench->sent_h[gpio]);
+
+  frame[0] = bench->sent_h[gpio] / 10;
+  frame[1] = 0;
+  frame[2] = bench->sent_t[gpio] / 10;
+  frame[3] = 0;
+
+  /* a bit of the values flipped, yet a valid checksum */
+  bench->glitched[gpio] = rand() < GLITCH_RATE * RAND_MAX;
+
+  if (bench->glitched[gpio]) frame[rand() % 4] ^= 1 << (rand() % 8);
+
+  frame[4] = dht_checksum(frame);
+
+  dht_sim_synthesize(frame, &bench->params, &bench->answers[gpio]);
+  return &bench->answers[gpio];
+}
+
+/******************************************************************************/
+
+static void on_sample(struct dht_sensor *sensor,
+                      int status,
+                      const struct dht_reading *reading,
+                      void *data)
+{
+  struct run *run = data;
+  struct dht_reading r = *reading;
+  const unsigned int gpio = sensor->gpio;
+
+  run->readings++;
+
+  if (run->adapt)
+  {
+    if (!dht_adapt_reading(run->adapt, sensor, status, &r)) return;
+  }
+  else if (status != DHT_DECODE_OK) return;
+
+  run->passed++;
+
+  /* a glitch that made it, rather than one filtered or too small to
+     tell from the room (a flipped low bit) */
+  if (run->bench->glitched[gpio] &&
+      (abs(r.temperature - run->bench->sent_t[gpio]) > DHT_HAMPEL_FLOOR_T ||
+       abs((int)r.humidity - run->bench->sent_h[gpio]) > DHT_HAMPEL_FLOOR_H))
+    run->glitches++;
+
+  run->have[gpio] = 1;
+  run->estimate_t[gpio] = r.temperature;
+  run->estimate_h[gpio] = r.humidity;
+}
+
+/******************************************************************************/
+
+static void run_mode(struct bench *bench,
+                     const unsigned int *pins,
+                     unsigned int num_pins,
+                     double seconds,
+                     int adaptive)
+{
+  struct dht_sampler sampler;
+  struct dht_adapt adapt;
+  struct run run;
+
+  memset(&run, 0, sizeof(run));
+  run.bench = bench;
+
+  if (adaptive)
+  {
+    dht_adapt_init(&adapt, 1);
+    run.adapt = &adapt;
+  }
+
+  dht_gpio_sim.init();
+  dht_sim_source(answer, bench);
+
+  bench->clock = 0;
+  bench->tick = dht_gpio_sim.tick();
+
+  dht_sampler_init(&sampler, &dht_gpio_sim, pins, num_pins,
+                   adaptive ? DHT_ADAPT_MIN_US : FIXED_PERIOD_US,
+                   DHT_SETTLE_US, on_sample, &run);
+
+  sampler.settle_always = !adaptive;
+
+  double check = 1, cpu = 0;
+
+  while (bench->clock < seconds)
+  {
+    /* the sampler's (and simulation's) time, not the bench's */
+    const double start = cpu_time();
+
+    dht_sampler_step(&sampler);
+    cpu += cpu_time() - start;
+
+    const uint32_t tick = dht_gpio_sim.tick();
+
+    bench->clock += (uint32_t)(tick - bench->tick) / 1e6;
+    bench->tick = tick;
+
+    /* how far off the values passed on are, every second */
+    for (; check <= bench->clock; check += 1)
+    {
+      for (unsigned int i = 0; i < num_pins; ++i)
+      {
+        const unsigned int gpio = pins[i];
+        int t, h;
+
+        if (!run.have[gpio]) continue;
+
+        room_at(&bench->rooms[gpio], check, &t, &h);
+        run.error_t += abs(run.estimate_t[gpio] - t);
+        run.error_h += abs(run.estimate_h[gpio] - h);
+        run.errors++;
+      }
+    }
+  }
+
+  const double passed = run.passed ? run.passed : 1;
+  const double sensor_hours = seconds / 3600 * num_pins;
+
+  printf("%-9s %7lu readings, %7lu passed on, %4lu glitches among them, "
+         "off by %.2f C / %.2f %% on average\n"
+         "          per reading passed on: %5.2f wakeups, %5.1f us CPU; "
+         "per sensor and hour: %6.1f readings, %7.1f wakeups, %6.1f ms "
+         "CPU\n", adaptive ? "adaptive:" : "fixed:", run.readings,
+         run.passed, run.glitches, run.error_t / run.errors / 10,
+         run.error_h / run.errors / 10, sampler.sleeps / passed,
+         cpu / passed * 1e6, run.readings / sensor_hours,
+         sampler.sleeps / sensor_hours, cpu / sensor_hours * 1e3);
+
+  dht_sampler_free(&sampler);
+  dht_sim_source(NULL, NULL);
+  dht_gpio_sim.terminate();
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  static struct bench bench;
+  unsigned int pins[DHT_SAMPLER_MAX_GPIO];
+  int sensors = 8, hours = 24, seed = 1, opt;
+
+  while ((opt = getopt(argc, argv, "g:t:s:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'g': sensors = atoi(optarg); break;
+      case 't': hours = atoi(optarg); break;
+      case 's': seed = atoi(optarg); break;
+      default: sensors = 0; break;
+    }
+  }
+
+  if (optind != argc || sensors < 1 || sensors > DHT_SAMPLER_MAX_GPIO - 2 ||
+      hours < 1)
+  {
+    fprintf(stderr, "usage: %s [-g sensors] [-t hours] [-s seed]\n",
+            argv[0]);
+    return 1;
+  }
+
+  const double seconds = hours * 3600.0;
+
+  /* the same rooms for both runs, the answers differ */
+  srand(seed);
+
+  for (int i = 0; i < sensors; ++i)
+  {
+    struct room *room = &bench.rooms[2 + i];
+    double t = 0;
+
+    pins[i] = 2 + i;
+    room->phase = rand() % 628 / 100.0;
+
+    /* a door every half hour or so */
+    while (room->num_events < MAX_EVENTS &&
+           (t -= EVENT_MEAN_S * log((rand() + 1.0) / (RAND_MAX + 2.0))) <
+           seconds)
+      room->events[room->num_events++] = t;
+  }
+
+  bench.params = (struct dht_sim_params){ 3, 0, 0.002, 0.02 };
+
+  printf("%d sensors, %d hours simulated\n", sensors, hours);
+
+  srand(seed);
+  run_mode(&bench, pins, sensors, seconds, 0);
+
+  srand(seed);
+  run_mode(&bench, pins, sensors, seconds, 1);
+  return 0;
+}
@@ -0,0 +1,202 @@
+/******************************************************************************/
+/* File: bench_decode.c
+   Author: N.Kim
+   Abstract: Throughput of the bulk DHT11 frame decoder
+
+   Description:
+     Takes the data pulses of every complete reading of the traces and
+     decodes them over and over, once with dht_decode() and once bit by
+     bit with branches per pulse, the way the reader used to (with the
+     same rules though). Reports frames/sec of both and how the frames
+     turned out.
+
+     bench_decode [-n repeat] trace... */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dht_decode.h"
+#include "dht_sim.h"
+
+/* the edges before the data bits: the reference, the spike and the two
+   pulses of the response */
+#define LEADING_EDGES 4
+
+/* keeps the compiler from dropping the decoding */
+static volatile unsigned long sink;
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static int decode_bit(int low, int high)
+{
+  if (low < DHT_PULSE_MIN_US || low > DHT_PULSE_MAX_US) return -1;
+  else if (high < DHT_PULSE_MIN_US || high > DHT_PULSE_MAX_US) return -1;
+  else if (high > DHT_BIT_THRESHOLD_US) return 1;
+  else return 0;
+}
+
+/******************************************************************************/
+
+static int decode_per_bit(const uint8_t *pulses, uint8_t *frame)
+{
+  for (int i = 0; i < DHT_FRAME_LENGTH; ++i)
+  {
+    frame[i] = 0;
+
+    for (int j = 0; j < 8; ++j)
+    {
+      const int bit = decode_bit(pulses[16 * i + 2 * j],
+                                 pulses[16 * i + 2 * j + 1]);
+
+      if (bit < 0) return DHT_DECODE_BAD_PULSE;
+
+      frame[i] |= bit << (7 - j);
+    }
+  }
+
+  return dht_checksum(frame) == frame[4] ? DHT_DECODE_OK : DHT_DECODE_CHECKSUM;
+}
+
+/******************************************************************************/
+
+static size_t extract_pulses(const struct dht_sim_reading *readings,
+                             size_t num,
+                             uint8_t *pulses)
+{
+  size_t n = 0;
+
+  for (size_t i = 0; i < num; ++i)
+  {
+    const struct dht_sim_reading *r = &readings[i];
+
+    if (r->num_edges < LEADING_EDGES + 2 * DHT_FRAME_BITS) continue;
+
+    for (unsigned int j = 0; j < 2 * DHT_FRAME_BITS; ++j)
+    {
+      const uint32_t width = r->time_us[LEADING_EDGES + j] -
+        r->time_us[LEADING_EDGES + j - 1];
+
+      pulses[n * 2 * DHT_FRAME_BITS + j] = width > 255 ? 255 : width;
+    }
+
+    n++;
+  }
+
+  return n;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  struct dht_sim_reading *all = NULL;
+  size_t num = 0;
+  int repeat = 10000, opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': repeat = atoi(optarg); break;
+      default: repeat = 0; break;
+    }
+  }
+
+  if (optind >= argc || repeat < 1)
+  {
+    fprintf(stderr, "usage: %s [-n repeat] trace...\n", argv[0]);
+    return 1;
+  }
+
+  for (int i = optind; i < argc; ++i)
+  {
+    struct dht_sim_reading *readings;
+    size_t n;
+
+    if (dht_sim_load(argv[i], &readings, &n) < 0)
+    {
+      perror(argv[i]);
+      return 1;
+    }
+
+    all = realloc(all, (num + n) * sizeof(*all));
+    memcpy(all + num, readings, n * sizeof(*all));
+    num += n;
+    free(readings);
+  }
+
+  uint8_t *pulses = malloc(num * 2 * DHT_FRAME_BITS + 1);
+  const size_t frames = extract_pulses(all, num, pulses);
+  unsigned long status[3] = { 0 }, mismatches = 0;
+  struct dht_reading reading;
+  uint8_t frame[DHT_FRAME_LENGTH];
+
+  if (frames == 0)
+  {
+    fprintf(stderr, "No complete readings\n");
+    return 1;
+  }
+
+  /* both have to agree before timing them */
+  for (size_t i = 0; i < frames; ++i)
+  {
+    const uint8_t *p = pulses + i * 2 * DHT_FRAME_BITS;
+    const int bulk = dht_decode(p, &reading);
+
+    status[-bulk]++;
+
+    if (bulk != decode_per_bit(p, frame) ||
+        (bulk != DHT_DECODE_BAD_PULSE &&
+         memcmp(frame, reading.frame, DHT_FRAME_LENGTH) != 0))
+      mismatches++;
+  }
+
+  printf("%zu frames of %zu readings: %lu ok, %lu bad pulses, "
+         "%lu bad checksums, %lu mismatches\n", frames, num, status[0],
+         status[1], status[2], mismatches);
+
+  unsigned long sum = 0;
+  double start = now();
+
+  for (int r = 0; r < repeat; ++r)
+    for (size_t i = 0; i < frames; ++i)
+      sum += dht_decode(pulses + i * 2 * DHT_FRAME_BITS, &reading) +
+        reading.frame[0];
+
+  const double bulk = now() - start;
+
+  start = now();
+
+  for (int r = 0; r < repeat; ++r)
+    for (size_t i = 0; i < frames; ++i)
+      sum += decode_per_bit(pulses + i * 2 * DHT_FRAME_BITS, frame) +
+        frame[0];
+
+  const double per_bit = now() - start;
+  const double total = (double)frames * repeat;
+
+  printf("bulk:    %6.1f M frames/s, %5.1f ns/frame\n",
+         total / bulk / 1e6, bulk / total * 1e9);
+  printf("per bit: %6.1f M frames/s, %5.1f ns/frame\n",
+         total / per_bit / 1e6, per_bit / total * 1e9);
+  sink = sum;
+
+  free(pulses);
+  free(all);
+  return mismatches ? 1 : 0;
+}
@@ -0,0 +1,83 @@
+/******************************************************************************/
+/* File: dht_decode.c
+   Author: N.Kim
+   Abstract: Bulk decoder of DHT11 frames
+
+   Description:
+     The pulse widths are compared eight at a time within 64 bit words
+     (four bits, i.e. low/high pairs, per word), a multiplication then
+     gathers the results of the high pulses into a nibble. There is no
+     branch per bit, glitches of all 80 pulses are checked once at the
+     end. */
+
+/******************************************************************************/
+
+#include <string.h>
+
+#include "dht_decode.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the pulses are loaded as little endian words"
+#endif
+
+#if DHT_PULSE_MAX_US > 127 || DHT_BIT_THRESHOLD_US > 127
+#error "the byte wise comparison takes limits below 128"
+#endif
+
+#define ONES 0x0101010101010101ULL
+#define TOP_BITS (0x80 * ONES)
+
+/* the top bits of the high pulses, odd bytes of a word */
+#define HIGH_PULSES 0x8000800080008000ULL
+
+/* moves the bits 0, 16, 32 and 48 to 51, 50, 49 and 48, without carries
+   since no two products overlap */
+#define GATHER ((1ULL << 51) | (1ULL << 34) | (1ULL << 17) | 1ULL)
+
+/******************************************************************************/
+
+static inline uint64_t greater(uint64_t x, unsigned int n)
+{
+  /* the top bit of every byte of 'x' above 'n'. Bytes below 128 cannot
+     carry into their neighbours, the others are greater anyway */
+  return (((x & ~TOP_BITS) + (127 - n) * ONES) | x) & TOP_BITS;
+}
+
+/******************************************************************************/
+
+enum dht_decode_status dht_decode(const uint8_t *pulses,
+                                  struct dht_reading *reading)
+{
+  uint64_t bad = 0;
+
+  for (unsigned int i = 0; i < DHT_FRAME_LENGTH; ++i, pulses += 16)
+  {
+    uint64_t w[2];
+    unsigned int byte = 0;
+
+    memcpy(w, pulses, sizeof(w));
+
+    for (unsigned int j = 0; j < 2; ++j)
+    {
+      const uint64_t ones = greater(w[j], DHT_BIT_THRESHOLD_US) & HIGH_PULSES;
+
+      byte = byte << 4 | ((ones >> 15) * GATHER >> 48 & 0xf);
+      bad |= greater(w[j], DHT_PULSE_MAX_US) |
+        (~greater(w[j], DHT_PULSE_MIN_US - 1) & TOP_BITS);
+    }
+
+    reading->frame[i] = byte;
+  }
+
+  const uint8_t *frame = reading->frame;
+  const int tenths = frame[3] & 0x7f;
+
+  reading->humidity = frame[0] * 10 + frame[1] % 10;
+  reading->temperature = frame[3] & 0x80 ?
+    -(frame[2] * 10 + tenths % 10) : frame[2] * 10 + tenths % 10;
+
+  if (bad) return DHT_DECODE_BAD_PULSE;
+
+  return dht_checksum(frame) == frame[4] ?
+    DHT_DECODE_OK : DHT_DECODE_CHECKSUM;
+}
@@ -0,0 +1,54 @@
+/******************************************************************************/
+/* File: dht_decode.h
+   Author: N.Kim
+   Abstract: Bulk decoder of DHT11 frames */
+/******************************************************************************/
+
+#ifndef DHT_DECODE_H
+#define DHT_DECODE_H
+
+#include <stdint.h>
+
+/* humidity high/low, temperature high/low, checksum */
+#define DHT_FRAME_LENGTH 5
+#define DHT_FRAME_BITS (8 * DHT_FRAME_LENGTH)
+
+/* a bit is a constant low pulse followed by a high pulse of 26 us (0) or
+   70 us (1), everything longer than that is a one */
+#define DHT_BIT_THRESHOLD_US 48
+
+/* pulses outside of this range are glitches rather than bits */
+#define DHT_PULSE_MIN_US 11
+#define DHT_PULSE_MAX_US 99
+
+enum dht_decode_status {
+  DHT_DECODE_OK = 0,
+  DHT_DECODE_BAD_PULSE = -1,
+  DHT_DECODE_CHECKSUM = -2
+};
+
+struct dht_reading {
+  uint8_t frame[DHT_FRAME_LENGTH];
+
+  /* in tenths, i.e. 215 is 21.5 C. The DHT11 sends the fractional parts
+     in the low bytes, the top bit of the temperature's one is the sign */
+  int temperature;
+  unsigned int humidity;
+};
+
+/* 'pulses' are the 2 * DHT_FRAME_BITS pulse widths (in microseconds,
+   saturated at 255) of the data bits: low, high, low, high... The high
+   pulses are split at the threshold, eight at a time, and packed into
+   the frame. Any pulse outside of DHT_PULSE_MIN_US..DHT_PULSE_MAX_US
+   fails the frame. The reading is filled in even if the checksum does
+   not match */
+enum dht_decode_status dht_decode(const uint8_t *pulses,
+                                  struct dht_reading *reading);
+
+/* checksum of the first four bytes of a frame */
+static inline uint8_t dht_checksum(const uint8_t *frame)
+{
+  return frame[0] + frame[1] + frame[2] + frame[3];
+}
+
+#endif
@@ -0,0 +1,74 @@
+/******************************************************************************/
+/* File: dht_gpio.h
+   Author: N.Kim
+   Abstract: GPIO access of the DHT11 reader with pigpio and simulated
+             backends */
+/******************************************************************************/
+
+#ifndef DHT_GPIO_H
+#define DHT_GPIO_H
+
+#include <stdint.h>
+
+enum dht_gpio_mode {
+  DHT_GPIO_INPUT,
+  DHT_GPIO_OUTPUT
+};
+
+enum dht_gpio_pull {
+  DHT_GPIO_PULL_OFF,
+  DHT_GPIO_PULL_DOWN,
+  DHT_GPIO_PULL_UP
+};
+
+/* the level of 'gpio' changed at 'tick' (microseconds, wrapping), the
+   same as pigpio's gpioAlertFunc_t */
+typedef void (*dht_gpio_alert_cb)(int gpio, int level, uint32_t tick);
+
+/* a sample read from a notification pipe, the layout of pigpio's
+   gpioReport_t. 'level' holds GPIOs 0-31, one bit each. Reports with
+   'flags' set (keep-alives, watchdogs) carry no level change */
+struct dht_gpio_report {
+  uint16_t seqno;
+  uint16_t flags;
+  uint32_t tick;
+  uint32_t level;
+};
+
+/* the pigpio calls the reader relies on. All but 'init' return 0 or a
+   negative error code */
+struct dht_gpio_backend {
+  const char *name;
+
+  int (*init)(void);
+  void (*terminate)(void);
+
+  int (*set_mode)(unsigned int gpio, enum dht_gpio_mode mode);
+  int (*set_pull)(unsigned int gpio, enum dht_gpio_pull pull);
+  int (*write)(unsigned int gpio, int level);
+
+  /* NULL stops the alerts */
+  int (*set_alert)(unsigned int gpio, dht_gpio_alert_cb cb);
+
+  /* alerts keep coming in while sleeping */
+  void (*sleep)(unsigned int us);
+  uint32_t (*tick)(void);
+
+  /* level changes of the GPIOs in 'bits' as a stream of struct
+     dht_gpio_report, read in batches from the returned non-blocking
+     descriptor rather than a callback per edge. Returns -1 on errors */
+  int (*notify_open)(uint32_t bits);
+  void (*notify_close)(int fd);
+
+  /* at most 'timeout_us' until there are reports to read, returns 0 on
+     timeouts. Time passes meanwhile, the same as with 'sleep' */
+  int (*notify_wait)(int fd, unsigned int timeout_us);
+};
+
+/* the real thing, needs root and a Raspberry Pi */
+extern const struct dht_gpio_backend dht_gpio_pigpio;
+
+/* replays edge traces on virtual time, see dht_sim.h */
+extern const struct dht_gpio_backend dht_gpio_sim;
+
+#endif
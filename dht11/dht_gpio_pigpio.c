@@ -0,0 +1,157 @@
+/******************************************************************************/
+/* File: dht_gpio_pigpio.c
+   Author: N.Kim
+   Abstract: pigpio backend of the DHT11 GPIO access */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pigpio.h>
+
+#include "dht_gpio.h"
+
+/* notification handles by the descriptor of their pipe */
+static struct {
+  int fd;
+  int handle;
+} notifies[PI_NOTIFY_SLOTS];
+
+static int num_notifies = 0;
+
+/******************************************************************************/
+
+static int pig_init(void)
+{
+  return gpioInitialise() < 0 ? -1 : 0;
+}
+
+/******************************************************************************/
+
+static void pig_terminate(void)
+{
+  gpioTerminate();
+}
+
+/******************************************************************************/
+
+static int pig_set_mode(unsigned int gpio, enum dht_gpio_mode mode)
+{
+  return gpioSetMode(gpio, mode == DHT_GPIO_OUTPUT ? PI_OUTPUT : PI_INPUT);
+}
+
+/******************************************************************************/
+
+static int pig_set_pull(unsigned int gpio, enum dht_gpio_pull pull)
+{
+  static const unsigned int pud[] = {
+    [DHT_GPIO_PULL_OFF] = PI_PUD_OFF,
+    [DHT_GPIO_PULL_DOWN] = PI_PUD_DOWN,
+    [DHT_GPIO_PULL_UP] = PI_PUD_UP
+  };
+
+  return gpioSetPullUpDown(gpio, pud[pull]);
+}
+
+/******************************************************************************/
+
+static int pig_write(unsigned int gpio, int level)
+{
+  return gpioWrite(gpio, level);
+}
+
+/******************************************************************************/
+
+static int pig_set_alert(unsigned int gpio, dht_gpio_alert_cb cb)
+{
+  return gpioSetAlertFunc(gpio, cb);
+}
+
+/******************************************************************************/
+
+static void pig_sleep(unsigned int us)
+{
+  gpioSleep(PI_TIME_RELATIVE, us / 1000000, us % 1000000);
+}
+
+/******************************************************************************/
+
+static uint32_t pig_tick(void)
+{
+  return gpioTick();
+}
+
+/******************************************************************************/
+
+static int pig_notify_open(uint32_t bits)
+{
+  char path[32];
+  int handle, fd;
+
+  if (num_notifies == PI_NOTIFY_SLOTS) return -1;
+
+  /* pigpio writes the reports into /dev/pigpio<handle> */
+  if ((handle = gpioNotifyOpen()) < 0) return -1;
+
+  snprintf(path, sizeof(path), "/dev/pigpio%d", handle);
+
+  if ((fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+  {
+    gpioNotifyClose(handle);
+    return -1;
+  }
+
+  if (gpioNotifyBegin(handle, bits) != 0)
+  {
+    close(fd);
+    gpioNotifyClose(handle);
+    return -1;
+  }
+
+  notifies[num_notifies].fd = fd;
+  notifies[num_notifies++].handle = handle;
+  return fd;
+}
+
+/******************************************************************************/
+
+static void pig_notify_close(int fd)
+{
+  for (int i = 0; i < num_notifies; ++i)
+  {
+    if (notifies[i].fd != fd) continue;
+
+    gpioNotifyClose(notifies[i].handle);
+    close(fd);
+
+    notifies[i] = notifies[--num_notifies];
+    return;
+  }
+}
+
+/******************************************************************************/
+
+static int pig_notify_wait(int fd, unsigned int timeout_us)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+
+  return poll(&pfd, 1, (timeout_us + 999) / 1000) > 0;
+}
+
+/******************************************************************************/
+
+const struct dht_gpio_backend dht_gpio_pigpio = {
+  .name = "pigpio",
+  .init = pig_init,
+  .terminate = pig_terminate,
+  .set_mode = pig_set_mode,
+  .set_pull = pig_set_pull,
+  .write = pig_write,
+  .set_alert = pig_set_alert,
+  .sleep = pig_sleep,
+  .tick = pig_tick,
+  .notify_open = pig_notify_open,
+  .notify_close = pig_notify_close,
+  .notify_wait = pig_notify_wait
+};
@@ -0,0 +1,518 @@
+/******************************************************************************/
+/* File: dht_sim.c
+   Author: N.Kim
+   Abstract: Simulated DHT11 sensor replaying edge traces on virtual time
+
+   Description:
+     Time only passes while the reader sleeps, the edges due by then are
+     handed to the installed alert functions right away. Thus, a reading
+     costs no more than decoding it, whatever the delays of the protocol.
+     The tick starts a minute before it wraps, like pigpio's will at some
+     point. */
+
+/******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "dht_gpio.h"
+#include "dht_sim.h"
+
+/* pigpio numbers the GPIOs of the header 0 to 53 */
+#define MAX_GPIO 54
+
+/* the sensor ignores start signals shorter than that */
+#define START_LOW_US 18000
+
+/* virtual tick at init, wraps after a minute */
+#define START_TICK ((uint32_t)-60000000)
+
+/* pulses of a clean reading, in microseconds. The reader sees the line
+   going high after the start signal, then the sensor pulling it low */
+#define RELEASE_US 35
+#define SPIKE_US 30
+#define RESPONSE_US 80
+#define BIT_LOW_US 50
+#define ZERO_US 26
+#define ONE_US 70
+
+/* range of the width of corrupted bits */
+#define CORRUPT_MIN_US 5
+#define CORRUPT_MAX_US 110
+
+#define FRAME_PREFIX "# frame:"
+
+/* pigpio's alert thread passes on the samples of a millisecond at once,
+   so does the simulated notification pipe */
+#define NOTIFY_PERIOD_US 1000
+#define NOTIFY_BATCH 256
+
+struct sim_pin {
+  enum dht_gpio_mode mode;
+  int level;
+  uint32_t low_since;
+  dht_gpio_alert_cb cb;
+
+  /* the answer being sent, if any */
+  const struct dht_sim_reading *reading;
+  unsigned int edge;
+  uint32_t start;
+};
+
+static struct {
+  struct sim_pin pins[MAX_GPIO];
+  uint32_t now;
+
+  const struct dht_sim_reading *readings;
+  size_t num_readings;
+  size_t next;
+  unsigned long answered;
+
+  /* answers the start signals instead, if set */
+  dht_sim_source_fn source;
+  void *source_data;
+
+  /* levels of GPIOs 0-31 for the reports */
+  uint32_t levels;
+
+  /* the notification pipe, if open, and the reports not yet written */
+  int notify_fds[2];
+  uint32_t notify_bits;
+  uint16_t seqno;
+  struct dht_gpio_report batch[NOTIFY_BATCH];
+  unsigned int batched;
+} sim = { .notify_fds = { -1, -1 } };
+
+/******************************************************************************/
+
+static int jitter(unsigned int amount)
+{
+  return amount ? (int)(rand() % (2 * amount + 1)) - (int)amount : 0;
+}
+
+/******************************************************************************/
+
+static int chance(double probability)
+{
+  return rand() < probability * RAND_MAX;
+}
+
+/******************************************************************************/
+
+void dht_sim_synthesize(const uint8_t *frame,
+                        const struct dht_sim_params *params,
+                        struct dht_sim_reading *reading)
+{
+  unsigned int widths[4 + 2 * 8 * DHT_SIM_FRAME_LENGTH];
+  unsigned int n = 0;
+
+  widths[n++] = SPIKE_US;
+  widths[n++] = RESPONSE_US;
+  widths[n++] = RESPONSE_US;
+
+  for (unsigned int i = 0; i < 8 * DHT_SIM_FRAME_LENGTH; ++i)
+  {
+    const int bit = frame[i / 8] >> (7 - i % 8) & 1;
+
+    widths[n++] = BIT_LOW_US;
+    widths[n++] = chance(params->corrupt) ?
+      CORRUPT_MIN_US + rand() % (CORRUPT_MAX_US - CORRUPT_MIN_US + 1) :
+      bit ? ONE_US : ZERO_US;
+  }
+
+  /* the sensor lets go of the line after the last bit */
+  widths[n++] = BIT_LOW_US;
+
+  memcpy(reading->frame, frame, DHT_SIM_FRAME_LENGTH);
+  reading->known = 1;
+
+  uint32_t t = RELEASE_US;
+  int level = 1;
+
+  reading->num_edges = 0;
+  reading->time_us[reading->num_edges] = t;
+  reading->level[reading->num_edges++] = level;
+
+  for (unsigned int i = 0; i < n; ++i)
+  {
+    const int width = widths[i] + jitter(params->jitter_us) +
+      (level ? params->skew_us : -params->skew_us);
+
+    t += width > 1 ? width : 1;
+    level ^= 1;
+
+    reading->time_us[reading->num_edges] = t;
+    reading->level[reading->num_edges++] = level;
+  }
+
+  /* a pulse too short to be noticed, i.e. two edges less */
+  if (chance(params->drop))
+  {
+    const unsigned int at = 1 + rand() % (reading->num_edges - 2);
+    const unsigned int rest = reading->num_edges - at - 2;
+
+    memmove(reading->time_us + at, reading->time_us + at + 2,
+            rest * sizeof(reading->time_us[0]));
+    memmove(reading->level + at, reading->level + at + 2, rest);
+    reading->num_edges -= 2;
+  }
+}
+
+/******************************************************************************/
+
+void dht_sim_write(FILE *f, const struct dht_sim_reading *reading)
+{
+  if (reading->known)
+  {
+    fprintf(f, FRAME_PREFIX " %02x %02x %02x %02x %02x\n",
+            reading->frame[0], reading->frame[1], reading->frame[2],
+            reading->frame[3], reading->frame[4]);
+  }
+  else fprintf(f, FRAME_PREFIX " ?\n");
+
+  for (unsigned int i = 0; i < reading->num_edges; ++i)
+    fprintf(f, "%u %u\n", reading->time_us[i], reading->level[i]);
+}
+
+/******************************************************************************/
+
+int dht_sim_load(const char *path,
+                 struct dht_sim_reading **readings,
+                 size_t *num)
+{
+  FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  struct dht_sim_reading *r = NULL;
+  size_t n = 0, cap = 0;
+  char *line = NULL;
+  size_t size = 0;
+
+  if (!f) return -1;
+
+  while (getline(&line, &size, f) >= 0)
+  {
+    const int header = strncmp(line, FRAME_PREFIX, strlen(FRAME_PREFIX)) == 0;
+    unsigned int t, level;
+
+    if (!header && (line[0] == '#' || sscanf(line, "%u %u", &t, &level) != 2))
+      continue;
+
+    /* a new reading, edges without a header start one too */
+    if (header || n == 0)
+    {
+      if (n == cap)
+      {
+        cap = cap ? 2 * cap : 256;
+        r = realloc(r, cap * sizeof(*r));
+      }
+
+      struct dht_sim_reading *reading = &r[n++];
+      unsigned int b[DHT_SIM_FRAME_LENGTH];
+
+      reading->num_edges = 0;
+      reading->known = header &&
+        sscanf(line + strlen(FRAME_PREFIX), "%x %x %x %x %x",
+               &b[0], &b[1], &b[2], &b[3], &b[4]) == DHT_SIM_FRAME_LENGTH;
+
+      for (unsigned int i = 0; i < DHT_SIM_FRAME_LENGTH; ++i)
+        reading->frame[i] = reading->known ? b[i] : 0;
+
+      if (header) continue;
+    }
+
+    struct dht_sim_reading *reading = &r[n - 1];
+
+    if (reading->num_edges == DHT_SIM_MAX_EDGES) continue;
+
+    reading->time_us[reading->num_edges] = t;
+    reading->level[reading->num_edges++] = level != 0;
+  }
+
+  free(line);
+
+  if (f != stdin) fclose(f);
+
+  *readings = r;
+  *num = n;
+  return 0;
+}
+
+/******************************************************************************/
+
+void dht_sim_play(const struct dht_sim_reading *readings, size_t num)
+{
+  sim.readings = readings;
+  sim.num_readings = num;
+  sim.next = 0;
+}
+
+/******************************************************************************/
+
+void dht_sim_source(dht_sim_source_fn source, void *data)
+{
+  sim.source = source;
+  sim.source_data = data;
+}
+
+/******************************************************************************/
+
+const struct dht_sim_reading *dht_sim_answer(unsigned int gpio)
+{
+  return gpio < MAX_GPIO ? sim.pins[gpio].reading : NULL;
+}
+
+/******************************************************************************/
+
+unsigned long dht_sim_answered(void)
+{
+  return sim.answered;
+}
+
+/******************************************************************************/
+
+static void set_level(unsigned int gpio, int level)
+{
+  sim.pins[gpio].level = level;
+
+  if (gpio >= 32) return;
+
+  sim.levels = (sim.levels & ~(1u << gpio)) | (uint32_t)level << gpio;
+}
+
+/******************************************************************************/
+
+static void flush_reports(void)
+{
+  /* a full pipe loses them, as pigpio's would */
+  if (sim.batched && sim.notify_fds[1] >= 0)
+  {
+    const ssize_t n = write(sim.notify_fds[1], sim.batch,
+                            sim.batched * sizeof(sim.batch[0]));
+    (void)n;
+  }
+
+  sim.batched = 0;
+}
+
+/******************************************************************************/
+
+static void report(unsigned int gpio, uint32_t tick)
+{
+  if (gpio >= 32 || !(sim.notify_bits & 1u << gpio)) return;
+
+  if (sim.batched == NOTIFY_BATCH) flush_reports();
+
+  sim.batch[sim.batched++] = (struct dht_gpio_report){
+    .seqno = sim.seqno++,
+    .flags = 0,
+    .tick = tick,
+    .level = sim.levels
+  };
+}
+
+/******************************************************************************/
+
+static int sim_init(void)
+{
+  memset(sim.pins, 0, sizeof(sim.pins));
+
+  for (unsigned int i = 0; i < MAX_GPIO; ++i) set_level(i, 1);
+
+  sim.now = START_TICK;
+  sim.answered = 0;
+  return 0;
+}
+
+/******************************************************************************/
+
+static void sim_terminate(void)
+{
+}
+
+/******************************************************************************/
+
+static int sim_set_mode(unsigned int gpio, enum dht_gpio_mode mode)
+{
+  if (gpio >= MAX_GPIO) return -1;
+
+  sim.pins[gpio].mode = mode;
+  return 0;
+}
+
+/******************************************************************************/
+
+static int sim_set_pull(unsigned int gpio, enum dht_gpio_pull pull)
+{
+  (void)pull;
+  return gpio < MAX_GPIO ? 0 : -1;
+}
+
+/******************************************************************************/
+
+static int sim_write(unsigned int gpio, int level)
+{
+  if (gpio >= MAX_GPIO) return -1;
+
+  struct sim_pin *pin = &sim.pins[gpio];
+
+  if (pin->mode != DHT_GPIO_OUTPUT) return 0;
+
+  if (level == 0 && pin->level != 0) pin->low_since = sim.now;
+
+  /* the end of a start signal, the sensor answers (and gives up on a
+     previous answer if still sending it) */
+  if (level != 0 && pin->level == 0 && (sim.num_readings || sim.source) &&
+      sim.now - pin->low_since >= START_LOW_US)
+  {
+    if (sim.source)
+      pin->reading = sim.source(gpio, sim.now, sim.source_data);
+    else
+    {
+      pin->reading = &sim.readings[sim.next];
+      sim.next = (sim.next + 1) % sim.num_readings;
+    }
+
+    pin->edge = 0;
+    pin->start = sim.now;
+
+    if (pin->reading) sim.answered++;
+  }
+
+  set_level(gpio, level != 0);
+  return 0;
+}
+
+/******************************************************************************/
+
+static int sim_set_alert(unsigned int gpio, dht_gpio_alert_cb cb)
+{
+  if (gpio >= MAX_GPIO) return -1;
+
+  sim.pins[gpio].cb = cb;
+  return 0;
+}
+
+/******************************************************************************/
+
+static void sim_sleep(unsigned int us)
+{
+  const uint32_t end = sim.now + us;
+
+  /* all edges due by the end, in order across the pins */
+  for (;;)
+  {
+    struct sim_pin *next = NULL;
+    uint32_t at = 0;
+
+    for (unsigned int i = 0; i < MAX_GPIO; ++i)
+    {
+      struct sim_pin *pin = &sim.pins[i];
+
+      if (!pin->reading || pin->edge == pin->reading->num_edges) continue;
+
+      const uint32_t t = pin->start + pin->reading->time_us[pin->edge];
+
+      if ((int32_t)(t - end) > 0) continue;
+
+      if (!next || (int32_t)(t - at) < 0)
+      {
+        next = pin;
+        at = t;
+      }
+    }
+
+    if (!next) break;
+
+    const unsigned int edge = next->edge++;
+
+    if ((int32_t)(at - sim.now) > 0) sim.now = at;
+
+    /* nobody listening, the edge is gone */
+    if (next->mode != DHT_GPIO_INPUT) continue;
+
+    set_level(next - sim.pins, next->reading->level[edge]);
+    report(next - sim.pins, at);
+
+    if (next->cb) next->cb(next - sim.pins, next->level, at);
+  }
+
+  sim.now = end;
+  flush_reports();
+}
+
+/******************************************************************************/
+
+static uint32_t sim_tick(void)
+{
+  return sim.now;
+}
+
+/******************************************************************************/
+
+static int sim_notify_open(uint32_t bits)
+{
+  /* a single pipe will do for the simulation */
+  if (sim.notify_fds[0] >= 0 ||
+      pipe2(sim.notify_fds, O_NONBLOCK | O_CLOEXEC) < 0)
+    return -1;
+
+  sim.notify_bits = bits;
+  sim.batched = 0;
+  return sim.notify_fds[0];
+}
+
+/******************************************************************************/
+
+static void sim_notify_close(int fd)
+{
+  if (fd < 0 || fd != sim.notify_fds[0]) return;
+
+  close(sim.notify_fds[0]);
+  close(sim.notify_fds[1]);
+
+  sim.notify_fds[0] = sim.notify_fds[1] = -1;
+  sim.notify_bits = 0;
+}
+
+/******************************************************************************/
+
+static int sim_notify_wait(int fd, unsigned int timeout_us)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  unsigned int waited = 0;
+
+  /* a period at a time, until something has been written */
+  while (poll(&pfd, 1, 0) == 0)
+  {
+    if (waited >= timeout_us) return 0;
+
+    const unsigned int step = timeout_us - waited < NOTIFY_PERIOD_US ?
+      timeout_us - waited : NOTIFY_PERIOD_US;
+
+    sim_sleep(step);
+    waited += step;
+  }
+
+  return 1;
+}
+
+/******************************************************************************/
+
+const struct dht_gpio_backend dht_gpio_sim = {
+  .name = "sim",
+  .init = sim_init,
+  .terminate = sim_terminate,
+  .set_mode = sim_set_mode,
+  .set_pull = sim_set_pull,
+  .write = sim_write,
+  .set_alert = sim_set_alert,
+  .sleep = sim_sleep,
+  .tick = sim_tick,
+  .notify_open = sim_notify_open,
+  .notify_close = sim_notify_close,
+  .notify_wait = sim_notify_wait
+};
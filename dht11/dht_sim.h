@@ -0,0 +1,82 @@
+/******************************************************************************/
+/* File: dht_sim.h
+   Author: N.Kim
+   Abstract: Simulated DHT11 sensor replaying edge traces on virtual time */
+/******************************************************************************/
+
+#ifndef DHT_SIM_H
+#define DHT_SIM_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* a clean reading has 85 edges, leave room for glitches */
+#define DHT_SIM_MAX_EDGES 128
+
+/* the frame as sent: humidity high/low, temperature high/low, checksum */
+#define DHT_SIM_FRAME_LENGTH 5
+
+/* one answer of the sensor to a start signal: the edges as the reader
+   sees them, timed in microseconds since the host released the line.
+   Traces are text files, a reading starts with its frame ('?' if it is
+   not known, e.g. recorded from a sensor) followed by its edges:
+
+     # frame: 2d 00 16 04 47
+     35 1
+     65 0
+     ... */
+struct dht_sim_reading {
+  uint8_t frame[DHT_SIM_FRAME_LENGTH];
+  int known;
+
+  unsigned int num_edges;
+  uint32_t time_us[DHT_SIM_MAX_EDGES];
+  uint8_t level[DHT_SIM_MAX_EDGES];
+};
+
+/* how far synthetic readings are off a clean one */
+struct dht_sim_params {
+  unsigned int jitter_us;   /* every pulse is off by up to that */
+  int skew_us;              /* high pulses longer, low ones shorter by that,
+                               e.g. slow edges on long wires */
+  double corrupt;           /* probability of a bit having a random width */
+  double drop;              /* probability of a reading losing an edge */
+};
+
+/* the edges of 'frame', randomized as asked for */
+void dht_sim_synthesize(const uint8_t *frame,
+                        const struct dht_sim_params *params,
+                        struct dht_sim_reading *reading);
+
+/* appends a reading to a trace */
+void dht_sim_write(FILE *f, const struct dht_sim_reading *reading);
+
+/* reads a trace, "-" is stdin. Returns -1 if the file cannot be read,
+   '*readings' is to be freed */
+int dht_sim_load(const char *path,
+                 struct dht_sim_reading **readings,
+                 size_t *num);
+
+/* sensors on any pin answer start signals (at least 18 ms low, then
+   high) with these readings in turn, starting over at the end. The
+   readings are not copied */
+void dht_sim_play(const struct dht_sim_reading *readings, size_t num);
+
+/* rather than the readings of a trace, the sensor on 'gpio' answers a
+   start signal at 'tick' with what this returns (NULL for no answer).
+   The reading is to stay as it is until the next start signal of the
+   pin. NULL goes back to the trace */
+typedef const struct dht_sim_reading *(*dht_sim_source_fn)(unsigned int gpio,
+                                                           uint32_t tick,
+                                                           void *data);
+
+void dht_sim_source(dht_sim_source_fn source, void *data);
+
+/* the reading 'gpio' answered the last start signal with, NULL if none */
+const struct dht_sim_reading *dht_sim_answer(unsigned int gpio);
+
+/* start signals answered so far */
+unsigned long dht_sim_answered(void);
+
+#endif
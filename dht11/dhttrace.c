@@ -0,0 +1,419 @@
+/******************************************************************************/
+/* File: dhttrace.c
+   Author: N.Kim
+   Abstract: Generate and replay DHT11 edge traces
+
+   Description:
+     dhttrace gen [-n readings] [-j jitter-us] [-k skew-us] [-c corrupt%]
+                  [-d drop%] [-s seed]
+       writes a trace of random but plausible readings to stdout, see
+       dht_sim.h. Every pulse is off by up to 'jitter-us', high pulses
+       are 'skew-us' longer (and low ones shorter), 'corrupt' percent of
+       the bits get a random width and 'drop' percent of the readings
+       lose a pulse.
+
+     dhttrace replay [-n repeat] [-p] [-v] trace...
+       runs the reader (start signal, capture, checks, decoding) against
+       the simulated sensor answering with the readings of the traces, as
+       fast as possible. Reports readings/sec and how many of the
+       readings came out right, got rejected (timeouts, bad pulses), had
+       a bad checksum or passed the checksum with wrong values. -p
+       captures from the notification pipe rather than by callbacks,
+       edges per wakeup tell how well that batches.
+
+     dhttrace sample [-g sensors] [-i interval-ms] [-S settle-ms]
+                     [-t seconds] [-v] trace...
+       reads 'sensors' simulated sensors on GPIO 2 onwards with the
+       sampler (see sampler.h) for 'seconds' of simulated time, a reading
+       of each every 'interval-ms' after settling for 'settle-ms'. The
+       sensors answer with the readings of the traces in turn. Reports
+       readings/sec in total and per sensor, against one sensor at a time,
+       and how the readings came out */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sensor.h"
+#include "sampler.h"
+#include "dht_sim.h"
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static void random_frame(uint8_t *frame)
+{
+  /* the DHT11 range: 20-90% and 0-50 C, some send tenths of a degree */
+  frame[0] = 20 + rand() % 71;
+  frame[1] = 0;
+  frame[2] = rand() % 51;
+  frame[3] = rand() % 4 ? 0 : rand() % 10;
+  frame[4] = frame[0] + frame[1] + frame[2] + frame[3];
+}
+
+/******************************************************************************/
+
+static int run_gen(int argc, char **argv)
+{
+  struct dht_sim_params params = { 0, 0, 0, 0 };
+  struct dht_sim_reading reading;
+  int count = 100, opt;
+
+  while ((opt = getopt(argc, argv, "n:j:k:c:d:s:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': count = atoi(optarg); break;
+      case 'j': params.jitter_us = atoi(optarg); break;
+      case 'k': params.skew_us = atoi(optarg); break;
+      case 'c': params.corrupt = atof(optarg) / 100; break;
+      case 'd': params.drop = atof(optarg) / 100; break;
+      case 's': srand(atoi(optarg)); break;
+      default: return -1;
+    }
+  }
+
+  if (count < 1) return -1;
+
+  printf("# dht11 edge trace, %d readings, jitter %u us, skew %d us, "
+         "corrupt %.2f%%, drop %.2f%%\n", count, params.jitter_us,
+         params.skew_us, params.corrupt * 100, params.drop * 100);
+
+  for (int i = 0; i < count; ++i)
+  {
+    uint8_t frame[DHT_SIM_FRAME_LENGTH];
+
+    random_frame(frame);
+    dht_sim_synthesize(frame, &params, &reading);
+    dht_sim_write(stdout, &reading);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+struct outcome {
+  unsigned long readings;
+  unsigned long ok;
+  unsigned long timeouts;
+  unsigned long rejected;
+  unsigned long checksum;
+  unsigned long wrong;
+};
+
+/******************************************************************************/
+
+static void judge(struct outcome *out,
+                  int status,
+                  const struct dht_reading *reading,
+                  const struct dht_sim_reading *sent,
+                  int verbose)
+{
+  const uint8_t *frame = reading->frame;
+
+  if (status == DHT_DECODE_BAD_PULSE) out->rejected++;
+  else if (status == DHT_DECODE_CHECKSUM) out->checksum++;
+  else if (sent->known &&
+           memcmp(frame, sent->frame, DHT_SIM_FRAME_LENGTH) != 0)
+  {
+    out->wrong++;
+
+    if (verbose)
+    {
+      printf("  sent %02x %02x %02x %02x %02x, got %02x %02x %02x %02x "
+             "%02x\n", sent->frame[0], sent->frame[1], sent->frame[2],
+             sent->frame[3], sent->frame[4], frame[0], frame[1], frame[2],
+             frame[3], frame[4]);
+    }
+  }
+  else out->ok++;
+}
+
+/******************************************************************************/
+
+static void read_one(struct outcome *out, int verbose)
+{
+  struct dht_reading reading;
+
+  out->readings++;
+
+  init_sensor_reading();
+
+  if (read_data() < 0)
+  {
+    if (!respinfo.finished) out->timeouts++;
+    else out->rejected++;
+
+    return;
+  }
+
+  const int status = decode_data(&reading);
+
+  judge(out, status, &reading, dht_sim_answer(DHT_GPIO_PORT), verbose);
+}
+
+/******************************************************************************/
+
+static void print_outcome(const struct outcome *out)
+{
+  const double n = out->readings ? out->readings : 1;
+
+  printf("%lu readings, ok %.2f%%, timeouts %.2f%%, rejected %.2f%%, "
+         "bad checksum %.2f%%, wrong %.2f%%", out->readings,
+         100 * out->ok / n, 100 * out->timeouts / n, 100 * out->rejected / n,
+         100 * out->checksum / n, 100 * out->wrong / n);
+}
+
+/******************************************************************************/
+
+static int run_replay(int argc, char **argv)
+{
+  int repeat = 1, verbose = 0, opt;
+  struct outcome total = { 0 };
+  unsigned long edges = 0;
+  double elapsed = 0;
+
+  while ((opt = getopt(argc, argv, "n:pv")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': repeat = atoi(optarg); break;
+      case 'p': sensor_capture = SENSOR_CAPTURE_NOTIFY; break;
+      case 'v': verbose = 1; break;
+      default: return -1;
+    }
+  }
+
+  if (optind >= argc || repeat < 1) return -1;
+
+  sensor_gpio = &dht_gpio_sim;
+  sensor_verbose = verbose;
+
+  for (int i = optind; i < argc; ++i)
+  {
+    struct dht_sim_reading *readings;
+    struct outcome out = { 0 };
+    size_t num;
+
+    if (dht_sim_load(argv[i], &readings, &num) < 0)
+    {
+      perror(argv[i]);
+      continue;
+    }
+
+    sensor_gpio->init();
+    dht_sim_play(readings, num);
+
+    if (sensor_capture == SENSOR_CAPTURE_NOTIFY && sensor_notify_open() < 0)
+    {
+      perror("notification pipe");
+      return 1;
+    }
+
+    double start = now();
+
+    for (size_t r = 0; r < num * repeat; ++r) read_one(&out, verbose);
+
+    elapsed += now() - start;
+    sensor_notify_close();
+    sensor_gpio->terminate();
+
+    for (size_t r = 0; r < num; ++r) edges += readings[r].num_edges * repeat;
+
+    printf("%s: ", argv[i]);
+    print_outcome(&out);
+    printf("\n");
+
+    total.readings += out.readings;
+    total.ok += out.ok;
+    total.timeouts += out.timeouts;
+    total.rejected += out.rejected;
+    total.checksum += out.checksum;
+    total.wrong += out.wrong;
+
+    free(readings);
+  }
+
+  if (optind + 1 < argc)
+  {
+    printf("overall: ");
+    print_outcome(&total);
+    printf("\n");
+  }
+
+  if (elapsed > 0)
+    printf("%.0f readings/s, %.1f M edges/s\n", total.readings / elapsed,
+           edges / elapsed / 1e6);
+
+  if (sensor_stats.wakeups)
+    printf("%.1f edges per wakeup, %.0f us capture per reading\n",
+           (double)sensor_stats.edges / sensor_stats.wakeups,
+           (double)sensor_stats.capture_us / sensor_stats.captures);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+/* what the sampler's readings came to, by way of on_sample() */
+struct sample_run {
+  struct outcome out;
+  int verbose;
+};
+
+/******************************************************************************/
+
+static void on_sample(struct dht_sensor *sensor,
+                      int status,
+                      const struct dht_reading *reading,
+                      void *data)
+{
+  struct sample_run *run = data;
+
+  run->out.readings++;
+
+  if (status == DHT_SAMPLE_TIMEOUT) run->out.timeouts++;
+  else if (status == DHT_SAMPLE_BAD_RESPONSE) run->out.rejected++;
+  else judge(&run->out, status, reading, dht_sim_answer(sensor->gpio),
+             run->verbose);
+}
+
+/******************************************************************************/
+
+static int run_sample(int argc, char **argv)
+{
+  struct dht_sim_reading *all = NULL;
+  unsigned int pins[DHT_SAMPLER_MAX_GPIO];
+  struct sample_run run = { { 0 }, 0 };
+  struct dht_sampler sampler;
+  int sensors = 24, interval_ms = DHT_INTERVAL_US / 1000,
+    settle_ms = DHT_SETTLE_US / 1000, seconds = 600, opt;
+  size_t num = 0;
+
+  while ((opt = getopt(argc, argv, "g:i:S:t:v")) != -1)
+  {
+    switch (opt)
+    {
+      case 'g': sensors = atoi(optarg); break;
+      case 'i': interval_ms = atoi(optarg); break;
+      case 'S': settle_ms = atoi(optarg); break;
+      case 't': seconds = atoi(optarg); break;
+      case 'v': run.verbose = 1; break;
+      default: return -1;
+    }
+  }
+
+  /* the pins from GPIO 2 on, 0 and 1 being the HAT EEPROM's */
+  if (optind >= argc || sensors < 1 || sensors > DHT_SAMPLER_MAX_GPIO - 2 ||
+      interval_ms < 1 || settle_ms < 0 || seconds < 1)
+    return -1;
+
+  for (int i = optind; i < argc; ++i)
+  {
+    struct dht_sim_reading *readings;
+    size_t n;
+
+    if (dht_sim_load(argv[i], &readings, &n) < 0)
+    {
+      perror(argv[i]);
+      return 1;
+    }
+
+    all = realloc(all, (num + n) * sizeof(*all));
+    memcpy(all + num, readings, n * sizeof(*all));
+    num += n;
+    free(readings);
+  }
+
+  if (num == 0)
+  {
+    fprintf(stderr, "No readings\n");
+    return 1;
+  }
+
+  for (int i = 0; i < sensors; ++i) pins[i] = 2 + i;
+
+  sensor_verbose = run.verbose;
+  dht_gpio_sim.init();
+  dht_sim_play(all, num);
+
+  if (dht_sampler_init(&sampler, &dht_gpio_sim, pins, sensors,
+                       interval_ms * 1000u, settle_ms * 1000u, on_sample,
+                       &run) < 0)
+  {
+    fprintf(stderr, "Failed setting up the sampler\n");
+    return 1;
+  }
+
+  const uint32_t begin = dht_gpio_sim.tick();
+  const double start = now();
+
+  while (dht_gpio_sim.tick() - begin < seconds * 1000000u)
+    dht_sampler_step(&sampler);
+
+  const double elapsed = now() - start;
+  const struct sensor_stats *stats = &sampler.stats;
+  const double capture_us = stats->captures ?
+    (double)stats->capture_us / stats->captures : DHT_CAPTURE_US;
+
+  printf("%d sensors: ", sensors);
+  print_outcome(&run.out);
+  printf("\n");
+
+  /* one sensor at a time would wait for every phase of every reading */
+  printf("%.2f readings/s (%.3f per sensor) in %d s simulated, one at a "
+         "time %.2f/s\n", (double)run.out.readings / seconds,
+         (double)run.out.readings / seconds / sensors, seconds,
+         1e6 / (settle_ms * 1000.0 + DHT_START_US + capture_us));
+
+  if (stats->wakeups)
+    printf("%.1f edges per wakeup, %.0f us capture per reading, "
+           "%.0f readings/s of CPU\n",
+           (double)stats->edges / stats->wakeups, capture_us,
+           run.out.readings / elapsed);
+
+  dht_sampler_free(&sampler);
+  dht_gpio_sim.terminate();
+  free(all);
+  return 0;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  int status = -1;
+
+  if (argc > 1 && strcmp(argv[1], "gen") == 0)
+    status = run_gen(argc - 1, argv + 1);
+  else if (argc > 1 && strcmp(argv[1], "replay") == 0)
+    status = run_replay(argc - 1, argv + 1);
+  else if (argc > 1 && strcmp(argv[1], "sample") == 0)
+    status = run_sample(argc - 1, argv + 1);
+
+  if (status < 0)
+  {
+    fprintf(stderr, "usage: %s gen [-n readings] [-j jitter-us] "
+            "[-k skew-us] [-c corrupt%%] [-d drop%%] [-s seed]\n"
+            "       %s replay [-n repeat] [-p] [-v] trace...\n"
+            "       %s sample [-g sensors] [-i interval-ms] [-S settle-ms] "
+            "[-t seconds] [-v] trace...\n", argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+/******************************************************************************/
+/* File: edge_ring.h
+   Author: N.Kim
+   Abstract: Lock-free single producer/single consumer ring of GPIO edges
+
+   Description:
+     pigpio's alert thread pushes, the reader pops. Each side owns one
+     index: the producer publishes an event by a release store of 'head'
+     after writing it, the consumer frees slots by a release store of
+     'tail' after reading them. The acquire loads of the other side's
+     index pair with these, no locks, no further barriers. The indices
+     run freely and wrap, the size is a power of two. */
+/******************************************************************************/
+
+#ifndef EDGE_RING_H
+#define EDGE_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* room for three answers of 85 edges */
+#define EDGE_RING_SIZE 256
+
+/* keeps the indices of both sides apart */
+#define EDGE_RING_CACHE_LINE 64
+
+struct edge_event {
+  uint32_t tick;
+  uint32_t level;
+};
+
+struct edge_ring {
+  _Alignas(EDGE_RING_CACHE_LINE) atomic_uint_least32_t head;
+  _Alignas(EDGE_RING_CACHE_LINE) atomic_uint_least32_t tail;
+
+  _Alignas(EDGE_RING_CACHE_LINE) struct edge_event events[EDGE_RING_SIZE];
+};
+
+_Static_assert((EDGE_RING_SIZE & (EDGE_RING_SIZE - 1)) == 0,
+               "EDGE_RING_SIZE is to be a power of two");
+
+/******************************************************************************/
+
+static inline void edge_ring_init(struct edge_ring *ring)
+{
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+}
+
+/******************************************************************************/
+
+/* producer side, returns -1 if the ring is full and the edge is lost */
+static inline int edge_ring_push(struct edge_ring *ring,
+                                 uint32_t tick,
+                                 int level)
+{
+  const uint32_t head =
+    atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const uint32_t tail =
+    atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (head - tail == EDGE_RING_SIZE) return -1;
+
+  ring->events[head & (EDGE_RING_SIZE - 1)] =
+    (struct edge_event){ tick, (uint32_t)level };
+
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return 0;
+}
+
+/******************************************************************************/
+
+/* consumer side, up to 'max' events into 'out' at once. Returns the
+   number of events taken */
+static inline size_t edge_ring_pop(struct edge_ring *ring,
+                                   struct edge_event *out,
+                                   size_t max)
+{
+  const uint32_t tail =
+    atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  const uint32_t head =
+    atomic_load_explicit(&ring->head, memory_order_acquire);
+  size_t n = head - tail;
+
+  if (n > max) n = max;
+
+  for (size_t i = 0; i < n; ++i)
+    out[i] = ring->events[(tail + i) & (EDGE_RING_SIZE - 1)];
+
+  atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+  return n;
+}
+
+#endif
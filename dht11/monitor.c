@@ -0,0 +1,349 @@
+/*****************************************************************************/
+/* File: monitor.c                                                           */
+/* Author: NKim                                                              */
+/* Abstract: Temperature/humidity monitoring main loop                       */
+/*                                                                           */
+/* Usage: sensor [-p] [-a] [-g gpio,...] [-r trace] [-s store] [-b socket]   */
+/*   reads the sensor on DHT_GPIO_PORT every 2 seconds. With -r, the GPIO    */
+/*   is simulated and answers with the readings of the trace (see            */
+/*   dht_sim.h) instead, each once and as fast as possible. -p captures      */
+/*   through pigpio's notification pipe rather than alert callbacks. -g      */
+/*   reads the sensors on the pins given, interleaved (see sampler.h). -a    */
+/*   reads them as often as their values change and filters glitches        */
+/*   (see adapt.h). -s keeps the good readings in a time series file (see    */
+/*   ts_store.h), -b sends them to the advertizer's socket (see              */
+/*   env_bridge.h)                                                           */
+/*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sensor.h"
+#include "sampler.h"
+#include "adapt.h"
+#include "dht_sim.h"
+#include "ts_store.h"
+#include "env_bridge.h"
+
+/* global, but thats ok for this tutorial */
+int sigint_detected = 0;
+
+/* readings of the sampler so far */
+unsigned long sampled = 0;
+
+/* the sampler's intervals and filters, with -a */
+int adaptive = 0;
+struct dht_adapt adapt;
+
+/* where the readings go, if anywhere */
+struct ts_store store = { .fd = -1 };
+struct env_bridge bridge = { .fd = -1 };
+
+/*****************************************************************************/
+
+void on_sigint_receive(int signo)
+{
+  if (signo == SIGINT) sigint_detected = 1;
+}
+
+//-----------------------------------------------------------------------------
+
+void print_reading(const struct dht_reading *reading, int status)
+{
+  printf("  temperature: %.1f C\n", reading->temperature / 10.0);
+  printf("  humidity: %.1f %%\n", reading->humidity / 10.0);
+  printf("  frame: %02x %02x %02x %02x %02x\n", reading->frame[0],
+         reading->frame[1], reading->frame[2], reading->frame[3],
+         reading->frame[4]);
+
+  printf("data status: ");
+
+  if (status == DHT_DECODE_OK) printf("ok\n");
+  else if (status == DHT_DECODE_CHECKSUM) printf("invalid checksum\n");
+  else printf("invalid pulses\n");
+}
+
+//-----------------------------------------------------------------------------
+
+void store_reading(unsigned int gpio, const struct dht_reading *reading)
+{
+  const struct ts_record record = {
+    .time = time(NULL),
+    .temperature = reading->temperature,
+    .humidity = reading->humidity,
+    .sensor = gpio
+  };
+
+  if (store.map) ts_store_append(&store, &record);
+}
+
+//-----------------------------------------------------------------------------
+
+void bridge_reading(unsigned int gpio, const struct dht_reading *reading,
+                    uint32_t last_edge)
+{
+  /* the edge was that long ago by the GPIO's clock */
+  const uint32_t since = sensor_gpio->tick() - last_edge;
+  struct env_bridge_msg msg = {
+    .edge_ns = env_bridge_now_ns() - since * 1000ull,
+    .temperature = reading->temperature,
+    .humidity = reading->humidity,
+    .sensor = gpio
+  };
+
+  if (bridge.fd < 0) return;
+
+  memcpy(msg.frame, reading->frame, sizeof(msg.frame));
+  env_bridge_send(&bridge, &msg);
+}
+
+//-----------------------------------------------------------------------------
+
+void on_sample(struct dht_sensor *sensor, int status,
+               const struct dht_reading *reading, void *data)
+{
+  struct dht_reading filtered = *reading;
+
+  (void)data;
+  sampled++;
+
+  /* glitches come out as the median of the last readings */
+  if (adaptive && !dht_adapt_reading(&adapt, sensor, status, &filtered))
+    return;
+
+  if (status == DHT_SAMPLE_TIMEOUT || status == DHT_SAMPLE_BAD_RESPONSE)
+    return;
+
+  printf("Sensor data (GPIO %u):\n", sensor->gpio);
+  print_reading(&filtered, status);
+
+  if (status == DHT_DECODE_OK)
+  {
+    store_reading(sensor->gpio, &filtered);
+    bridge_reading(sensor->gpio, &filtered, sensor->resp.tick_count);
+  }
+}
+
+//-----------------------------------------------------------------------------
+
+int parse_pins(const char *arg, unsigned int *pins)
+{
+  /* a comma separated list, no more pins than pigpio has */
+  int num = 0;
+
+  for (;;)
+  {
+    char *end;
+    const long pin = strtol(arg, &end, 10);
+
+    if (end == arg || pin < 0 || pin >= DHT_SAMPLER_MAX_GPIO ||
+        num == DHT_SAMPLER_MAX_GPIO)
+      return -1;
+
+    pins[num++] = pin;
+
+    if (*end == 0) return num;
+    if (*end != ',') return -1;
+
+    arg = end + 1;
+  }
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+  struct dht_sim_reading *readings = NULL;
+  unsigned int pins[DHT_SAMPLER_MAX_GPIO];
+  struct dht_sampler sampler;
+  size_t num_readings = 0;
+  int num_pins = 0, opt;
+
+  sensor_gpio = &dht_gpio_pigpio;
+
+  while ((opt = getopt(argc, argv, "pag:r:s:b:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'p':
+        sensor_capture = SENSOR_CAPTURE_NOTIFY;
+        break;
+
+      case 'a':
+        adaptive = 1;
+        break;
+
+      case 'g':
+        if ((num_pins = parse_pins(optarg, pins)) < 0)
+        {
+          fprintf(stderr, "Bad GPIO list %s\n", optarg);
+          return -1;
+        }
+        break;
+
+      case 'r':
+        if (dht_sim_load(optarg, &readings, &num_readings) < 0 ||
+            num_readings == 0)
+        {
+          fprintf(stderr, "Failed loading trace %s\n", optarg);
+          return -1;
+        }
+
+        sensor_gpio = &dht_gpio_sim;
+        break;
+
+      case 's':
+        if (ts_store_open(&store, optarg, 0, 0, 0) < 0)
+        {
+          fprintf(stderr, "Failed opening the store %s\n", optarg);
+          return -1;
+        }
+        break;
+
+      case 'b':
+        if (env_bridge_sender(&bridge, optarg) < 0)
+        {
+          fprintf(stderr, "Failed opening the bridge %s\n", optarg);
+          return -1;
+        }
+        break;
+
+      default:
+        fprintf(stderr, "Usage: sensor [-p] [-a] [-g gpio,...] [-r trace] "
+                "[-s store] [-b socket]\n");
+        return -1;
+    }
+  }
+
+  /* adapting is up to the sampler, on the usual pin unless told */
+  if (adaptive && num_pins == 0)
+  {
+    pins[0] = DHT_GPIO_PORT;
+    num_pins = 1;
+  }
+
+  /* the sampler takes its edges from the alert functions */
+  if (num_pins && sensor_capture == SENSOR_CAPTURE_NOTIFY)
+  {
+    fprintf(stderr, "-p is for a single sensor only\n");
+    return -1;
+  }
+
+  printf("Starting temperature/humidity monitoring (%s)\n", sensor_gpio->name);
+
+  /* first things first, do this */
+  if (sensor_gpio->init() < 0)
+  {
+    fprintf(stderr, "Failed GPIO initialization\n");
+    return -1;
+  }
+
+  dht_sim_play(readings, num_readings);
+
+  if (num_pins)
+  {
+    if (dht_sampler_init(&sampler, sensor_gpio, pins, num_pins,
+                         DHT_INTERVAL_US, DHT_SETTLE_US, on_sample, NULL) < 0)
+    {
+      fprintf(stderr, "Failed setting up the sensors\n");
+      goto terminate;
+    }
+
+    /* the line stays high in between, the sensors settle once */
+    if (adaptive)
+    {
+      dht_adapt_init(&adapt, time(NULL));
+      sampler.settle_always = 0;
+    }
+
+    signal(SIGINT, on_sigint_receive);
+
+    /* the sampler sleeps until something is due, one step at a time */
+    while (!sigint_detected && !(readings && sampled >= num_readings))
+      dht_sampler_step(&sampler);
+
+    printf("%lu readings of %d sensors\n", sampled, num_pins);
+
+    for (unsigned int i = 0; i < sampler.num_sensors; ++i)
+      printf("  GPIO %u: %lu of %lu ok\n", sampler.sensors[i].gpio,
+             sampler.sensors[i].ok, sampler.sensors[i].readings);
+
+    if (adaptive)
+      printf("%lu passed on, %lu glitches filtered, %lu failed, %lu "
+             "wakeups\n", adapt.valid, adapt.glitches, adapt.failed,
+             sampler.sleeps);
+
+    dht_sampler_free(&sampler);
+    goto terminate;
+  }
+
+  if (sensor_capture == SENSOR_CAPTURE_NOTIFY && sensor_notify_open() < 0)
+  {
+    fprintf(stderr, "Failed opening the notification pipe\n");
+    goto terminate;
+  }
+
+  if (sensor_gpio->set_pull(DHT_GPIO_PORT, DHT_GPIO_PULL_UP) != 0)
+  {
+    fprintf(stderr, "Failed setting internal pull-up\n");
+    goto terminate;
+  }
+
+  /* install a signal handler to terminate the main loop */
+  signal(SIGINT, on_sigint_receive);
+
+  /* top level processing is very simple: init, read, decode,
+     print. Repeat until tired (or the trace is over) */
+  while (!sigint_detected &&
+         !(readings && dht_sim_answered() == num_readings))
+  {
+    init_sensor_reading();
+
+    if (read_data() != -1)
+    {
+      struct dht_reading reading;
+      const int status = decode_data(&reading);
+
+      printf("Sensor data:\n");
+      print_reading(&reading, status);
+
+      if (status == DHT_DECODE_OK)
+      {
+        store_reading(DHT_GPIO_PORT, &reading);
+        bridge_reading(DHT_GPIO_PORT, &reading, respinfo.tick_count);
+      }
+    }
+
+    /* perform data acquisition in economy mode. I.e. we read sensor data
+       every 2 seconds */
+    sensor_gpio->sleep(2000000);
+  }
+
+  if (sensor_stats.wakeups)
+  {
+    printf("%lu edges in %lu wakeups, %.1f per wakeup, %.0f us capture per "
+           "reading\n", sensor_stats.edges, sensor_stats.wakeups,
+           (double)sensor_stats.edges / sensor_stats.wakeups,
+           (double)sensor_stats.capture_us / sensor_stats.captures);
+  }
+
+terminate:
+  sensor_notify_close();
+  sensor_gpio->terminate();
+  ts_store_close(&store);
+
+  if (bridge.fd >= 0)
+  {
+    printf("%lu readings sent to the bridge, %lu dropped\n", bridge.sent,
+           bridge.dropped);
+    env_bridge_close(&bridge);
+  }
+
+  free(readings);
+  printf("Monitoring done\n");
+  return 0;
+}
@@ -0,0 +1,258 @@
+/******************************************************************************/
+/* File: sampler.c
+   Author: N.Kim
+   Abstract: Interleaved reading of many DHT11 sensors */
+/******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sampler.h"
+
+/* the sensors by pin, for the alert function */
+static struct dht_sensor *sensors_by_gpio[DHT_SAMPLER_MAX_GPIO];
+
+/******************************************************************************/
+
+static void on_alert(int gpio, int level, uint32_t tick)
+{
+  /* pigpio's thread, queue the edge and leave */
+  if (gpio < 0 || gpio >= DHT_SAMPLER_MAX_GPIO || level < 0 || level > 1)
+    return;
+
+  struct dht_sensor *sensor = sensors_by_gpio[gpio];
+
+  if (sensor) edge_ring_push(&sensor->edges, tick, level);
+}
+
+/******************************************************************************/
+
+int dht_sampler_init(struct dht_sampler *sampler,
+                     const struct dht_gpio_backend *gpio,
+                     const unsigned int *pins,
+                     unsigned int num_pins,
+                     uint32_t interval_us,
+                     uint32_t settle_us,
+                     dht_sample_cb cb,
+                     void *data)
+{
+  const uint32_t now = gpio->tick();
+
+  memset(sampler, 0, sizeof(*sampler));
+
+  if (num_pins == 0) return -1;
+
+  for (unsigned int i = 0; i < num_pins; ++i)
+  {
+    if (pins[i] >= DHT_SAMPLER_MAX_GPIO || sensors_by_gpio[pins[i]]) return -1;
+
+    for (unsigned int j = 0; j < i; ++j)
+      if (pins[j] == pins[i]) return -1;
+  }
+
+  /* the queues keep their indices on cache lines of their own */
+  sampler->sensors = aligned_alloc(_Alignof(struct dht_sensor),
+                                   num_pins * sizeof(struct dht_sensor));
+
+  if (!sampler->sensors) return -1;
+
+  memset(sampler->sensors, 0, num_pins * sizeof(struct dht_sensor));
+
+  sampler->gpio = gpio;
+  sampler->num_sensors = num_pins;
+  sampler->interval_us = interval_us;
+  sampler->settle_us = settle_us;
+  sampler->settle_always = 1;
+  sampler->cb = cb;
+  sampler->data = data;
+
+  for (unsigned int i = 0; i < num_pins; ++i)
+  {
+    struct dht_sensor *sensor = &sampler->sensors[i];
+
+    sensor->gpio = pins[i];
+    sensor->phase = DHT_SENSOR_IDLE;
+    sensor->interval_us = interval_us;
+
+    /* spread the starts over the interval */
+    sensor->due = now + (uint64_t)interval_us * i / num_pins;
+
+    edge_ring_init(&sensor->edges);
+    sensors_by_gpio[pins[i]] = sensor;
+
+    gpio->set_pull(pins[i], DHT_GPIO_PULL_UP);
+    gpio->set_alert(pins[i], on_alert);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void dht_sampler_free(struct dht_sampler *sampler)
+{
+  for (unsigned int i = 0; i < sampler->num_sensors; ++i)
+  {
+    const unsigned int gpio = sampler->sensors[i].gpio;
+
+    sampler->gpio->set_alert(gpio, NULL);
+    sensors_by_gpio[gpio] = NULL;
+  }
+
+  free(sampler->sensors);
+  sampler->sensors = NULL;
+  sampler->num_sensors = 0;
+}
+
+/******************************************************************************/
+
+static void finish(struct dht_sampler *sampler,
+                   struct dht_sensor *sensor,
+                   uint32_t now)
+{
+  struct dht_reading reading;
+  int status;
+
+  memset(&reading, 0, sizeof(reading));
+
+  sampler->stats.captures++;
+  sampler->stats.capture_us += now - sensor->release;
+
+  if (!sensor->resp.finished) status = DHT_SAMPLE_TIMEOUT;
+  else if (sensor_check_response(&sensor->resp) < 0)
+    status = DHT_SAMPLE_BAD_RESPONSE;
+  else status = sensor_decode(&sensor->resp, &reading);
+
+  sensor->readings++;
+  sensor->settled = 1;
+  if (status == DHT_DECODE_OK) sensor->ok++;
+
+  if (sampler->cb) sampler->cb(sensor, status, &reading, sampler->data);
+
+  /* next one an interval after this one began, right away if late */
+  sensor->phase = DHT_SENSOR_IDLE;
+  sensor->due = sensor->cycle + sensor->interval_us;
+
+  if ((int32_t)(sensor->due - now) < 0) sensor->due = now;
+}
+
+/******************************************************************************/
+
+static void capture(struct dht_sampler *sampler,
+                    struct dht_sensor *sensor,
+                    uint32_t now)
+{
+  struct edge_event batch[EDGE_RING_SIZE];
+  const size_t n = edge_ring_pop(&sensor->edges, batch, EDGE_RING_SIZE);
+
+  if (n) sampler->stats.wakeups++;
+
+  for (size_t i = 0; i < n && !sensor->resp.finished; ++i)
+  {
+    /* our own start signal */
+    if ((int32_t)(batch[i].tick - sensor->release) < 0) continue;
+
+    sampler->stats.edges++;
+    sensor_record_edge(&sensor->resp, batch[i].level, batch[i].tick);
+  }
+
+  if (sensor->resp.finished || now - sensor->release >= DHT_CAPTURE_US)
+    finish(sampler, sensor, now);
+}
+
+/******************************************************************************/
+
+static void advance(struct dht_sampler *sampler,
+                    struct dht_sensor *sensor,
+                    uint32_t now)
+{
+  const struct dht_gpio_backend *gpio = sampler->gpio;
+  struct edge_event stale[EDGE_RING_SIZE];
+
+  switch (sensor->phase)
+  {
+    case DHT_SENSOR_IDLE:
+      gpio->set_mode(sensor->gpio, DHT_GPIO_OUTPUT);
+      sensor->cycle = now;
+
+      /* the line has been high since the last answer */
+      if (sensor->settled && !sampler->settle_always)
+      {
+        gpio->write(sensor->gpio, 0);
+
+        sensor->phase = DHT_SENSOR_START;
+        sensor->due = now + DHT_START_US;
+        break;
+      }
+
+      gpio->write(sensor->gpio, 1);
+
+      sensor->phase = DHT_SENSOR_SETTLE;
+      sensor->due = now + sampler->settle_us;
+      break;
+
+    case DHT_SENSOR_SETTLE:
+      gpio->write(sensor->gpio, 0);
+
+      sensor->phase = DHT_SENSOR_START;
+      sensor->due = now + DHT_START_US;
+      break;
+
+    case DHT_SENSOR_START:
+      /* release the line and listen. Whatever is queued by now is older
+         than the answer */
+      gpio->write(sensor->gpio, 1);
+      gpio->set_mode(sensor->gpio, DHT_GPIO_INPUT);
+
+      while (edge_ring_pop(&sensor->edges, stale, EDGE_RING_SIZE)) {}
+
+      memset(&sensor->resp, 0, sizeof(sensor->resp));
+      sensor->phase = DHT_SENSOR_CAPTURE;
+      sensor->release = gpio->tick();
+      sensor->due = sensor->release + DHT_CAPTURE_US;
+      break;
+
+    case DHT_SENSOR_CAPTURE:
+      break;
+  }
+}
+
+/******************************************************************************/
+
+void dht_sampler_step(struct dht_sampler *sampler)
+{
+  const uint32_t now = sampler->gpio->tick();
+  uint32_t wait = UINT32_MAX;
+
+  for (unsigned int i = 0; i < sampler->num_sensors; ++i)
+  {
+    struct dht_sensor *sensor = &sampler->sensors[i];
+
+    if (sensor->phase == DHT_SENSOR_CAPTURE) capture(sampler, sensor, now);
+    else if ((int32_t)(now - sensor->due) >= 0) advance(sampler, sensor, now);
+  }
+
+  /* until the next phase is due, answers are polled for */
+  for (unsigned int i = 0; i < sampler->num_sensors; ++i)
+  {
+    const struct dht_sensor *sensor = &sampler->sensors[i];
+    const int32_t left = sensor->due - now;
+
+    if (sensor->phase == DHT_SENSOR_CAPTURE)
+    {
+      const int32_t answered = sensor->release + DHT_ANSWER_MIN_US - now;
+      const uint32_t poll =
+        answered > DHT_RING_POLL_US ? (uint32_t)answered : DHT_RING_POLL_US;
+
+      if (wait > poll) wait = poll;
+    }
+    else if (left <= 0) wait = 0;
+    else if ((uint32_t)left < wait) wait = left;
+  }
+
+  if (wait)
+  {
+    sampler->sleeps++;
+    sampler->gpio->sleep(wait);
+  }
+}
@@ -0,0 +1,126 @@
+/******************************************************************************/
+/* File: sampler.h
+   Author: N.Kim
+   Abstract: Interleaved reading of many DHT11 sensors
+
+   Description:
+     Every sensor has its own pin, answer and alert queue, and goes through
+     the phases of a reading on its own: settling (line high), the start
+     signal (18 ms low), the capture of the answer. The phases of all of
+     them are interleaved on one thread, waiting for whichever is due
+     next, so the waits overlap rather than add up. The starts are spread
+     over the interval, thus captures rarely coincide (they may though).
+
+     pigpio's alert thread queues the edges by pin, the sampler polls the
+     queues of the sensors capturing. One sampler per process, the alert
+     functions of pigpio know nothing but the pin. */
+/******************************************************************************/
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdint.h>
+
+#include "sensor.h"
+#include "edge_ring.h"
+
+/* pigpio numbers the GPIOs of the header 0 to 53 */
+#define DHT_SAMPLER_MAX_GPIO 54
+
+/* the phases, see init_sensor_reading() */
+#define DHT_SETTLE_US 1000000
+#define DHT_START_US 18000
+
+/* an answer of zeros takes that long at least, the queue of a sensor is
+   not polled before */
+#define DHT_ANSWER_MIN_US 3000
+
+/* a reading of each sensor every that often by default. The DHT11 wants
+   a second at least */
+#define DHT_INTERVAL_US 2000000
+
+/* what became of a reading besides enum dht_decode_status */
+enum dht_sample_status {
+  DHT_SAMPLE_BAD_RESPONSE = -3,   /* sensor_check_response() said no */
+  DHT_SAMPLE_TIMEOUT = -4         /* no complete answer in time */
+};
+
+enum dht_sensor_phase {
+  DHT_SENSOR_IDLE,
+  DHT_SENSOR_SETTLE,
+  DHT_SENSOR_START,
+  DHT_SENSOR_CAPTURE
+};
+
+struct dht_sensor {
+  unsigned int gpio;
+  enum dht_sensor_phase phase;
+
+  uint32_t due;       /* tick the phase is over */
+  uint32_t cycle;     /* tick the reading began, the next one is an
+                         interval later */
+  uint32_t release;   /* tick the start signal ended */
+
+  /* the next reading begins that long after this one did, may be
+     changed by the callback */
+  uint32_t interval_us;
+  int settled;
+
+  struct init_response_info resp;
+  unsigned long readings;
+  unsigned long ok;
+
+  /* filled by pigpio's thread */
+  struct edge_ring edges;
+};
+
+/* every reading, the reading is only valid if 'status' is DHT_DECODE_OK
+   (or DHT_DECODE_CHECKSUM, for a look at it). The sensor's interval is
+   taken after the callback returns */
+typedef void (*dht_sample_cb)(struct dht_sensor *sensor,
+                              int status,
+                              const struct dht_reading *reading,
+                              void *data);
+
+struct dht_sampler {
+  const struct dht_gpio_backend *gpio;
+
+  struct dht_sensor *sensors;
+  unsigned int num_sensors;
+
+  uint32_t interval_us;
+  uint32_t settle_us;
+
+  /* settle before every reading (the default) rather than the first
+     one only, the line is pulled up in between anyway */
+  int settle_always;
+
+  dht_sample_cb cb;
+  void *data;
+
+  /* as kept by read_data, a wakeup being a poll that found edges */
+  struct sensor_stats stats;
+
+  /* times it went to sleep */
+  unsigned long sleeps;
+};
+
+/* sensors on 'pins', each read every 'interval_us' after settling for
+   'settle_us'. The GPIO is to be up. Returns -1 on bad or duplicate pins
+   and if out of memory */
+int dht_sampler_init(struct dht_sampler *sampler,
+                     const struct dht_gpio_backend *gpio,
+                     const unsigned int *pins,
+                     unsigned int num_pins,
+                     uint32_t interval_us,
+                     uint32_t settle_us,
+                     dht_sample_cb cb,
+                     void *data);
+
+void dht_sampler_free(struct dht_sampler *sampler);
+
+/* moves every sensor due on, then sleeps until the next is (or polls
+   the captures). To be called over and over */
+void dht_sampler_step(struct dht_sampler *sampler);
+
+#endif
@@ -4,86 +4,100 @@
 /* Abstract: Definition of functions dealing with sensor interfacing         */
 /*****************************************************************************/
 
-#include <pigpio.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
-#include <signal.h>
-
-/* NOTE, my sensor does not seem to work properly on the 3.3V power rail
-   (red), thus, use the 5V GPIO power supply. The data port itself (yellow)
-   is in turn not restricted */
-#define DHT_GPIO_PORT 4
-
-/* this is something i am not entirely sure about, but this seems to work ok
-   for my configuration. This corresponds to the number of pulses to be
-   received after the initial 18 ms delay has been performed */
-#define DHT_INIT_RESPONSE_LENGTH 3
-
-/* each bit is represented by 2 pulses, additionally reserve 3 fields for the
-   pulses at the beginning of the initialization sequence (see manual) */
-#define DHT_BUFFER_LENGTH 80 + DHT_INIT_RESPONSE_LENGTH
-
-struct init_response_info {
-  char tick_buf[DHT_BUFFER_LENGTH];
-  int tick_count;
-  int tick_index;
-  int running;
-  int finished;
-  int error;
-} respinfo = { {0}, 0, 0, 0, 0, 0 };
-
-/* global, but thats ok for this tutorial */
-int sigint_detected = 0;
+#include <unistd.h>
 
-/*****************************************************************************/
+#include "sensor.h"
+#include "edge_ring.h"
 
-void on_sigint_receive(int signo)
-{
-  if (signo == SIGINT) sigint_detected = 1;
-}
+struct init_response_info respinfo = { {0}, 0, 0, 0, 0, 0 };
 
-/*****************************************************************************/
+/* set by the caller before anything else, globals, but thats ok for this
+   tutorial */
+const struct dht_gpio_backend *sensor_gpio = NULL;
+enum sensor_capture sensor_capture = SENSOR_CAPTURE_ALERT;
+struct sensor_stats sensor_stats = { 0, 0, 0, 0 };
+int sensor_verbose = 1;
 
-void on_init_response_change(int gpio, int level, uint32_t ticks) {
-  /* this is the callback we have installed for the sampler. This means,
-     whenever the pin (connected to the sensor) level changes, we get
-     notified. We also receive the number of ticks that have passed
-     since the last pin change. Thus, record them in order to be able to
-     check later whether we are dealing with ones or zeroes */
-  if (gpio != DHT_GPIO_PORT || level < 0 || level > 1) return;
+/* edges queued by the alert function, see edge_ring.h */
+static struct edge_ring edges;
+
+/* the notification pipe and what has been read from it, reports may
+   arrive in pieces */
+static int notify_fd = -1;
+static struct dht_gpio_report notify_buf[64];
+static size_t notify_fill = 0;
 
-  if (respinfo.finished == 1) return;
+/* the complaints of read_data, quiet when replaying traces in bulk */
+#define complain(...) \
+  do { if (sensor_verbose) fprintf(stderr, __VA_ARGS__); } while (0)
 
-  if (respinfo.tick_index < DHT_BUFFER_LENGTH) {
-    if (respinfo.running == 0) {
-      respinfo.running = 1;
-      respinfo.tick_count = ticks;
+/*****************************************************************************/
+
+void sensor_record_edge(struct init_response_info *info, int level,
+                        uint32_t ticks) {
+  /* this is called for every edge of the answer. This means, whenever the
+     pin (connected to the sensor) level changes, we get notified. We also
+     receive the tick of the change. Thus, record the ticks passed since the
+     last change in order to be able to check later whether we are dealing
+     with ones or zeroes */
+  if (info->finished == 1) return;
+
+  if (info->tick_index < DHT_BUFFER_LENGTH) {
+    if (info->running == 0) {
+      info->running = 1;
+      info->tick_count = ticks;
       return;
     }
 
-    const int length = ticks - respinfo.tick_count;
+    const uint32_t length = ticks - info->tick_count;
 
     /* record reasonable pulse lengths only, according to the manual,
        the highest value is somewhere in the region of 70us (which
        means 1 btw) */
 
     if (length > 10 && length < 100) {
-      respinfo.tick_buf[respinfo.tick_index] = length;
-      respinfo.tick_count = ticks;
-      respinfo.tick_index++;
+      info->tick_buf[info->tick_index] = length;
+      info->tick_count = ticks;
+      info->tick_index++;
     }
     else {
-      respinfo.error = 1;
+      info->error = 1;
       return;
     }
   }
-  else {
-    respinfo.running = 0;
-    respinfo.finished = 1;
+
+  /* the last pulse of the last bit completes the answer, no need to wait
+     for the sensor to let go of the line */
+  if (info->tick_index == DHT_BUFFER_LENGTH) {
+    info->running = 0;
+    info->finished = 1;
   }
 }
 
+//-----------------------------------------------------------------------------
+
+void on_init_response_change(int gpio, int level, uint32_t ticks) {
+  /* the sensor on DHT_GPIO_PORT, read by read_data */
+  if (gpio != DHT_GPIO_PORT || level < 0 || level > 1) return;
+
+  sensor_record_edge(&respinfo, level, ticks);
+}
+
+/*****************************************************************************/
+
+static void on_alert(int gpio, int level, uint32_t ticks) {
+  /* this is the callback we have installed for the sampler, on pigpio's
+     thread. It only queues the edge, read_data takes it from there. A
+     full queue loses it, the reading will time out */
+  if (gpio != DHT_GPIO_PORT || level < 0 || level > 1) return;
+
+  edge_ring_push(&edges, ticks, level);
+}
+
 /*****************************************************************************/
 
 void clear_response_info(void) {
@@ -94,226 +108,199 @@ void clear_response_info(void) {
   respinfo.error = 0;
 }
 
-/*****************************************************************************/
-
-int decode_data_bit(int pulse_length) {
-  /* long pulses are interpreted as 1 and short ones as 1. Concrete
-     average values are somewhere in the range of 25us for 0 and 70us
-     for 1 */
-
-  if (pulse_length >= 15 && pulse_length <= 35) return 0;
-  else if (pulse_length >= 60 && pulse_length <= 80) return 1;
-  else return -1;
-}
-
 //-----------------------------------------------------------------------------
 
-int init_sensor_reading() {
+int init_sensor_reading(void) {
   /* require only one GPIO port for now, the dht11 sensor is mapped to port 4.
      The data reading requires a predefined signal pattern (see dht11 manual),
      thus, we need to write to the port first. Wait 1 sec for the port to
      become 'stable' */
-  gpioSetMode(DHT_GPIO_PORT, PI_OUTPUT);
-  gpioSetPullUpDown(DHT_GPIO_PORT, PI_PUD_DOWN);
-  gpioSleep(PI_TIME_RELATIVE, 1, 0);
+  sensor_gpio->set_mode(DHT_GPIO_PORT, DHT_GPIO_OUTPUT);
+  sensor_gpio->set_pull(DHT_GPIO_PORT, DHT_GPIO_PULL_DOWN);
+  sensor_gpio->sleep(1000000);
 
   /* pull on low for min. 18msec. After this the manual becomes barely
      understandable. Especially, its unclear whether the pulse of 20-40 usec
      is to be interpreted as output (i.e. to be sent from the MCU) or input
      (incoming acknowledgement from the sensor). Since i keep receiving short
      spikes, i assume the second case */
-  gpioWrite(DHT_GPIO_PORT, 0);
-  gpioSleep(PI_TIME_RELATIVE, 0, 18000);
+  sensor_gpio->write(DHT_GPIO_PORT, 0);
+  sensor_gpio->sleep(18000);
 
-  gpioWrite(DHT_GPIO_PORT, 1);
-  gpioSleep(PI_TIME_RELATIVE, 0, 30);
+  sensor_gpio->write(DHT_GPIO_PORT, 1);
+  sensor_gpio->sleep(30);
+  return 0;
 }
 
 //-----------------------------------------------------------------------------
 
-int read_data(void) {
+int sensor_notify_open(void) {
+  notify_fd = sensor_gpio->notify_open(1u << DHT_GPIO_PORT);
+  notify_fill = 0;
 
-  gpioSetMode(DHT_GPIO_PORT, PI_INPUT);
+  return notify_fd < 0 ? -1 : 0;
+}
 
-  clear_response_info();
+//-----------------------------------------------------------------------------
 
-  /* specify the handler for the sampling and give the reading process 5000
-     usec to complete. This should be plenty */
-  gpioSetAlertFunc(DHT_GPIO_PORT, on_init_response_change);
-  gpioSleep(PI_TIME_RELATIVE, 0, 5000);
-  gpioSetAlertFunc(DHT_GPIO_PORT, NULL);
+void sensor_notify_close(void) {
+  if (notify_fd < 0) return;
 
-  if (respinfo.running || !respinfo.finished) {
-    fprintf(stderr, "Timeout occured while reading data\n");
-    return -1;
-  }
+  sensor_gpio->notify_close(notify_fd);
+  notify_fd = -1;
+}
 
-  /* check the length of the first 3 elements, these correspond to the init
-     response from the sensor. The first spike is described to be somewhere
-     in the range of 20 and 40 usec. Allow additional margins of 10 usec */
-  if (respinfo.tick_buf[0] < 10 || respinfo.tick_buf[0] > 50) {
-    fprintf(stderr, "Bad length (first response pulse)\n");
-    return -1;
-  }
+//-----------------------------------------------------------------------------
 
-  /* second and third pulses are specified to be in the range of 80 usec, we
-     allow a margin of 15 usec here */
-  if (respinfo.tick_buf[1] < 65 || respinfo.tick_buf[1] > 95 ||
-      respinfo.tick_buf[2] < 65 || respinfo.tick_buf[2] > 95)
-  {
-    fprintf(stderr, "Bad length (second/third response pulse)\n");
-    return -1;
-  }
+static void capture_alert(uint32_t start) {
+  struct edge_event batch[EDGE_RING_SIZE];
+
+  sensor_gpio->set_alert(DHT_GPIO_PORT, on_alert);
+
+  /* decode as soon as the last bit is in, give up after 5000 usec. This
+     should be plenty */
+  while (!respinfo.finished) {
+    const size_t n = edge_ring_pop(&edges, batch, EDGE_RING_SIZE);
 
-  // now start inspecting received data. Each bit is encoded by 2 pulses,
-  // with the first being of constant length (50 usec) and the second puls
-  // being variable (20-30 usec for 0 and 70 usec for 1)
-  for (int i = DHT_INIT_RESPONSE_LENGTH; i < DHT_BUFFER_LENGTH; i += 2) {
-    if (respinfo.tick_buf[i] < 40 || respinfo.tick_buf[i] > 60) {
-      fprintf(stderr, "Bad header pulse length %d at position %d\n",
-              respinfo.tick_buf[i], i);
-      return -1;
+    if (n == 0) {
+      if (sensor_gpio->tick() - start >= DHT_CAPTURE_US) break;
+
+      sensor_gpio->sleep(DHT_RING_POLL_US);
+      continue;
     }
 
-    const int good_low =
-      respinfo.tick_buf[i+1] >= 15 && respinfo.tick_buf[i+1] <= 35;
+    sensor_stats.wakeups++;
 
-    const int good_high =
-      respinfo.tick_buf[i+1] >= 55 && respinfo.tick_buf[i+1] <= 85;
+    for (size_t i = 0; i < n && !respinfo.finished; ++i) {
+      /* left over from a previous reading */
+      if ((int32_t)(batch[i].tick - start) < 0) continue;
 
-    if (!(good_low || good_high)) {
-      fprintf(stderr, "Bad data pulse length %d at position %d\n",
-              respinfo.tick_buf[i+1], i);
-      return -1;
+      sensor_stats.edges++;
+      on_init_response_change(DHT_GPIO_PORT, batch[i].level, batch[i].tick);
     }
   }
 
-  return 0;
+  sensor_gpio->set_alert(DHT_GPIO_PORT, NULL);
 }
 
 //-----------------------------------------------------------------------------
 
-int decode_data(unsigned char *temp_high,
-                unsigned char *temp_low,
-                unsigned char *hum_high,
-                unsigned char *hum_low,
-                unsigned char *parity)
-{
-  /* again, two pulses (i.e. array fields) for each data bit, thus, if we
-     want to extract 8 bits, we first need to skip the first 3 indices (init
-     response pattern) and then scan 16 positions of the buffer */
-  int start_index = DHT_INIT_RESPONSE_LENGTH;
-  int end_index = start_index + 16;
-
-  for (int i = start_index, j = 0; i < end_index; i += 2, ++j) {
-    int bit = decode_data_bit(respinfo.tick_buf[i+1]);
-    *hum_high = *hum_high | bit << (7 - j);
-  }
+static void capture_notify(uint32_t start) {
+  const uint32_t bit = 1u << DHT_GPIO_PORT;
+  const size_t size = sizeof(notify_buf[0]);
+  int level = -1;
 
-  start_index += 16;
-  end_index += 16;
+  while (!respinfo.finished) {
+    const uint32_t waited = sensor_gpio->tick() - start;
 
-  /* according to the manual, it is sufficient to read out the high byte for
-     the humidity, for the parity check we still extract the low byte too */
-  for (int i = start_index, j = 0; i < end_index; i += 2, ++j) {
-    int bit = decode_data_bit(respinfo.tick_buf[i+1]);
-    *hum_low = *hum_low | bit << (7 - j);
-  }
+    if (waited >= DHT_CAPTURE_US ||
+        !sensor_gpio->notify_wait(notify_fd, DHT_CAPTURE_US - waited))
+      break;
 
-  start_index += 16;
-  end_index += 16;
+    const ssize_t n = read(notify_fd, (char *)notify_buf + notify_fill,
+                           sizeof(notify_buf) - notify_fill);
 
-  for (int i = start_index, j = 0; i < end_index; i += 2, j++) {
-    int bit = decode_data_bit(respinfo.tick_buf[i+1]);
-    *temp_high = *temp_high | bit << (7 - j);
-  }
+    if (n <= 0) continue;
 
-  start_index += 16;
-  end_index += 16;
+    sensor_stats.wakeups++;
+    notify_fill += n;
 
-  /* the same applies to the temperature as well, the lower byte only encodes
-     the fractional value of the temperature, so this part can be skipped too
-     for a quick and lazy implementation */
-  for (int i = start_index, j = 0; i < end_index; i += 2, j++) {
-    int bit = decode_data_bit(respinfo.tick_buf[i+1]);
-    *temp_low = *temp_low | bit << (7 - j);
-  }
+    /* all complete reports at once, on our own thread */
+    const size_t count = notify_fill / size;
 
-  start_index += 16;
-  end_index += 16;
+    for (size_t i = 0; i < count; ++i) {
+      const struct dht_gpio_report *r = &notify_buf[i];
+      const int l = (r->level & bit) != 0;
 
-  for (int i = start_index, j = 0; i <= end_index; i += 2, ++j) {
-    int bit = decode_data_bit(respinfo.tick_buf[i+1]);
-    *parity = *parity | bit << (7 - j);
+      if (r->flags || (int32_t)(r->tick - start) < 0 || l == level) continue;
+
+      level = l;
+      sensor_stats.edges++;
+
+      on_init_response_change(DHT_GPIO_PORT, l, r->tick);
+    }
+
+    notify_fill -= count * size;
+    memmove(notify_buf, (char *)notify_buf + count * size, notify_fill);
   }
 }
 
 //-----------------------------------------------------------------------------
 
-int main(int argc, char **argv)
-{
-  printf("Starting temperature/humidity monitoring\n");
+int sensor_check_response(const struct init_response_info *info) {
+  /* the answer is to be complete, whichever sensor it came from */
+  if (info->running || !info->finished) {
+    complain("Timeout occured while reading data\n");
+    return -1;
+  }
 
-  /* first things first, do this */
-  if (gpioInitialise() < 0)
-  {
-    fprintf(stderr, "Failed GPIO initialization\n");
+  /* check the length of the first 3 elements, these correspond to the init
+     response from the sensor. The first spike is described to be somewhere
+     in the range of 20 and 40 usec. Allow additional margins of 10 usec */
+  if (info->tick_buf[0] < 10 || info->tick_buf[0] > 50) {
+    complain("Bad length (first response pulse)\n");
     return -1;
   }
 
-  if (gpioSetPullUpDown(DHT_GPIO_PORT, PI_PUD_UP) != 0)
+  /* second and third pulses are specified to be in the range of 80 usec, we
+     allow a margin of 15 usec here */
+  if (info->tick_buf[1] < 65 || info->tick_buf[1] > 95 ||
+      info->tick_buf[2] < 65 || info->tick_buf[2] > 95)
   {
-    fprintf(stderr, "Failed setting internal pull-up\n");
-    goto terminate;
+    complain("Bad length (second/third response pulse)\n");
+    return -1;
   }
 
-  /* install a signal handler to terminate the main loop */
-  signal(SIGINT, on_sigint_receive);
+  return 0;
+}
 
-  /* top level processing is very simple: init, read, decode,
-     print. Repeat until tired */
-  while (!sigint_detected)
-  {
-    init_sensor_reading();
-
-    if (read_data() != -1)
-    {
-      unsigned char temp_high = 0;
-      unsigned char temp_low = 0;
-      unsigned char hum_high = 0;
-      unsigned char hum_low = 0;
-      unsigned char parity = 0;
-
-      decode_data(
-        &temp_high,
-        &temp_low,
-        &hum_high,
-        &hum_low,
-        &parity);
-
-      const int byte_sum = temp_high + temp_low + hum_high + hum_low;
-
-      printf("Sensor data:\n");
-      printf("  temperature high: %d\n", temp_high);
-      printf("  temperature low: %d\n", temp_low);
-      printf("  humidity high: %d\n", hum_high);
-      printf("  humidity low: %d\n", hum_low);
-      printf("  parity: %d\n", parity);
-
-      printf("data status: ");
-
-      if (byte_sum != parity)
-        printf("invalid\n");
-      else printf("ok\n");
-    }
+//-----------------------------------------------------------------------------
 
-    /* perform data acquisition in economy mode. I.e. we read sensor data
-       every 2 seconds */
-    gpioSleep(PI_TIME_RELATIVE, 2, 0);
-  }
+int read_data(void) {
+
+  sensor_gpio->set_mode(DHT_GPIO_PORT, DHT_GPIO_INPUT);
+
+  clear_response_info();
 
-terminate:
-  gpioTerminate();
-  printf("Monitoring done\n");
+  /* queued alerts or reports of the start signal and the previous reading
+     may still be waiting, they are older than this */
+  const uint32_t start = sensor_gpio->tick();
+
+  /* either take the edges queued by the alert function or read batches of
+     samples from the notification pipe, until the answer is complete */
+  if (sensor_capture == SENSOR_CAPTURE_NOTIFY) capture_notify(start);
+  else capture_alert(start);
+
+  sensor_stats.captures++;
+  sensor_stats.capture_us += sensor_gpio->tick() - start;
+
+  if (sensor_check_response(&respinfo) < 0) return -1;
+
+  /* the data bits are checked by decode_data, in bulk */
   return 0;
 }
+
+//-----------------------------------------------------------------------------
+
+int sensor_decode(const struct init_response_info *info,
+                  struct dht_reading *reading)
+{
+  /* the data bits follow the init response pattern, two pulses each. The
+     decoder takes them as bytes, saturated */
+  uint8_t pulses[2 * DHT_FRAME_BITS];
+
+  for (int i = 0; i < 2 * DHT_FRAME_BITS; ++i) {
+    const uint32_t length = info->tick_buf[DHT_INIT_RESPONSE_LENGTH + i];
+
+    pulses[i] = length > 255 ? 255 : length;
+  }
+
+  return dht_decode(pulses, reading);
+}
+
+//-----------------------------------------------------------------------------
+
+int decode_data(struct dht_reading *reading)
+{
+  return sensor_decode(&respinfo, reading);
+}
@@ -0,0 +1,99 @@
+/*****************************************************************************/
+/* File: sensor.h                                                            */
+/* Author: NKim                                                              */
+/* Abstract: Declaration of functions dealing with sensor interfacing        */
+/*****************************************************************************/
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stdint.h>
+
+#include "dht_gpio.h"
+#include "dht_decode.h"
+
+/* NOTE, my sensor does not seem to work properly on the 3.3V power rail
+   (red), thus, use the 5V GPIO power supply. The data port itself (yellow)
+   is in turn not restricted */
+#define DHT_GPIO_PORT 4
+
+/* this is something i am not entirely sure about, but this seems to work ok
+   for my configuration. This corresponds to the number of pulses to be
+   received after the initial 18 ms delay has been performed */
+#define DHT_INIT_RESPONSE_LENGTH 3
+
+/* each bit is represented by 2 pulses, additionally reserve 3 fields for the
+   pulses at the beginning of the initialization sequence (see manual) */
+#define DHT_BUFFER_LENGTH 80 + DHT_INIT_RESPONSE_LENGTH
+
+/* time given to the sensor to answer */
+#define DHT_CAPTURE_US 5000
+
+/* how read_data captures the answer */
+enum sensor_capture {
+  SENSOR_CAPTURE_ALERT,   /* a callback per edge on pigpio's thread */
+  SENSOR_CAPTURE_NOTIFY   /* batches read from a notification pipe */
+};
+
+/* alerts are queued by pigpio's thread, read_data checks for them that
+   often */
+#define DHT_RING_POLL_US 200
+
+/* counted by read_data: times it found new edges (in the alert queue or
+   the notification pipe), edges it got to see and the time it took to
+   capture the answers */
+struct sensor_stats {
+  unsigned long wakeups;
+  unsigned long edges;
+  unsigned long captures;
+  unsigned long long capture_us;
+};
+
+struct init_response_info {
+  uint32_t tick_buf[DHT_BUFFER_LENGTH];
+  uint32_t tick_count;
+  int tick_index;
+  int running;
+  int finished;
+  int error;
+};
+
+extern struct init_response_info respinfo;
+
+/* the GPIO access to go through, pigpio or the simulation (see
+   dht_gpio.h). Has to be set before anything else */
+extern const struct dht_gpio_backend *sensor_gpio;
+
+extern enum sensor_capture sensor_capture;
+extern struct sensor_stats sensor_stats;
+
+/* read_data complains about bad readings on stderr unless this is 0 */
+extern int sensor_verbose;
+
+/* the pipe SENSOR_CAPTURE_NOTIFY reads from, to be opened once the GPIO
+   is up */
+int sensor_notify_open(void);
+void sensor_notify_close(void);
+
+void on_init_response_change(int gpio, int level, uint32_t ticks);
+void clear_response_info(void);
+
+/* the same for the answer of any sensor, see sampler.h: record an edge,
+   check the response pulses (-1 if bad or incomplete) and decode the
+   data bits. The functions below take respinfo */
+void sensor_record_edge(struct init_response_info *info, int level,
+                        uint32_t ticks);
+int sensor_check_response(const struct init_response_info *info);
+int sensor_decode(const struct init_response_info *info,
+                  struct dht_reading *reading);
+
+/* start signal, then capture the answer. read_data returns -1 on
+   timeouts and bad response pulses, the data bits are left to
+   decode_data */
+int init_sensor_reading(void);
+int read_data(void);
+
+/* the captured answer as a reading, see dht_decode() */
+int decode_data(struct dht_reading *reading);
+
+#endif
@@ -0,0 +1,562 @@
+/******************************************************************************/
+/* File: bench_notify.c
+   Author: N.Kim
+   Abstract: GATT notification benchmark (AcquireNotify vs. PropertiesChanged)
+
+   Description:
+     Spawns a private message bus (GTestDBus, requires dbus-daemon) and
+     a stand-in 'org.bluez' GattManager1 on its own thread, registers the
+     Environmental Sensing application (see gatt_ess.h) with it and makes
+     it notify a changing temperature to 1, 10 and 100 subscribers.
+
+     With AcquireNotify the stand-in acquires a socket per subscriber, a
+     reader thread standing in for the centrals drains them. With
+     StartNotify every value comes as a PropertiesChanged signal through
+     the bus, the stand-in fans it out to socket pairs standing in for
+     the centrals, as BlueZ would.
+
+     Reports notifications/sec as seen by the centrals, the CPU time per
+     notification of this process (application, stand-in and centrals)
+     and of the bus daemon, and the CPU time of the application thread
+     per subscriber and update.
+
+     bench_notify [-u updates] */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <glib.h>
+
+#include "gatt_ess.h"
+
+#define BENCH_SENSOR 4
+#define BENCH_MTU 247
+#define BENCH_TIMEOUT_US 10000000
+
+enum bench_mode {
+  BENCH_ACQUIRE,
+  BENCH_SIGNAL
+};
+
+static const char STANDIN_XML[] =
+  "<node>"
+  "  <interface name='org.bluez.GattManager1'>"
+  "    <method name='RegisterApplication'>"
+  "      <arg name='application' type='o' direction='in'/>"
+  "      <arg name='options' type='a{sv}' direction='in'/>"
+  "    </method>"
+  "    <method name='UnregisterApplication'>"
+  "      <arg name='application' type='o' direction='in'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+/* the stand-in's side of a run, set up on registration */
+struct standin {
+  GDBusConnection *con;
+  GMainLoop *loop;
+
+  enum bench_mode mode;
+  guint subscribers;
+
+  /* read by the centrals: the acquired sockets or the far ends of the
+     links the signals are fanned out to */
+  gint *central_fds;
+  gint *link_fds;
+
+  gchar *chrc_path;
+  guint signal_id;
+
+  gint epoll_fd;
+  GThread *reader;
+  atomic_ulong received;
+  atomic_int stop;
+};
+
+static const gchar *bus_address = NULL;
+static struct standin standin;
+
+static GMutex standin_lock;
+static GCond standin_cond;
+
+/******************************************************************************/
+
+static double cpu_time(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+/* CPU seconds of the bus daemon, a child of ours */
+
+static double daemon_cpu(void)
+{
+  DIR *dir = opendir("/proc");
+  struct dirent *entry;
+  double seconds = 0;
+
+  if (!dir) return 0;
+
+  while ((entry = readdir(dir)) != NULL)
+  {
+    char path[300], comm[64];
+    unsigned long utime, stime;
+    int ppid;
+
+    snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+
+    FILE *f = fopen(path, "r");
+
+    if (!f) continue;
+
+    /* pid (comm) state ppid, then 9 fields up to utime and stime */
+    if (fscanf(f, "%*d %63s %*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+               "%lu %lu", comm, &ppid, &utime, &stime) == 4 &&
+        ppid == getpid() && strcmp(comm, "(dbus-daemon)") == 0)
+      seconds += (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+    fclose(f);
+  }
+
+  closedir(dir);
+  return seconds;
+}
+
+/******************************************************************************/
+/* The centrals, one thread for all of them */
+
+static gpointer reader_thread(gpointer data)
+{
+  struct epoll_event events[64];
+  guint8 value[GATT_ESS_VALUE_LENGTH];
+
+  while (!atomic_load(&standin.stop))
+  {
+    const int n = epoll_wait(standin.epoll_fd, events, 64, 100);
+
+    for (int i = 0; i < n; ++i)
+    {
+      unsigned long got = 0;
+
+      /* one message, one notification */
+      while (recv(events[i].data.fd, value, sizeof(value), MSG_DONTWAIT) > 0)
+        got++;
+
+      atomic_fetch_add(&standin.received, got);
+    }
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+/* PropertiesChanged of the characteristic, to every central */
+
+static void on_value_changed(GDBusConnection *con,
+                             const gchar *sender,
+                             const gchar *obj_path,
+                             const gchar *iface_name,
+                             const gchar *signal_name,
+                             GVariant *params,
+                             gpointer udata)
+{
+  GVariant *changed = NULL;
+  const gchar *iface;
+
+  g_variant_get(params, "(&s@a{sv}@as)", &iface, &changed, NULL);
+
+  GVariant *value = g_variant_lookup_value(changed, "Value",
+                                           G_VARIANT_TYPE("ay"));
+
+  if (value)
+  {
+    gsize len;
+    const guint8 *bytes = g_variant_get_fixed_array(value, &len, 1);
+
+    for (guint i = 0; i < standin.subscribers; ++i)
+      if (send(standin.link_fds[i], bytes, len, MSG_NOSIGNAL) < 0)
+        g_printerr("Link %u: %s\n", i, g_strerror(errno));
+
+    g_variant_unref(value);
+  }
+
+  g_variant_unref(changed);
+}
+
+/******************************************************************************/
+/* The path of the first temperature characteristic of the application */
+
+static gchar *find_temperature(GDBusConnection *con,
+                               const gchar *sender,
+                               const gchar *app_path)
+{
+  GError *err = NULL;
+  GVariantIter *objects;
+  const gchar *path;
+  GVariant *ifaces;
+  gchar *found = NULL;
+
+  GVariant *ret = g_dbus_connection_call_sync(con, sender, app_path,
+    DBUS_OM_IFACE, "GetManagedObjects", NULL,
+    G_VARIANT_TYPE("(a{oa{sa{sv}}})"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+    &err);
+
+  g_assert(ret && err == NULL);
+  g_variant_get(ret, "(a{oa{sa{sv}}})", &objects);
+
+  while (g_variant_iter_next(objects, "{&o@a{sa{sv}}}", &path, &ifaces))
+  {
+    GVariant *props = g_variant_lookup_value(ifaces, BLUEZ_GATT_CHRC_IFACE,
+                                             G_VARIANT_TYPE("a{sv}"));
+    const gchar *uuid;
+
+    if (props && !found && g_variant_lookup(props, "UUID", "&s", &uuid) &&
+        strcmp(uuid, GATT_ESS_TEMPERATURE_UUID) == 0)
+      found = g_strdup(path);
+
+    if (props) g_variant_unref(props);
+    g_variant_unref(ifaces);
+  }
+
+  g_variant_iter_free(objects);
+  g_variant_unref(ret);
+  return found;
+}
+
+/******************************************************************************/
+
+static void add_central(gint fd)
+{
+  struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+
+  epoll_ctl(standin.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/******************************************************************************/
+/* What BlueZ does once centrals subscribe */
+
+static void subscribe(const gchar *sender)
+{
+  GError *err = NULL;
+  const guint n = standin.subscribers;
+
+  standin.central_fds = g_new(gint, n);
+  standin.link_fds = g_new(gint, n);
+  standin.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+  for (guint i = 0; i < n; ++i)
+  {
+    if (standin.mode == BENCH_ACQUIRE)
+    {
+      GUnixFDList *fd_list = NULL;
+      GVariantBuilder *builder =
+        g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+      gint32 handle;
+      guint16 mtu;
+
+      g_variant_builder_add(builder, "{sv}", "mtu",
+        g_variant_new_uint16(BENCH_MTU));
+
+      GVariant *ret = g_dbus_connection_call_with_unix_fd_list_sync(
+        standin.con, sender, standin.chrc_path, BLUEZ_GATT_CHRC_IFACE,
+        "AcquireNotify", g_variant_new("(a{sv})", builder),
+        G_VARIANT_TYPE("(hq)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+        &fd_list, NULL, &err);
+
+      g_assert(ret && err == NULL);
+      g_variant_get(ret, "(hq)", &handle, &mtu);
+
+      standin.central_fds[i] = g_unix_fd_list_get(fd_list, handle, &err);
+      standin.link_fds[i] = -1;
+
+      g_assert(standin.central_fds[i] >= 0);
+
+      g_variant_unref(ret);
+      g_variant_builder_unref(builder);
+      g_object_unref(fd_list);
+    }
+    else
+    {
+      gint fds[2];
+      const int ok = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0,
+                                fds);
+
+      g_assert(ok == 0);
+
+      standin.link_fds[i] = fds[0];
+      standin.central_fds[i] = fds[1];
+    }
+
+    add_central(standin.central_fds[i]);
+  }
+
+  if (standin.mode == BENCH_SIGNAL)
+  {
+    standin.signal_id = g_dbus_connection_signal_subscribe(standin.con,
+      sender, DBUS_PROPERTIES_IFACE, "PropertiesChanged",
+      standin.chrc_path, NULL, G_DBUS_SIGNAL_FLAGS_NONE, on_value_changed,
+      NULL, NULL);
+
+    GVariant *ret = g_dbus_connection_call_sync(standin.con, sender,
+      standin.chrc_path, BLUEZ_GATT_CHRC_IFACE, "StartNotify", NULL,
+      NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &err);
+
+    g_assert(ret && err == NULL);
+    g_variant_unref(ret);
+  }
+
+  atomic_store(&standin.received, 0);
+  atomic_store(&standin.stop, 0);
+  standin.reader = g_thread_new("centrals", reader_thread, NULL);
+}
+
+/******************************************************************************/
+
+static void unsubscribe(void)
+{
+  atomic_store(&standin.stop, 1);
+  g_thread_join(standin.reader);
+
+  if (standin.signal_id)
+    g_dbus_connection_signal_unsubscribe(standin.con, standin.signal_id);
+
+  standin.signal_id = 0;
+
+  /* the application sees its acquired sockets hang up */
+  for (guint i = 0; i < standin.subscribers; ++i)
+  {
+    close(standin.central_fds[i]);
+    if (standin.link_fds[i] >= 0) close(standin.link_fds[i]);
+  }
+
+  close(standin.epoll_fd);
+  g_free(standin.central_fds);
+  g_free(standin.link_fds);
+  g_free(standin.chrc_path);
+}
+
+/******************************************************************************/
+
+static void on_standin_method_call(GDBusConnection *con,
+                                   const gchar *sender,
+                                   const gchar *obj_path,
+                                   const gchar *iface_name,
+                                   const gchar *method_name,
+                                   GVariant *params,
+                                   GDBusMethodInvocation *invoc,
+                                   gpointer udata)
+{
+  const gchar *app_path;
+
+  /* the application keeps serving while we wait, it is on the main
+     thread */
+  if (strcmp(method_name, "RegisterApplication") == 0)
+  {
+    g_variant_get(params, "(&o@a{sv})", &app_path, NULL);
+
+    standin.chrc_path = find_temperature(con, sender, app_path);
+    g_assert(standin.chrc_path != NULL);
+
+    subscribe(sender);
+  }
+  else unsubscribe();
+
+  g_dbus_method_invocation_return_value(invoc, NULL);
+}
+
+/******************************************************************************/
+
+static gpointer standin_thread(gpointer data)
+{
+  GError *err = NULL;
+  GMainContext *ctx = g_main_context_new();
+
+  /* objects registered from here get dispatched in this context */
+  g_main_context_push_thread_default(ctx);
+
+  GDBusConnection *con = g_dbus_connection_new_for_address_sync(
+    bus_address,
+    G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+    G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+    NULL, NULL, &err);
+
+  g_assert(con && err == NULL);
+
+  GVariant *ret = g_dbus_connection_call_sync(con,
+    "org.freedesktop.DBus", "/org/freedesktop/DBus",
+    "org.freedesktop.DBus", "RequestName",
+    g_variant_new("(su)", BLUEZ_BUS_NAME, 0x4),
+    NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &err);
+
+  g_assert(ret && err == NULL);
+  g_variant_unref(ret);
+
+  GDBusNodeInfo *info = g_dbus_node_info_new_for_xml(STANDIN_XML, NULL);
+
+  GDBusInterfaceVTable vtable = { on_standin_method_call, NULL, NULL };
+
+  g_dbus_connection_register_object(con, ADAPTER_PATH,
+    info->interfaces[0], &vtable, NULL, NULL, &err);
+
+  g_assert(err == NULL);
+
+  g_mutex_lock(&standin_lock);
+  standin.con = con;
+  standin.loop = g_main_loop_new(ctx, FALSE);
+  g_cond_signal(&standin_cond);
+  g_mutex_unlock(&standin_lock);
+
+  g_main_loop_run(standin.loop);
+
+  g_dbus_node_info_unref(info);
+  g_object_unref(con);
+  g_main_context_pop_thread_default(ctx);
+  g_main_context_unref(ctx);
+  return NULL;
+}
+
+/******************************************************************************/
+
+static void on_registered(GError *err, gpointer udata)
+{
+  g_assert(err == NULL);
+  g_main_loop_quit(udata);
+}
+
+/******************************************************************************/
+
+static void run(GDBusConnection *conn,
+                GMainLoop *loop,
+                enum bench_mode mode,
+                guint subscribers,
+                guint updates)
+{
+  GError *err = NULL;
+  const guint sensor = BENCH_SENSOR;
+
+  struct gatt_ess *ess =
+    gatt_ess_new(conn, GATT_ESS_OBJECT_PATH, &sensor, 1, &err);
+
+  g_assert(ess && err == NULL);
+
+  /* read by the stand-in once it is called */
+  standin.mode = mode;
+  standin.subscribers = subscribers;
+
+  gatt_ess_register(ess, ADAPTER_PATH, TRUE, on_registered, loop);
+  g_main_loop_run(loop);
+
+  const double cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+  const double app = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+  const double bus = daemon_cpu();
+  const gint64 start = g_get_monotonic_time();
+
+  /* a new temperature every time, the humidity stays, one flush each */
+  for (guint u = 0; u < updates; ++u)
+  {
+    gatt_ess_update(ess, sensor, u % 1000, 500);
+
+    while (ess->flush_id) g_main_context_iteration(NULL, TRUE);
+  }
+
+  const double app_cpu = cpu_time(CLOCK_THREAD_CPUTIME_ID) - app;
+
+  /* until the centrals got all there is to get */
+  const unsigned long expected =
+    (unsigned long)updates * subscribers - ess->dropped;
+
+  while (atomic_load(&standin.received) < expected &&
+         g_get_monotonic_time() - start < BENCH_TIMEOUT_US)
+    g_usleep(100);
+
+  const double elapsed = (g_get_monotonic_time() - start) / 1e6;
+  const unsigned long received = atomic_load(&standin.received);
+  const double per = received ? received : 1;
+
+  g_print("%-14s %6u %12.0f %12.2f %12.2f %12.2f %8lu\n",
+          mode == BENCH_ACQUIRE ? "AcquireNotify" : "StartNotify",
+          subscribers, received / elapsed,
+          (cpu_time(CLOCK_PROCESS_CPUTIME_ID) - cpu) / per * 1e6,
+          (daemon_cpu() - bus) / per * 1e6,
+          app_cpu / ((double)updates * subscribers) * 1e6,
+          ess->dropped + (expected - received));
+
+  gatt_ess_register(ess, ADAPTER_PATH, FALSE, on_registered, loop);
+  g_main_loop_run(loop);
+
+  gatt_ess_free(ess);
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  GError *err = NULL;
+  const guint counts[] = { 1, 10, 100 };
+  int updates = 20000, opt;
+
+  while ((opt = getopt(argc, argv, "u:")) != -1)
+  {
+    if (opt == 'u') updates = atoi(optarg);
+    else updates = 0;
+  }
+
+  if (optind != argc || updates < 1)
+  {
+    g_printerr("usage: %s [-u updates]\n", argv[0]);
+    return 1;
+  }
+
+  GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+  g_test_dbus_up(bus);
+  bus_address = g_test_dbus_get_bus_address(bus);
+
+  GThread *thread = g_thread_new("standin", standin_thread, NULL);
+
+  g_mutex_lock(&standin_lock);
+  while (!standin.loop) g_cond_wait(&standin_cond, &standin_lock);
+  g_mutex_unlock(&standin_lock);
+
+  GDBusConnection *conn = g_dbus_connection_new_for_address_sync(
+    bus_address,
+    G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+    G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+    NULL, NULL, &err);
+
+  g_assert(conn && err == NULL);
+
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+  g_print("%d updates\n", updates);
+  g_print("%-14s %6s %12s %12s %12s %12s %8s\n", "", "subs", "notif/s",
+          "us CPU/notif", "us bus/notif", "us app/sub", "lost");
+
+  for (guint m = BENCH_ACQUIRE; m <= BENCH_SIGNAL; ++m)
+    for (guint i = 0; i < G_N_ELEMENTS(counts); ++i)
+      run(conn, loop, m, counts[i], updates);
+
+  g_main_loop_quit(standin.loop);
+  g_thread_join(thread);
+
+  g_main_loop_unref(loop);
+  g_object_unref(conn);
+  g_test_dbus_down(bus);
+  g_object_unref(bus);
+  return 0;
+}
@@ -0,0 +1,679 @@
+/******************************************************************************/
+/* File: gatt_ess.c
+   Author: N.Kim
+   Abstract: GATT Environmental Sensing service of DHT11 readings */
+/******************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include <gio/gunixfdlist.h>
+#include <glib-unix.h>
+
+#include "gatt_ess.h"
+#include "env_bridge.h"
+
+/* For simplicity, the properties are read-only and the characteristics
+   have no descriptors (the ES Measurement one being optional) */
+static const gchar introspect_xml[] =
+  "<node>"
+  "  <interface name='org.freedesktop.DBus.ObjectManager'>"
+  "    <method name='GetManagedObjects'>"
+  "      <arg name='objects' type='a{oa{sa{sv}}}' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "  <interface name='org.bluez.GattService1'>"
+  "    <property name='UUID' type='s' access='read'/>"
+  "    <property name='Primary' type='b' access='read'/>"
+  "  </interface>"
+  "  <interface name='org.bluez.GattCharacteristic1'>"
+  "    <method name='ReadValue'>"
+  "      <arg name='options' type='a{sv}' direction='in'/>"
+  "      <arg name='value' type='ay' direction='out'/>"
+  "    </method>"
+  "    <method name='AcquireNotify'>"
+  "      <arg name='options' type='a{sv}' direction='in'/>"
+  "      <arg name='fd' type='h' direction='out'/>"
+  "      <arg name='mtu' type='q' direction='out'/>"
+  "    </method>"
+  "    <method name='StartNotify'/>"
+  "    <method name='StopNotify'/>"
+  "    <property name='UUID' type='s' access='read'/>"
+  "    <property name='Service' type='o' access='read'/>"
+  "    <property name='Flags' type='as' access='read'/>"
+  "    <property name='Value' type='ay' access='read'/>"
+  "    <property name='Notifying' type='b' access='read'/>"
+  "    <property name='NotifyAcquired' type='b' access='read'/>"
+  "  </interface>"
+  "</node>";
+
+static const gchar *const service_properties[] = {
+  "UUID", "Primary", NULL
+};
+
+static const gchar *const chrc_properties[] = {
+  "UUID", "Service", "Flags", "Value", "Notifying", "NotifyAcquired", NULL
+};
+
+typedef GVariant *(*property_fn)(gconstpointer object, const gchar *name);
+
+/******************************************************************************/
+
+static GVariant *get_service_property(gconstpointer object,
+                                      const gchar *name)
+{
+  if (strcmp(name, "UUID") == 0)
+    return g_variant_new_string(GATT_ESS_SERVICE_UUID);
+
+  if (strcmp(name, "Primary") == 0)
+    return g_variant_new_boolean(TRUE);
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+static GVariant *get_chrc_property(gconstpointer object, const gchar *name)
+{
+  const struct gatt_ess_chrc *chrc = object;
+
+  if (strcmp(name, "UUID") == 0)
+    return g_variant_new_string(chrc->uuid);
+
+  if (strcmp(name, "Service") == 0)
+    return g_variant_new_object_path(chrc->service->path);
+
+  if (strcmp(name, "Flags") == 0)
+  {
+    const gchar *flags[] = { "read", "notify" };
+
+    return g_variant_new_strv(flags, 2);
+  }
+
+  if (strcmp(name, "Value") == 0)
+    return g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, chrc->value,
+                                     GATT_ESS_VALUE_LENGTH, 1);
+
+  if (strcmp(name, "Notifying") == 0)
+    return g_variant_new_boolean(chrc->notifying > 0);
+
+  if (strcmp(name, "NotifyAcquired") == 0)
+    return g_variant_new_boolean(chrc->subscribers->len > 0);
+
+  return NULL;
+}
+
+/******************************************************************************/
+/* All properties of an object as a{sv} */
+
+static GVariant *get_properties(const gchar *const *names,
+                                property_fn get,
+                                gconstpointer object)
+{
+  GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+
+  for (; *names; ++names)
+    g_variant_builder_add(builder, "{sv}", *names, get(object, *names));
+
+  GVariant *result = g_variant_builder_end(builder);
+  g_variant_builder_unref(builder);
+
+  return result;
+}
+
+/******************************************************************************/
+/* An object's one interface with its properties, as a{sa{sv}} */
+
+static GVariant *get_interfaces(const gchar *iface_name, GVariant *props)
+{
+  GVariantBuilder *builder =
+    g_variant_builder_new(G_VARIANT_TYPE("a{sa{sv}}"));
+
+  g_variant_builder_add(builder, "{s@a{sv}}", iface_name, props);
+
+  GVariant *result = g_variant_builder_end(builder);
+  g_variant_builder_unref(builder);
+
+  return result;
+}
+
+/******************************************************************************/
+
+static GVariant *on_get_property(GDBusConnection *con,
+                                 const gchar *sender,
+                                 const gchar *obj_path,
+                                 const gchar *iface_name,
+                                 const gchar *prop_name,
+                                 GError **err,
+                                 gpointer udata)
+{
+  /* the object is the service or the characteristic, by interface */
+  if (strcmp(iface_name, BLUEZ_GATT_SERVICE_IFACE) == 0)
+    return get_service_property(udata, prop_name);
+
+  return get_chrc_property(udata, prop_name);
+}
+
+/******************************************************************************/
+/* 'GetManagedObjects' on the root, the whole tree at once */
+
+static void on_root_method_call(GDBusConnection *con,
+                                const gchar *sender,
+                                const gchar *obj_path,
+                                const gchar *iface_name,
+                                const gchar *method_name,
+                                GVariant *params,
+                                GDBusMethodInvocation *invoc,
+                                gpointer udata)
+{
+  struct gatt_ess *ess = udata;
+
+  GVariantBuilder *builder =
+    g_variant_builder_new(G_VARIANT_TYPE("a{oa{sa{sv}}}"));
+
+  for (guint i = 0; i < ess->num_services; ++i)
+  {
+    const struct gatt_ess_service *service = &ess->services[i];
+
+    g_variant_builder_add(builder, "{o@a{sa{sv}}}", service->path,
+      get_interfaces(BLUEZ_GATT_SERVICE_IFACE,
+        get_properties(service_properties, get_service_property,
+                       service)));
+
+    for (guint j = 0; j < GATT_ESS_CHRCS; ++j)
+    {
+      const struct gatt_ess_chrc *chrc = &service->chrcs[j];
+
+      g_variant_builder_add(builder, "{o@a{sa{sv}}}", chrc->path,
+        get_interfaces(BLUEZ_GATT_CHRC_IFACE,
+          get_properties(chrc_properties, get_chrc_property, chrc)));
+    }
+  }
+
+  GVariant *result = g_variant_builder_end(builder);
+  g_variant_builder_unref(builder);
+
+  GVariant *tuples[1] = { result };
+
+  g_dbus_method_invocation_return_value(invoc,
+    g_variant_new_tuple(tuples, 1));
+}
+
+/******************************************************************************/
+
+static void remove_subscriber(struct gatt_ess_chrc *chrc, guint index)
+{
+  struct gatt_ess_subscriber *sub =
+    &g_array_index(chrc->subscribers, struct gatt_ess_subscriber, index);
+
+  if (sub->watch_id) g_source_remove(sub->watch_id);
+  close(sub->fd);
+
+  /* the order does not matter, every one gets the same */
+  g_array_remove_index_fast(chrc->subscribers, index);
+}
+
+/******************************************************************************/
+/* BlueZ closed its end, the central unsubscribed or went away */
+
+static gboolean on_subscriber_hup(gint fd,
+                                  GIOCondition cond,
+                                  gpointer udata)
+{
+  struct gatt_ess_chrc *chrc = udata;
+
+  for (guint i = 0; i < chrc->subscribers->len; ++i)
+  {
+    struct gatt_ess_subscriber *sub =
+      &g_array_index(chrc->subscribers, struct gatt_ess_subscriber, i);
+
+    if (sub->fd != fd) continue;
+
+    /* the source goes away with the return value */
+    sub->watch_id = 0;
+    remove_subscriber(chrc, i);
+    break;
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/******************************************************************************/
+
+static void acquire_notify(struct gatt_ess_chrc *chrc,
+                           GVariant *options,
+                           GDBusMethodInvocation *invoc)
+{
+  struct gatt_ess_subscriber sub = { -1, GATT_ESS_DEFAULT_MTU, 0 };
+  gint fds[2];
+
+  g_variant_lookup(options, "mtu", "q", &sub.mtu);
+
+  /* one write, one notification */
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0,
+                 fds) < 0)
+  {
+    g_dbus_method_invocation_return_dbus_error(invoc,
+      "org.bluez.Error.Failed", g_strerror(errno));
+    return;
+  }
+
+  sub.fd = fds[0];
+  sub.watch_id = g_unix_fd_add(sub.fd, G_IO_HUP | G_IO_ERR,
+                               on_subscriber_hup, chrc);
+
+  g_array_append_val(chrc->subscribers, sub);
+
+  /* the list owns the other end from now on */
+  GUnixFDList *fd_list = g_unix_fd_list_new_from_array(&fds[1], 1);
+
+  g_dbus_method_invocation_return_value_with_unix_fd_list(invoc,
+    g_variant_new("(hq)", 0, sub.mtu), fd_list);
+
+  g_object_unref(fd_list);
+}
+
+/******************************************************************************/
+
+static void on_chrc_method_call(GDBusConnection *con,
+                                const gchar *sender,
+                                const gchar *obj_path,
+                                const gchar *iface_name,
+                                const gchar *method_name,
+                                GVariant *params,
+                                GDBusMethodInvocation *invoc,
+                                gpointer udata)
+{
+  struct gatt_ess_chrc *chrc = udata;
+
+  if (strcmp(method_name, "ReadValue") == 0)
+  {
+    GVariant *options = NULL;
+    guint16 offset = 0;
+
+    g_variant_get(params, "(@a{sv})", &options);
+    g_variant_lookup(options, "offset", "q", &offset);
+    g_variant_unref(options);
+
+    if (!chrc->service->have_reading)
+    {
+      g_dbus_method_invocation_return_dbus_error(invoc,
+        "org.bluez.Error.Failed", "No reading yet");
+    }
+    else if (offset > GATT_ESS_VALUE_LENGTH)
+    {
+      g_dbus_method_invocation_return_dbus_error(invoc,
+        "org.bluez.Error.InvalidOffset", "Invalid offset");
+    }
+    else
+    {
+      GVariant *value = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
+        chrc->value + offset, GATT_ESS_VALUE_LENGTH - offset, 1);
+
+      g_dbus_method_invocation_return_value(invoc,
+        g_variant_new_tuple(&value, 1));
+    }
+  }
+  else if (strcmp(method_name, "AcquireNotify") == 0)
+  {
+    GVariant *options = NULL;
+
+    g_variant_get(params, "(@a{sv})", &options);
+    acquire_notify(chrc, options, invoc);
+    g_variant_unref(options);
+  }
+  else if (strcmp(method_name, "StartNotify") == 0)
+  {
+    chrc->notifying++;
+    g_dbus_method_invocation_return_value(invoc, NULL);
+  }
+  else
+  {
+    /* 'StopNotify' */
+    if (chrc->notifying > 0) chrc->notifying--;
+    g_dbus_method_invocation_return_value(invoc, NULL);
+  }
+}
+
+/******************************************************************************/
+
+static const GDBusInterfaceVTable root_vtable = {
+  on_root_method_call,
+  NULL,
+  NULL
+};
+
+static const GDBusInterfaceVTable service_vtable = {
+  NULL,
+  on_get_property,
+  NULL
+};
+
+static const GDBusInterfaceVTable chrc_vtable = {
+  on_chrc_method_call,
+  on_get_property,
+  NULL
+};
+
+/******************************************************************************/
+/* For those who did 'StartNotify', as 'PropertiesChanged' of the value */
+
+static void emit_value_changed(struct gatt_ess *ess,
+                               const struct gatt_ess_chrc *chrc)
+{
+  GVariantBuilder *prop_builder =
+    g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+
+  GVariantBuilder *inv_prop_builder =
+    g_variant_builder_new(G_VARIANT_TYPE("as"));
+
+  g_variant_builder_add(prop_builder, "{sv}", "Value",
+    get_chrc_property(chrc, "Value"));
+
+  GVariant *args[3] = {
+    g_variant_new_string(BLUEZ_GATT_CHRC_IFACE),
+    g_variant_builder_end(prop_builder),
+    g_variant_builder_end(inv_prop_builder)
+  };
+
+  g_dbus_connection_emit_signal(ess->conn, NULL, chrc->path,
+    DBUS_PROPERTIES_IFACE, "PropertiesChanged",
+    g_variant_new_tuple(args, 3), NULL);
+
+  g_variant_builder_unref(prop_builder);
+  g_variant_builder_unref(inv_prop_builder);
+  ess->signals++;
+}
+
+/******************************************************************************/
+/* Every characteristic changed since the last time, to every subscriber.
+   Runs once the main loop has nothing more urgent to do, the updates of
+   a burst of readings go out together */
+
+static gboolean on_flush(gpointer udata)
+{
+  struct gatt_ess *ess = udata;
+
+  ess->flush_id = 0;
+  ess->flushes++;
+
+  for (guint i = 0; i < ess->num_services; ++i)
+  {
+    for (guint j = 0; j < GATT_ESS_CHRCS; ++j)
+    {
+      struct gatt_ess_chrc *chrc = &ess->services[i].chrcs[j];
+
+      if (!chrc->dirty) continue;
+
+      chrc->dirty = FALSE;
+
+      /* the same bytes for everyone */
+      for (guint k = 0; k < chrc->subscribers->len;)
+      {
+        const struct gatt_ess_subscriber *sub =
+          &g_array_index(chrc->subscribers, struct gatt_ess_subscriber, k);
+
+        if (send(sub->fd, chrc->value, GATT_ESS_VALUE_LENGTH,
+                 MSG_DONTWAIT | MSG_NOSIGNAL) == GATT_ESS_VALUE_LENGTH)
+        {
+          ess->notifications++;
+          k++;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+        {
+          /* not keeping up, the next value will do */
+          ess->dropped++;
+          k++;
+        }
+        else remove_subscriber(chrc, k);
+      }
+
+      if (chrc->notifying) emit_value_changed(ess, chrc);
+    }
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/******************************************************************************/
+
+void gatt_ess_update(struct gatt_ess *ess,
+                     guint sensor,
+                     gint temperature,
+                     guint humidity)
+{
+  struct gatt_ess_service *service = NULL;
+  guint8 values[GATT_ESS_CHRCS][GATT_ESS_VALUE_LENGTH];
+
+  for (guint i = 0; i < ess->num_services && !service; ++i)
+    if (ess->services[i].sensor == sensor) service = &ess->services[i];
+
+  if (!service) return;
+
+  ess->updates++;
+
+  /* encoded here once, whoever is subscribed gets these bytes */
+  env_ess_put_temperature(values[GATT_ESS_TEMPERATURE], temperature);
+  env_ess_put_humidity(values[GATT_ESS_HUMIDITY], humidity);
+
+  for (guint j = 0; j < GATT_ESS_CHRCS; ++j)
+  {
+    struct gatt_ess_chrc *chrc = &service->chrcs[j];
+
+    /* unchanged values are not notified */
+    if (service->have_reading &&
+        memcmp(chrc->value, values[j], GATT_ESS_VALUE_LENGTH) == 0)
+      continue;
+
+    memcpy(chrc->value, values[j], GATT_ESS_VALUE_LENGTH);
+    chrc->dirty = TRUE;
+
+    if (!ess->flush_id) ess->flush_id = g_idle_add(on_flush, ess);
+  }
+
+  service->have_reading = TRUE;
+}
+
+/******************************************************************************/
+
+guint gatt_ess_subscribers(const struct gatt_ess *ess)
+{
+  guint count = 0;
+
+  for (guint i = 0; i < ess->num_services; ++i)
+    for (guint j = 0; j < GATT_ESS_CHRCS; ++j)
+      count += ess->services[i].chrcs[j].subscribers->len;
+
+  return count;
+}
+
+/******************************************************************************/
+
+struct gatt_ess *gatt_ess_new(GDBusConnection *conn,
+                              const gchar *root,
+                              const guint *sensors,
+                              guint num_sensors,
+                              GError **err)
+{
+  struct gatt_ess *ess = g_new0(struct gatt_ess, 1);
+  const gchar *uuids[GATT_ESS_CHRCS] = {
+    GATT_ESS_TEMPERATURE_UUID,
+    GATT_ESS_HUMIDITY_UUID
+  };
+
+  ess->conn = g_object_ref(conn);
+  ess->root = g_strdup(root);
+
+  ess->introspect_data = g_dbus_node_info_new_for_xml(introspect_xml, NULL);
+  g_assert(ess->introspect_data != NULL);
+
+  GDBusInterfaceInfo *root_iface = g_dbus_node_info_lookup_interface(
+    ess->introspect_data, DBUS_OM_IFACE);
+
+  GDBusInterfaceInfo *service_iface = g_dbus_node_info_lookup_interface(
+    ess->introspect_data, BLUEZ_GATT_SERVICE_IFACE);
+
+  GDBusInterfaceInfo *chrc_iface = g_dbus_node_info_lookup_interface(
+    ess->introspect_data, BLUEZ_GATT_CHRC_IFACE);
+
+  g_assert(root_iface && service_iface && chrc_iface);
+
+  ess->root_id = g_dbus_connection_register_object(conn, root, root_iface,
+    &root_vtable, ess, NULL, err);
+
+  if (ess->root_id == 0) goto failed;
+
+  ess->services = g_new0(struct gatt_ess_service, num_sensors);
+  ess->num_services = num_sensors;
+
+  for (guint i = 0; i < num_sensors; ++i)
+  {
+    struct gatt_ess_service *service = &ess->services[i];
+
+    service->ess = ess;
+    service->sensor = sensors[i];
+    service->path = g_strdup_printf("%s/service%u", root, sensors[i]);
+
+    for (guint j = 0; j < GATT_ESS_CHRCS; ++j)
+    {
+      struct gatt_ess_chrc *chrc = &service->chrcs[j];
+
+      chrc->service = service;
+      chrc->uuid = uuids[j];
+      chrc->path = g_strdup_printf("%s/char%u", service->path, j);
+      chrc->subscribers = g_array_new(FALSE, FALSE,
+                                      sizeof(struct gatt_ess_subscriber));
+    }
+
+    /* a GPIO given twice fails here, the path is taken */
+    service->reg_id = g_dbus_connection_register_object(conn,
+      service->path, service_iface, &service_vtable, service, NULL, err);
+
+    if (service->reg_id == 0) goto failed;
+
+    for (guint j = 0; j < GATT_ESS_CHRCS; ++j)
+    {
+      struct gatt_ess_chrc *chrc = &service->chrcs[j];
+
+      chrc->reg_id = g_dbus_connection_register_object(conn, chrc->path,
+        chrc_iface, &chrc_vtable, chrc, NULL, err);
+
+      if (chrc->reg_id == 0) goto failed;
+    }
+  }
+
+  return ess;
+
+failed:
+  gatt_ess_free(ess);
+  return NULL;
+}
+
+/******************************************************************************/
+
+void gatt_ess_free(struct gatt_ess *ess)
+{
+  if (!ess) return;
+
+  for (guint i = 0; i < ess->num_services; ++i)
+  {
+    struct gatt_ess_service *service = &ess->services[i];
+
+    for (guint j = 0; j < GATT_ESS_CHRCS; ++j)
+    {
+      struct gatt_ess_chrc *chrc = &service->chrcs[j];
+
+      while (chrc->subscribers && chrc->subscribers->len)
+        remove_subscriber(chrc, chrc->subscribers->len - 1);
+
+      if (chrc->reg_id)
+        g_dbus_connection_unregister_object(ess->conn, chrc->reg_id);
+
+      if (chrc->subscribers) g_array_free(chrc->subscribers, TRUE);
+      g_free(chrc->path);
+    }
+
+    if (service->reg_id)
+      g_dbus_connection_unregister_object(ess->conn, service->reg_id);
+
+    g_free(service->path);
+  }
+
+  if (ess->root_id)
+    g_dbus_connection_unregister_object(ess->conn, ess->root_id);
+
+  if (ess->flush_id) g_source_remove(ess->flush_id);
+
+  g_free(ess->services);
+  g_dbus_node_info_unref(ess->introspect_data);
+  g_object_unref(ess->conn);
+  g_free(ess->root);
+  g_free(ess);
+}
+
+/******************************************************************************/
+
+static void on_register_reply(GObject *source_object,
+                              GAsyncResult *res,
+                              gpointer user_data)
+{
+  struct gatt_ess *ess = user_data;
+
+  GError *err = NULL;
+  GVariant *ret = g_dbus_connection_call_finish(
+    G_DBUS_CONNECTION(source_object), res, &err);
+
+  if (ret) g_variant_unref(ret);
+
+  if (ess->on_done) ess->on_done(err, ess->done_udata);
+
+  g_clear_error(&err);
+}
+
+/******************************************************************************/
+
+void gatt_ess_register(struct gatt_ess *ess,
+                       const gchar *adapter,
+                       gboolean enable,
+                       gatt_ess_done_cb done,
+                       gpointer udata)
+{
+  GVariant *args;
+
+  ess->on_done = done;
+  ess->done_udata = udata;
+
+  if (enable)
+  {
+    /* no options */
+    GVariantBuilder *builder =
+      g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+
+    GVariant *params[2] = {
+      g_variant_new_object_path(ess->root),
+      g_variant_builder_end(builder)
+    };
+
+    g_variant_builder_unref(builder);
+    args = g_variant_new_tuple(params, 2);
+  }
+  else args = g_variant_new("(o)", ess->root);
+
+  /* no waiting here, BlueZ calls 'GetManagedObjects' before replying */
+  g_dbus_connection_call(
+    ess->conn,
+    BLUEZ_BUS_NAME,          /* org.bluez */
+    adapter,                 /* /org/bluez/hci0 */
+    BLUEZ_GATT_MAN_IFACE,    /* org.bluez.GattManager1 */
+    enable ? "RegisterApplication" : "UnregisterApplication",
+    args,
+    NULL,
+    G_DBUS_CALL_FLAGS_NONE,
+    G_MAXINT,
+    NULL,
+    on_register_reply,
+    ess);
+}
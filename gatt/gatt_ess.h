@@ -0,0 +1,147 @@
+/******************************************************************************/
+/* File: gatt_ess.h
+   Author: N.Kim
+   Abstract: GATT Environmental Sensing service of DHT11 readings
+
+   Description:
+     A GATT application as BlueZ wants it (see GattManager1): a root
+     object implementing 'GetManagedObjects', below it an Environmental
+     Sensing service per sensor with a Temperature and a Humidity
+     characteristic, both to be read and notified.
+
+     Notifications go through 'AcquireNotify': every call hands out one
+     end of a socket pair, each write to it being one notification. The
+     value of a characteristic is encoded once, into the characteristic,
+     and that buffer is written to every socket. Updates coming in during
+     one main loop iteration are coalesced, the sockets see the last
+     value only. 'StartNotify' (PropertiesChanged of 'Value' for every
+     update) is there for whoever does not acquire. */
+/******************************************************************************/
+
+#ifndef GATT_ESS_H
+#define GATT_ESS_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+/* bluez and GDBus paths and interfaces */
+#define BLUEZ_BUS_NAME "org.bluez"
+#define BLUEZ_GATT_MAN_IFACE "org.bluez.GattManager1"
+#define BLUEZ_GATT_SERVICE_IFACE "org.bluez.GattService1"
+#define BLUEZ_GATT_CHRC_IFACE "org.bluez.GattCharacteristic1"
+#define DBUS_OM_IFACE "org.freedesktop.DBus.ObjectManager"
+#define DBUS_PROPERTIES_IFACE "org.freedesktop.DBus.Properties"
+
+#define GATT_ESS_OBJECT_PATH "/org/bitzap/dev/gatt"
+#define ADAPTER_PATH "/org/bluez/hci0"
+
+#define GATT_ESS_SERVICE_UUID "0000181a-0000-1000-8000-00805f9b34fb"
+#define GATT_ESS_TEMPERATURE_UUID "00002a6e-0000-1000-8000-00805f9b34fb"
+#define GATT_ESS_HUMIDITY_UUID "00002a6f-0000-1000-8000-00805f9b34fb"
+
+/* both values are 2 bytes, see env_bridge.h */
+#define GATT_ESS_VALUE_LENGTH 2
+
+/* the ATT default, if BlueZ does not tell */
+#define GATT_ESS_DEFAULT_MTU 23
+
+enum gatt_ess_chrc_index {
+  GATT_ESS_TEMPERATURE,
+  GATT_ESS_HUMIDITY,
+  GATT_ESS_CHRCS
+};
+
+/* the sending end of an acquired notification socket */
+struct gatt_ess_subscriber {
+  gint fd;
+  guint16 mtu;
+  guint watch_id;
+};
+
+struct gatt_ess_chrc {
+  gchar *path;
+  const gchar *uuid;
+  struct gatt_ess_service *service;
+  guint reg_id;
+
+  /* the encoded value, shared by all subscribers */
+  guint8 value[GATT_ESS_VALUE_LENGTH];
+  gboolean dirty;
+
+  /* acquired sockets, and 'StartNotify' calls not stopped yet */
+  GArray *subscribers;
+  guint notifying;
+};
+
+struct gatt_ess_service {
+  gchar *path;
+  guint sensor;
+  guint reg_id;
+
+  /* nothing to read before the first reading */
+  gboolean have_reading;
+
+  struct gatt_ess_chrc chrcs[GATT_ESS_CHRCS];
+  struct gatt_ess *ess;
+};
+
+/* invoked once 'RegisterApplication' or 'UnregisterApplication' got
+   its reply, 'err' is NULL on success */
+typedef void (*gatt_ess_done_cb)(GError *err, gpointer udata);
+
+struct gatt_ess {
+  GDBusConnection *conn;
+  gchar *root;
+  guint root_id;
+
+  struct gatt_ess_service *services;
+  guint num_services;
+
+  GDBusNodeInfo *introspect_data;
+  guint flush_id;
+
+  gatt_ess_done_cb on_done;
+  gpointer done_udata;
+
+  /* updates taken, flushes (one per main loop iteration at most),
+     notifications written, not written as the socket was full, signals
+     emitted */
+  unsigned long updates;
+  unsigned long flushes;
+  unsigned long notifications;
+  unsigned long dropped;
+  unsigned long signals;
+};
+
+/* exports the application below 'root', a service for each of 'sensors'
+   (GPIOs). Returns NULL (and 'err' set) if an object can not be
+   exported */
+struct gatt_ess *gatt_ess_new(GDBusConnection *conn,
+                              const gchar *root,
+                              const guint *sensors,
+                              guint num_sensors,
+                              GError **err);
+
+/* closes the subscriber sockets, unexports the objects */
+void gatt_ess_free(struct gatt_ess *ess);
+
+/* (un)registers the application with the GattManager1 of 'adapter'.
+   BlueZ reads the objects before it replies, the main loop has to run */
+void gatt_ess_register(struct gatt_ess *ess,
+                       const gchar *adapter,
+                       gboolean enable,
+                       gatt_ess_done_cb done,
+                       gpointer udata);
+
+/* a reading of 'sensor' (tenths of a degree and of a percent), ignored
+   if there is no service for it. The characteristics that changed are
+   notified from the main loop */
+void gatt_ess_update(struct gatt_ess *ess,
+                     guint sensor,
+                     gint temperature,
+                     guint humidity);
+
+/* the subscribers of all characteristics */
+guint gatt_ess_subscribers(const struct gatt_ess *ess);
+
+#endif
@@ -0,0 +1,206 @@
+/******************************************************************************/
+/* File: gatt_server.c
+   Author: N.Kim
+   Abstract: Simple C DBus/BlueZ GATT server example
+
+   Description:
+     Serves the readings the sensor sends to 'socket' (see
+     ../dht11/monitor.c and ../common/env_bridge.h) as Environmental
+     Sensing services, one for each GPIO given (the sensor's usual one,
+     4, by default). Centrals read the values or subscribe to their
+     notifications, see gatt_ess.h.
+
+     gatt_server [-g gpio,...] socket */
+
+/******************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "gatt_ess.h"
+#include "env_bridge.h"
+
+#define GATT_MAX_SENSORS 64
+#define GATT_DEFAULT_GPIO 4
+
+static GMainLoop *loop = NULL;
+static GDBusConnection *conn = NULL;
+static struct gatt_ess *ess = NULL;
+static struct env_bridge bridge = { .fd = -1 };
+
+/* global event processing flags */
+static int loop_done = 0;
+static int registering = 0;
+
+/******************************************************************************/
+
+void on_signal_received(int signo)
+{
+  if (signo == SIGINT) loop_done = 1;
+}
+
+/******************************************************************************/
+
+static gboolean on_loop_idle(gpointer udata)
+{
+  /* triggered via SIGINT */
+  if (loop_done)
+  {
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/******************************************************************************/
+
+static void on_registered(GError *err, gpointer udata)
+{
+  g_print("Application %s: %s\n", registering ? "registered" :
+          "unregistered", err ? err->message : "ok");
+
+  /* the unregistration at exit runs a main loop of its own */
+  if (!registering) g_main_loop_quit(loop);
+}
+
+/******************************************************************************/
+
+static gboolean on_bridge_readable(gint fd, GIOCondition cond,
+                                   gpointer udata)
+{
+  struct env_bridge_msg msg;
+  int got;
+
+  /* all there is, the notifications go out once they are read */
+  while ((got = env_bridge_recv(&bridge, &msg)) == 1)
+    gatt_ess_update(ess, msg.sensor, msg.temperature, msg.humidity);
+
+  if (got < 0)
+  {
+    g_printerr("Failed reading the bridge: %s\n", g_strerror(errno));
+    loop_done = 1;
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/******************************************************************************/
+
+static int parse_sensors(const char *arg, guint *sensors)
+{
+  /* a comma separated list of GPIOs */
+  int num = 0;
+
+  for (;;)
+  {
+    char *end;
+    const long gpio = strtol(arg, &end, 10);
+
+    if (end == arg || gpio < 0 || gpio >= GATT_MAX_SENSORS ||
+        num == GATT_MAX_SENSORS)
+      return -1;
+
+    sensors[num++] = gpio;
+
+    if (*end == 0) return num;
+    if (*end != ',') return -1;
+
+    arg = end + 1;
+  }
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  GError *err = NULL;
+  guint sensors[GATT_MAX_SENSORS] = { GATT_DEFAULT_GPIO };
+  int num_sensors = 1, opt;
+
+  while ((opt = getopt(argc, argv, "g:")) != -1)
+  {
+    if (opt != 'g' || (num_sensors = parse_sensors(optarg, sensors)) < 0)
+    {
+      optind = argc;
+      break;
+    }
+  }
+
+  if (optind + 1 != argc)
+  {
+    g_printerr("usage: %s [-g gpio,...] socket\n", argv[0]);
+    return 1;
+  }
+
+  conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &err);
+  g_print("Connecting to the system D-Bus...");
+
+  if (err != NULL || conn == NULL)
+  {
+    g_print("failed\n");
+    goto done;
+  } else g_print("ok\n");
+
+  g_print("Exporting %d service(s)...", num_sensors);
+
+  ess = gatt_ess_new(conn, GATT_ESS_OBJECT_PATH, sensors, num_sensors,
+                     &err);
+
+  if (ess == NULL)
+  {
+    g_print("failed: %s\n", err->message);
+    goto done;
+  } else g_print("ok\n");
+
+  g_print("Opening the bridge %s...", argv[optind]);
+
+  if (env_bridge_receiver(&bridge, argv[optind]) < 0)
+  {
+    g_print("failed\n");
+    goto done;
+  } else g_print("ok\n");
+
+  loop = g_main_loop_new(NULL, FALSE);
+
+  g_unix_fd_add(bridge.fd, G_IO_IN, on_bridge_readable, NULL);
+
+  /* BlueZ reads the objects back before it replies, hence the loop has
+     to run by then */
+  registering = 1;
+  gatt_ess_register(ess, ADAPTER_PATH, TRUE, on_registered, NULL);
+
+  signal(SIGINT, on_signal_received);
+
+  /* kick off the main loop now. Be careful not to have anything
+     blocking in 'on_loop_idle' */
+  g_idle_add(on_loop_idle, NULL);
+  g_main_loop_run(loop);
+
+  g_print("\n%lu readings, %lu notifications in %lu flushes, %lu dropped, "
+          "%lu signals, %u subscribers left\n", ess->updates,
+          ess->notifications, ess->flushes, ess->dropped, ess->signals,
+          gatt_ess_subscribers(ess));
+
+  /* wait for the reply, so the application is really gone before we
+     drop the connection */
+  registering = 0;
+  gatt_ess_register(ess, ADAPTER_PATH, FALSE, on_registered, NULL);
+  g_main_loop_run(loop);
+
+done:
+  env_bridge_close(&bridge);
+  gatt_ess_free(ess);
+  g_clear_error(&err);
+  if (loop) g_main_loop_unref(loop);
+  if (conn) g_object_unref(conn);
+  return 0;
+}
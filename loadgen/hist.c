@@ -0,0 +1,138 @@
+/******************************************************************************/
+/* File: hist.c
+   Author: N.Kim
+   Abstract: Log-linear histograms of latencies and rates */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "hist.h"
+
+#define SUB_BUCKETS (1 << HIST_SUB_BITS)
+
+/* widest bar of hist_print() */
+#define BAR_WIDTH 50
+
+/******************************************************************************/
+
+static unsigned int bucket_of(uint64_t value)
+{
+  if (value >= (uint64_t)1 << 32) value = ((uint64_t)1 << 32) - 1;
+
+  if (value < 2 * SUB_BUCKETS) return value;
+
+  const unsigned int msb = 63 - __builtin_clzll(value);
+  const unsigned int shift = msb - HIST_SUB_BITS;
+
+  return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/******************************************************************************/
+
+static uint64_t bucket_low(unsigned int bucket)
+{
+  if (bucket < 2 * SUB_BUCKETS) return bucket;
+
+  const unsigned int shift = bucket / SUB_BUCKETS - 1;
+
+  return (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+/******************************************************************************/
+
+void hist_reset(struct hist *h)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+/******************************************************************************/
+
+void hist_add(struct hist *h, uint64_t value)
+{
+  h->buckets[bucket_of(value)]++;
+  h->count++;
+  h->sum += value;
+
+  if (value > h->max) h->max = value;
+}
+
+/******************************************************************************/
+
+void hist_merge(struct hist *into, const struct hist *from)
+{
+  for (unsigned int i = 0; i < HIST_BUCKETS; ++i)
+    into->buckets[i] += from->buckets[i];
+
+  into->count += from->count;
+  into->sum += from->sum;
+
+  if (from->max > into->max) into->max = from->max;
+}
+
+/******************************************************************************/
+
+uint64_t hist_percentile(const struct hist *h, double fraction)
+{
+  /* the rank of the sample asked for, counting from 1 */
+  const uint64_t rank = fraction * h->count + 0.5 < 1 ? 1 :
+    (uint64_t)(fraction * h->count + 0.5);
+  uint64_t seen = 0;
+
+  if (h->count == 0) return 0;
+
+  for (unsigned int i = 0; i < HIST_BUCKETS; ++i)
+  {
+    seen += h->buckets[i];
+
+    if (seen < rank) continue;
+
+    /* never beyond what has actually been seen */
+    const uint64_t mid = (bucket_low(i) + bucket_low(i + 1)) / 2;
+
+    return mid > h->max ? h->max : mid;
+  }
+
+  return h->max;
+}
+
+/******************************************************************************/
+
+void hist_print(const struct hist *h,
+                FILE *f,
+                double scale,
+                const char *unit)
+{
+  uint64_t groups[64] = { 0 };
+  uint64_t widest = 0;
+  int first = -1, last = -1;
+
+  /* a line per power of two is plenty for reading it */
+  for (unsigned int i = 0; i < HIST_BUCKETS; ++i)
+  {
+    if (h->buckets[i] == 0) continue;
+
+    const uint64_t low = bucket_low(i);
+    const int group = low ? 64 - __builtin_clzll(low) : 0;
+
+    groups[group] += h->buckets[i];
+
+    if (first < 0) first = group;
+    last = group;
+  }
+
+  for (int g = first; g >= 0 && g <= last; ++g)
+    if (groups[g] > widest) widest = groups[g];
+
+  for (int g = first; g >= 0 && g <= last; ++g)
+  {
+    const unsigned int width = widest ? groups[g] * BAR_WIDTH / widest : 0;
+    char bar[BAR_WIDTH + 1];
+
+    memset(bar, '#', width);
+    bar[width] = '\0';
+
+    fprintf(f, "  < %10.3f %-4s %10llu %s\n",
+            ((uint64_t)1 << g) / scale, unit,
+            (unsigned long long)groups[g], bar);
+  }
+}
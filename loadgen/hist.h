@@ -0,0 +1,42 @@
+/******************************************************************************/
+/* File: hist.h
+   Author: N.Kim
+   Abstract: Log-linear histograms of latencies and rates */
+/******************************************************************************/
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* values below 32 get a bucket each, above that every power of two is
+   split into 16 buckets, i.e. the error stays below 6.25% up to 2^32 */
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS 464
+
+struct hist {
+  uint64_t count;
+  uint64_t max;
+  uint64_t sum;
+  uint32_t buckets[HIST_BUCKETS];
+};
+
+void hist_reset(struct hist *h);
+void hist_add(struct hist *h, uint64_t value);
+
+/* all of 'from' into 'into' */
+void hist_merge(struct hist *into, const struct hist *from);
+
+/* value below which 'fraction' (0..1) of the samples are, the middle of
+   the bucket it falls into. 0 if there are no samples */
+uint64_t hist_percentile(const struct hist *h, double fraction);
+
+/* bars per power of two, 'scale' divides the values (e.g. 1000 to
+   print microseconds as milliseconds) */
+void hist_print(const struct hist *h,
+                FILE *f,
+                double scale,
+                const char *unit);
+
+#endif
@@ -0,0 +1,865 @@
+/******************************************************************************/
+/* File: loadgen.c
+   Author: N.Kim
+   Abstract: Load generator for the morse and profile servers
+
+   Description:
+     Runs thousands of client sessions from a single thread, all of them
+     on non-blocking sockets driven by one epoll instance. The servers
+     listen on local stand-ins of the Bluetooth links for this, i.e.
+     UNIX sockets or TCP on the loopback (see sock_url.h).
+
+     Every session follows the same script (see pattern.h), speaking
+     either the morse packet protocol (morse_wire.h) or the framed
+     profile protocol (profile_frame.h). Each message is followed by an
+     echo request, a morse acknowledgment or a profile ping, the time
+     until the echo arrives is the latency of the message.
+
+     Reports messages and characters per second plus the latency
+     percentiles per interval, and at the end the p50/p99/p999 of the
+     connect time, the latency and the per interval throughput along
+     with their histograms.
+
+     loadgen [-P morse|profile] [-c sessions] [-r connects/s]
+             [-d seconds] [-i interval] [-p pattern | -f pattern-file]
+             [-m mtu] [-t timeout-ms] url */
+
+/******************************************************************************/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "hist.h"
+#include "morse_wire.h"
+#include "pattern.h"
+#include "profile_frame.h"
+#include "sock_url.h"
+
+#define DEFAULT_SESSIONS 1000
+#define DEFAULT_PATTERN "send 32; sleep 50-150; repeat 0"
+#define DEFAULT_SECONDS 10
+#define DEFAULT_TIMEOUT_MS 5000
+
+/* events handled per epoll_wait */
+#define EPOLL_BATCH 256
+
+/* both echo requests are 8 bytes, the acknowledgment of the morse
+   protocol as well as a ping frame with a 32-bit sequence number */
+#define ECHO_LENGTH 8
+#define PING_PAYLOAD 4
+
+/* connects refused for a full backlog are retried that much later */
+#define RETRY_MS 10
+
+#define NS_PER_MS 1000000ull
+#define NS_PER_US 1000ull
+
+enum protocol {
+  PROTOCOL_MORSE,
+  PROTOCOL_PROFILE
+};
+
+enum session_state {
+  SESSION_WAITING,       /* for its turn to connect */
+  SESSION_CONNECTING,
+  SESSION_RUNNING,       /* about to take the next step */
+  SESSION_SENDING,       /* messages of a step out, echoes pending */
+  SESSION_SLEEPING,
+  SESSION_DONE
+};
+
+/* the body of a message, the same for every session. Packets go out
+   one at a time, they keep their boundaries on sequential packet
+   sockets (morse over unix://) */
+struct message {
+  unsigned char *data;
+  size_t *offsets;
+  unsigned int num_packets;
+};
+
+struct session {
+  int fd;
+  enum session_state state;
+  unsigned int step;
+  unsigned int repeats[PATTERN_MAX_STEPS];
+
+  /* messages of the step not started yet. 'packet' is the one being
+     written, 'num_packets' of the body stands for the echo request,
+     anything beyond means no message is on the way */
+  unsigned int to_send;
+  unsigned int packet;
+  size_t offset;
+  int want_out;
+  unsigned char request[ECHO_LENGTH];
+
+  uint32_t sequence;
+  uint32_t echoed;
+  uint64_t sent_at[PATTERN_MAX_BURST];
+
+  unsigned char reply[ECHO_LENGTH];
+  unsigned int reply_fill;
+
+  /* connect start, echo timeout, wake up from sleeping */
+  uint64_t started;
+  uint64_t deadline;
+  uint64_t wake;
+  int heap_pos;
+};
+
+struct counters {
+  uint64_t messages;
+  uint64_t chars;
+  uint64_t bytes;
+};
+
+static enum protocol protocol = PROTOCOL_MORSE;
+static struct sock_url url;
+static struct pattern pattern;
+static struct message messages[PATTERN_MAX_STEPS];
+static size_t mtu = MORSE_DEFAULT_MTU;
+static uint64_t timeout_ns = DEFAULT_TIMEOUT_MS * NS_PER_MS;
+
+static struct session *sessions;
+static unsigned int num_sessions = DEFAULT_SESSIONS;
+static int epfd = -1;
+
+/* sleeping sessions and those still to connect, by wake up time */
+static unsigned int *heap;
+static unsigned int heap_size = 0;
+
+static unsigned int active = 0;
+static unsigned int finished = 0;
+static unsigned int failed = 0;
+static unsigned int timeouts = 0;
+
+static struct counters total, interval;
+static struct hist connect_hist, latency_hist, interval_hist, rate_hist;
+
+static volatile sig_atomic_t stop = 0;
+
+/******************************************************************************/
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/******************************************************************************/
+
+static void on_signal(int signo)
+{
+  stop = 1;
+}
+
+/******************************************************************************/
+/* binary min-heap of session indices */
+
+static int heap_less(unsigned int a, unsigned int b)
+{
+  return sessions[heap[a]].wake < sessions[heap[b]].wake;
+}
+
+static void heap_swap(unsigned int a, unsigned int b)
+{
+  const unsigned int t = heap[a];
+
+  heap[a] = heap[b];
+  heap[b] = t;
+  sessions[heap[a]].heap_pos = a;
+  sessions[heap[b]].heap_pos = b;
+}
+
+static void heap_push(unsigned int id, uint64_t wake)
+{
+  unsigned int i = heap_size++;
+
+  sessions[id].wake = wake;
+  sessions[id].heap_pos = i;
+  heap[i] = id;
+
+  for (; i > 0 && heap_less(i, (i - 1) / 2); i = (i - 1) / 2)
+    heap_swap(i, (i - 1) / 2);
+}
+
+static unsigned int heap_pop(void)
+{
+  const unsigned int id = heap[0];
+  unsigned int i = 0;
+
+  heap_swap(0, --heap_size);
+  sessions[id].heap_pos = -1;
+
+  for (;;)
+  {
+    unsigned int least = i, l = 2 * i + 1, r = l + 1;
+
+    if (l < heap_size && heap_less(l, least)) least = l;
+    if (r < heap_size && heap_less(r, least)) least = r;
+    if (least == i) break;
+
+    heap_swap(i, least);
+    i = least;
+  }
+
+  return id;
+}
+
+/******************************************************************************/
+
+static int build_message(struct message *m, unsigned int chars)
+{
+  static const char alphabet[] = "the quick brown fox jumps over the lazy dog ";
+  char text[PATTERN_MAX_CHARS];
+
+  for (unsigned int i = 0; i < chars; ++i)
+    text[i] = alphabet[i % (sizeof(alphabet) - 1)];
+
+  /* an upper bound of either encoding, then one packet per MTU
+     (morse) or frame (profile). Packing takes a whole MTU of room */
+  const size_t cap = (size_t)chars * PACKET_LENGTH + mtu +
+    PROFILE_FRAME_HEADER_SIZE;
+
+  m->data = malloc(cap);
+  m->offsets = malloc((chars + 1) * sizeof(size_t));
+  m->num_packets = 0;
+
+  if (!m->data || !m->offsets) return -1;
+
+  size_t pos = 0;
+  m->offsets[0] = 0;
+
+  for (unsigned int i = 0; i < chars;)
+  {
+    size_t consumed;
+
+    if (protocol == PROTOCOL_MORSE)
+      pos += morse_pack(text + i, chars - i, &consumed, m->data + pos, mtu);
+    else
+    {
+      consumed = chars - i;
+
+      if (consumed > PROFILE_FRAME_MAX_PAYLOAD)
+        consumed = PROFILE_FRAME_MAX_PAYLOAD;
+
+      pos += profile_frame_encode(m->data + pos, cap - pos,
+                                  PROFILE_FRAME_TEXT, 0, text + i, consumed);
+    }
+
+    if (consumed == 0) return -1;
+
+    i += consumed;
+    m->offsets[++m->num_packets] = pos;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+static void encode_request(unsigned char *out, uint32_t sequence)
+{
+  if (protocol == PROTOCOL_MORSE)
+  {
+    morse_pack_ack(sequence, out);
+    return;
+  }
+
+  const uint8_t payload[PING_PAYLOAD] = {
+    sequence & 0xff, (sequence >> 8) & 0xff,
+    (sequence >> 16) & 0xff, (sequence >> 24) & 0xff
+  };
+
+  profile_frame_encode(out, ECHO_LENGTH, PROFILE_FRAME_PING, 0,
+                       payload, sizeof(payload));
+}
+
+/******************************************************************************/
+
+static int decode_reply(const unsigned char *in, uint32_t *sequence)
+{
+  if (protocol == PROTOCOL_MORSE)
+    return morse_unpack_ack(in, ECHO_LENGTH, sequence);
+
+  /* length, type and flags of a ping */
+  if (in[0] != PING_PAYLOAD || in[1] != 0 || in[2] != PROFILE_FRAME_PING)
+    return -1;
+
+  *sequence = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+  return 0;
+}
+
+/******************************************************************************/
+
+static void watch(struct session *s, int want_out)
+{
+  struct epoll_event ev = { 0 };
+
+  if (s->want_out == want_out) return;
+
+  ev.events = EPOLLIN | (want_out ? EPOLLOUT : 0);
+  ev.data.u32 = s - sessions;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+
+  s->want_out = want_out;
+}
+
+/******************************************************************************/
+
+static void close_session(struct session *s, int ok)
+{
+  /* morse servers expect a farewell, profile servers do not care */
+  if (ok && protocol == PROTOCOL_MORSE)
+    send(s->fd, "goodbye!", PACKET_LENGTH, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+  close(s->fd);
+  s->fd = -1;
+  s->state = SESSION_DONE;
+
+  active--;
+
+  if (ok) finished++;
+  else failed++;
+}
+
+/******************************************************************************/
+
+/* returns 0 once everything is out, 1 if the socket is full and -1 on
+   errors */
+static int send_pending(struct session *s)
+{
+  const struct message *m = &messages[s->step];
+
+  for (;;)
+  {
+    /* next message, if any */
+    if (s->packet > m->num_packets)
+    {
+      if (s->to_send == 0) return 0;
+
+      s->to_send--;
+      s->packet = 0;
+      s->offset = 0;
+      s->sent_at[s->sequence % PATTERN_MAX_BURST] = now_ns();
+      encode_request(s->request, s->sequence++);
+    }
+
+    const unsigned char *p = s->request;
+    size_t len = ECHO_LENGTH;
+
+    if (s->packet < m->num_packets)
+    {
+      p = m->data + m->offsets[s->packet];
+      len = m->offsets[s->packet + 1] - m->offsets[s->packet];
+    }
+
+    ssize_t n = send(s->fd, p + s->offset, len - s->offset, MSG_NOSIGNAL);
+
+    if (n < 0) return errno == EAGAIN || errno == EINTR ? 1 : -1;
+
+    interval.bytes += n;
+    s->offset += n;
+
+    if (s->offset < len) continue;
+
+    s->packet++;
+    s->offset = 0;
+  }
+}
+
+/******************************************************************************/
+
+static void flush_session(struct session *s)
+{
+  const int status = send_pending(s);
+
+  if (status < 0) close_session(s, 0);
+  else watch(s, status > 0);
+}
+
+/******************************************************************************/
+
+static void advance(struct session *s)
+{
+  while (s->state == SESSION_RUNNING)
+  {
+    if (s->step == pattern.num_steps)
+    {
+      close_session(s, 1);
+      return;
+    }
+
+    const struct pattern_step *step = &pattern.steps[s->step];
+
+    switch (step->op)
+    {
+      case PATTERN_SEND:
+        s->state = SESSION_SENDING;
+        s->to_send = step->count;
+        s->packet = messages[s->step].num_packets + 1;
+        s->deadline = now_ns() + timeout_ns;
+        flush_session(s);
+        return;
+
+      case PATTERN_SLEEP:
+      {
+        const unsigned int ms = step->min_ms +
+          (step->max_ms > step->min_ms ?
+           random() % (step->max_ms - step->min_ms + 1) : 0);
+
+        s->state = SESSION_SLEEPING;
+        s->step++;
+        heap_push(s - sessions, now_ns() + ms * NS_PER_MS);
+        return;
+      }
+
+      case PATTERN_REPEAT:
+        if (step->count == 0 || ++s->repeats[s->step] < step->count)
+          s->step = step->target;
+        else
+        {
+          s->repeats[s->step] = 0;
+          s->step++;
+        }
+        break;
+    }
+  }
+}
+
+/******************************************************************************/
+
+static void on_reply(struct session *s)
+{
+  const struct pattern_step *step = &pattern.steps[s->step];
+  const uint64_t t = now_ns();
+  uint32_t sequence;
+
+  /* echoes come in order, the server handles one packet after the
+     other */
+  if (s->state != SESSION_SENDING || s->echoed == s->sequence ||
+      decode_reply(s->reply, &sequence) < 0 || sequence != s->echoed)
+  {
+    close_session(s, 0);
+    return;
+  }
+
+  hist_add(&interval_hist,
+           (t - s->sent_at[sequence % PATTERN_MAX_BURST]) / NS_PER_US);
+
+  interval.messages++;
+  interval.chars += step->chars;
+  s->echoed++;
+  s->deadline = t + timeout_ns;
+
+  /* the step is done once everything has been echoed */
+  if (s->to_send == 0 && s->packet > messages[s->step].num_packets &&
+      s->echoed == s->sequence)
+  {
+    s->state = SESSION_RUNNING;
+    s->step++;
+    advance(s);
+  }
+}
+
+/******************************************************************************/
+
+static void on_readable(struct session *s)
+{
+  const enum session_state state = s->state;
+  const unsigned int step = s->step;
+
+  /* at most what completes the echo at hand, the rest is read once the
+     session is through with it */
+  while (s->state == state && s->step == step)
+  {
+    ssize_t n = recv(s->fd, s->reply + s->reply_fill,
+                     ECHO_LENGTH - s->reply_fill, 0);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+
+    /* nothing else comes from the servers, hanging up is a failure
+       as well */
+    if (n <= 0)
+    {
+      close_session(s, 0);
+      return;
+    }
+
+    s->reply_fill += n;
+
+    if (s->reply_fill < ECHO_LENGTH) continue;
+
+    s->reply_fill = 0;
+    on_reply(s);
+  }
+}
+
+/******************************************************************************/
+
+static void start_session(struct session *s, uint64_t t)
+{
+  struct epoll_event ev = { 0 };
+
+  s->fd = sock_url_connect(&url, 1);
+
+  /* UNIX sockets refuse rather than queue once the backlog is full */
+  if (s->fd < 0 && errno == EAGAIN)
+  {
+    heap_push(s - sessions, t + RETRY_MS * NS_PER_MS);
+    return;
+  }
+
+  active++;
+
+  if (s->fd < 0)
+  {
+    active--;
+    failed++;
+    s->state = SESSION_DONE;
+    return;
+  }
+
+  /* writable once connected */
+  ev.events = EPOLLIN | EPOLLOUT;
+  ev.data.u32 = s - sessions;
+
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev) < 0)
+  {
+    close_session(s, 0);
+    return;
+  }
+
+  s->state = SESSION_CONNECTING;
+  s->want_out = 1;
+  s->started = t;
+  s->deadline = t + timeout_ns;
+}
+
+/******************************************************************************/
+
+static void on_connected(struct session *s)
+{
+  int error = 0;
+  socklen_t len = sizeof(error);
+
+  if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error)
+  {
+    close_session(s, 0);
+    return;
+  }
+
+  hist_add(&connect_hist, (now_ns() - s->started) / NS_PER_US);
+
+  s->state = SESSION_RUNNING;
+  watch(s, 0);
+  advance(s);
+}
+
+/******************************************************************************/
+
+static void on_event(struct session *s, uint32_t events)
+{
+  if (s->state == SESSION_CONNECTING)
+  {
+    if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) on_connected(s);
+    return;
+  }
+
+  if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) on_readable(s);
+
+  if (s->state == SESSION_SENDING && (events & EPOLLOUT)) flush_session(s);
+}
+
+/******************************************************************************/
+
+static void wake_sessions(uint64_t t)
+{
+  while (heap_size > 0 && sessions[heap[0]].wake <= t)
+  {
+    struct session *s = &sessions[heap_pop()];
+
+    if (s->state == SESSION_WAITING) start_session(s, t);
+    else
+    {
+      s->state = SESSION_RUNNING;
+      advance(s);
+    }
+  }
+}
+
+/******************************************************************************/
+
+static void check_timeouts(uint64_t t)
+{
+  for (unsigned int i = 0; i < num_sessions; ++i)
+  {
+    struct session *s = &sessions[i];
+
+    if ((s->state == SESSION_CONNECTING || s->state == SESSION_SENDING) &&
+        t > s->deadline)
+    {
+      timeouts++;
+      close_session(s, 0);
+    }
+  }
+}
+
+/******************************************************************************/
+
+static void report_interval(double elapsed, double seconds)
+{
+  const double rate = interval.messages / seconds;
+
+  printf("%7.1f %9u %10.0f %10.0f %9.3f %9.3f %9.3f %7u\n",
+         elapsed, active, rate, interval.chars / seconds,
+         hist_percentile(&interval_hist, 0.5) / 1e3,
+         hist_percentile(&interval_hist, 0.99) / 1e3,
+         hist_percentile(&interval_hist, 0.999) / 1e3, failed);
+  fflush(stdout);
+
+  hist_add(&rate_hist, (uint64_t)(rate + 0.5));
+  hist_merge(&latency_hist, &interval_hist);
+  hist_reset(&interval_hist);
+
+  total.messages += interval.messages;
+  total.chars += interval.chars;
+  total.bytes += interval.bytes;
+  interval = (struct counters){0};
+}
+
+/******************************************************************************/
+
+static void print_percentiles(const char *name,
+                              const struct hist *h,
+                              double scale,
+                              const char *unit)
+{
+  printf("%-11s p50 %10.3f  p99 %10.3f  p999 %10.3f  max %10.3f %s"
+         " (%llu)\n", name,
+         hist_percentile(h, 0.5) / scale, hist_percentile(h, 0.99) / scale,
+         hist_percentile(h, 0.999) / scale, h->max / scale, unit,
+         (unsigned long long)h->count);
+}
+
+/******************************************************************************/
+
+static int usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [-P morse|profile] [-c sessions] [-r connects/s]\n"
+          "       [-d seconds] [-i interval] [-p pattern | -f pattern-file]\n"
+          "       [-m mtu] [-t timeout-ms] url\n", name);
+  return 1;
+}
+
+/******************************************************************************/
+
+static char *read_file(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  char *text = NULL;
+  long len;
+
+  if (!f) return NULL;
+
+  if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) >= 0 &&
+      fseek(f, 0, SEEK_SET) == 0 && (text = malloc(len + 1)))
+    text[fread(text, 1, len, f)] = '\0';
+
+  fclose(f);
+  return text;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const char *pattern_text = DEFAULT_PATTERN;
+  char *pattern_file = NULL;
+  double connect_rate = 0;
+  double seconds = DEFAULT_SECONDS;
+  double tick = 1;
+  char name[SOCK_URL_PATH_MAX + 32];
+  char error[64];
+  struct rlimit rl;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "P:c:r:d:i:p:f:m:t:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'P':
+        if (strcmp(optarg, "morse") == 0) protocol = PROTOCOL_MORSE;
+        else if (strcmp(optarg, "profile") == 0) protocol = PROTOCOL_PROFILE;
+        else return usage(argv[0]);
+        break;
+
+      case 'c': num_sessions = atoi(optarg); break;
+      case 'r': connect_rate = atof(optarg); break;
+      case 'd': seconds = atof(optarg); break;
+      case 'i': tick = atof(optarg); break;
+      case 'p': pattern_text = optarg; break;
+      case 'm': mtu = atoi(optarg); break;
+      case 't': timeout_ns = atoi(optarg) * NS_PER_MS; break;
+
+      case 'f':
+        pattern_text = pattern_file = read_file(optarg);
+
+        if (!pattern_file)
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+
+      default:
+        return usage(argv[0]);
+    }
+  }
+
+  if (optind != argc - 1 || sock_url_parse(argv[optind], &url) < 0 ||
+      num_sessions == 0 || tick <= 0 || mtu < 8 || mtu > 0xffff)
+    return usage(argv[0]);
+
+  if (pattern_parse(pattern_text, &pattern, error, sizeof(error)) < 0)
+  {
+    fprintf(stderr, "Bad pattern step: %s\n", error);
+    return 1;
+  }
+
+  for (unsigned int i = 0; i < pattern.num_steps; ++i)
+    if (pattern.steps[i].op == PATTERN_SEND &&
+        build_message(&messages[i], pattern.steps[i].chars) < 0)
+    {
+      fprintf(stderr, "Failed encoding the messages, MTU too small?\n");
+      return 1;
+    }
+
+  /* every session costs a file descriptor, go for the hard limit */
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  sessions = calloc(num_sessions, sizeof(*sessions));
+  heap = calloc(num_sessions, sizeof(*heap));
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (!sessions || !heap || epfd < 0)
+  {
+    fprintf(stderr, "Out of memory or descriptors\n");
+    return 1;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGPIPE, SIG_IGN);
+  srandom(1);
+
+  printf("%s protocol on %s, %u sessions, pattern '%s'\n",
+         protocol == PROTOCOL_MORSE ? "morse" : "profile",
+         sock_url_name(&url, name, sizeof(name)), num_sessions,
+         pattern_file ? "(file)" : pattern_text);
+  printf("%7s %9s %10s %10s %9s %9s %9s %7s\n", "time", "sessions",
+         "msgs/s", "chars/s", "p50 ms", "p99 ms", "p999 ms", "failed");
+
+  /* all at once, or spread evenly at the connect rate */
+  const uint64_t start = now_ns();
+
+  for (unsigned int i = 0; i < num_sessions; ++i)
+  {
+    sessions[i].fd = -1;
+    sessions[i].state = SESSION_WAITING;
+    heap_push(i, start + (connect_rate > 0 ? i / connect_rate * 1e9 : 0));
+  }
+
+  const uint64_t end = seconds > 0 ? start + seconds * 1e9 : UINT64_MAX;
+  const uint64_t tick_ns = tick * 1e9;
+  uint64_t next_tick = start + tick_ns;
+  uint64_t last_tick = start;
+  uint64_t t = start;
+
+  while (!stop && t < end && (active > 0 || heap_size > 0))
+  {
+    struct epoll_event events[EPOLL_BATCH];
+    uint64_t until = next_tick < end ? next_tick : end;
+
+    if (heap_size > 0 && sessions[heap[0]].wake < until)
+      until = sessions[heap[0]].wake;
+
+    const int timeout_ms = until > t ? (until - t + NS_PER_MS - 1) / NS_PER_MS
+      : 0;
+    const int num = epoll_wait(epfd, events, EPOLL_BATCH, timeout_ms);
+
+    for (int i = 0; i < num; ++i)
+    {
+      struct session *s = &sessions[events[i].data.u32];
+
+      if (s->state != SESSION_DONE) on_event(s, events[i].events);
+    }
+
+    t = now_ns();
+    wake_sessions(t);
+
+    if (t >= next_tick)
+    {
+      check_timeouts(t);
+      report_interval((t - start) / 1e9, (t - last_tick) / 1e9);
+
+      last_tick = t;
+      next_tick += tick_ns;
+
+      if (next_tick <= t) next_tick = t + tick_ns;
+    }
+  }
+
+  /* the remainder of the last interval */
+  if (t > last_tick) report_interval((t - start) / 1e9, (t - last_tick) / 1e9);
+
+  const double elapsed = (t - start) / 1e9;
+  const unsigned int unfinished = active;
+
+  for (unsigned int i = 0; i < num_sessions; ++i)
+    if (sessions[i].fd >= 0) close_session(&sessions[i], 1);
+
+  printf("\nsessions    %u finished, %u cut off at the end, %u failed "
+         "(%u timed out)\n", finished - unfinished, unfinished, failed,
+         timeouts);
+  printf("messages    %llu in %.3f s, %.0f msgs/s, %.0f chars/s, "
+         "%.0f bytes/s\n", (unsigned long long)total.messages, elapsed,
+         total.messages / elapsed, total.chars / elapsed,
+         total.bytes / elapsed);
+
+  print_percentiles("connect", &connect_hist, 1e3, "ms");
+  print_percentiles("latency", &latency_hist, 1e3, "ms");
+  print_percentiles("throughput", &rate_hist, 1, "msgs/s");
+
+  printf("\nlatency histogram\n");
+  hist_print(&latency_hist, stdout, 1e3, "ms");
+  printf("\nthroughput histogram, one sample per interval\n");
+  hist_print(&rate_hist, stdout, 1, "/s");
+
+  for (unsigned int i = 0; i < pattern.num_steps; ++i)
+  {
+    free(messages[i].data);
+    free(messages[i].offsets);
+  }
+
+  close(epfd);
+  free(heap);
+  free(sessions);
+  free(pattern_file);
+  return failed > 0;
+}
@@ -0,0 +1,142 @@
+/******************************************************************************/
+/* File: pattern.c
+   Author: N.Kim
+   Abstract: Scripted traffic of a load generator session */
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pattern.h"
+
+/* longest step, e.g. "burst 64 4096" */
+#define STEP_LENGTH 64
+
+/******************************************************************************/
+
+static int parse_step(const char *line, struct pattern *p)
+{
+  struct pattern_step *step = &p->steps[p->num_steps];
+  char op[16];
+  int end = 0;
+
+  /* blank lines and comments */
+  if (sscanf(line, " %15s", op) != 1) return 0;
+
+  *step = (struct pattern_step){0};
+
+  if (strcmp(op, "send") == 0 &&
+      sscanf(line, " send %u %n", &step->chars, &end) == 1)
+  {
+    step->op = PATTERN_SEND;
+    step->count = 1;
+  }
+  else if (strcmp(op, "burst") == 0 &&
+           sscanf(line, " burst %u %u %n", &step->count, &step->chars,
+                  &end) == 2)
+    step->op = PATTERN_SEND;
+  else if (strcmp(op, "sleep") == 0 &&
+           sscanf(line, " sleep %u %n", &step->min_ms, &end) == 1)
+  {
+    int more = 0;
+
+    step->op = PATTERN_SLEEP;
+    step->max_ms = step->min_ms;
+
+    /* the optional upper bound */
+    if (line[end] == '-')
+    {
+      if (sscanf(line + end, "-%u %n", &step->max_ms, &more) != 1) return -1;
+
+      end += more;
+    }
+  }
+  else if (strcmp(op, "repeat") == 0 &&
+           sscanf(line, " repeat %u %n", &step->count, &end) == 1)
+  {
+    step->op = PATTERN_REPEAT;
+
+    /* back to the step after the previous repeat */
+    for (unsigned int i = p->num_steps; i-- > 0;)
+    {
+      if (p->steps[i].op != PATTERN_REPEAT) continue;
+
+      step->target = i + 1;
+      break;
+    }
+  }
+  else return -1;
+
+  if (line[end] != '\0') return -1;
+
+  if (step->op == PATTERN_SEND &&
+      (step->count < 1 || step->count > PATTERN_MAX_BURST ||
+       step->chars < 1 || step->chars > PATTERN_MAX_CHARS))
+    return -1;
+
+  if (step->op == PATTERN_SLEEP && step->max_ms < step->min_ms) return -1;
+
+  /* nothing to repeat */
+  if (step->op == PATTERN_REPEAT && step->target == p->num_steps) return -1;
+
+  p->num_steps++;
+  return 0;
+}
+
+/******************************************************************************/
+
+int pattern_parse(const char *text,
+                  struct pattern *p,
+                  char *error,
+                  unsigned int len)
+{
+  p->num_steps = 0;
+
+  while (*text)
+  {
+    char line[STEP_LENGTH];
+    size_t n = strcspn(text, ";\n#");
+
+    if (n >= sizeof(line) || p->num_steps == PATTERN_MAX_STEPS)
+    {
+      snprintf(error, len, "%.*s", (int)(n < 32 ? n : 32), text);
+      return -1;
+    }
+
+    memcpy(line, text, n);
+    line[n] = '\0';
+
+    if (parse_step(line, p) < 0)
+    {
+      snprintf(error, len, "%s", line);
+      return -1;
+    }
+
+    /* comments run up to the end of the line */
+    text += n;
+
+    if (*text == '#') text += strcspn(text, "\n");
+    if (*text) text++;
+  }
+
+  if (p->num_steps == 0)
+  {
+    snprintf(error, len, "(empty)");
+    return -1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+unsigned int pattern_max_chars(const struct pattern *p)
+{
+  unsigned int max = 0;
+
+  for (unsigned int i = 0; i < p->num_steps; ++i)
+    if (p->steps[i].op == PATTERN_SEND && p->steps[i].chars > max)
+      max = p->steps[i].chars;
+
+  return max;
+}
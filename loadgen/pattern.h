@@ -0,0 +1,59 @@
+/******************************************************************************/
+/* File: pattern.h
+   Author: N.Kim
+   Abstract: Scripted traffic of a load generator session */
+/******************************************************************************/
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+/* steps are separated by new lines or ';', '#' starts a comment:
+
+     send <chars>              one message, wait for its echo
+     burst <count> <chars>     messages back to back, wait for all echoes
+     sleep <ms>[-<ms>]         pause, uniformly random within the range
+     repeat <count>            run the steps since the previous repeat
+                               (or the start) <count> times in total,
+                               0 repeats forever
+
+   A session hangs up once it runs out of steps, e.g.
+
+     send 32; sleep 50-150; repeat 0 */
+enum pattern_op {
+  PATTERN_SEND,
+  PATTERN_SLEEP,
+  PATTERN_REPEAT
+};
+
+#define PATTERN_MAX_STEPS 32
+
+/* messages in flight per session at most, see 'burst' */
+#define PATTERN_MAX_BURST 64
+
+/* characters per message at most */
+#define PATTERN_MAX_CHARS 4096
+
+struct pattern_step {
+  enum pattern_op op;
+  unsigned int count;     /* messages or repetitions */
+  unsigned int chars;     /* per message */
+  unsigned int min_ms;    /* sleep range */
+  unsigned int max_ms;
+  unsigned int target;    /* first step repeated */
+};
+
+struct pattern {
+  struct pattern_step steps[PATTERN_MAX_STEPS];
+  unsigned int num_steps;
+};
+
+/* returns -1 on syntax errors, 'error' receives the offending step */
+int pattern_parse(const char *text,
+                  struct pattern *p,
+                  char *error,
+                  unsigned int len);
+
+/* characters per message at most, 0 if the pattern sends nothing */
+unsigned int pattern_max_chars(const struct pattern *p);
+
+#endif
@@ -0,0 +1,190 @@
+/******************************************************************************/
+/* File: bench_audio.c
+   Author: N.Kim
+   Abstract: Samples per second of the morse tone renderer
+
+   Description:
+     Renders random text with the precomputed dot/dash blocks and, for
+     comparison, the way it is usually done, evaluating sin() and the
+     ramp for every sample. Both run on a single core, they must produce
+     the very same samples. Reports samples/sec and how many real time
+     streams (clients keying at the default speed) one core keeps up
+     with.
+
+     bench_audio [rate] [wpm] [seconds] */
+
+/******************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "morse_audio.h"
+#include "morse_codec.h"
+
+#define TEXT_LENGTH 4096
+#define BUFFER_SAMPLES (1 << 20)
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+struct naive {
+  unsigned int rate;
+  unsigned int unit;
+  unsigned int ramp;
+  double step;
+};
+
+static void naive_tone(const struct naive *n, int16_t *out, unsigned int len)
+{
+  for (unsigned int i = 0; i < len; ++i)
+  {
+    const unsigned int left = len - 1 - i;
+    double level = 0.8 * 32767;
+
+    if (i < n->ramp) level *= 0.5 * (1 - cos(M_PI * i / n->ramp));
+    if (left < n->ramp) level *= 0.5 * (1 - cos(M_PI * left / n->ramp));
+
+    out[i] = lrint(level * sin(n->step * i));
+  }
+}
+
+/******************************************************************************/
+
+static size_t naive_render(const struct naive *n,
+                           const char *text,
+                           size_t len,
+                           int16_t *out,
+                           size_t cap,
+                           size_t *consumed)
+{
+  int16_t *op = out;
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+  {
+    const unsigned int code = morse_code(text[i]);
+    const unsigned int symbols = code ? morse_code_length(code) : 0;
+    const size_t need = code ?
+      (2 * symbols + 2 * (__builtin_popcount(code) - 1) + 2) * n->unit :
+      4 * n->unit;
+
+    if ((size_t)(out + cap - op) < need) break;
+
+    if (code == 0)
+    {
+      for (size_t k = 0; k < need; ++k) *op++ = 0;
+      continue;
+    }
+
+    for (unsigned int s = symbols; s-- > 0;)
+    {
+      const unsigned int tone = ((code >> s) & 1 ? 3 : 1) * n->unit;
+      const unsigned int space = (s ? 1 : 3) * n->unit;
+
+      naive_tone(n, op, tone);
+      op += tone;
+
+      for (unsigned int k = 0; k < space; ++k) *op++ = 0;
+    }
+  }
+
+  *consumed = i;
+  return op - out;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const unsigned int rate = argc > 1 ? atoi(argv[1]) : MORSE_AUDIO_DEFAULT_RATE;
+  const unsigned int wpm = argc > 2 ? atoi(argv[2]) : MORSE_AUDIO_DEFAULT_WPM;
+  const double seconds = argc > 3 ? atof(argv[3]) : 1;
+
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 ";
+  static char text[TEXT_LENGTH];
+
+  struct morse_audio audio;
+
+  int16_t *fast = malloc(BUFFER_SAMPLES * sizeof(int16_t));
+  int16_t *slow = malloc(BUFFER_SAMPLES * sizeof(int16_t));
+
+  if (!fast || !slow ||
+      morse_audio_init(&audio, rate, MORSE_AUDIO_DEFAULT_TONE, wpm) < 0)
+  {
+    fprintf(stderr, "bad parameters or out of memory\n");
+    return 1;
+  }
+
+  /* the same parameters as the renderer derives them */
+  unsigned int ramp = rate * MORSE_AUDIO_RAMP_MS / 1000;
+
+  if (ramp > audio.unit / 2) ramp = audio.unit / 2;
+
+  const struct naive naive = {
+    rate, audio.unit, ramp, 2 * M_PI * MORSE_AUDIO_DEFAULT_TONE / rate
+  };
+
+  for (size_t i = 0; i < TEXT_LENGTH; ++i)
+    text[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+
+  /* both must agree on every sample */
+  size_t consumed_fast, consumed_slow;
+  size_t n_fast = morse_audio_render(&audio, text, TEXT_LENGTH, fast,
+                                     BUFFER_SAMPLES, &consumed_fast);
+  size_t n_slow = naive_render(&naive, text, TEXT_LENGTH, slow,
+                               BUFFER_SAMPLES, &consumed_slow);
+  int same = n_fast == n_slow && consumed_fast == consumed_slow &&
+    memcmp(fast, slow, n_fast * sizeof(int16_t)) == 0;
+
+  printf("%u Hz, %u wpm, %u samples per dot\n", rate, wpm, audio.unit);
+
+  for (int pass = 0; pass < 2; ++pass)
+  {
+    uint64_t samples = 0;
+    size_t pos = 0;
+    double start = now(), elapsed;
+
+    /* fill the buffer over and over, the text wraps around */
+    do
+    {
+      for (int i = 0; i < 16; ++i)
+      {
+        size_t consumed;
+
+        samples += pass == 0 ?
+          morse_audio_render(&audio, text + pos, TEXT_LENGTH - pos, fast,
+                             BUFFER_SAMPLES, &consumed) :
+          naive_render(&naive, text + pos, TEXT_LENGTH - pos, slow,
+                       BUFFER_SAMPLES, &consumed);
+
+        pos = (pos + consumed) % TEXT_LENGTH;
+      }
+
+      elapsed = now() - start;
+    }
+    while (elapsed < seconds);
+
+    printf("%-12s %8.1f M samples/s per core, %8.0f real time streams\n",
+           pass == 0 ? "precomputed" : "sin()",
+           samples / elapsed / 1e6, samples / elapsed / rate);
+  }
+
+  printf("samples %s\n", same ? "identical" : "DIFFER");
+
+  morse_audio_free(&audio);
+  free(slow);
+  free(fast);
+  return !same;
+}
@@ -0,0 +1,130 @@
+/******************************************************************************/
+/* File: bench_codec.c
+   Author: N.Kim
+   Abstract: Throughput of the bulk morse encoder/decoder
+
+   Description:
+     Encodes a few MB of log like text (words, digits, punctuation, new
+     lines) chunk by chunk into caller buffers and decodes the result
+     again. Reports MB/s of text for both directions and verifies the
+     round trip.
+
+     bench_codec [MB of text] */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "morse_codec.h"
+
+/* the codec is used on buffers of that size, e.g. a read() from a file */
+#define CHUNK_SIZE 65536
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static void fill_text(char *text, size_t len)
+{
+  static const char *words[] = {
+    "sensor", "temp", "21.5", "hum", "45", "ok", "error", "retry",
+    "connected", "to", "the", "adapter", "profile", "(fd", "3)", "rssi",
+    "-67", "battery", "low!", "device", "a0:b1:c2", "=", "done;"
+  };
+
+  size_t pos = 0;
+
+  while (pos < len)
+  {
+    const char *w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+
+    for (; *w && pos < len; ++w) text[pos++] = *w;
+
+    if (pos < len) text[pos++] = rand() % 8 ? ' ' : '\n';
+  }
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const size_t len = (argc > 1 ? atof(argv[1]) : 16) * 1e6;
+
+  char *text = malloc(len);
+  char *morse = malloc(len * 7);
+  char *back = malloc(len);
+
+  if (!text || !morse || !back)
+  {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  fill_text(text, len);
+
+  /* encode, one chunk at a time, the output concatenates as is */
+  double start = now();
+  size_t mlen = 0;
+
+  for (size_t pos = 0; pos < len;)
+  {
+    size_t consumed;
+    size_t chunk = len - pos < CHUNK_SIZE ? len - pos : CHUNK_SIZE;
+
+    mlen += morse_encode(text + pos, chunk, morse + mlen, len * 7 - mlen,
+                         &consumed);
+    pos += consumed;
+  }
+
+  double encode_time = now() - start;
+
+  /* decode, chunks may end in the middle of a character, thus, carry
+     on where the decoder stopped */
+  start = now();
+  size_t blen = 0;
+
+  for (size_t pos = 0; pos < mlen;)
+  {
+    size_t consumed;
+    size_t chunk = mlen - pos < CHUNK_SIZE ? mlen - pos : CHUNK_SIZE;
+
+    /* back off to the last separator unless this is the end */
+    if (pos + chunk < mlen)
+      while (chunk > 0 && morse[pos + chunk - 1] != ' ') chunk--;
+
+    blen += morse_decode(morse + pos, chunk, back + blen, len - blen,
+                         &consumed);
+    pos += consumed;
+  }
+
+  double decode_time = now() - start;
+
+  /* decoded text is lower case */
+  size_t errors = blen != len;
+
+  for (size_t i = 0; i < len && i < blen; ++i)
+    if (tolower((unsigned char)text[i]) != back[i]) errors++;
+
+  printf("text %.1f MB, morse %.1f MB (%.2f bytes/char)\n",
+         len / 1e6, mlen / 1e6, (double)mlen / len);
+  printf("encode %8.1f MB/s\n", len / 1e6 / encode_time);
+  printf("decode %8.1f MB/s\n", len / 1e6 / decode_time);
+  printf("round trip %s\n", errors ? "FAILED" : "ok");
+
+  free(back);
+  free(morse);
+  free(text);
+  return errors != 0;
+}
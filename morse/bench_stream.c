@@ -0,0 +1,133 @@
+/******************************************************************************/
+/* File: bench_stream.c
+   Author: N.Kim
+   Abstract: Throughput and latency of the streaming morse decoder
+
+   Description:
+     Encodes random text into symbols and feeds them to the streaming
+     decoder in chunks of random size (1 to 64 symbols), the way they
+     arrive in symbol packets, characters being split across chunks.
+     Verifies the decoded text and reports symbols/sec, characters/sec
+     and the time from a chunk arriving to the characters it completes
+     being available (p50, p99, max).
+
+     bench_stream [million characters] */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "morse_codec.h"
+#include "morse_stream.h"
+
+#define MAX_CHUNK 64
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static int compare(const void *a, const void *b)
+{
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789.,?";
+
+  const size_t len = (argc > 1 ? atof(argv[1]) : 4) * 1e6;
+
+  char *text = malloc(len);
+  char *symbols = malloc(len * 11);
+  char *back = malloc(len + 1);
+  size_t *chunks = malloc(len * 11 * sizeof(size_t));
+  double *latency = malloc(len * sizeof(double));
+
+  if (!text || !symbols || !back || !chunks || !latency)
+  {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  /* words of 1 to 8 characters */
+  for (size_t i = 0; i < len; ++i)
+    text[i] = (i % 9 == 8) ? ' ' : alphabet[rand() % (sizeof(alphabet) - 1)];
+
+  size_t slen = morse_encode(text, len, symbols, len * 11, NULL);
+
+  /* chunk sizes are drawn up front, not to be measured */
+  size_t num_chunks = 0;
+
+  for (size_t pos = 0; pos < slen; ++num_chunks)
+  {
+    chunks[num_chunks] = 1 + rand() % MAX_CHUNK;
+    pos += chunks[num_chunks];
+  }
+
+  struct morse_stream stream;
+  size_t blen = 0;
+  size_t num_latency = 0;
+
+  morse_stream_init(&stream);
+
+  double start = now();
+
+  for (size_t c = 0, pos = 0; c < num_chunks; ++c)
+  {
+    size_t chunk = chunks[c] < slen - pos ? chunks[c] : slen - pos;
+    double t = now();
+
+    size_t n = morse_stream_feed(&stream, symbols + pos, chunk,
+                                 back + blen, len + 1 - blen, NULL);
+
+    if (n > 0) latency[num_latency++] = now() - t;
+
+    pos += chunk;
+    blen += n;
+  }
+
+  char c = morse_stream_flush(&stream);
+
+  if (c) back[blen++] = c;
+
+  double elapsed = now() - start;
+
+  size_t errors = blen != len;
+
+  for (size_t i = 0; i < len && i < blen; ++i)
+    if (text[i] != back[i]) errors++;
+
+  qsort(latency, num_latency, sizeof(double), compare);
+
+  printf("%.1f M symbols in %zu chunks\n", slen / 1e6, num_chunks);
+  printf("%10.1f M symbols/s\n", slen / elapsed / 1e6);
+  printf("%10.1f M chars/s\n", len / elapsed / 1e6);
+  printf("latency per chunk: p50 %.0f ns, p99 %.0f ns, max %.0f ns\n",
+         latency[num_latency / 2] * 1e9,
+         latency[num_latency * 99 / 100] * 1e9,
+         latency[num_latency - 1] * 1e9);
+  printf("decoded text %s\n", errors ? "WRONG" : "ok");
+
+  free(latency);
+  free(chunks);
+  free(back);
+  free(symbols);
+  free(text);
+  return errors != 0;
+}
@@ -4,80 +4,446 @@
    Abstract: Client part of the Bluetooth Morse tutorial */
 /******************************************************************************/
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
 
 #include <sys/socket.h>
-#include <bluetooth/bluetooth.h>
-#include <bluetooth/l2cap.h>
-#include <bluetooth/rfcomm.h>
 
-#define PACKET_LENGTH 8
+#include "morse_transport.h"
+#include "morse_wire.h"
+
+/* largest packet the server takes, the negotiated outgoing MTU */
+static size_t mtu = MORSE_DEFAULT_MTU;
+
+/* packets in flight in batch mode (-w), 0 sends without waiting for
+   acknowledgments */
+#define DEFAULT_WINDOW 8
+
+/* older servers do not echo acknowledgments, stop waiting for them */
+#define ACK_TIMEOUT_MS 5000
+
+/* input is read in chunks of that many bytes */
+#define BATCH_CHUNK 65536
 
 //-----------------------------------------------------------------------------
 //
-int main(int argc, char **argv)
+static double now(void)
 {
-  struct sockaddr_rc addr = {0};
-  int s, status;
-  char *message = "hello!";
-  char dest[18] = {0};
+  struct timespec ts;
 
-  if (argc < 2) {
-    fprintf(stderr, "usage: %s <bt_addr>\n", argv[0]);
-    return 1;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//-----------------------------------------------------------------------------
+//
+static int compare_doubles(const void *a, const void *b)
+{
+  const double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+//-----------------------------------------------------------------------------
+//
+static int write_all(int s, const unsigned char *data, size_t len)
+{
+  /* byte streams may take less at once */
+  while (len > 0) {
+    ssize_t n = write(s, data, len);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+
+    data += n;
+    len -= n;
   }
 
-  strncpy(dest, argv[1], 18);
-  s = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+  return 0;
+}
 
-  // set the connection parameters (who to connect to)
-  addr.rc_family = AF_BLUETOOTH;
-  addr.rc_bdaddr = *BDADDR_ANY;
-  addr.rc_channel = 27;  /* test */
+//-----------------------------------------------------------------------------
+//
+static int send_goodbye(int s)
+{
+  /* same in both formats, stretched to 8 bytes */
+  printf("Terminating processing loop...");
 
-  str2ba(dest, &addr.rc_bdaddr);
+  int status = write(s, "goodbye!", PACKET_LENGTH);
 
-  /* connect to them morse server that does decoding */
-  status = connect(s, (struct sockaddr *)&addr, sizeof(addr));
+  if (status < 0) printf("failed\n");
+  else printf("ok\n");
 
-  printf("Establishing connection...");
+  return status;
+}
 
-  if (status == 0) {
-    printf("ok\n");
-    printf("Press <SPACE + ENTER> to quit, or message to send:\n");
+//-----------------------------------------------------------------------------
+//
+static void run_packed(int s)
+{
+  /* whole lines go out at once, split into as few packets as the MTU
+     allows */
+  char line[1024];
+  unsigned char packet[mtu];
+
+  printf("Press <ENTER> on an empty line to quit, or message to send:\n");
+
+  while (fgets(line, sizeof(line), stdin) && line[0] != '\n')
+  {
+    size_t len = strcspn(line, "\n");
+    size_t offset = 0;
+    int packets = 0;
+    int status = 0;
+
+    while (offset < len && status >= 0)
+    {
+      size_t consumed;
+      size_t plen = morse_pack(line + offset, len - offset, &consumed,
+                               packet, sizeof(packet));
+
+      status = write(s, packet, plen);
+      offset += consumed;
+      packets++;
+    }
+
+    printf("  sent %zu characters in %d packet(s)...%s\n",
+           len, packets, status < 0 ? "failed" : "ok");
+  }
+
+  send_goodbye(s);
+}
+
+//-----------------------------------------------------------------------------
+//
+static void run_keyer(int s)
+{
+  /* dots and dashes as keyed, the server does the decoding. The end of
+     a line also ends the character keyed last */
+  char line[1024];
+  unsigned char packet[mtu];
+
+  printf("Key dots and dashes, ' ' ends a character and '/' a word.\n");
+  printf("Press <ENTER> on an empty line to quit:\n");
+
+  while (fgets(line, sizeof(line), stdin) && line[0] != '\n')
+  {
+    size_t len = strcspn(line, "\n");
+    size_t offset = 0;
+    int status = 0;
+
+    line[len++] = ' ';
 
-    while (1)  {
-      char c = getchar();
+    while (offset < len && status >= 0)
+    {
+      size_t consumed;
+      size_t plen = morse_pack_symbols(line + offset, len - offset,
+                                       &consumed, packet, sizeof(packet));
 
-      /* reserve 8 bytes to encode messages to be sent */
-      char data[PACKET_LENGTH] = "        ";
+      status = write(s, packet, plen);
+      offset += consumed;
+    }
+
+    printf("  sent %zu symbols...%s\n", len, status < 0 ? "failed" : "ok");
+  }
+
+  send_goodbye(s);
+}
+
+//-----------------------------------------------------------------------------
+//
+static void run_trace(int s, const char *path)
+{
+  /* recorded key events, see morse_timing.h. The timestamps travel
+     along, thus, there is no need to keep the pace of the recording */
+  struct morse_key_event events[(mtu - MORSE_KEYS_HEADER) /
+                                MORSE_KEY_EVENT_SIZE];
+  unsigned char packet[mtu];
+  char line[256];
+  size_t num = 0, total = 0;
+  int status = 0;
+
+  FILE *f = fopen(path, "r");
+
+  if (!f) {
+    perror(path);
+    send_goodbye(s);
+    return;
+  }
+
+  printf("Replaying %s...", path);
+
+  while (status >= 0) {
+    int more = fgets(line, sizeof(line), f) != NULL;
+
+    if (more && morse_trace_parse(line, &events[num]) > 0) num++;
+
+    /* full packets, the rest at the end */
+    if (more && num < sizeof(events) / sizeof(events[0])) continue;
+    if (num == 0) break;
+
+    size_t consumed;
+    size_t plen = morse_pack_keys(events, num, &consumed, packet,
+                                  sizeof(packet));
+
+    status = write(s, packet, plen);
+    total += num;
+    num = 0;
+
+    if (!more) break;
+  }
+
+  printf("%s (%zu events)\n", status < 0 ? "failed" : "ok", total);
+
+  fclose(f);
+  send_goodbye(s);
+}
+
+//-----------------------------------------------------------------------------
+//
+static void run_batch(int s, const char *path, unsigned int window, int glue)
+{
+  /* MTU-sized packets, each one followed by an acknowledgment request.
+     Up to 'window' of them are in flight, the echo tells the latency.
+     On byte streams both go out in a single write */
+  static char chunk[BATCH_CHUNK];
+  unsigned char packet[mtu + MORSE_ACK_LENGTH];
+  double *sent_at = calloc(window ? window : 1, sizeof(double));
+  double *latencies = NULL;
+  size_t num_latencies = 0, max_latencies = 0;
+  size_t fill = 0, pos = 0;
+  unsigned long chars = 0, packets = 0;
+  uint32_t sequence = 0, acked = 0;
+  int eof = 0, status = 0;
 
-      if (c == 0x20) {
-        /* spacebar as loop exit, stretch to 8 bytes */
-	printf("Terminating processing loop...");
-	status = write(s, "goodbye!", PACKET_LENGTH);
+  FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
 
-       	if (status < 0) printf("failed\n");
-	else printf("ok\n");
+  if (!f || !sent_at) {
+    perror(path);
+    free(sent_at);
+    send_goodbye(s);
+    return;
+  }
+
+  const double start = now();
+
+  while (status >= 0) {
+    if (pos == fill && !eof) {
+      fill = fread(chunk, 1, sizeof(chunk), f);
+      pos = 0;
+      eof = fill == 0;
+
+      /* line breaks and tabs separate words as well */
+      for (size_t i = 0; i < fill; ++i)
+        if (isspace((unsigned char)chunk[i])) chunk[i] = ' ';
+    }
+
+    const uint32_t in_flight = sequence - acked;
+
+    if (pos == fill && in_flight == 0) break;
+
+    struct pollfd pfd = { s, 0, 0 };
+
+    if (in_flight > 0) pfd.events |= POLLIN;
+    if (pos < fill && (window == 0 || in_flight < window))
+      pfd.events |= POLLOUT;
+
+    int n = poll(&pfd, 1, ACK_TIMEOUT_MS);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) break;
+
+    if (n == 0) {
+      fprintf(stderr, "No acknowledgment within %d ms, sending without\n",
+              ACK_TIMEOUT_MS);
+      window = 0;
+      acked = sequence;
+      continue;
+    }
+
+    if (pfd.revents & POLLIN) {
+      unsigned char ack[MORSE_ACK_LENGTH];
+      uint32_t seq;
+
+      /* in order, the server handles packets one after the other */
+      if (recv(s, ack, sizeof(ack), MSG_WAITALL) != sizeof(ack) ||
+          morse_unpack_ack(ack, sizeof(ack), &seq) < 0 || seq != acked) {
+        status = -1;
         break;
       }
-      else {
-	/* catch lower case alpha's and single digits only */
-	if ((c >= '0' && c <= '9') || (c >= 'a') && (c <= 'z')) {
-          printf("  sending '%c'...", c);
-	  data[0] = c;
 
-          status = write(s, data, PACKET_LENGTH);
+      if (num_latencies == max_latencies) {
+        size_t num = max_latencies ? 2 * max_latencies : 1024;
+        double *more = realloc(latencies, num * sizeof(double));
 
-          if (status < 0) printf("failed\n");
-          else printf("ok\n");
+        if (!more) break;
+
+        latencies = more;
+        max_latencies = num;
+      }
+
+      latencies[num_latencies++] = now() - sent_at[seq % window];
+      acked++;
+    }
+    else if (pfd.revents & (POLLERR | POLLHUP)) {
+      status = -1;
+      break;
+    }
+
+    if (pfd.revents & POLLOUT) {
+      size_t consumed;
+      size_t plen = morse_pack(chunk + pos, fill - pos, &consumed,
+                               packet, mtu);
+
+      pos += consumed;
+      chars += consumed;
+      packets++;
+
+      if (window > 0) {
+        sent_at[sequence % window] = now();
+
+        /* glued to the packet on byte streams, a packet of its own
+           otherwise */
+        if (glue) plen += morse_pack_ack(sequence++, packet + plen);
+        else {
+          status = write_all(s, packet, plen);
+          plen = morse_pack_ack(sequence++, packet);
         }
       }
+
+      if (status >= 0) status = write_all(s, packet, plen);
     }
   }
-  else printf("failed\n");
+
+  const double elapsed = now() - start;
+
+  printf("Sent %lu characters in %lu packet(s), %.3f s, %.0f characters/s"
+         "...%s\n", chars, packets, elapsed, elapsed > 0 ? chars / elapsed : 0,
+         status < 0 ? "failed" : "ok");
+
+  if (num_latencies > 0) {
+    qsort(latencies, num_latencies, sizeof(double), compare_doubles);
+
+    printf("Latency p50 %.3f ms, p99 %.3f ms, max %.3f ms (%zu acks)\n",
+           latencies[num_latencies / 2] * 1e3,
+           latencies[num_latencies * 99 / 100] * 1e3,
+           latencies[num_latencies - 1] * 1e3, num_latencies);
+  }
+
+  if (f != stdin) fclose(f);
+
+  free(latencies);
+  free(sent_at);
+  send_goodbye(s);
+}
+
+//-----------------------------------------------------------------------------
+//
+static void run_legacy(int s)
+{
+  int status;
+
+  printf("Press <SPACE + ENTER> to quit, or message to send:\n");
+
+  while (1)  {
+    int c = getchar();
+
+    /* reserve 8 bytes to encode messages to be sent */
+    char data[PACKET_LENGTH] = "        ";
+
+    if (c == 0x20 || c == EOF) {
+      /* spacebar as loop exit */
+      send_goodbye(s);
+      break;
+    }
+    else {
+      /* catch lower case alpha's and single digits only */
+      if ((c >= '0' && c <= '9') || (c >= 'a') && (c <= 'z')) {
+        printf("  sending '%c'...", c);
+        data[0] = c;
+
+        status = write(s, data, PACKET_LENGTH);
+
+        if (status < 0) printf("failed\n");
+        else printf("ok\n");
+      }
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+//
+int main(int argc, char **argv)
+{
+  struct morse_endpoint ep;
+  int s;
+  int legacy = 0;
+  int keyer = 0;
+  const char *trace = NULL;
+  const char *batch = NULL;
+  unsigned int window = DEFAULT_WINDOW;
+  int opt;
+
+  /* -l sends one character per 8-byte packet, as older servers expect,
+     -k sends dots and dashes as typed, -t replays a key timing trace,
+     -b sends a whole file ('-' for stdin) as fast as possible, with up
+     to -w packets in flight */
+  while ((opt = getopt(argc, argv, "lkt:b:w:")) != -1) {
+    if (opt == 'l') legacy = 1;
+    else if (opt == 'k') keyer = 1;
+    else if (opt == 't') trace = optarg;
+    else if (opt == 'b') batch = optarg;
+    else if (opt == 'w') window = atoi(optarg);
+    else {
+      fprintf(stderr, "usage: %s [-l | -k | -t trace | -b file [-w window]] "
+              "<url | bt_addr>\n", argv[0]);
+      return 1;
+    }
+  }
+
+  /* e.g. l2cap://00:11:22:33:44:55 or unix:///tmp/morse.sock, a bare
+     address connects via RFCOMM, see morse_transport.h */
+  if (optind >= argc || morse_endpoint_parse(argv[optind], &ep) < 0) {
+    fprintf(stderr, "usage: %s [-l | -k | -t trace | -b file [-w window]] "
+            "<url | bt_addr>\n", argv[0]);
+    return 1;
+  }
+
+  /* connect to them morse server that does decoding */
+  printf("Establishing connection...");
+
+  s = morse_transport_connect(&ep);
+
+  if (s >= 0) {
+    struct morse_link link;
+    char name[64];
+
+    printf("ok\n");
+
+    /* the server tells how large packets may get, see the URL query */
+    if (morse_transport_link(s, &ep, &link) == 0) {
+      printf("Link: %s\n", morse_link_name(&link, name, sizeof(name)));
+
+      if (link.omtu >= MORSE_MTU_MIN) mtu = link.omtu;
+    }
+
+    if (legacy) run_legacy(s);
+    else if (keyer) run_keyer(s);
+    else if (trace) run_trace(s, trace);
+    else if (batch)
+      run_batch(s, batch, window, morse_endpoint_is_stream(&ep));
+    else run_packed(s);
+  }
+  else {
+    printf("failed\n");
+    return 1;
+  }
 
   close(s);
   return 0;
@@ -0,0 +1,481 @@
+/******************************************************************************/
+/* File: keytrace.c
+   Author: N.Kim
+   Abstract: Generate, decode and replay morse key timing traces
+
+   Description:
+     keytrace gen [-w wpm] [-e end-wpm] [-j jitter%] [-r dash-ratio]
+                  [-b bounce%] [-s seed] [text]
+       keys the text (or stdin) as a hand keying operator would: the
+       speed drifts from 'wpm' to 'end-wpm', every element is off by up
+       to 'jitter' percent, dashes take 'dash-ratio' dots and some key
+       ups bounce. Writes the trace to stdout, see morse_timing.h.
+
+     keytrace decode
+       reads a trace from stdin as it is being written (e.g. by a GPIO
+       capture) and prints the text in real time. A character shows up
+       as soon as the key has been up long enough to end it.
+
+     keytrace replay [-w wpm] [-n repeat] [-v] trace...
+       decodes recorded traces as fast as possible. Reports events/sec,
+       the final speed estimate and, for traces carrying their text,
+       the character error rate (edit distance / length). */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "morse_codec.h"
+#include "morse_stream.h"
+#include "morse_timing.h"
+
+/* events decoded at once */
+#define CHUNK_EVENTS 256
+
+/* contact bounce inserted by the generator, well below the debounce */
+#define BOUNCE_US 1500
+
+#define TEXT_PREFIX "# text: "
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static double jitter(double duration, double amount)
+{
+  return duration * (1.0 + amount * (2.0 * rand() / RAND_MAX - 1.0));
+}
+
+/******************************************************************************/
+
+static void print_event(unsigned long long time_us, int down)
+{
+  printf("%llu %d\n", time_us, down);
+}
+
+/******************************************************************************/
+
+static int run_gen(int argc, char **argv)
+{
+  double wpm = 20, end_wpm = 0, amount = 0, ratio = 3, bounce = 0;
+  char text[4096] = "";
+  int opt;
+
+  while ((opt = getopt(argc, argv, "w:e:j:r:b:s:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'w': wpm = atof(optarg); break;
+      case 'e': end_wpm = atof(optarg); break;
+      case 'j': amount = atof(optarg) / 100; break;
+      case 'r': ratio = atof(optarg); break;
+      case 'b': bounce = atof(optarg) / 100; break;
+      case 's': srand(atoi(optarg)); break;
+      default: return -1;
+    }
+  }
+
+  if (wpm <= 0) return -1;
+  if (end_wpm <= 0) end_wpm = wpm;
+
+  /* the text, from the arguments or stdin, as a single line */
+  if (optind < argc)
+  {
+    for (int i = optind; i < argc; ++i)
+    {
+      if (i > optind) strncat(text, " ", sizeof(text) - strlen(text) - 1);
+      strncat(text, argv[i], sizeof(text) - strlen(text) - 1);
+    }
+  }
+  else text[fread(text, 1, sizeof(text) - 1, stdin)] = '\0';
+
+  for (char *p = text; *p; ++p)
+    if (isspace((unsigned char)*p)) *p = ' ';
+
+  const size_t len = strlen(text);
+
+  printf("# morse key trace, %.0f to %.0f wpm, jitter %.0f%%, "
+         "dash ratio %.1f\n", wpm, end_wpm, amount * 100, ratio);
+  printf(TEXT_PREFIX "%s\n", text);
+
+  /* spaces in units, 0 before the very first mark */
+  unsigned long long t = 0;
+  double pending = 0;
+
+  for (size_t i = 0; i < len; ++i)
+  {
+    const double unit = 1.2e6 / (wpm + (end_wpm - wpm) * i / len);
+    const unsigned int code = morse_code(text[i]);
+
+    if (text[i] == ' ')
+    {
+      if (pending > 0) pending = 7;
+      continue;
+    }
+
+    if (code == 0) continue;
+
+    for (unsigned int n = morse_code_length(code); n-- > 0;)
+    {
+      t += jitter(pending * unit, amount);
+      print_event(t, 1);
+
+      t += jitter(((code >> n) & 1 ? ratio : 1) * unit, amount);
+      print_event(t, 0);
+
+      if (rand() < bounce * RAND_MAX)
+      {
+        print_event(t + BOUNCE_US / 3, 1);
+        print_event(t + BOUNCE_US, 0);
+      }
+
+      pending = 1;
+    }
+
+    pending = 3;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+static void print_symbols(struct morse_stream *stream,
+                          const char *symbols,
+                          size_t len)
+{
+  char text[CHUNK_EVENTS * 2];
+  size_t n = morse_stream_feed(stream, symbols, len, text, sizeof(text), NULL);
+
+  fwrite(text, 1, n, stdout);
+  fflush(stdout);
+}
+
+/******************************************************************************/
+
+static int run_decode(void)
+{
+  struct morse_timing timing;
+  struct morse_stream stream;
+  struct morse_key_event ev;
+  struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+
+  char line[256];
+  char symbol;
+  size_t fill = 0;
+
+  /* trace time of the last event and when it has been read, together
+     they give the trace time now */
+  uint32_t last_us = 0;
+  double last_read = now();
+
+  morse_timing_init(&timing, 0);
+  morse_stream_init(&stream);
+
+  for (;;)
+  {
+    /* nothing to read for a while, the space may be over by now */
+    if (fill == 0 && poll(&pfd, 1, 10) == 0)
+    {
+      const uint32_t now_us = last_us + (now() - last_read) * 1e6;
+
+      if (morse_timing_idle(&timing, now_us, &symbol))
+        print_symbols(&stream, &symbol, 1);
+
+      continue;
+    }
+
+    ssize_t n = read(STDIN_FILENO, line + fill, sizeof(line) - 1 - fill);
+
+    if (n <= 0) break;
+
+    fill += n;
+    line[fill] = '\0';
+
+    /* complete lines only, keep the rest */
+    char *start = line;
+
+    for (char *eol; (eol = strchr(start, '\n')); start = eol + 1)
+    {
+      *eol = '\0';
+
+      if (morse_trace_parse(start, &ev) <= 0) continue;
+
+      if (morse_timing_feed(&timing, &ev, 1, &symbol, 1, NULL))
+        print_symbols(&stream, &symbol, 1);
+
+      last_us = ev.time_us;
+      last_read = now();
+    }
+
+    fill = line + fill - start;
+    memmove(line, start, fill);
+
+    /* overlong line, drop it */
+    if (fill == sizeof(line) - 1) fill = 0;
+  }
+
+  symbol = morse_stream_flush(&stream);
+
+  if (symbol) putchar(symbol);
+
+  putchar('\n');
+  return 0;
+}
+
+/******************************************************************************/
+
+struct trace {
+  struct morse_key_event *events;
+  size_t num;
+  char *text;
+};
+
+static int load_trace(const char *path, struct trace *tr)
+{
+  FILE *f = fopen(path, "r");
+  char *line = NULL;
+  size_t size = 0, cap = 0;
+
+  if (!f) return -1;
+
+  *tr = (struct trace){0};
+
+  while (getline(&line, &size, f) >= 0)
+  {
+    struct morse_key_event ev;
+
+    line[strcspn(line, "\n")] = '\0';
+
+    if (!tr->text && strncmp(line, TEXT_PREFIX, strlen(TEXT_PREFIX)) == 0)
+      tr->text = strdup(line + strlen(TEXT_PREFIX));
+
+    if (morse_trace_parse(line, &ev) <= 0) continue;
+
+    if (tr->num == cap)
+    {
+      cap = cap ? 2 * cap : 1024;
+      tr->events = realloc(tr->events, cap * sizeof(ev));
+    }
+
+    tr->events[tr->num++] = ev;
+  }
+
+  free(line);
+  fclose(f);
+  return 0;
+}
+
+/******************************************************************************/
+
+static size_t decode_trace(const struct trace *tr,
+                           unsigned int wpm,
+                           char *out,
+                           unsigned int *final_wpm)
+{
+  struct morse_timing timing;
+  struct morse_stream stream;
+  char symbols[CHUNK_EVENTS];
+  size_t len = 0;
+
+  morse_timing_init(&timing, wpm);
+  morse_stream_init(&stream);
+
+  /* a character completes no sooner than its gap, thus, there is never
+     more text than events */
+  for (size_t pos = 0; pos < tr->num; pos += CHUNK_EVENTS)
+  {
+    const size_t chunk = tr->num - pos < CHUNK_EVENTS ?
+      tr->num - pos : CHUNK_EVENTS;
+    const size_t n = morse_timing_feed(&timing, tr->events + pos, chunk,
+                                       symbols, sizeof(symbols), NULL);
+
+    len += morse_stream_feed(&stream, symbols, n, out + len, tr->num + 1 - len,
+                             NULL);
+  }
+
+  const char c = morse_stream_flush(&stream);
+
+  if (c) out[len++] = c;
+
+  *final_wpm = morse_timing_wpm(&timing);
+  return len;
+}
+
+/******************************************************************************/
+
+static size_t normalize(const char *text, char *out)
+{
+  /* as decoded: lower case, characters with a code, single spaces */
+  size_t len = 0;
+
+  for (; *text; ++text)
+  {
+    if (isspace((unsigned char)*text))
+    {
+      if (len > 0 && out[len - 1] != ' ') out[len++] = ' ';
+    }
+    else if (morse_code(*text))
+      out[len++] = tolower((unsigned char)*text);
+  }
+
+  while (len > 0 && out[len - 1] == ' ') len--;
+
+  return len;
+}
+
+/******************************************************************************/
+
+static size_t edit_distance(const char *a, size_t n, const char *b, size_t m)
+{
+  size_t *row = malloc((m + 1) * sizeof(size_t));
+  size_t result;
+
+  for (size_t j = 0; j <= m; ++j) row[j] = j;
+
+  for (size_t i = 1; i <= n; ++i)
+  {
+    size_t diag = row[0];
+
+    row[0] = i;
+
+    for (size_t j = 1; j <= m; ++j)
+    {
+      const size_t up = row[j];
+      size_t best = diag + (a[i - 1] != b[j - 1]);
+
+      if (up + 1 < best) best = up + 1;
+      if (row[j - 1] + 1 < best) best = row[j - 1] + 1;
+
+      diag = up;
+      row[j] = best;
+    }
+  }
+
+  result = row[m];
+  free(row);
+  return result;
+}
+
+/******************************************************************************/
+
+static int run_replay(int argc, char **argv)
+{
+  unsigned int wpm = 0;
+  int repeat = 1, verbose = 0, opt;
+  size_t total_events = 0, total_chars = 0, total_errors = 0, total_len = 0;
+  double elapsed = 0;
+
+  while ((opt = getopt(argc, argv, "w:n:v")) != -1)
+  {
+    switch (opt)
+    {
+      case 'w': wpm = atoi(optarg); break;
+      case 'n': repeat = atoi(optarg); break;
+      case 'v': verbose = 1; break;
+      default: return -1;
+    }
+  }
+
+  if (optind >= argc || repeat < 1) return -1;
+
+  for (int i = optind; i < argc; ++i)
+  {
+    struct trace tr;
+    unsigned int final_wpm = 0;
+    size_t len = 0;
+
+    if (load_trace(argv[i], &tr) < 0)
+    {
+      perror(argv[i]);
+      continue;
+    }
+
+    char *out = malloc(tr.num + 1);
+    double start = now();
+
+    for (int r = 0; r < repeat; ++r)
+      len = decode_trace(&tr, wpm, out, &final_wpm);
+
+    elapsed += now() - start;
+    total_events += tr.num * repeat;
+    total_chars += len * repeat;
+
+    while (len > 0 && out[len - 1] == ' ') len--;
+
+    printf("%s: %zu events, %zu chars, %u wpm", argv[i], tr.num, len,
+           final_wpm);
+
+    if (tr.text)
+    {
+      char *expected = malloc(strlen(tr.text) + 1);
+      size_t elen = normalize(tr.text, expected);
+      size_t errors = edit_distance(expected, elen, out, len);
+
+      printf(", %zu errors, CER %.2f%%", errors,
+             elen ? 100.0 * errors / elen : 0.0);
+
+      total_errors += errors;
+      total_len += elen;
+      free(expected);
+    }
+
+    printf("\n");
+
+    if (verbose) printf("  %.*s\n", (int)len, out);
+
+    free(out);
+    free(tr.text);
+    free(tr.events);
+  }
+
+  if (elapsed > 0)
+    printf("%.1f M events/s, %.1f M chars/s", total_events / elapsed / 1e6,
+           total_chars / elapsed / 1e6);
+
+  if (total_len > 0)
+    printf(", CER %.2f%% overall", 100.0 * total_errors / total_len);
+
+  printf("\n");
+  return 0;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  int status = -1;
+
+  if (argc > 1 && strcmp(argv[1], "gen") == 0)
+    status = run_gen(argc - 1, argv + 1);
+  else if (argc > 1 && strcmp(argv[1], "decode") == 0)
+    status = run_decode();
+  else if (argc > 1 && strcmp(argv[1], "replay") == 0)
+    status = run_replay(argc - 1, argv + 1);
+
+  if (status < 0)
+  {
+    fprintf(stderr, "usage: %s gen [-w wpm] [-e end-wpm] [-j jitter%%] "
+            "[-r dash-ratio] [-b bounce%%] [-s seed] [text]\n"
+            "       %s decode\n"
+            "       %s replay [-w wpm] [-n repeat] [-v] trace...\n",
+            argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,312 @@
+/******************************************************************************/
+/* File: loadtest.c
+   Author: N.Kim
+   Abstract: Load test of the Bluetooth Morse server
+
+   Description:
+     Starts the server on a UNIX socket, sequential packets (stand-in for
+     L2CAP) or a byte stream (stand-in for RFCOMM), and connects a
+     growing number of clients to it. Every client sends its characters
+     followed by "goodbye!", the server closing the connection marks the
+     characters as processed.
+
+     Reports characters/sec and packets per character for a few numbers
+     of concurrent clients, in the legacy (8 bytes per character) and
+     the packed wire format, the latency from "goodbye!" to the server
+     hanging up (p50, p99) and the number of clients the server manages
+     to serve all at once.
+
+     loadtest [-s server-binary] [-u unix-url] [-c max-clients]
+              [-n chars-per-client] */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "morse_transport.h"
+#include "morse_wire.h"
+
+#define DEFAULT_URL "unix:///tmp/morse-loadtest.sock"
+
+static struct morse_endpoint endpoint;
+
+/******************************************************************************/
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+static int connect_client(void)
+{
+  struct timeval tv = { 10, 0 };
+
+  int s = morse_transport_connect(&endpoint);
+
+  if (s < 0) return -1;
+
+  /* a stuck server should not stall the test forever */
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  return s;
+}
+
+/******************************************************************************/
+
+static int send_packet(int s, const void *packet, size_t len)
+{
+  return send(s, packet, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+/******************************************************************************/
+
+/* say goodbye and wait until the server hung up, i.e. it has processed
+   everything sent so far. Returns the seconds this took, -1 on failure */
+static double finish_client(int s)
+{
+  char buf[PACKET_LENGTH];
+  double start = now();
+  double latency = -1;
+
+  if (send_packet(s, "goodbye!", PACKET_LENGTH) == 0 &&
+      recv(s, buf, sizeof(buf), 0) == 0)
+    latency = now() - start;
+
+  close(s);
+  return latency;
+}
+
+/******************************************************************************/
+
+static int compare(const void *a, const void *b)
+{
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/******************************************************************************/
+
+/* split the text into packets of the selected format, returns the
+   number of packets */
+static int build_packets(const char *text,
+                         size_t len,
+                         int packed,
+                         unsigned char *buf,
+                         size_t *offsets)
+{
+  int num = 0;
+  size_t pos = 0;
+
+  /* as large as the server takes them, see the URL's mtu= */
+  const size_t mtu = endpoint.mtu ? endpoint.mtu : MORSE_DEFAULT_MTU;
+
+  offsets[0] = 0;
+
+  for (size_t i = 0; i < len; ++num)
+  {
+    if (packed)
+    {
+      size_t consumed;
+
+      pos += morse_pack(text + i, len - i, &consumed,
+                        buf + pos, mtu);
+      i += consumed;
+    }
+    else
+    {
+      memset(buf + pos, ' ', PACKET_LENGTH);
+      buf[pos] = text[i++];
+      pos += PACKET_LENGTH;
+    }
+
+    offsets[num + 1] = pos;
+  }
+
+  return num;
+}
+
+/******************************************************************************/
+
+/* returns the number of clients served successfully, 'packets' and
+   'bytes' receive what a single client sent, 'latency' the p50 and p99
+   of the clients served */
+static int run(int num,
+               int chars,
+               int packed,
+               double *elapsed,
+               int *packets,
+               size_t *bytes,
+               double latency[2])
+{
+  const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+  int *fds = calloc(num, sizeof(int));
+  double *latencies = calloc(num, sizeof(double));
+  int connected = 0;
+  int served = 0;
+
+  /* every client sends the same text, thus, encode it only once */
+  char *text = malloc(chars);
+  unsigned char *buf = malloc((size_t)chars * PACKET_LENGTH);
+  size_t *offsets = malloc((chars + 1) * sizeof(size_t));
+
+  for (int i = 0; i < chars; ++i)
+    text[i] = alphabet[i % (sizeof(alphabet) - 1)];
+
+  *packets = build_packets(text, chars, packed, buf, offsets);
+  *bytes = offsets[*packets];
+
+  double start = now();
+
+  for (; connected < num; ++connected)
+    if ((fds[connected] = connect_client()) < 0) break;
+
+  /* round robin across all clients, they are all active at once */
+  for (int i = 0; i < *packets; ++i)
+  {
+    for (int c = 0; c < connected; ++c)
+    {
+      const size_t len = offsets[i + 1] - offsets[i];
+
+      if (fds[c] >= 0 && send_packet(fds[c], buf + offsets[i], len) < 0)
+      {
+        close(fds[c]);
+        fds[c] = -1;
+      }
+    }
+  }
+
+  for (int c = 0; c < connected; ++c)
+    if (fds[c] >= 0 && (latencies[served] = finish_client(fds[c])) >= 0)
+      served++;
+
+  *elapsed = now() - start;
+
+  qsort(latencies, served, sizeof(double), compare);
+
+  latency[0] = served ? latencies[served / 2] : 0;
+  latency[1] = served ? latencies[served * 99 / 100] : 0;
+
+  free(offsets);
+  free(buf);
+  free(text);
+  free(latencies);
+  free(fds);
+  return served;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const char *server = "./server";
+  const char *url = DEFAULT_URL;
+  int max_clients = 10000;
+  int chars = 200;
+  int failed = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:u:c:n:")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': server = optarg; break;
+      case 'u': url = optarg; break;
+      case 'c': max_clients = atoi(optarg); break;
+      case 'n': chars = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-s server] [-u unix-url] "
+                "[-c max-clients] [-n chars-per-client]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  /* no radios involved, UNIX sockets only */
+  if (morse_endpoint_parse(url, &endpoint) < 0 ||
+      (endpoint.transport != MORSE_TRANSPORT_UNIX &&
+       endpoint.transport != MORSE_TRANSPORT_UNIX_STREAM))
+  {
+    fprintf(stderr, "Not a unix:// or unix-stream:// URL: %s\n", url);
+    return 1;
+  }
+
+  /* leave some descriptors to the rest of the process */
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+
+    if (rl.rlim_cur != RLIM_INFINITY && max_clients > (int)rl.rlim_cur - 32)
+      max_clients = rl.rlim_cur - 32;
+  }
+
+  pid_t pid = fork();
+
+  if (pid == 0)
+  {
+    execl(server, server, "-q", "-l", url, (char *)NULL);
+    perror("Failed starting the server");
+    _exit(1);
+  }
+
+  /* wait for the server to come up */
+  for (int i = 0; i < 100 && access(endpoint.path, F_OK) < 0; ++i)
+    usleep(10000);
+
+  usleep(50000);
+
+  printf("server on %s\n", url);
+  printf("%-7s %8s %8s %10s %12s %10s %10s %8s %8s\n", "format", "clients",
+         "served", "seconds", "chars/s", "pkts/char", "bytes/char",
+         "p50 ms", "p99 ms");
+
+  for (int packed = 0; packed < 2; ++packed)
+  {
+    for (int num = 1; num <= max_clients; num *= 16)
+    {
+      double elapsed, latency[2];
+      int packets;
+      size_t bytes;
+      int served = run(num, chars, packed, &elapsed, &packets, &bytes,
+                       latency);
+
+      printf("%-7s %8d %8d %10.3f %12.0f %10.3f %10.3f %8.3f %8.3f\n",
+             packed ? "packed" : "legacy", num, served, elapsed,
+             (double)served * chars / elapsed, (double)packets / chars,
+             (double)bytes / chars, latency[0] * 1e3, latency[1] * 1e3);
+
+      failed |= served != num;
+    }
+  }
+
+  /* all clients connected at the same time, each sends one character */
+  double elapsed, latency[2];
+  int packets;
+  size_t bytes;
+  int served = run(max_clients, 1, 0, &elapsed, &packets, &bytes, latency);
+
+  printf("max concurrent clients served: %d (%.3f s)\n", served, elapsed);
+
+  kill(pid, SIGINT);
+  waitpid(pid, NULL, 0);
+
+  /* exits non-zero if any client of the fixed runs has been lost, e.g.
+     for CI. The maximum depends on the limits of the machine */
+  return failed;
+}
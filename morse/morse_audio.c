@@ -0,0 +1,185 @@
+/******************************************************************************/
+/* File: morse_audio.c
+   Author: N.Kim
+   Abstract: Renders morse code as a PCM tone */
+/******************************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "morse_audio.h"
+#include "morse_codec.h"
+
+/* some headroom below full scale */
+#define AMPLITUDE (0.8 * 32767)
+
+/******************************************************************************/
+
+static int16_t *render_tone(unsigned int len,
+                            unsigned int ramp,
+                            double step)
+{
+  int16_t *tone = malloc(len * sizeof(int16_t));
+
+  if (!tone) return NULL;
+
+  for (unsigned int i = 0; i < len; ++i)
+  {
+    const unsigned int left = len - 1 - i;
+    double level = AMPLITUDE;
+
+    /* raised cosine edges */
+    if (i < ramp) level *= 0.5 * (1 - cos(M_PI * i / ramp));
+    if (left < ramp) level *= 0.5 * (1 - cos(M_PI * left / ramp));
+
+    tone[i] = lrint(level * sin(step * i));
+  }
+
+  return tone;
+}
+
+/******************************************************************************/
+
+int morse_audio_init(struct morse_audio *a,
+                     unsigned int rate,
+                     unsigned int tone_hz,
+                     unsigned int wpm)
+{
+  *a = (struct morse_audio){0};
+
+  if (rate == 0 || wpm == 0 || tone_hz == 0 || 2 * tone_hz >= rate) return -1;
+
+  /* a word (PARIS) takes 50 units */
+  a->rate = rate;
+  a->unit = rate * 60 / (50 * wpm);
+
+  if (a->unit < 2) return -1;
+
+  unsigned int ramp = rate * MORSE_AUDIO_RAMP_MS / 1000;
+
+  if (ramp > a->unit / 2) ramp = a->unit / 2;
+
+  const double step = 2 * M_PI * tone_hz / rate;
+
+  a->dot = render_tone(a->unit, ramp, step);
+  a->dash = render_tone(3 * a->unit, ramp, step);
+
+  if (!a->dot || !a->dash)
+  {
+    morse_audio_free(a);
+    return -1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+void morse_audio_free(struct morse_audio *a)
+{
+  free(a->dot);
+  free(a->dash);
+
+  a->dot = a->dash = NULL;
+}
+
+/******************************************************************************/
+
+size_t morse_audio_samples(const struct morse_audio *a, unsigned int code)
+{
+  if (code == 0) return 4 * a->unit;
+
+  /* dots take 1 unit, dashes 3, 1 unit in between and 3 at the end */
+  const unsigned int n = morse_code_length(code);
+  const unsigned int dashes = __builtin_popcount(code) - 1;
+
+  return (2 * n + 2 * dashes + 2) * a->unit;
+}
+
+/******************************************************************************/
+
+size_t morse_audio_render(const struct morse_audio *a,
+                          const char *text,
+                          size_t len,
+                          int16_t *out,
+                          size_t cap,
+                          size_t *consumed)
+{
+  const size_t unit = a->unit;
+  int16_t *op = out;
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+  {
+    const unsigned char c = text[i];
+    const unsigned int code = morse_code(c);
+
+    /* whitespace is a word gap, like morse_encode() does it */
+    if (code == 0 && c != ' ' && c != '\t' && c != '\r') continue;
+
+    const size_t need = morse_audio_samples(a, code);
+
+    if ((size_t)(out + cap - op) < need) break;
+
+    if (code == 0)
+    {
+      memset(op, 0, need * sizeof(int16_t));
+      op += need;
+      continue;
+    }
+
+    for (unsigned int n = morse_code_length(code); n-- > 0;)
+    {
+      if ((code >> n) & 1)
+      {
+        memcpy(op, a->dash, 3 * unit * sizeof(int16_t));
+        op += 3 * unit;
+      }
+      else
+      {
+        memcpy(op, a->dot, unit * sizeof(int16_t));
+        op += unit;
+      }
+
+      const size_t space = n ? unit : 3 * unit;
+
+      memset(op, 0, space * sizeof(int16_t));
+      op += space;
+    }
+  }
+
+  if (consumed) *consumed = i;
+  return op - out;
+}
+
+/******************************************************************************/
+
+static void put_le(uint8_t *p, uint32_t value, unsigned int bytes)
+{
+  for (unsigned int i = 0; i < bytes; ++i) p[i] = (value >> (8 * i)) & 0xff;
+}
+
+/******************************************************************************/
+
+void morse_wav_header(uint8_t header[MORSE_WAV_HEADER],
+                      unsigned int rate,
+                      uint32_t samples)
+{
+  /* the RIFF size has to fit 32 bits as well */
+  const uint32_t max_bytes = (UINT32_MAX - (MORSE_WAV_HEADER - 8)) & ~1u;
+  const uint32_t bytes = samples > max_bytes / 2 ? max_bytes : samples * 2;
+
+  memcpy(header, "RIFF", 4);
+  put_le(header + 4, bytes + MORSE_WAV_HEADER - 8, 4);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  put_le(header + 16, 16, 4);          /* format chunk size */
+  put_le(header + 20, 1, 2);           /* PCM */
+  put_le(header + 22, 1, 2);           /* mono */
+  put_le(header + 24, rate, 4);
+  put_le(header + 28, rate * 2, 4);    /* bytes per second */
+  put_le(header + 32, 2, 2);           /* bytes per frame */
+  put_le(header + 34, 16, 2);          /* bits per sample */
+  memcpy(header + 36, "data", 4);
+  put_le(header + 40, bytes, 4);
+}
@@ -0,0 +1,62 @@
+/******************************************************************************/
+/* File: morse_audio.h
+   Author: N.Kim
+   Abstract: Renders morse code as a PCM tone */
+/******************************************************************************/
+
+#ifndef MORSE_AUDIO_H
+#define MORSE_AUDIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MORSE_AUDIO_DEFAULT_RATE 8000
+#define MORSE_AUDIO_DEFAULT_TONE 700
+#define MORSE_AUDIO_DEFAULT_WPM 20
+
+/* rising and falling edge of a tone, avoids clicks */
+#define MORSE_AUDIO_RAMP_MS 5
+
+/* 16-bit signed mono samples. The dot and the dash are rendered once,
+   sine and ramps included, rendering a character copies these blocks
+   and zeroes the spaces in between, no sample is computed on the way.
+   Every element starts at phase 0, the ramps make this inaudible */
+struct morse_audio {
+  unsigned int rate;
+  unsigned int unit;        /* samples per dot */
+  int16_t *dot;             /* one unit */
+  int16_t *dash;            /* three units */
+};
+
+/* returns -1 if out of memory or the parameters make no sense */
+int morse_audio_init(struct morse_audio *a,
+                     unsigned int rate,
+                     unsigned int tone_hz,
+                     unsigned int wpm);
+
+void morse_audio_free(struct morse_audio *a);
+
+/* number of samples of a character including the space after it (three
+   units), 0 is a word gap (four more units) */
+size_t morse_audio_samples(const struct morse_audio *a, unsigned int code);
+
+/* render text, one character after the other as with morse_encode().
+   Stops once the next character does not fit into 'out'. Returns the
+   number of samples written, 'consumed' (may be NULL) receives the
+   number of characters used */
+size_t morse_audio_render(const struct morse_audio *a,
+                          const char *text,
+                          size_t len,
+                          int16_t *out,
+                          size_t cap,
+                          size_t *consumed);
+
+#define MORSE_WAV_HEADER 44
+
+/* RIFF/WAVE header of 'samples' samples. UINT32_MAX gives the largest
+   size possible, for streams of unknown length */
+void morse_wav_header(uint8_t header[MORSE_WAV_HEADER],
+                      unsigned int rate,
+                      uint32_t samples);
+
+#endif
@@ -0,0 +1,303 @@
+/******************************************************************************/
+/* File: morse_codec.c
+   Author: N.Kim
+   Abstract: Table driven bulk morse encoder/decoder
+
+   Description:
+     Both tables are generated by the compiler from a single list of
+     characters and their codes, nothing is set up at runtime. Encoding
+     is one table lookup plus one store per symbol, decoding shifts the
+     symbols into a code and looks up the character once a separator
+     shows up. */
+
+/******************************************************************************/
+
+#include <string.h>
+
+#include "morse_codec.h"
+
+/* symbols, 'di' is a dot and 'da' a dash. They are pasted onto other
+   tokens, thus, they must not be macros themselves */
+#define V_di 0
+#define V_da 1
+
+/* codes, the sentinel moves along with every symbol appended */
+#define M1(a) (0x2 | V_##a)
+#define M2(a, b) (M1(a) << 1 | V_##b)
+#define M3(a, b, c) (M2(a, b) << 1 | V_##c)
+#define M4(a, b, c, d) (M3(a, b, c) << 1 | V_##d)
+#define M5(a, b, c, d, e) (M4(a, b, c, d) << 1 | V_##e)
+#define M6(a, b, c, d, e, f) (M5(a, b, c, d, e) << 1 | V_##f)
+#define M7(a, b, c, d, e, f, g) (M6(a, b, c, d, e, f) << 1 | V_##g)
+#define M8(a, b, c, d, e, f, g, h) (M7(a, b, c, d, e, f, g) << 1 | V_##h)
+#define M9(a, b, c, d, e, f, g, h, i) \
+  (M8(a, b, c, d, e, f, g, h) << 1 | V_##i)
+
+/* the same as text, adjacent string literals are concatenated */
+#define T_di "."
+#define T_da "-"
+
+#define T1(a) T_##a
+#define T2(a, b) T1(a) T_##b
+#define T3(a, b, c) T2(a, b) T_##c
+#define T4(a, b, c, d) T3(a, b, c) T_##d
+#define T5(a, b, c, d, e) T4(a, b, c, d) T_##e
+#define T6(a, b, c, d, e, f) T5(a, b, c, d, e) T_##f
+#define T7(a, b, c, d, e, f, g) T6(a, b, c, d, e, f) T_##g
+#define T8(a, b, c, d, e, f, g, h) T7(a, b, c, d, e, f, g) T_##h
+#define T9(a, b, c, d, e, f, g, h, i) T8(a, b, c, d, e, f, g, h) T_##i
+
+/* character, number of symbols, symbols. Lower case letters only, the
+   upper case ones are derived */
+#define MORSE_LETTERS(X) \
+  X('a', 2, di, da) \
+  X('b', 4, da, di, di, di) \
+  X('c', 4, da, di, da, di) \
+  X('d', 3, da, di, di) \
+  X('e', 1, di) \
+  X('f', 4, di, di, da, di) \
+  X('g', 3, da, da, di) \
+  X('h', 4, di, di, di, di) \
+  X('i', 2, di, di) \
+  X('j', 4, di, da, da, da) \
+  X('k', 3, da, di, da) \
+  X('l', 4, di, da, di, di) \
+  X('m', 2, da, da) \
+  X('n', 2, da, di) \
+  X('o', 3, da, da, da) \
+  X('p', 4, di, da, da, di) \
+  X('q', 4, da, da, di, da) \
+  X('r', 3, di, da, di) \
+  X('s', 3, di, di, di) \
+  X('t', 1, da) \
+  X('u', 3, di, di, da) \
+  X('v', 4, di, di, di, da) \
+  X('w', 3, di, da, da) \
+  X('x', 4, da, di, di, da) \
+  X('y', 4, da, di, da, da) \
+  X('z', 4, da, da, di, di)
+
+/* digits, punctuation (ITU-R M.1677-1 plus the common '!', '$' and
+   '_'), the new line (AA) and the prosigns of their own */
+#define MORSE_OTHERS(X) \
+  X('0', 5, da, da, da, da, da) \
+  X('1', 5, di, da, da, da, da) \
+  X('2', 5, di, di, da, da, da) \
+  X('3', 5, di, di, di, da, da) \
+  X('4', 5, di, di, di, di, da) \
+  X('5', 5, di, di, di, di, di) \
+  X('6', 5, da, di, di, di, di) \
+  X('7', 5, da, da, di, di, di) \
+  X('8', 5, da, da, da, di, di) \
+  X('9', 5, da, da, da, da, di) \
+  X('.', 6, di, da, di, da, di, da) \
+  X(',', 6, da, da, di, di, da, da) \
+  X('?', 6, di, di, da, da, di, di) \
+  X('\'', 6, di, da, da, da, da, di) \
+  X('!', 6, da, di, da, di, da, da) \
+  X('/', 5, da, di, di, da, di) \
+  X('(', 5, da, di, da, da, di) \
+  X(')', 6, da, di, da, da, di, da) \
+  X('&', 5, di, da, di, di, di) \
+  X(':', 6, da, da, da, di, di, di) \
+  X(';', 6, da, di, da, di, da, di) \
+  X('=', 5, da, di, di, di, da) \
+  X('+', 5, di, da, di, da, di) \
+  X('-', 6, da, di, di, di, di, da) \
+  X('_', 6, di, di, da, da, di, da) \
+  X('"', 6, di, da, di, di, da, di) \
+  X('$', 7, di, di, di, da, di, di, da) \
+  X('@', 6, di, da, da, di, da, di) \
+  X('\n', 4, di, da, di, da) \
+  X(MORSE_PROSIGN_KA, 5, da, di, da, di, da) \
+  X(MORSE_PROSIGN_SK, 6, di, di, di, da, di, da) \
+  X(MORSE_PROSIGN_SN, 5, di, di, di, da, di) \
+  X(MORSE_PROSIGN_SOS, 9, di, di, di, da, da, da, di, di, di) \
+  X(MORSE_PROSIGN_HH, 8, di, di, di, di, di, di, di, di)
+
+#define ENCODE(c, n, ...) [(unsigned char)(c)] = M##n(__VA_ARGS__),
+#define ENCODE_UPPER(c, n, ...) \
+  [(unsigned char)(c) - 'a' + 'A'] = M##n(__VA_ARGS__),
+#define DECODE(c, n, ...) [M##n(__VA_ARGS__)] = (c),
+#define TEXT(c, n, ...) [(unsigned char)(c)] = { n + 1, T##n(__VA_ARGS__) " " },
+#define TEXT_UPPER(c, n, ...) \
+  [(unsigned char)(c) - 'a' + 'A'] = { n + 1, T##n(__VA_ARGS__) " " },
+
+const uint16_t morse_encode_table[256] = {
+  MORSE_LETTERS(ENCODE)
+  MORSE_LETTERS(ENCODE_UPPER)
+  MORSE_OTHERS(ENCODE)
+};
+
+const char morse_decode_table[MORSE_CODE_LIMIT] = {
+  MORSE_LETTERS(DECODE)
+  MORSE_OTHERS(DECODE)
+};
+
+/* rendered output per character including its separator, padded to 16
+   bytes to be copied as a whole. Characters without a code have a
+   length of 0 and are skipped */
+struct morse_text {
+  uint8_t len;
+  char text[15];
+};
+
+static const struct morse_text text_table[256] = {
+  MORSE_LETTERS(TEXT)
+  MORSE_LETTERS(TEXT_UPPER)
+  MORSE_OTHERS(TEXT)
+  [' '] = { 2, "/ " },
+  ['\t'] = { 2, "/ " },
+  ['\r'] = { 2, "/ " }
+};
+
+/* input classes of the decoder, bit 1 marks a symbol, bit 0 a dash */
+enum {
+  SEPARATOR = 0,
+  WORD_GAP = 1,
+  DOT = 2,
+  DASH = 3
+};
+
+static const unsigned char decode_class[256] = {
+  [MORSE_DOT] = DOT,
+  [MORSE_DASH] = DASH,
+  [MORSE_WORD_GAP] = WORD_GAP
+};
+
+/* longer sequences stick to this code, it has no character (9 dashes) */
+#define CODE_OVERFLOW (MORSE_CODE_LIMIT - 1)
+
+/******************************************************************************/
+
+size_t morse_encode(const char *text,
+                    size_t len,
+                    char *out,
+                    size_t cap,
+                    size_t *consumed)
+{
+  char *op = out;
+  char *end = out + cap;
+  size_t i = 0;
+
+  /* every character is followed by its separator, thus, the output of
+     successive calls can simply be concatenated. As long as there is
+     room for a whole entry, copy it without looking at its length */
+  for (; i < len && end - op >= (ptrdiff_t)sizeof(text_table[0].text); ++i)
+  {
+    const struct morse_text *t = &text_table[(unsigned char)text[i]];
+
+    memcpy(op, t->text, sizeof(t->text));
+    op += t->len;
+  }
+
+  for (; i < len; ++i)
+  {
+    const struct morse_text *t = &text_table[(unsigned char)text[i]];
+
+    if (end - op < t->len) break;
+
+    memcpy(op, t->text, t->len);
+    op += t->len;
+  }
+
+  if (consumed) *consumed = i;
+  return op - out;
+}
+
+/******************************************************************************/
+
+size_t morse_decode(const char *morse,
+                    size_t len,
+                    char *out,
+                    size_t cap,
+                    size_t *consumed)
+{
+  size_t written = 0;
+  size_t start = 0;
+  unsigned int code = 1;
+  size_t i;
+
+  /* every character takes at least one symbol and its separator, thus,
+     there is never more output than input. With enough room for all of
+     it, the bounds checks and most branches go away: the character of
+     the pending code is always stored, but only kept at a separator */
+  if (cap > len)
+  {
+    unsigned int pending = 0;
+
+    for (i = 0; i < len; ++i)
+    {
+      const unsigned int cls = decode_class[(unsigned char)morse[i]];
+      const unsigned int symbol = cls >> 1;
+      const char c = morse_decode_table[code];
+
+      out[written] = c ? c : MORSE_UNKNOWN;
+      written += pending & !symbol;
+
+      out[written] = ' ';
+      written += cls == WORD_GAP;
+
+      code = symbol ? (code << 1) | (cls & 1) : 1;
+      code = code < MORSE_CODE_LIMIT ? code : CODE_OVERFLOW;
+      pending = symbol;
+    }
+
+    if (pending)
+    {
+      const char c = morse_decode_table[code];
+      out[written++] = c ? c : MORSE_UNKNOWN;
+    }
+
+    if (consumed) *consumed = len;
+    return written;
+  }
+
+  for (i = 0; i < len; ++i)
+  {
+    const unsigned int cls = decode_class[(unsigned char)morse[i]];
+
+    if (cls & DOT)
+    {
+      code = (code << 1) | (cls & 1);
+      if (code >= MORSE_CODE_LIMIT) code = CODE_OVERFLOW;
+      continue;
+    }
+
+    if (code > 1)
+    {
+      if (written == cap) break;
+
+      const char c = morse_decode_table[code];
+
+      out[written++] = c ? c : MORSE_UNKNOWN;
+      code = 1;
+    }
+
+    /* everything up to the separator has been consumed */
+    start = i;
+
+    if (cls == WORD_GAP)
+    {
+      if (written == cap) break;
+      out[written++] = ' ';
+    }
+
+    start = i + 1;
+  }
+
+  if (i == len && code > 1)
+  {
+    if (written < cap)
+    {
+      const char c = morse_decode_table[code];
+
+      out[written++] = c ? c : MORSE_UNKNOWN;
+      start = len;
+    }
+  }
+  else if (i == len) start = len;
+
+  if (consumed) *consumed = start;
+  return written;
+}
@@ -0,0 +1,80 @@
+/******************************************************************************/
+/* File: morse_codec.h
+   Author: N.Kim
+   Abstract: Table driven bulk morse encoder/decoder */
+/******************************************************************************/
+
+#ifndef MORSE_CODEC_H
+#define MORSE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* a character's code is its symbols (0 dot, 1 dash, first symbol most
+   significant) behind a leading 1 bit, the sentinel, which marks the
+   length. E.g. 'a' (.-) is 0b101, 'e' (.) is 0b10. 0 is no code */
+#define MORSE_MAX_SYMBOLS 9
+#define MORSE_CODE_LIMIT (1 << (MORSE_MAX_SYMBOLS + 1))
+
+/* prosigns without a character of their own are mapped to control
+   characters. AR, BT, KN and AS share their code with '+', '=', '(' and
+   '&' and decode as those */
+#define MORSE_PROSIGN_KA '\x02'   /* -.-.-      starting signal */
+#define MORSE_PROSIGN_SK '\x04'   /* ...-.-     end of work */
+#define MORSE_PROSIGN_SN '\x06'   /* ...-.      understood */
+#define MORSE_PROSIGN_SOS '\x07'  /* ...---...  distress */
+#define MORSE_PROSIGN_HH '\x08'   /* ........   error */
+
+/* emitted by the decoder for symbol sequences without a character */
+#define MORSE_UNKNOWN '#'
+
+/* textual representation, characters are separated by a space and
+   words by " / ", e.g. "sos sos" is "... --- ... / ... --- ..." */
+#define MORSE_DOT '.'
+#define MORSE_DASH '-'
+#define MORSE_WORD_GAP '/'
+
+extern const uint16_t morse_encode_table[256];
+extern const char morse_decode_table[MORSE_CODE_LIMIT];
+
+/* code of a character, upper and lower case letters share theirs */
+static inline unsigned int morse_code(unsigned char c)
+{
+  return morse_encode_table[c];
+}
+
+/* character of a code, 0 if there is none */
+static inline char morse_char(unsigned int code)
+{
+  return code < MORSE_CODE_LIMIT ? morse_decode_table[code] : 0;
+}
+
+/* number of symbols of a (valid) code */
+static inline unsigned int morse_code_length(unsigned int code)
+{
+  return 31 - __builtin_clz(code);
+}
+
+/* text to dots and dashes. Characters without a code are skipped,
+   spaces, tabs and carriage returns are word gaps, a newline is the
+   prosign AA (.-.-). Stops once the next character does not fit into
+   'out'. Returns the number of bytes written, 'consumed' (may be
+   NULL) receives the number of characters used. The output is not
+   terminated */
+size_t morse_encode(const char *text,
+                    size_t len,
+                    char *out,
+                    size_t cap,
+                    size_t *consumed);
+
+/* dots and dashes back to (lower case) text. The input has to end on a
+   character boundary, anything but dots, dashes and the word gap
+   separates characters. Returns the number of characters written,
+   'consumed' (may be NULL) receives the number of bytes used */
+size_t morse_decode(const char *morse,
+                    size_t len,
+                    char *out,
+                    size_t cap,
+                    size_t *consumed);
+
+#endif
@@ -0,0 +1,78 @@
+/******************************************************************************/
+/* File: morse_stream.c
+   Author: N.Kim
+   Abstract: Streaming decoder from morse symbols to text */
+/******************************************************************************/
+
+#include "morse_codec.h"
+#include "morse_stream.h"
+
+/* paths deeper than any character stay on this node, it has none */
+#define NODE_OVERFLOW (MORSE_CODE_LIMIT - 1)
+
+/******************************************************************************/
+
+void morse_stream_init(struct morse_stream *s)
+{
+  s->node = 1;
+}
+
+/******************************************************************************/
+
+static char node_char(unsigned int node)
+{
+  const char c = morse_decode_table[node];
+  return c ? c : MORSE_UNKNOWN;
+}
+
+/******************************************************************************/
+
+size_t morse_stream_feed(struct morse_stream *s,
+                         const char *symbols,
+                         size_t len,
+                         char *out,
+                         size_t cap,
+                         size_t *consumed)
+{
+  unsigned int node = s->node;
+  size_t written = 0;
+  size_t i;
+
+  for (i = 0; i < len; ++i)
+  {
+    const char sym = symbols[i];
+
+    /* descend */
+    if (sym == MORSE_SYMBOL_DOT || sym == MORSE_SYMBOL_DASH)
+    {
+      node = 2 * node + (sym == MORSE_SYMBOL_DASH);
+      if (node >= MORSE_CODE_LIMIT) node = NODE_OVERFLOW;
+      continue;
+    }
+
+    /* a gap completes the character, a word gap adds a space */
+    const size_t need = (node > 1) + (sym == MORSE_SYMBOL_WORD_GAP);
+
+    if (cap - written < need) break;
+
+    if (node > 1) out[written++] = node_char(node);
+    if (sym == MORSE_SYMBOL_WORD_GAP) out[written++] = ' ';
+
+    node = 1;
+  }
+
+  s->node = node;
+
+  if (consumed) *consumed = i;
+  return written;
+}
+
+/******************************************************************************/
+
+char morse_stream_flush(struct morse_stream *s)
+{
+  const unsigned int node = s->node;
+
+  s->node = 1;
+  return node > 1 ? node_char(node) : 0;
+}
@@ -0,0 +1,45 @@
+/******************************************************************************/
+/* File: morse_stream.h
+   Author: N.Kim
+   Abstract: Streaming decoder from morse symbols to text */
+/******************************************************************************/
+
+#ifndef MORSE_STREAM_H
+#define MORSE_STREAM_H
+
+#include <stddef.h>
+
+/* symbols are fed one at a time or in chunks of any size, a character
+   may well be split across several chunks (i.e. packets). The decoder
+   walks the code tree, which is stored flat: the root is node 1, the
+   dot child of node i is 2i and the dash child 2i + 1. That is exactly
+   the layout of the codec's code to character table, thus, the tree
+   costs no memory of its own. A character is emitted with the gap that
+   ends it, nothing is allocated on the way */
+struct morse_stream {
+  unsigned int node;
+};
+
+/* input symbols, the textual representation of morse_codec.h plus the
+   end of a character (also any other byte) */
+#define MORSE_SYMBOL_DOT '.'
+#define MORSE_SYMBOL_DASH '-'
+#define MORSE_SYMBOL_GAP ' '
+#define MORSE_SYMBOL_WORD_GAP '/'
+
+void morse_stream_init(struct morse_stream *s);
+
+/* feed symbols, the text completed by them is written to 'out'. Stops
+   once 'out' is full. Returns the number of characters written,
+   'consumed' receives the number of symbols used */
+size_t morse_stream_feed(struct morse_stream *s,
+                         const char *symbols,
+                         size_t len,
+                         char *out,
+                         size_t cap,
+                         size_t *consumed);
+
+/* end of input, returns the pending character if any, 0 otherwise */
+char morse_stream_flush(struct morse_stream *s);
+
+#endif
@@ -0,0 +1,226 @@
+/******************************************************************************/
+/* File: morse_timing.c
+   Author: N.Kim
+   Abstract: Decoder from key down/up timestamps to morse symbols */
+/******************************************************************************/
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#include "morse_codec.h"
+#include "morse_timing.h"
+
+/* a word (PARIS) takes 50 units */
+#define UNITS_PER_MINUTE 1200000
+
+/* refinements of the short/long split, converges in one or two */
+#define CLUSTER_ROUNDS 3
+
+enum {
+  GAP_NONE = 0,
+  GAP_CHAR = 1,
+  GAP_WORD = 2
+};
+
+/******************************************************************************/
+
+void morse_timing_init(struct morse_timing *t, unsigned int wpm)
+{
+  if (wpm == 0) wpm = 20;
+
+  *t = (struct morse_timing){0};
+
+  t->dot_us = UNITS_PER_MINUTE / wpm;
+  t->dash_us = 3 * t->dot_us;
+}
+
+/******************************************************************************/
+
+unsigned int morse_timing_wpm(const struct morse_timing *t)
+{
+  return (UNITS_PER_MINUTE + t->dot_us / 2) / t->dot_us;
+}
+
+/******************************************************************************/
+
+static void estimate(struct morse_timing *t)
+{
+  uint32_t lo = UINT32_MAX;
+  uint32_t hi = 0;
+  uint64_t sum = 0;
+
+  for (unsigned int i = 0; i < t->num_marks; ++i)
+  {
+    if (t->marks[i] < lo) lo = t->marks[i];
+    if (t->marks[i] > hi) hi = t->marks[i];
+    sum += t->marks[i];
+  }
+
+  if (hi >= 2 * lo)
+  {
+    /* short and long marks, i.e. dots and dashes. Split halfway and
+       move both to the mean of their side (k-means with k = 2), the
+       shortest and the longest mark always stay on their side */
+    for (unsigned int round = 0; round < CLUSTER_ROUNDS; ++round)
+    {
+      const uint32_t split = lo / 2 + hi / 2;
+      uint64_t sum_lo = 0, sum_hi = 0;
+      unsigned int n_lo = 0, n_hi = 0;
+
+      for (unsigned int i = 0; i < t->num_marks; ++i)
+      {
+        if (t->marks[i] < split) { sum_lo += t->marks[i]; n_lo++; }
+        else { sum_hi += t->marks[i]; n_hi++; }
+      }
+
+      lo = sum_lo / n_lo;
+      hi = sum_hi / n_hi;
+    }
+
+    t->dot_us = lo;
+    t->dash_us = hi;
+  }
+  else
+  {
+    /* all alike, stick to what they have been taken for so far */
+    const uint32_t mean = sum / t->num_marks;
+
+    if (mean < t->dot_us / 2 + t->dash_us / 2)
+    {
+      t->dot_us = mean;
+      t->dash_us = 3 * mean;
+    }
+    else
+    {
+      t->dot_us = mean / 3;
+      t->dash_us = mean;
+    }
+  }
+
+  /* keep within the supported speeds, the dots decide */
+  const uint32_t min_dot = UNITS_PER_MINUTE / MORSE_TIMING_MAX_WPM;
+  const uint32_t max_dot = UNITS_PER_MINUTE / MORSE_TIMING_MIN_WPM;
+
+  if (t->dot_us < min_dot) t->dot_us = min_dot;
+  if (t->dot_us > max_dot) t->dot_us = max_dot;
+  if (t->dash_us < 2 * t->dot_us) t->dash_us = 2 * t->dot_us;
+}
+
+/******************************************************************************/
+
+static unsigned int gap_level(const struct morse_timing *t, uint32_t space)
+{
+  /* spaces are 1, 3 and 7 dots, no matter how long the dashes are.
+     Split halfway */
+  if (space >= 5 * t->dot_us) return GAP_WORD;
+  if (space >= 2 * t->dot_us) return GAP_CHAR;
+  return GAP_NONE;
+}
+
+/******************************************************************************/
+
+static size_t emit_gap(struct morse_timing *t, uint32_t space, char *out)
+{
+  const unsigned int level = gap_level(t, space);
+
+  /* a gap is written once, a word gap after a character gap still ends
+     the word */
+  if (level <= t->gap) return 0;
+
+  t->gap = level;
+  *out = level == GAP_WORD ? MORSE_WORD_GAP : ' ';
+  return 1;
+}
+
+/******************************************************************************/
+
+size_t morse_timing_feed(struct morse_timing *t,
+                         const struct morse_key_event *events,
+                         size_t num,
+                         char *out,
+                         size_t cap,
+                         size_t *consumed)
+{
+  size_t written = 0;
+  size_t i;
+
+  /* every event yields one symbol at most */
+  for (i = 0; i < num && written < cap; ++i)
+  {
+    const struct morse_key_event *ev = &events[i];
+
+    if (!ev->down == !t->down) continue;
+
+    if (ev->down)
+    {
+      /* the space is over, the first key down has none before it */
+      if (t->started) written += emit_gap(t, ev->time_us - t->up_us,
+                                          out + written);
+
+      t->started = 1;
+      t->down = 1;
+      t->down_us = ev->time_us;
+      continue;
+    }
+
+    const uint32_t mark = ev->time_us - t->down_us;
+
+    t->down = 0;
+
+    /* bounce, as if the key had never been down */
+    if (mark < MORSE_TIMING_DEBOUNCE_US) continue;
+
+    t->marks[t->next_mark] = mark;
+    t->next_mark = (t->next_mark + 1) % MORSE_TIMING_WINDOW;
+    if (t->num_marks < MORSE_TIMING_WINDOW) t->num_marks++;
+
+    estimate(t);
+
+    out[written++] = mark >= t->dot_us / 2 + t->dash_us / 2 ?
+      MORSE_DASH : MORSE_DOT;
+
+    t->up_us = ev->time_us;
+    t->gap = GAP_NONE;
+  }
+
+  if (consumed) *consumed = i;
+  return written;
+}
+
+/******************************************************************************/
+
+size_t morse_timing_idle(struct morse_timing *t, uint32_t now_us, char *out)
+{
+  if (!t->started || t->down) return 0;
+
+  return emit_gap(t, now_us - t->up_us, out);
+}
+
+/******************************************************************************/
+
+int morse_trace_parse(const char *line, struct morse_key_event *event)
+{
+  char *end;
+
+  while (isspace((unsigned char)*line)) line++;
+
+  if (*line == '\0' || *line == '#') return 0;
+
+  const unsigned long time_us = strtoul(line, &end, 10);
+
+  if (end == line || !isspace((unsigned char)*end)) return -1;
+
+  line = end;
+
+  const unsigned long down = strtoul(line, &end, 10);
+
+  if (end == line || down > 1) return -1;
+
+  while (isspace((unsigned char)*end)) end++;
+
+  if (*end != '\0') return -1;
+
+  event->time_us = time_us;
+  event->down = down;
+  return 1;
+}
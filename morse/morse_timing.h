@@ -0,0 +1,88 @@
+/******************************************************************************/
+/* File: morse_timing.h
+   Author: N.Kim
+   Abstract: Decoder from key down/up timestamps to morse symbols */
+/******************************************************************************/
+
+#ifndef MORSE_TIMING_H
+#define MORSE_TIMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* a transition of the key, e.g. an edge on a GPIO. Timestamps are in
+   microseconds, they may wrap around (after about 71 minutes) */
+struct morse_key_event {
+  uint32_t time_us;
+  uint8_t down;
+};
+
+/* number of recent marks the speed is estimated from */
+#define MORSE_TIMING_WINDOW 16
+
+/* marks shorter than this are taken as contact bounce and dropped */
+#define MORSE_TIMING_DEBOUNCE_US 4000
+
+/* speed range the estimator is kept in */
+#define MORSE_TIMING_MIN_WPM 5
+#define MORSE_TIMING_MAX_WPM 80
+
+/* a mark (key down) is a dot or a dash, the space (key up) after it is
+   within a character, between characters or between words. Nominally
+   a dash takes three dots and the spaces one, three and seven, however,
+   operators keying by hand deviate from that and change their speed.
+   Thus, dots and dashes are told apart by clustering the recent marks
+   into the short and the long ones, which gives the dot and the dash
+   length the operator actually uses. The spaces are classified by the
+   dot length. Memory is fixed, the state below is all there is */
+struct morse_timing {
+  uint32_t marks[MORSE_TIMING_WINDOW];
+  unsigned int num_marks;
+  unsigned int next_mark;
+
+  /* current estimates, microseconds */
+  uint32_t dot_us;
+  uint32_t dash_us;
+
+  /* last transitions */
+  uint32_t down_us;
+  uint32_t up_us;
+  uint8_t down;
+  uint8_t started;
+
+  /* gap already emitted for the current space, see morse_timing_idle() */
+  uint8_t gap;
+};
+
+/* start at 'wpm' words per minute (PARIS), 0 for 20 */
+void morse_timing_init(struct morse_timing *t, unsigned int wpm);
+
+/* turn key events into symbols as understood by morse_stream.h ('.',
+   '-', ' ' and '/'). A symbol is known as soon as the transition ending
+   it happens, i.e. a mark on key up, a gap on key down. Repeated
+   states are ignored, every event yields one symbol at most. Stops
+   once 'out' is full. Returns the number of symbols written, 'consumed'
+   (may be NULL) receives the number of events used */
+size_t morse_timing_feed(struct morse_timing *t,
+                         const struct morse_key_event *events,
+                         size_t num,
+                         char *out,
+                         size_t cap,
+                         size_t *consumed);
+
+/* the key is still up at 'now_us'. Writes the gap symbol once the space
+   is long enough to end the character (or word), so it does not have
+   to wait for the next key down. Returns the number of symbols written
+   (0 or 1) */
+size_t morse_timing_idle(struct morse_timing *t, uint32_t now_us, char *out);
+
+/* current speed estimate, from the dot length */
+unsigned int morse_timing_wpm(const struct morse_timing *t);
+
+/* traces are text, one event per line: the timestamp in microseconds
+   and 1 for key down or 0 for key up. Lines starting with '#' are
+   comments, "# text: " gives the text keyed, if known. Returns 1 if
+   'line' holds an event, 0 if it holds none, -1 if it is malformed */
+int morse_trace_parse(const char *line, struct morse_key_event *event);
+
+#endif
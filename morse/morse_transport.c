@@ -0,0 +1,548 @@
+/******************************************************************************/
+/* File: morse_transport.c
+   Author: N.Kim
+   Abstract: Sockets of the Bluetooth Morse tutorial, picked by URL */
+/******************************************************************************/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/l2cap.h>
+#include <bluetooth/rfcomm.h>
+
+#include "morse_transport.h"
+#include "morse_wire.h"
+#include "sock_url.h"
+
+/* "00:11:22:33:44:55" */
+#define BDADDR_LENGTH 17
+
+static const struct {
+  const char *scheme;
+  enum morse_transport transport;
+} schemes[] = {
+  { "l2cap://", MORSE_TRANSPORT_L2CAP },
+  { "rfcomm://", MORSE_TRANSPORT_RFCOMM },
+  { "unix://", MORSE_TRANSPORT_UNIX },
+  { "unix-stream://", MORSE_TRANSPORT_UNIX_STREAM },
+  { "tcp://", MORSE_TRANSPORT_TCP }
+};
+
+#define NUM_SCHEMES (sizeof(schemes) / sizeof(schemes[0]))
+
+/* numeric options of the query, most of them are about L2CAP only */
+static const struct {
+  const char *name;
+  size_t offset;
+  unsigned long min;
+  unsigned long max;
+  int l2cap;
+} options[] = {
+  { "mtu", offsetof(struct morse_endpoint, mtu), MORSE_MTU_MIN, MORSE_MTU_MAX,
+    0 },
+  { "flush", offsetof(struct morse_endpoint, flush_ms), 1, 0xffff, 1 },
+  { "txwin", offsetof(struct morse_endpoint, txwin), 1, 0x3fff, 1 },
+  { "maxtx", offsetof(struct morse_endpoint, max_tx), 1, 0xff, 1 }
+};
+
+#define NUM_OPTIONS (sizeof(options) / sizeof(options[0]))
+
+/* indexed by enum morse_l2cap_mode */
+static const char *const mode_names[] = {
+  NULL, "basic", "ertm", "streaming"
+};
+
+static const uint8_t l2cap_modes[] = {
+  0, L2CAP_MODE_BASIC, L2CAP_MODE_ERTM, L2CAP_MODE_STREAMING
+};
+
+static const uint8_t bt_modes[] = {
+  0, BT_MODE_BASIC, BT_MODE_ERTM, BT_MODE_STREAMING
+};
+
+#define NUM_MODES (sizeof(mode_names) / sizeof(mode_names[0]))
+
+/* longest "name=value" of a query */
+#define OPTION_LENGTH 32
+
+/* socket address of any transport */
+union morse_sockaddr {
+  struct sockaddr sa;
+  struct sockaddr_l2 l2;
+  struct sockaddr_rc rc;
+  struct sockaddr_un un;
+};
+
+/******************************************************************************/
+
+static int parse_bluetooth(const char *rest, struct morse_endpoint *ep)
+{
+  char addr[BDADDR_LENGTH + 1];
+
+  ep->port = ep->transport == MORSE_TRANSPORT_L2CAP ?
+    MORSE_L2CAP_PSM : MORSE_RFCOMM_CHANNEL;
+
+  /* the address is optional, so is the port */
+  if (strlen(rest) >= BDADDR_LENGTH)
+  {
+    memcpy(addr, rest, BDADDR_LENGTH);
+    addr[BDADDR_LENGTH] = '\0';
+
+    if (bachk(addr) == 0)
+    {
+      str2ba(addr, &ep->addr);
+      rest += BDADDR_LENGTH;
+    }
+  }
+
+  if (*rest == '\0') return 0;
+  if (*rest != ':') return -1;
+
+  char *end;
+  unsigned long port = strtoul(rest + 1, &end, 0);
+
+  if (end == rest + 1 || *end != '\0') return -1;
+
+  /* PSMs are odd, RFCOMM has 30 channels */
+  if (ep->transport == MORSE_TRANSPORT_L2CAP &&
+      (port > 0xffff || (port & 1) == 0))
+    return -1;
+
+  if (ep->transport == MORSE_TRANSPORT_RFCOMM && (port < 1 || port > 30))
+    return -1;
+
+  ep->port = port;
+  return 0;
+}
+
+/******************************************************************************/
+
+static int parse_mode(const char *value, struct morse_endpoint *ep)
+{
+  for (size_t i = 1; i < NUM_MODES; ++i)
+  {
+    if (strcmp(value, mode_names[i]) != 0) continue;
+
+    ep->mode = i;
+    return 0;
+  }
+
+  return -1;
+}
+
+/******************************************************************************/
+
+static int parse_query(const char *query, struct morse_endpoint *ep)
+{
+  const int l2cap = ep->transport == MORSE_TRANSPORT_L2CAP;
+
+  while (*query != '\0')
+  {
+    const size_t len = strcspn(query, "&");
+    char option[OPTION_LENGTH];
+    char *value, *end;
+    size_t i;
+
+    if (len >= sizeof(option)) return -1;
+
+    memcpy(option, query, len);
+    option[len] = '\0';
+    query += query[len] == '&' ? len + 1 : len;
+
+    value = strchr(option, '=');
+
+    if (!value) return -1;
+
+    *value++ = '\0';
+
+    if (strcmp(option, "mode") == 0)
+    {
+      if (!l2cap || parse_mode(value, ep) < 0) return -1;
+      continue;
+    }
+
+    for (i = 0; i < NUM_OPTIONS; ++i)
+      if (strcmp(option, options[i].name) == 0) break;
+
+    if (i == NUM_OPTIONS || (options[i].l2cap && !l2cap)) return -1;
+
+    unsigned long num = strtoul(value, &end, 0);
+
+    if (end == value || *end != '\0' ||
+        num < options[i].min || num > options[i].max)
+      return -1;
+
+    *(unsigned int *)((char *)ep + options[i].offset) = num;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int morse_endpoint_parse(const char *url, struct morse_endpoint *ep)
+{
+  *ep = (struct morse_endpoint){0};
+
+  for (size_t i = 0; i < NUM_SCHEMES; ++i)
+  {
+    const size_t len = strlen(schemes[i].scheme);
+    char rest[MORSE_PATH_MAX];
+
+    if (strncmp(url, schemes[i].scheme, len) != 0) continue;
+
+    ep->transport = schemes[i].transport;
+
+    /* the query goes last, cut it off first */
+    const char *query = strchr(url + len, '?');
+    const size_t rest_len = query ? (size_t)(query - url) - len :
+      strlen(url + len);
+
+    if (rest_len >= sizeof(rest)) return -1;
+
+    memcpy(rest, url + len, rest_len);
+    rest[rest_len] = '\0';
+
+    if (query && parse_query(query + 1, ep) < 0) return -1;
+
+    if (ep->transport == MORSE_TRANSPORT_L2CAP ||
+        ep->transport == MORSE_TRANSPORT_RFCOMM)
+      return parse_bluetooth(rest, ep);
+
+    if (ep->transport == MORSE_TRANSPORT_TCP)
+    {
+      struct sock_url su;
+      char tcp[sizeof(rest) + 8];
+
+      snprintf(tcp, sizeof(tcp), "tcp://%s", rest);
+
+      if (sock_url_parse(tcp, &su) < 0) return -1;
+
+      strcpy(ep->path, su.path);
+      ep->port = su.port;
+      return 0;
+    }
+
+    if (rest[0] == '\0') return -1;
+
+    strcpy(ep->path, rest);
+    return 0;
+  }
+
+  /* what the client used to take */
+  if (bachk(url) == 0)
+  {
+    ep->transport = MORSE_TRANSPORT_RFCOMM;
+    ep->port = MORSE_RFCOMM_CHANNEL;
+    str2ba(url, &ep->addr);
+    return 0;
+  }
+
+  return -1;
+}
+
+/******************************************************************************/
+
+const char *morse_endpoint_name(const struct morse_endpoint *ep,
+                                char *buf,
+                                size_t len)
+{
+  char addr[BDADDR_LENGTH + 1] = "";
+
+  switch (ep->transport)
+  {
+    case MORSE_TRANSPORT_L2CAP:
+    case MORSE_TRANSPORT_RFCOMM:
+      if (bacmp(&ep->addr, BDADDR_ANY) != 0) ba2str(&ep->addr, addr);
+
+      snprintf(buf, len, ep->transport == MORSE_TRANSPORT_L2CAP ?
+               "l2cap://%s:0x%04x" : "rfcomm://%s:%u", addr, ep->port);
+      break;
+
+    case MORSE_TRANSPORT_UNIX:
+      snprintf(buf, len, "unix://%s", ep->path);
+      break;
+
+    case MORSE_TRANSPORT_UNIX_STREAM:
+      snprintf(buf, len, "unix-stream://%s", ep->path);
+      break;
+
+    case MORSE_TRANSPORT_TCP:
+      snprintf(buf, len, "tcp://%s:%u", ep->path, ep->port);
+      break;
+  }
+
+  return buf;
+}
+
+/******************************************************************************/
+
+int morse_endpoint_is_stream(const struct morse_endpoint *ep)
+{
+  return ep->transport == MORSE_TRANSPORT_RFCOMM ||
+    ep->transport == MORSE_TRANSPORT_UNIX_STREAM ||
+    ep->transport == MORSE_TRANSPORT_TCP;
+}
+
+/******************************************************************************/
+
+static int open_socket(const struct morse_endpoint *ep,
+                       union morse_sockaddr *addr,
+                       socklen_t *addr_len)
+{
+  *addr = (union morse_sockaddr){0};
+
+  switch (ep->transport)
+  {
+    case MORSE_TRANSPORT_L2CAP:
+      addr->l2.l2_family = AF_BLUETOOTH;
+      addr->l2.l2_bdaddr = ep->addr;
+      addr->l2.l2_psm = htobs(ep->port);
+      *addr_len = sizeof(addr->l2);
+      return socket(AF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+
+    case MORSE_TRANSPORT_RFCOMM:
+      addr->rc.rc_family = AF_BLUETOOTH;
+      addr->rc.rc_bdaddr = ep->addr;
+      addr->rc.rc_channel = ep->port;
+      *addr_len = sizeof(addr->rc);
+      return socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+
+    case MORSE_TRANSPORT_UNIX:
+    case MORSE_TRANSPORT_UNIX_STREAM:
+      addr->un.sun_family = AF_UNIX;
+      strcpy(addr->un.sun_path, ep->path);
+      *addr_len = sizeof(addr->un);
+      return socket(AF_UNIX, ep->transport == MORSE_TRANSPORT_UNIX ?
+                    SOCK_SEQPACKET : SOCK_STREAM, 0);
+
+    case MORSE_TRANSPORT_TCP:
+      break;
+  }
+
+  errno = EINVAL;
+  return -1;
+}
+
+/******************************************************************************/
+
+static int set_l2cap_options(int s, const struct morse_endpoint *ep)
+{
+  struct l2cap_options opts;
+  socklen_t len = sizeof(opts);
+  int error;
+
+  if (!ep->mtu && !ep->mode && !ep->flush_ms && !ep->txwin && !ep->max_tx)
+    return 0;
+
+  /* everything at once, the kernel validates the combination */
+  if (getsockopt(s, SOL_L2CAP, L2CAP_OPTIONS, &opts, &len) == 0)
+  {
+    if (ep->mtu) opts.imtu = ep->mtu;
+    if (ep->mode) opts.mode = l2cap_modes[ep->mode];
+    if (ep->flush_ms) opts.flush_to = ep->flush_ms;
+    if (ep->txwin) opts.txwin_size = ep->txwin;
+    if (ep->max_tx) opts.max_tx = ep->max_tx;
+
+    if (setsockopt(s, SOL_L2CAP, L2CAP_OPTIONS, &opts, sizeof(opts)) == 0)
+      return 0;
+  }
+
+  /* LE channels refuse L2CAP_OPTIONS, the MTU and the mode (BT_MODE
+     needs the kernel's enable_ecred) are the only ones left then */
+  error = errno;
+
+  if (ep->flush_ms || ep->txwin || ep->max_tx)
+  {
+    errno = error;
+    return -1;
+  }
+
+  if (ep->mtu)
+  {
+    const uint16_t mtu = ep->mtu;
+
+    if (setsockopt(s, SOL_BLUETOOTH, BT_RCVMTU, &mtu, sizeof(mtu)) < 0)
+      return -1;
+  }
+
+  if (ep->mode)
+  {
+    const uint8_t mode = bt_modes[ep->mode];
+
+    if (setsockopt(s, SOL_BLUETOOTH, BT_MODE, &mode, sizeof(mode)) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+static int fail(int s)
+{
+  const int error = errno;
+
+  close(s);
+  errno = error;
+  return -1;
+}
+
+/******************************************************************************/
+
+static void tcp_url(const struct morse_endpoint *ep, struct sock_url *su)
+{
+  *su = (struct sock_url){0};
+
+  su->type = SOCK_URL_TCP;
+  su->port = ep->port;
+  strcpy(su->path, ep->path);
+}
+
+/******************************************************************************/
+
+int morse_transport_listen(const struct morse_endpoint *ep, int backlog)
+{
+  union morse_sockaddr addr;
+  socklen_t addr_len;
+  struct sock_url su;
+
+  /* nothing Bluetooth about it */
+  if (ep->transport == MORSE_TRANSPORT_TCP)
+  {
+    tcp_url(ep, &su);
+    return sock_url_listen(&su, backlog);
+  }
+
+  int s = open_socket(ep, &addr, &addr_len);
+
+  if (s < 0) return -1;
+
+  if (addr.sa.sa_family == AF_UNIX) unlink(ep->path);
+
+  /* accepted channels inherit the options of the listening one */
+  if ((ep->transport == MORSE_TRANSPORT_L2CAP &&
+       set_l2cap_options(s, ep) < 0) ||
+      bind(s, &addr.sa, addr_len) < 0 || listen(s, backlog) < 0)
+    return fail(s);
+
+  return s;
+}
+
+/******************************************************************************/
+
+int morse_transport_connect(const struct morse_endpoint *ep)
+{
+  union morse_sockaddr addr;
+  socklen_t addr_len;
+  struct sock_url su;
+
+  if (ep->transport == MORSE_TRANSPORT_TCP)
+  {
+    tcp_url(ep, &su);
+    return sock_url_connect(&su, 0);
+  }
+
+  int s = open_socket(ep, &addr, &addr_len);
+
+  if (s < 0) return -1;
+
+  if ((ep->transport == MORSE_TRANSPORT_L2CAP &&
+       set_l2cap_options(s, ep) < 0) ||
+      connect(s, &addr.sa, addr_len) < 0)
+    return fail(s);
+
+  return s;
+}
+
+/******************************************************************************/
+
+static enum morse_l2cap_mode link_mode(const uint8_t *modes, uint8_t mode)
+{
+  for (size_t i = 1; i < NUM_MODES; ++i)
+    if (modes[i] == mode) return i;
+
+  /* e.g. LE credit based flow control */
+  return MORSE_L2CAP_MODE_DEFAULT;
+}
+
+/******************************************************************************/
+
+int morse_transport_link(int s,
+                         const struct morse_endpoint *ep,
+                         struct morse_link *link)
+{
+  struct l2cap_options opts;
+  socklen_t len = sizeof(opts);
+  uint16_t mtu;
+  uint8_t mode;
+
+  *link = (struct morse_link){0};
+
+  /* nothing to negotiate, packets are as large as the sender makes
+     them */
+  if (ep->transport != MORSE_TRANSPORT_L2CAP)
+  {
+    link->imtu = link->omtu = ep->mtu ? ep->mtu : MORSE_DEFAULT_MTU;
+    return 0;
+  }
+
+  if (getsockopt(s, SOL_L2CAP, L2CAP_OPTIONS, &opts, &len) == 0)
+  {
+    link->imtu = opts.imtu;
+    link->omtu = opts.omtu;
+    link->mode = link_mode(l2cap_modes, opts.mode);
+    link->flush_ms = opts.flush_to;
+    link->txwin = opts.txwin_size;
+    link->max_tx = opts.max_tx;
+    return 0;
+  }
+
+  len = sizeof(mtu);
+
+  if (getsockopt(s, SOL_BLUETOOTH, BT_RCVMTU, &mtu, &len) < 0) return -1;
+
+  link->imtu = mtu;
+
+  /* only known once connected */
+  len = sizeof(mtu);
+
+  if (getsockopt(s, SOL_BLUETOOTH, BT_SNDMTU, &mtu, &len) == 0)
+    link->omtu = mtu;
+
+  len = sizeof(mode);
+
+  if (getsockopt(s, SOL_BLUETOOTH, BT_MODE, &mode, &len) == 0)
+    link->mode = link_mode(bt_modes, mode);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+const char *morse_link_name(const struct morse_link *link,
+                            char *buf,
+                            size_t len)
+{
+  int n = snprintf(buf, len, "imtu %u, omtu %u", link->imtu, link->omtu);
+
+  if (link->mode && n >= 0 && (size_t)n < len)
+    n += snprintf(buf + n, len - n, ", %s", mode_names[link->mode]);
+
+  if (link->mode == MORSE_L2CAP_MODE_ERTM && n >= 0 && (size_t)n < len)
+    n += snprintf(buf + n, len - n, ", txwin %u, maxtx %u",
+                  link->txwin, link->max_tx);
+
+  /* 0xffff is the default, i.e. never flushed */
+  if (link->flush_ms && link->flush_ms != 0xffff && n >= 0 && (size_t)n < len)
+    snprintf(buf + n, len - n, ", flush %u ms", link->flush_ms);
+
+  return buf;
+}
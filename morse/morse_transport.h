@@ -0,0 +1,118 @@
+/******************************************************************************/
+/* File: morse_transport.h
+   Author: N.Kim
+   Abstract: Sockets of the Bluetooth Morse tutorial, picked by URL */
+/******************************************************************************/
+
+#ifndef MORSE_TRANSPORT_H
+#define MORSE_TRANSPORT_H
+
+#include <stddef.h>
+#include <bluetooth/bluetooth.h>
+
+/* supported endpoints:
+
+     l2cap://[bdaddr][:psm]      sequential packets, PSM 0x1001 default
+     rfcomm://[bdaddr][:channel] byte stream, channel 27 default
+     unix://path                 sequential packets, stands in for L2CAP
+     unix-stream://path          byte stream, stands in for RFCOMM
+     tcp://[host]:port           byte stream over the loopback, see
+                                 sock_url.h
+
+   Without an address, servers listen on any adapter. Clients need
+   one, a bare Bluetooth address is taken as rfcomm://bdaddr
+
+   A query sets up the channel, e.g. l2cap://bdaddr?mtu=1024&mode=ertm
+
+     mtu=bytes          largest packet received, the incoming L2CAP MTU.
+                        Bounds the packets of the other transports too
+     mode=basic|ertm|streaming
+                        L2CAP mode, ERTM retransmits, streaming drops
+     flush=ms           L2CAP flush timeout, 0xffff never flushes
+     txwin=frames       ERTM transmit window
+     maxtx=count        ERTM transmissions of a frame before giving up
+
+   Anything not given keeps the kernel default */
+enum morse_transport {
+  MORSE_TRANSPORT_L2CAP,
+  MORSE_TRANSPORT_RFCOMM,
+  MORSE_TRANSPORT_UNIX,
+  MORSE_TRANSPORT_UNIX_STREAM,
+  MORSE_TRANSPORT_TCP
+};
+
+#define MORSE_L2CAP_PSM 0x1001
+#define MORSE_RFCOMM_CHANNEL 27
+
+/* longest AF_UNIX path, see sockaddr_un */
+#define MORSE_PATH_MAX 108
+
+enum morse_l2cap_mode {
+  MORSE_L2CAP_MODE_DEFAULT,
+  MORSE_L2CAP_MODE_BASIC,
+  MORSE_L2CAP_MODE_ERTM,
+  MORSE_L2CAP_MODE_STREAMING
+};
+
+/* 16-bit fields on the air, a packet needs a few bytes at least */
+#define MORSE_MTU_MIN 48
+#define MORSE_MTU_MAX 0xffff
+
+struct morse_endpoint {
+  enum morse_transport transport;
+  bdaddr_t addr;
+  unsigned int port;
+  char path[MORSE_PATH_MAX];   /* socket file or TCP host */
+
+  /* the query, 0 keeps the default */
+  unsigned int mtu;
+  enum morse_l2cap_mode mode;
+  unsigned int flush_ms;
+  unsigned int txwin;
+  unsigned int max_tx;
+};
+
+/* parameters of a connected (or listening) socket. 'imtu' is the
+   largest packet the socket receives, 'omtu' the largest one the peer
+   takes. Byte streams have no MTU of their own, the endpoint's or
+   MORSE_DEFAULT_MTU stands in */
+struct morse_link {
+  unsigned int imtu;
+  unsigned int omtu;
+  enum morse_l2cap_mode mode;
+  unsigned int flush_ms;
+  unsigned int txwin;
+  unsigned int max_tx;
+};
+
+/* returns -1 if the URL is malformed */
+int morse_endpoint_parse(const char *url, struct morse_endpoint *ep);
+
+/* URL of the endpoint, for the logs */
+const char *morse_endpoint_name(const struct morse_endpoint *ep,
+                                char *buf,
+                                size_t len);
+
+/* byte streams lose the packet boundaries, the receiver has to find
+   them again, see morse_packet_length() */
+int morse_endpoint_is_stream(const struct morse_endpoint *ep);
+
+/* bound and listening socket, -1 on failure (errno is set). UNIX
+   socket files are replaced */
+int morse_transport_listen(const struct morse_endpoint *ep, int backlog);
+
+/* connected socket, -1 on failure (errno is set) */
+int morse_transport_connect(const struct morse_endpoint *ep);
+
+/* what the kernel made of the endpoint's query, i.e. the negotiated
+   parameters once connected. Returns -1 if the socket cannot tell */
+int morse_transport_link(int s,
+                         const struct morse_endpoint *ep,
+                         struct morse_link *link);
+
+/* e.g. "imtu 1024, omtu 672, ertm, flush 100 ms", for the logs */
+const char *morse_link_name(const struct morse_link *link,
+                            char *buf,
+                            size_t len);
+
+#endif
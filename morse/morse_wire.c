@@ -0,0 +1,330 @@
+/******************************************************************************/
+/* File: morse_wire.c
+   Author: N.Kim
+   Abstract: Wire formats of the Bluetooth Morse tutorial */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "morse_codec.h"
+#include "morse_wire.h"
+
+/* lengths from here on take 2 more bits */
+#define LENGTH_ESCAPE 7
+
+/*****************************************************************************/
+
+static void put_bits(unsigned char *p,
+                     size_t *pos,
+                     unsigned int value,
+                     unsigned int count)
+{
+  /* most significant bit first, the buffer is zeroed */
+  for (unsigned int i = count; i-- > 0; ++*pos)
+    if ((value >> i) & 1) p[*pos >> 3] |= 0x80 >> (*pos & 7);
+}
+
+/*****************************************************************************/
+
+static unsigned int get_bits(const unsigned char *p,
+                             size_t *pos,
+                             unsigned int count)
+{
+  unsigned int value = 0;
+
+  for (unsigned int i = 0; i < count; ++i, ++*pos)
+    value = (value << 1) | ((p[*pos >> 3] >> (7 - (*pos & 7))) & 1);
+
+  return value;
+}
+
+/*****************************************************************************/
+
+size_t morse_pack(const char *text,
+                  size_t len,
+                  size_t *consumed,
+                  unsigned char *out,
+                  size_t mtu)
+{
+  size_t bits = 0;
+  size_t count = 0;
+  size_t i;
+
+  *consumed = 0;
+
+  if (mtu <= MORSE_PACKED_HEADER) return 0;
+  if (mtu > MORSE_PACKED_HEADER + 0xffff) mtu = MORSE_PACKED_HEADER + 0xffff;
+
+  const size_t max_bits = (mtu - MORSE_PACKED_HEADER) * 8;
+  unsigned char *p = out + MORSE_PACKED_HEADER;
+
+  memset(p, 0, mtu - MORSE_PACKED_HEADER);
+
+  for (i = 0; i < len && count < 0xffff; ++i)
+  {
+    const unsigned int code = morse_code(text[i]);
+    unsigned int length = 0;
+
+    if (code) length = morse_code_length(code);
+    else if (text[i] != ' ') continue;
+
+    const unsigned int extra = length >= LENGTH_ESCAPE ? 2 : 0;
+
+    if (bits + 3 + extra + length > max_bits) break;
+
+    if (extra)
+    {
+      put_bits(p, &bits, LENGTH_ESCAPE, 3);
+      put_bits(p, &bits, length - LENGTH_ESCAPE, 2);
+    }
+    else put_bits(p, &bits, length, 3);
+
+    put_bits(p, &bits, code, length);
+    count++;
+  }
+
+  const size_t bytes = (bits + 7) / 8;
+
+  out[0] = MORSE_PACKED_MAGIC;
+  out[1] = count & 0xff;
+  out[2] = (count >> 8) & 0xff;
+  out[3] = bytes & 0xff;
+  out[4] = (bytes >> 8) & 0xff;
+
+  *consumed = i;
+  return MORSE_PACKED_HEADER + bytes;
+}
+
+/*****************************************************************************/
+
+int morse_unpack(const unsigned char *data,
+                 size_t len,
+                 morse_code_cb cb,
+                 void *udata)
+{
+  if (len < MORSE_PACKED_HEADER || data[0] != MORSE_PACKED_MAGIC) return -1;
+
+  const size_t count = data[1] | (data[2] << 8);
+  const size_t bytes = data[3] | (data[4] << 8);
+
+  if (len != MORSE_PACKED_HEADER + bytes) return -1;
+
+  const unsigned char *p = data + MORSE_PACKED_HEADER;
+  const size_t max_bits = bytes * 8;
+  size_t bits = 0;
+
+  for (size_t n = 0; n < count; ++n)
+  {
+    if (bits + 3 > max_bits) return -1;
+
+    unsigned int length = get_bits(p, &bits, 3);
+
+    if (length == LENGTH_ESCAPE)
+    {
+      if (bits + 2 > max_bits) return -1;
+      length += get_bits(p, &bits, 2);
+    }
+
+    if (bits + length > max_bits) return -1;
+
+    /* put the sentinel back in front of the symbols */
+    unsigned int symbols = get_bits(p, &bits, length);
+
+    cb(length ? (1u << length) | symbols : 0, udata);
+  }
+
+  return count;
+}
+
+/*****************************************************************************/
+
+size_t morse_pack_symbols(const char *symbols,
+                          size_t len,
+                          size_t *consumed,
+                          unsigned char *out,
+                          size_t mtu)
+{
+  size_t bits = 0;
+  size_t count = 0;
+  size_t i;
+
+  *consumed = 0;
+
+  if (mtu <= MORSE_SYMBOLS_HEADER) return 0;
+
+  const size_t max = (mtu - MORSE_SYMBOLS_HEADER) * 4;
+  unsigned char *p = out + MORSE_SYMBOLS_HEADER;
+
+  memset(p, 0, mtu - MORSE_SYMBOLS_HEADER);
+
+  for (i = 0; i < len && count < max && count < 0xffff; ++i)
+  {
+    unsigned int sym;
+
+    switch (symbols[i])
+    {
+      case '.': sym = MORSE_WIRE_DOT; break;
+      case '-': sym = MORSE_WIRE_DASH; break;
+      case ' ': sym = MORSE_WIRE_GAP; break;
+      case '/': sym = MORSE_WIRE_WORD_GAP; break;
+      default: continue;
+    }
+
+    put_bits(p, &bits, sym, 2);
+    count++;
+  }
+
+  out[0] = MORSE_SYMBOLS_MAGIC;
+  out[1] = count & 0xff;
+  out[2] = (count >> 8) & 0xff;
+
+  *consumed = i;
+  return MORSE_SYMBOLS_HEADER + (count + 3) / 4;
+}
+
+/*****************************************************************************/
+
+int morse_unpack_symbols(const unsigned char *data,
+                         size_t len,
+                         char *out,
+                         size_t cap)
+{
+  static const char text[4] = { '.', '-', ' ', '/' };
+
+  if (len < MORSE_SYMBOLS_HEADER || data[0] != MORSE_SYMBOLS_MAGIC) return -1;
+
+  const size_t count = data[1] | (data[2] << 8);
+
+  if (len != MORSE_SYMBOLS_HEADER + (count + 3) / 4 || count > cap) return -1;
+
+  const unsigned char *p = data + MORSE_SYMBOLS_HEADER;
+
+  /* four symbols per byte */
+  for (size_t n = 0; n < count; ++n)
+    out[n] = text[(p[n >> 2] >> (6 - 2 * (n & 3))) & 3];
+
+  return count;
+}
+
+/*****************************************************************************/
+
+size_t morse_pack_keys(const struct morse_key_event *events,
+                       size_t num,
+                       size_t *consumed,
+                       unsigned char *out,
+                       size_t mtu)
+{
+  size_t count = 0;
+
+  *consumed = 0;
+
+  if (mtu <= MORSE_KEYS_HEADER) return 0;
+
+  size_t max = (mtu - MORSE_KEYS_HEADER) / MORSE_KEY_EVENT_SIZE;
+  unsigned char *p = out + MORSE_KEYS_HEADER;
+
+  if (max > 0xffff) max = 0xffff;
+
+  for (; count < num && count < max; ++count, p += MORSE_KEY_EVENT_SIZE)
+  {
+    const uint32_t t = events[count].time_us;
+
+    p[0] = t & 0xff;
+    p[1] = (t >> 8) & 0xff;
+    p[2] = (t >> 16) & 0xff;
+    p[3] = (t >> 24) & 0xff;
+    p[4] = events[count].down != 0;
+  }
+
+  out[0] = MORSE_KEYS_MAGIC;
+  out[1] = count & 0xff;
+  out[2] = (count >> 8) & 0xff;
+
+  *consumed = count;
+  return MORSE_KEYS_HEADER + count * MORSE_KEY_EVENT_SIZE;
+}
+
+/*****************************************************************************/
+
+int morse_unpack_keys(const unsigned char *data,
+                      size_t len,
+                      struct morse_key_event *out,
+                      size_t cap)
+{
+  if (len < MORSE_KEYS_HEADER || data[0] != MORSE_KEYS_MAGIC) return -1;
+
+  const size_t count = data[1] | (data[2] << 8);
+
+  if (len != MORSE_KEYS_HEADER + count * MORSE_KEY_EVENT_SIZE || count > cap)
+    return -1;
+
+  const unsigned char *p = data + MORSE_KEYS_HEADER;
+
+  for (size_t n = 0; n < count; ++n, p += MORSE_KEY_EVENT_SIZE)
+  {
+    if (p[4] > 1) return -1;
+
+    out[n].time_us = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    out[n].down = p[4];
+  }
+
+  return count;
+}
+
+/*****************************************************************************/
+
+size_t morse_pack_ack(uint32_t sequence, unsigned char *out)
+{
+  memset(out, 0, MORSE_ACK_LENGTH);
+
+  out[0] = MORSE_ACK_MAGIC;
+  out[4] = sequence & 0xff;
+  out[5] = (sequence >> 8) & 0xff;
+  out[6] = (sequence >> 16) & 0xff;
+  out[7] = (sequence >> 24) & 0xff;
+
+  return MORSE_ACK_LENGTH;
+}
+
+/*****************************************************************************/
+
+int morse_unpack_ack(const unsigned char *data,
+                     size_t len,
+                     uint32_t *sequence)
+{
+  if (len != MORSE_ACK_LENGTH || data[0] != MORSE_ACK_MAGIC) return -1;
+
+  *sequence = data[4] | (data[5] << 8) | (data[6] << 16) |
+    ((uint32_t)data[7] << 24);
+
+  return 0;
+}
+
+/*****************************************************************************/
+
+size_t morse_packet_length(const unsigned char *data, size_t len)
+{
+  if (len == 0) return 0;
+
+  switch (data[0])
+  {
+    case MORSE_PACKED_MAGIC:
+      if (len < MORSE_PACKED_HEADER) return 0;
+      return MORSE_PACKED_HEADER + (data[3] | (data[4] << 8));
+
+    case MORSE_SYMBOLS_MAGIC:
+      if (len < MORSE_SYMBOLS_HEADER) return 0;
+      return MORSE_SYMBOLS_HEADER + ((data[1] | (data[2] << 8)) + 3) / 4;
+
+    case MORSE_KEYS_MAGIC:
+      if (len < MORSE_KEYS_HEADER) return 0;
+      return MORSE_KEYS_HEADER +
+        (data[1] | (data[2] << 8)) * MORSE_KEY_EVENT_SIZE;
+
+    case MORSE_ACK_MAGIC:
+      return MORSE_ACK_LENGTH;
+
+    default:
+      return PACKET_LENGTH;
+  }
+}
@@ -0,0 +1,149 @@
+/******************************************************************************/
+/* File: morse_wire.h
+   Author: N.Kim
+   Abstract: Wire formats of the Bluetooth Morse tutorial */
+/******************************************************************************/
+
+#ifndef MORSE_WIRE_H
+#define MORSE_WIRE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "morse_timing.h"
+
+/* legacy format, one character per 8-byte packet padded with spaces.
+   The session ends with the "goodbye!" packet (in both formats) */
+#define PACKET_LENGTH 8
+
+/* packed format, many characters per packet:
+
+     0       1       3       5
+     +-------+-------+-------+------------------------------+
+     | magic | count | bytes | bit-packed symbols (bytes)   |
+     +-------+-------+-------+------------------------------+
+
+   'count' and 'bytes' are little endian. Each character takes a 3-bit
+   length followed by as many symbols (0 dot, 1 dash), most significant
+   bit first. A length of 0 is a word gap, a length of 7 is followed by
+   2 more bits to add (prosigns are up to 9 symbols long). The magic
+   byte is no valid character, thus, both formats can be told apart by
+   the first byte. Codes are those of morse_codec.h */
+#define MORSE_PACKED_MAGIC 0xA5
+#define MORSE_PACKED_HEADER 5
+
+/* symbol stream format, what a keyer produces, i.e. symbols which are
+   not known to form any character yet:
+
+     0       1       3
+     +-------+-------+------------------------------+
+     | magic | count | 2-bit symbols                |
+     +-------+-------+------------------------------+
+
+   'count' is the number of symbols (little endian), followed by
+   (count + 3) / 4 bytes of symbols, most significant bits first. A
+   character may be split across packets, see morse_stream.h */
+#define MORSE_SYMBOLS_MAGIC 0xA6
+#define MORSE_SYMBOLS_HEADER 3
+
+enum morse_wire_symbol {
+  MORSE_WIRE_DOT = 0,
+  MORSE_WIRE_DASH = 1,
+  MORSE_WIRE_GAP = 2,
+  MORSE_WIRE_WORD_GAP = 3
+};
+
+/* key event format, raw key down/up timestamps (e.g. from a GPIO), the
+   server does the timing:
+
+     0       1       3
+     +-------+-------+------------------------------+
+     | magic | count | events                       |
+     +-------+-------+------------------------------+
+
+   'count' is the number of events (little endian), each event takes 5
+   bytes: the timestamp in microseconds (little endian) and 1 for key
+   down or 0 for key up. See morse_timing.h */
+#define MORSE_KEYS_MAGIC 0xA7
+#define MORSE_KEYS_HEADER 3
+#define MORSE_KEY_EVENT_SIZE 5
+
+/* acknowledgment request, the server echoes it back once everything
+   sent before has been decoded, e.g. to measure the latency:
+
+     0       1       4
+     +-------+-------+---------------+
+     | magic | 0     | sequence      |
+     +-------+-------+---------------+
+
+   The sequence number is little endian and up to the sender. Being 8
+   bytes long, older servers take it for a legacy packet */
+#define MORSE_ACK_MAGIC 0xA8
+#define MORSE_ACK_LENGTH 8
+
+/* default L2CAP MTU, packed packets never exceed it */
+#define MORSE_DEFAULT_MTU 672
+
+/* pack as many characters of 'text' as fit into 'mtu' bytes. Characters
+   without morse code are dropped, spaces become word gaps. Returns the
+   packet length, 'consumed' receives the number of characters used */
+size_t morse_pack(const char *text,
+                  size_t len,
+                  size_t *consumed,
+                  unsigned char *out,
+                  size_t mtu);
+
+/* invoked per packed character with its code, 0 for a word gap */
+typedef void (*morse_code_cb)(unsigned int code, void *udata);
+
+/* returns the number of characters or -1 if the packet is malformed */
+int morse_unpack(const unsigned char *data,
+                 size_t len,
+                 morse_code_cb cb,
+                 void *udata);
+
+/* pack symbols ('.', '-', ' ' and '/') into at most 'mtu' bytes, any
+   other byte is dropped. Returns the packet length, 'consumed' receives
+   the number of input bytes used */
+size_t morse_pack_symbols(const char *symbols,
+                          size_t len,
+                          size_t *consumed,
+                          unsigned char *out,
+                          size_t mtu);
+
+/* unpack into 'out' (textual symbols). Returns the number of symbols,
+   -1 if the packet is malformed or does not fit */
+int morse_unpack_symbols(const unsigned char *data,
+                         size_t len,
+                         char *out,
+                         size_t cap);
+
+/* pack as many key events as fit into 'mtu' bytes. Returns the packet
+   length, 'consumed' receives the number of events used */
+size_t morse_pack_keys(const struct morse_key_event *events,
+                       size_t num,
+                       size_t *consumed,
+                       unsigned char *out,
+                       size_t mtu);
+
+/* unpack into 'out'. Returns the number of events, -1 if the packet is
+   malformed or does not fit */
+int morse_unpack_keys(const unsigned char *data,
+                      size_t len,
+                      struct morse_key_event *out,
+                      size_t cap);
+
+/* returns the packet length, i.e. MORSE_ACK_LENGTH */
+size_t morse_pack_ack(uint32_t sequence, unsigned char *out);
+
+/* returns -1 if the packet is no acknowledgment */
+int morse_unpack_ack(const unsigned char *data,
+                     size_t len,
+                     uint32_t *sequence);
+
+/* length of the packet starting at 'data', for byte streams (RFCOMM)
+   which do not keep the packet boundaries. 0 if 'len' bytes are not
+   enough to tell, the packet itself may well be incomplete */
+size_t morse_packet_length(const unsigned char *data, size_t len);
+
+#endif
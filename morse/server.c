@@ -4,183 +4,604 @@
    Abstract: Server part of the Bluetooth Morse tutorial */
 /******************************************************************************/
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/socket.h>
-#include <bluetooth/bluetooth.h>
-#include <bluetooth/l2cap.h>
-
-#define PACKET_LENGTH 8
-
-char decode_table[128] = {0};
-
-/*****************************************************************************/
-
-void setup_decoding_table(void)
-{
-  /* beat it manually. This is waste of space, but elegance is not our
-     main concern here. I am just going to paste a pre-fabricated
-     table here */
-
-  /* zeroes represent dots and ones represent dashes. Because the code
-     is variable in length, we reserve 3 MSB bits to encode the length
-     of a particular character */
-
-  decode_table['a'] = 0x41; // 01000001
-  decode_table['b'] = 0x88; // 10001000
-  decode_table['c'] = 0x8A; // 10001010
-  decode_table['d'] = 0x64; // 01100100
-  decode_table['e'] = 0x20; // 00100000
-  decode_table['f'] = 0x82; // 10000010
-  decode_table['g'] = 0x66; // 01100110
-  decode_table['h'] = 0x80; // 10000000
-  decode_table['i'] = 0x40; // 01000000
-  decode_table['j'] = 0x87; // 10000111
-  decode_table['k'] = 0x65; // 01100101
-  decode_table['l'] = 0x84; // 10000100
-  decode_table['m'] = 0x43; // 01000011
-  decode_table['n'] = 0x42; // 01000010
-  decode_table['o'] = 0x67; // 01100111
-  decode_table['p'] = 0x86; // 10000110
-  decode_table['q'] = 0x8D; // 10001101
-  decode_table['r'] = 0x62; // 01100010
-  decode_table['s'] = 0x60; // 01100000
-  decode_table['t'] = 0x21; // 00100001
-  decode_table['u'] = 0x61; // 01100001
-  decode_table['v'] = 0x81; // 10000001
-  decode_table['w'] = 0x63; // 01100011
-  decode_table['x'] = 0x89; // 10001001
-  decode_table['y'] = 0x8B; // 10001011
-  decode_table['z'] = 0x8C; // 10001100
-  decode_table['0'] = 0xBF; // 10111111
-  decode_table['1'] = 0xAF; // 10101111
-  decode_table['2'] = 0xA7; // 10100111
-  decode_table['3'] = 0xA3; // 10100011
-  decode_table['4'] = 0xA1; // 10100001
-  decode_table['5'] = 0xA0; // 10100000
-  decode_table['6'] = 0xB0; // 10110000
-  decode_table['7'] = 0xB8; // 10111000
-  decode_table['8'] = 0xBC; // 10111100
-  decode_table['9'] = 0xBE; // 10111110
-}
-
-/*****************************************************************************/
-
-unsigned int get_length_mask(int length)
-{
-  /* get a mask that needs to be applied on a particular entry in the
-     decoding table to extract significant bits. Alphas and numbers
-     have at most 5 morse digits */
-  switch(length)
-  {
-    case 1: return 0x1;
-    case 2: return 0x3;
-    case 3: return 0x7;
-    case 4: return 0xF;
-    case 5: return 0x1F;
-    default: break;
+#include <sys/resource.h>
+#include <fcntl.h>
+
+#include "io_loop.h"
+#include "morse_audio.h"
+#include "morse_codec.h"
+#include "morse_stream.h"
+#include "morse_timing.h"
+#include "morse_transport.h"
+#include "morse_wire.h"
+
+/* sizing hint for the I/O loop, the actual limit is the number of
+   file descriptors the process may open */
+#define MAX_CLIENTS 16384
+
+/* endpoints listened on at once (-l) */
+#define MAX_LISTENERS 8
+
+/* state kept per connected client. Character packets are
+   self-contained, symbol packets may end in the middle of a character,
+   the decoder keeps track of it. Key events go through the timing
+   decoder first, which turns them into symbols. Clients on byte
+   streams have a packet pending until it is complete */
+struct client {
+  int fd;
+  unsigned int id;
+  unsigned long chars;
+  struct morse_stream stream;
+  struct morse_timing timing;
+  char *pending;
+  size_t fill;
+};
+
+/* set on SIGINT, the server keeps running until then */
+volatile sig_atomic_t server_done = 0;
+
+/* suppress the per character output (-q), used for load testing */
+int quiet = 0;
+
+unsigned int num_clients = 0;
+unsigned int max_clients = 0;
+unsigned int total_clients = 0;
+unsigned long total_chars = 0;
+
+/* largest packet received, the largest incoming MTU of the listeners.
+   The scratch buffers of the decoders are sized from it */
+size_t buffer_size = 0;
+char *scratch_symbols = NULL;
+char *scratch_text = NULL;
+struct morse_key_event *scratch_events = NULL;
+
+/* audio output (-a), the decoded characters of all clients go into a
+   single tone stream in the order they arrive */
+struct morse_audio audio;
+int audio_fd = -1;
+int16_t *audio_buffer = NULL;
+size_t audio_cap = 0;
+size_t audio_fill = 0;
+uint64_t audio_samples = 0;
+
+/* room for that many of the longest characters */
+#define AUDIO_BUFFER_CHARS 64
+
+/*****************************************************************************/
+
+void print_chain(unsigned int id, const char c)
+{
+  /* turn a character into a sequence of morse digits, i.e. dots/dashes */
+  char chain[MORSE_MAX_SYMBOLS + 1];
+  size_t len = morse_encode(&c, 1, chain, sizeof(chain), NULL);
+
+  if (len == 0) return;
+
+  /* prosigns are mapped to control characters */
+  if (c >= 0x20) printf("[%u] (%c) %.*s\n", id, c, (int)len - 1, chain);
+  else printf("[%u] (0x%02x) %.*s\n", id, c, (int)len - 1, chain);
+}
+
+/*****************************************************************************/
+
+void flush_audio(void)
+{
+  const char *p = (const char *)audio_buffer;
+  size_t left = audio_fill * sizeof(int16_t);
+
+  while (left > 0)
+  {
+    ssize_t n = write(audio_fd, p, left);
+
+    if (n <= 0) break;
+
+    p += n;
+    left -= n;
+  }
+
+  audio_samples += audio_fill;
+  audio_fill = 0;
+}
+
+/*****************************************************************************/
+
+void render_audio(const char *text, size_t len)
+{
+  while (len > 0)
+  {
+    size_t consumed;
+
+    audio_fill += morse_audio_render(&audio, text, len,
+                                     audio_buffer + audio_fill,
+                                     audio_cap - audio_fill, &consumed);
+    text += consumed;
+    len -= consumed;
+
+    if (len > 0) flush_audio();
+  }
+}
+
+/*****************************************************************************/
+
+int open_audio(const char *path)
+{
+  uint8_t header[MORSE_WAV_HEADER];
+
+  if (morse_audio_init(&audio, MORSE_AUDIO_DEFAULT_RATE,
+                       MORSE_AUDIO_DEFAULT_TONE, MORSE_AUDIO_DEFAULT_WPM) < 0)
+    return -1;
+
+  audio_cap = AUDIO_BUFFER_CHARS *
+    morse_audio_samples(&audio, MORSE_CODE_LIMIT - 1);
+  audio_buffer = malloc(audio_cap * sizeof(int16_t));
+
+  /* the tone goes to stdout, everything else to stderr then */
+  if (strcmp(path, "-") == 0)
+  {
+    audio_fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
+  else audio_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (!audio_buffer || audio_fd < 0)
+  {
+    free(audio_buffer);
+    morse_audio_free(&audio);
+    return -1;
+  }
+
+  /* the length is not known until the end */
+  morse_wav_header(header, audio.rate, UINT32_MAX);
+
+  return write(audio_fd, header, sizeof(header)) == sizeof(header) ? 0 : -1;
+}
+
+/*****************************************************************************/
+
+void close_audio(void)
+{
+  uint8_t header[MORSE_WAV_HEADER];
+
+  flush_audio();
+
+  /* files get their actual length, pipes cannot seek */
+  if (lseek(audio_fd, 0, SEEK_SET) == 0)
+  {
+    /* the header counts 32 bits, longer recordings get the largest size */
+    morse_wav_header(header, audio.rate, audio_samples > UINT32_MAX ?
+                     UINT32_MAX : (uint32_t)audio_samples);
+
+    if (write(audio_fd, header, sizeof(header)) != sizeof(header))
+      perror("Failed updating the audio header");
   }
 
+  close(audio_fd);
+  free(audio_buffer);
+  morse_audio_free(&audio);
+}
+
+/*****************************************************************************/
+
+void add_chars(struct client *cl, const char *text, size_t len)
+{
+  if (audio_fd >= 0) render_audio(text, len);
+
+  cl->chars += len;
+  total_chars += len;
+}
+
+/*****************************************************************************/
+
+void on_signal_received(int signo)
+{
+  if (signo == SIGINT) server_done = 1;
+}
+
+/*****************************************************************************/
+
+void close_client(struct io_loop *loop, struct client *cl)
+{
+  const char c = morse_stream_flush(&cl->stream);
+
+  if (c)
+  {
+    if (!quiet) printf("[%u] %c\n", cl->id, c);
+
+    add_chars(cl, &c, 1);
+  }
+
+  if (!quiet)
+    printf("Client %u disconnected after %lu characters\n", cl->id, cl->chars);
+
+  io_loop_remove(loop, cl->fd);
+  close(cl->fd);
+
+  num_clients--;
+  free(cl->pending);
+  free(cl);
+}
+
+/*****************************************************************************/
+
+void on_packed_char(unsigned int code, void *udata)
+{
+  struct client *cl = udata;
+  const char c = code ? morse_char(code) : ' ';
+
+  if (!quiet && code) print_chain(cl->id, c);
+
+  add_chars(cl, &c, 1);
+}
+
+/*****************************************************************************/
+
+int on_symbols(struct client *cl, const unsigned char *data, size_t len)
+{
+  /* 4 symbols per byte at most, and never more text than symbols */
+  int count = morse_unpack_symbols(data, len, scratch_symbols,
+                                   4 * buffer_size);
+
+  if (count < 0) return -1;
+
+  size_t n = morse_stream_feed(&cl->stream, scratch_symbols, count,
+                               scratch_text, 4 * buffer_size, NULL);
+
+  if (!quiet && n > 0) printf("[%u] %.*s\n", cl->id, (int)n, scratch_text);
+
+  add_chars(cl, scratch_text, n);
   return 0;
 }
 
 /*****************************************************************************/
 
-void print_chain(const char c)
+int on_keys(struct client *cl, const unsigned char *data, size_t len)
 {
-  /* turn a character into a sequence of morse digits, i.e. dots/dashes */
-  if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))
+  /* one symbol per event at most, and never more text than symbols */
+  const size_t max_events = buffer_size / MORSE_KEY_EVENT_SIZE;
+
+  int count = morse_unpack_keys(data, len, scratch_events, max_events);
+
+  if (count < 0) return -1;
+
+  size_t num = morse_timing_feed(&cl->timing, scratch_events, count,
+                                 scratch_symbols, max_events, NULL);
+  size_t n = morse_stream_feed(&cl->stream, scratch_symbols, num,
+                               scratch_text, max_events, NULL);
+
+  if (!quiet && n > 0)
+    printf("[%u] %.*s (%u wpm)\n", cl->id, (int)n, scratch_text,
+           morse_timing_wpm(&cl->timing));
+
+  add_chars(cl, scratch_text, n);
+  return 0;
+}
+
+/*****************************************************************************/
+
+int on_packet(struct client *cl, const char *data, size_t len)
+{
+  /* the first byte tells the format, key event packets ... */
+  if ((unsigned char)data[0] == MORSE_KEYS_MAGIC)
   {
-    /* get the pattern from the decoding table */
-    char data = decode_table[c];
+    if (on_keys(cl, (const unsigned char *)data, len) == 0) return 0;
 
-    /* extract the length */
-    unsigned int length = (data >> 5) & 0x7;
+    printf("[%u] (bad packet)\n", cl->id);
+    return -1;
+  }
 
-    /* get the length mask */
-    unsigned int mask = get_length_mask(length);
+  /* ... acknowledgment requests, everything before has been decoded
+     by now. A client not reading them is its own problem ... */
+  if ((unsigned char)data[0] == MORSE_ACK_MAGIC && len == MORSE_ACK_LENGTH)
+  {
+    if (send(cl->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 &&
+        errno != EAGAIN)
+      return -1;
 
-    /* apply the mask to extract the morse representation for 'c' */
-    unsigned char chain = data & mask;
+    return 0;
+  }
 
-    /* now just print dots and dashes */
-    printf("(%c) ", c);
+  /* ... symbol packets ... */
+  if ((unsigned char)data[0] == MORSE_SYMBOLS_MAGIC)
+  {
+    if (on_symbols(cl, (const unsigned char *)data, len) == 0) return 0;
 
-    for (int i = 0; i < length; ++i)
-    {
-      unsigned char tmp = (chain << PACKET_LENGTH - length + i);
-      unsigned char sign = tmp >> PACKET_LENGTH - 1;
+    printf("[%u] (bad packet)\n", cl->id);
+    return -1;
+  }
+
+  /* ... packed packets ... */
+  if ((unsigned char)data[0] == MORSE_PACKED_MAGIC)
+  {
+    if (morse_unpack((const unsigned char *)data, len, on_packed_char, cl) >= 0)
+      return 0;
+
+    printf("[%u] (bad packet)\n", cl->id);
+    return -1;
+  }
+
+  /* ... or legacy packets of 8 bytes, several of them may come at once */
+  if (len % PACKET_LENGTH != 0)
+  {
+    printf("[%u] (bad character)\n", cl->id);
+    return -1;
+  }
+
+  for (const char *p = data; p < data + len; p += PACKET_LENGTH)
+  {
+    if (0 == strncmp(p, "goodbye!", PACKET_LENGTH)) return -1;
+
+    if (!quiet) print_chain(cl->id, p[0]);
+
+    add_chars(cl, p, 1);
+  }
+
+  return 0;
+}
 
-      if (sign == 0) printf(".");
-      else printf("-");
+/*****************************************************************************/
+
+int on_stream(struct client *cl, const char *data, size_t len)
+{
+  size_t pos = 0;
+
+  /* what is left over is part of a packet, thus, shorter than a read */
+  memcpy(cl->pending + cl->fill, data, len);
+  cl->fill += len;
+
+  for (;;)
+  {
+    const unsigned char *p = (const unsigned char *)cl->pending + pos;
+    const size_t plen = morse_packet_length(p, cl->fill - pos);
+
+    if (plen > buffer_size)
+    {
+      printf("[%u] (bad packet)\n", cl->id);
+      return -1;
     }
 
-    printf("\n");
+    if (plen == 0 || pos + plen > cl->fill) break;
+
+    if (on_packet(cl, cl->pending + pos, plen) < 0) return -1;
+
+    pos += plen;
   }
+
+  cl->fill -= pos;
+  memmove(cl->pending, cl->pending + pos, cl->fill);
+  return 0;
 }
 
 /*****************************************************************************/
 
-int main(int argc, char **argv)
+void on_client_recv(struct io_loop *loop,
+                    int fd,
+                    const char *data,
+                    ssize_t len,
+                    void *udata)
 {
-  struct sockaddr_l2 loc_addr = {0};
-  struct sockaddr_l2 rem_addr = {0};
+  struct client *cl = udata;
+
+  /* bail if the client is gone. Sequential packet sockets keep the
+     message boundaries, each read returns one packet. Byte streams
+     (RFCOMM) need to be cut into packets first */
+  if (len <= 0 ||
+      (cl->pending ? on_stream(cl, data, len) : on_packet(cl, data, len)) < 0)
+    close_client(loop, cl);
+}
 
-  char buf[64] = {0};
+/*****************************************************************************/
 
-  int s, client, bytes_read;
-  socklen_t opt = sizeof(rem_addr);
+void on_client_accept(struct io_loop *loop, int lfd, int fd, void *udata)
+{
+  const struct morse_endpoint *ep = udata;
+  struct client *cl = calloc(1, sizeof(*cl));
 
-  /* this is similar to the client's implementation with the additional
-     functionality of listening */
-  s = socket(AF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+  if (cl)
+  {
+    cl->fd = fd;
+    cl->id = total_clients + 1;
+    morse_stream_init(&cl->stream);
+    morse_timing_init(&cl->timing, 0);
+
+    /* a partial packet plus a whole read */
+    if (morse_endpoint_is_stream(ep))
+      cl->pending = malloc(2 * buffer_size);
+  }
 
-  /* bind the socket to port 0x1001 of the first available bluetooth
-     adapter */
-  loc_addr.l2_family = AF_BLUETOOTH;
-  loc_addr.l2_bdaddr = *BDADDR_ANY;
-  loc_addr.l2_psm = htobs(0x1001);
+  if (!cl || (morse_endpoint_is_stream(ep) && !cl->pending) ||
+      io_loop_add(loop, fd, on_client_recv, cl) < 0)
+  {
+    printf("Failed serving a new client\n");
+    if (cl) free(cl->pending);
+    free(cl);
+    close(fd);
+    return;
+  }
 
-  bind(s, (struct sockaddr*)&loc_addr, sizeof(loc_addr));
+  total_clients++;
 
-  printf("Start listening...\n");
+  if (++num_clients > max_clients) max_clients = num_clients;
 
-  /* put socket into listening state */
-  listen(s, 1);
+  if (!quiet)
+  {
+    struct morse_link link;
+    char name[64];
+
+    /* what the client and the kernel settled on */
+    if (morse_transport_link(fd, ep, &link) == 0)
+      printf("Client %u connected (%s)\n", cl->id,
+             morse_link_name(&link, name, sizeof(name)));
+    else printf("Client %u connected\n", cl->id);
+  }
+}
 
-  /* accept only one connection at a time */
-  client = accept(s, (struct sockaddr*)&rem_addr, &opt);
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+  struct io_loop *loop;
+  struct rlimit rl;
+
+  static struct morse_endpoint endpoints[MAX_LISTENERS];
+  int listeners[MAX_LISTENERS];
+  unsigned int num_endpoints = 0;
+
+  const char *audio_path = NULL;
+  char url[MORSE_PATH_MAX + 16];
+  char name[MORSE_PATH_MAX + 32];
+  char link_name[64];
+  int opt, status;
+
+  while ((opt = getopt(argc, argv, "l:u:qa:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'l':
+      case 'u':
+        /* -u path is short for -l unix://path */
+        snprintf(url, sizeof(url), "%s%s", opt == 'u' ? "unix://" : "",
+                 optarg);
+
+        if (num_endpoints == MAX_LISTENERS ||
+            morse_endpoint_parse(url, &endpoints[num_endpoints]) < 0)
+        {
+          fprintf(stderr, "Bad or too many endpoints: %s\n", url);
+          return 1;
+        }
+
+        num_endpoints++;
+        break;
+
+      case 'q': quiet = 1; break;
+      case 'a': audio_path = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-l url]... [-u unix-socket-path] [-q] "
+                "[-a wav-file | -]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  /* both Bluetooth transports unless told otherwise, thus, clients
+     using either of them find the server */
+  if (num_endpoints == 0)
+  {
+    morse_endpoint_parse("l2cap://", &endpoints[num_endpoints++]);
+    morse_endpoint_parse("rfcomm://", &endpoints[num_endpoints++]);
+  }
+
+  /* 16-bit mono WAV, '-' writes to stdout */
+  if (audio_path && open_audio(audio_path) < 0)
+  {
+    perror("Failed opening the audio output");
+    return 1;
+  }
 
-  ba2str(&rem_addr.l2_bdaddr, buf);
-  printf("Connected to %s\n", buf);
+  /* every client costs a file descriptor, go for the hard limit */
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
 
-  /* now done connecting, lets do morse-ing */
-  memset(buf, 0, sizeof(buf));
-  setup_decoding_table();
+  printf("Start listening...\n");
 
-  while(1)
+  /* the backlog absorbs bursts of clients connecting at the same time */
+  for (unsigned int i = 0; i < num_endpoints; ++i)
   {
-    /* always expect to read 8 bytes from the client, bail if this
-       is not the case */
-    bytes_read = read(client, buf, sizeof(buf));
+    morse_endpoint_name(&endpoints[i], name, sizeof(name));
+
+    listeners[i] = morse_transport_listen(&endpoints[i], SOMAXCONN);
 
-    if (8 == bytes_read)
+    if (listeners[i] < 0)
     {
-      if (0 == strcmp(buf, "goodbye!")) break;
-      else print_chain(buf[0]);
+      fprintf(stderr, "Failed listening on %s: %s\n", name, strerror(errno));
+      return 1;
     }
-    else
+
+    /* no channel ever carries more than the incoming MTU */
+    struct morse_link link;
+
+    if (morse_transport_link(listeners[i], &endpoints[i], &link) < 0)
+      link.imtu = link.omtu = MORSE_DEFAULT_MTU;
+
+    if (link.imtu > buffer_size) buffer_size = link.imtu;
+
+    printf("Listening on %s (%s)\n", name,
+           morse_link_name(&link, link_name, sizeof(link_name)));
+  }
+
+  scratch_symbols = malloc(4 * buffer_size);
+  scratch_text = malloc(4 * buffer_size);
+  scratch_events = malloc(buffer_size / MORSE_KEY_EVENT_SIZE *
+                          sizeof(*scratch_events));
+
+  /* now lets do morse-ing. The I/O backend is picked via the IO_BACKEND
+     environment variable (epoll or uring), reads are MTU-sized */
+  loop = scratch_symbols && scratch_text && scratch_events ?
+    io_loop_new_sized(NULL, MAX_CLIENTS, buffer_size) : NULL;
+  status = loop ? 0 : -1;
+
+  for (unsigned int i = 0; i < num_endpoints && status == 0; ++i)
+    status = io_loop_add_listener(loop, listeners[i], on_client_accept,
+                                  &endpoints[i]);
+
+  if (status < 0)
+  {
+    printf("Failed setting up the I/O loop\n");
+    server_done = 1;
+  }
+  else printf("Using %s I/O backend, %zu byte buffers\n",
+              io_loop_backend_name(loop), buffer_size);
+
+  signal(SIGINT, on_signal_received);
+
+  while (!server_done)
+  {
+    if (io_loop_run_once(loop, -1) < 0) break;
+
+    /* the tone of whatever has been decoded, for listening along */
+    if (audio_fd >= 0) flush_audio();
+  }
+
+  /* housekeeping, clients still connected are dropped */
+  if (loop)
+  {
+    for (unsigned int fd = 0; fd < loop->num_conns; ++fd)
     {
-      printf("(bad character)\n");
-      break;
+      struct io_conn *conn = loop->conns[fd];
+
+      if (conn && !conn->listening) close_client(loop, conn->udata);
     }
+
+    for (unsigned int i = 0; i < num_endpoints; ++i)
+      io_loop_remove(loop, listeners[i]);
+
+    io_loop_free(loop);
   }
 
-  /* housekeeping */
-  close(client);
-  close(s);
+  for (unsigned int i = 0; i < num_endpoints; ++i)
+  {
+    close(listeners[i]);
+
+    if (endpoints[i].transport == MORSE_TRANSPORT_UNIX ||
+        endpoints[i].transport == MORSE_TRANSPORT_UNIX_STREAM)
+      unlink(endpoints[i].path);
+  }
 
-  printf("Done listening\n");
+  if (audio_fd >= 0) close_audio();
+
+  free(scratch_events);
+  free(scratch_text);
+  free(scratch_symbols);
+
+  printf("Done listening, %u clients (at most %u at once), %lu characters\n",
+         total_clients, max_clients, total_chars);
   return 0;
 }
-
@@ -0,0 +1,262 @@
+/******************************************************************************/
+/* File: bench_compress.c
+   Author: N.Kim
+   Abstract: Benchmark of compressed vs. plain profile frames
+
+   Description:
+     A UNIX socket pair stands in for the RFCOMM link, the sender is
+     throttled by a token bucket to the given link rate (kbit/s, default
+     700, i.e. a busy BR/EDR link). The sender streams telemetry records
+     as profile frames, the receiver reassembles and, if compressed,
+     decompresses them. Reports the effective (plaintext) throughput
+     along with the CPU time spent on compression on both ends for a
+     few frame sizes.
+
+     bench_compress [kbit/s] [seconds] */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+
+#include "profile_frame.h"
+#include "lz_stream.h"
+
+struct sender_args {
+  int fd;
+  int compress;
+  size_t frame_size;
+  double rate;
+  double duration;
+
+  unsigned long plain_bytes;
+  unsigned long wire_bytes;
+  double cpu;
+};
+
+struct receiver_state {
+  int compress;
+  struct lz_stream lz;
+  unsigned long plain_bytes;
+  double cpu;
+  int errors;
+};
+
+/******************************************************************************/
+
+static double now(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+/* something like what a sensor node would report */
+static size_t fill_records(char *buf, size_t cap, unsigned long *seq)
+{
+  size_t len = 0;
+
+  while (len < cap)
+  {
+    char rec[96];
+
+    int n = snprintf(rec, sizeof(rec),
+      "ts=%lu temp=%d.%d hum=%d rssi=-%d seq=%lu\n",
+      1700000000000ul + *seq * 250, 21 + rand() % 3, rand() % 10,
+      40 + rand() % 5, 60 + rand() % 8, *seq);
+
+    size_t chunk = (size_t)n < cap - len ? (size_t)n : cap - len;
+
+    memcpy(buf + len, rec, chunk);
+    len += chunk;
+    (*seq)++;
+  }
+
+  return len;
+}
+
+/******************************************************************************/
+
+static void *sender_thread(void *data)
+{
+  struct sender_args *args = data;
+
+  static struct lz_stream lz;
+  char plain[LZ_MAX_INPUT];
+  uint8_t packed[PROFILE_FRAME_MAX_PAYLOAD];
+  uint8_t frame[PROFILE_FRAME_HEADER_SIZE + PROFILE_FRAME_MAX_PAYLOAD];
+
+  unsigned long seq = 0;
+
+  lz_stream_init(&lz);
+
+  double start = now(CLOCK_MONOTONIC);
+  double tokens = 0;
+  double last = start;
+
+  while (last - start < args->duration)
+  {
+    size_t len = fill_records(plain, args->frame_size, &seq);
+    size_t frame_len;
+
+    if (args->compress)
+    {
+      double t = now(CLOCK_THREAD_CPUTIME_ID);
+
+      size_t plen = lz_stream_compress(&lz, plain, len,
+                                       packed, sizeof(packed));
+
+      args->cpu += now(CLOCK_THREAD_CPUTIME_ID) - t;
+
+      frame_len = profile_frame_encode(frame, sizeof(frame),
+        PROFILE_FRAME_TELEMETRY, PROFILE_FRAME_FLAG_LZ, packed, plen);
+    }
+    else frame_len = profile_frame_encode(frame, sizeof(frame),
+      PROFILE_FRAME_TELEMETRY, 0, plain, len);
+
+    /* token bucket, bytes may only go out as fast as the link allows */
+    for (;;)
+    {
+      double t = now(CLOCK_MONOTONIC);
+
+      tokens += (t - last) * args->rate;
+      last = t;
+
+      if (tokens >= frame_len) break;
+
+      usleep((frame_len - tokens) / args->rate * 1e6);
+    }
+
+    tokens -= frame_len;
+
+    if (write(args->fd, frame, frame_len) != (ssize_t)frame_len)
+    {
+      perror("write");
+      break;
+    }
+
+    args->plain_bytes += len;
+    args->wire_bytes += frame_len;
+  }
+
+  shutdown(args->fd, SHUT_WR);
+  return NULL;
+}
+
+/******************************************************************************/
+
+static void on_frame(uint8_t type,
+                     uint8_t flags,
+                     const uint8_t *payload,
+                     size_t len,
+                     void *udata)
+{
+  struct receiver_state *rs = udata;
+
+  if (flags & PROFILE_FRAME_FLAG_LZ)
+  {
+    const uint8_t *plain;
+    double t = now(CLOCK_THREAD_CPUTIME_ID);
+
+    int n = lz_stream_decompress(&rs->lz, payload, len, &plain);
+
+    rs->cpu += now(CLOCK_THREAD_CPUTIME_ID) - t;
+
+    if (n < 0) rs->errors++;
+    else rs->plain_bytes += n;
+  }
+  else rs->plain_bytes += len;
+}
+
+/******************************************************************************/
+
+static void run(int compress, size_t frame_size, double rate, double duration)
+{
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+  {
+    perror("socketpair");
+    exit(1);
+  }
+
+  struct sender_args args = { 0 };
+  static struct receiver_state rs;
+  static struct profile_frame_decoder dec;
+
+  args.fd = sv[0];
+  args.compress = compress;
+  args.frame_size = frame_size;
+  args.rate = rate;
+  args.duration = duration;
+
+  memset(&rs, 0, sizeof(rs));
+  lz_stream_init(&rs.lz);
+  profile_frame_decoder_init(&dec);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, sender_thread, &args);
+
+  double start = now(CLOCK_MONOTONIC);
+  char buf[4096];
+  ssize_t len;
+
+  while ((len = read(sv[1], buf, sizeof(buf))) > 0)
+    if (profile_frame_decode(&dec, buf, len, on_frame, &rs) < 0)
+      rs.errors++;
+
+  double elapsed = now(CLOCK_MONOTONIC) - start;
+
+  pthread_join(thread, NULL);
+  close(sv[0]);
+  close(sv[1]);
+
+  if (rs.plain_bytes != args.plain_bytes) rs.errors++;
+
+  double mb = args.plain_bytes / 1e6;
+
+  printf("%-5s %6zu %10.1f %8.3f %12.1f %12.1f %s\n",
+         compress ? "lz" : "plain", frame_size,
+         args.plain_bytes / elapsed / 1e3,
+         (double)args.wire_bytes / args.plain_bytes,
+         args.cpu > 0 ? mb / args.cpu : 0,
+         rs.cpu > 0 ? mb / rs.cpu : 0,
+         rs.errors ? "ERRORS" : "");
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const size_t sizes[] = { 64, 256, 1024, LZ_MAX_INPUT };
+
+  double kbits = argc > 1 ? atof(argv[1]) : 700;
+  double duration = argc > 2 ? atof(argv[2]) : 2;
+
+  if (kbits <= 0 || duration <= 0)
+  {
+    fprintf(stderr, "usage: %s [kbit/s] [seconds]\n", argv[0]);
+    return 1;
+  }
+
+  printf("link %.0f kbit/s, %.1f s per run\n", kbits, duration);
+  printf("%-5s %6s %10s %8s %12s %12s\n",
+         "mode", "frame", "kB/s", "wire", "comp MB/s", "decomp MB/s");
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+  {
+    run(0, sizes[i], kbits * 1000 / 8, duration);
+    run(1, sizes[i], kbits * 1000 / 8, duration);
+  }
+
+  return 0;
+}
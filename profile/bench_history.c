@@ -0,0 +1,446 @@
+/******************************************************************************/
+/* File: bench_history.c
+   Author: N.Kim
+   Abstract: Benchmark of the history download (see history_sync.h)
+
+   Description:
+     Fills a store with a day of 24 sensors read every 2 seconds (or
+     the number of readings given), then downloads all of it through a
+     UNIX socket pair standing in for the RFCOMM link. The server end runs
+     on a thread of its own, its writes are throttled by a token bucket
+     to the given link rate (kbit/s, default 700, i.e. a busy BR/EDR
+     link, 0 for none). The client checks every reading against the
+     store and acknowledges every batch.
+
+     Reports readings per second and bytes per reading on the link, once
+     throttled, once as fast as it gets and once more with the client
+     dropping the connection halfway and resuming from its last
+     acknowledged position.
+
+     bench_history [kbit/s] [readings] */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+
+#include "ts_store.h"
+#include "profile_frame.h"
+#include "history_sync.h"
+
+#define SENSORS 24
+#define PERIOD 2
+
+#define WRITE_SIZE \
+  (HISTORY_WINDOW * (PROFILE_FRAME_HEADER_SIZE + PROFILE_FRAME_MAX_PAYLOAD))
+
+/* the server is paced in chunks, as the link would take them */
+#define PACE_CHUNK 1024
+
+struct server_args {
+  int fd;
+  double rate;
+  const struct ts_store *store;
+
+  struct history_sender *sender;
+  int started;
+  int errors;
+
+  unsigned long wire_bytes;
+  double cpu;
+};
+
+struct client_state {
+  int fd;
+  const struct ts_record *expected;
+  size_t total;
+
+  /* verified so far, over all connections */
+  size_t got;
+  struct history_pos pos;
+
+  /* drops the connection once that many readings are in, 0 for never */
+  size_t stop_after;
+
+  unsigned long batches;
+  unsigned long bytes;
+  int done;
+  int errors;
+};
+
+/******************************************************************************/
+
+static double now(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/******************************************************************************/
+
+/* something like what the sampler of ../dht11 stores: half the sensors
+   every even second, half every odd one, whole degrees and percents
+   changing every now and then */
+static int fill_store(struct ts_store *store, size_t count)
+{
+  int16_t temperature[SENSORS];
+  uint16_t humidity[SENSORS];
+  uint32_t start = 1700000000;
+
+  for (int s = 0; s < SENSORS; ++s)
+  {
+    temperature[s] = 200 + 10 * (s % 5);
+    humidity[s] = 400 + 10 * (s % 7);
+  }
+
+  srand(1);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    const unsigned int s = i % SENSORS;
+    const size_t cycle = i / SENSORS;
+    struct ts_record r;
+
+    if (rand() % 20 == 0) temperature[s] += rand() % 2 ? 10 : -10;
+    if (rand() % 10 == 0) humidity[s] += rand() % 2 ? 10 : -10;
+
+    r.time = start + cycle * PERIOD + (s >= SENSORS / 2);
+    r.temperature = temperature[s];
+    r.humidity = humidity[s];
+    r.sensor = s;
+
+    if (ts_store_append(store, &r) < 0) return -1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+static void paced_write(struct server_args *args,
+                        const uint8_t *data,
+                        size_t len)
+{
+  static __thread double tokens = 0, last = 0;
+
+  if (last == 0) last = now(CLOCK_MONOTONIC);
+
+  while (len > 0)
+  {
+    size_t chunk = len < PACE_CHUNK ? len : PACE_CHUNK;
+
+    /* token bucket, bytes may only go out as fast as the link allows */
+    while (args->rate > 0)
+    {
+      double t = now(CLOCK_MONOTONIC);
+
+      tokens += (t - last) * args->rate;
+      last = t;
+
+      if (tokens > 4 * PACE_CHUNK) tokens = 4 * PACE_CHUNK;
+      if (tokens >= chunk) break;
+
+      usleep((chunk - tokens) / args->rate * 1e6);
+    }
+
+    tokens -= chunk;
+
+    /* the client may have dropped the connection */
+    if (send(args->fd, data, chunk, MSG_NOSIGNAL) != (ssize_t)chunk) return;
+
+    args->wire_bytes += chunk;
+    data += chunk;
+    len -= chunk;
+  }
+}
+
+/******************************************************************************/
+
+static void on_server_frame(uint8_t type,
+                            uint8_t flags,
+                            const uint8_t *payload,
+                            size_t len,
+                            void *udata)
+{
+  struct server_args *args = udata;
+
+  if (type == PROFILE_FRAME_HISTORY_REQUEST &&
+      history_sender_start(args->sender, payload, len) == 0)
+    args->started = 1;
+  else if (type != PROFILE_FRAME_HISTORY_ACK || !args->started ||
+           history_sender_ack(args->sender, payload, len) < 0)
+    args->errors++;
+}
+
+/******************************************************************************/
+
+static void *server_thread(void *data)
+{
+  struct server_args *args = data;
+  struct profile_frame_decoder dec;
+  uint8_t *out = malloc(WRITE_SIZE);
+  uint8_t buf[4096];
+  ssize_t len;
+
+  args->sender = malloc(sizeof(*args->sender));
+  profile_frame_decoder_init(&dec);
+
+  /* as the profile server does it, all acknowledgements read at once
+     make for one write */
+  while ((len = read(args->fd, buf, sizeof(buf))) > 0)
+  {
+    double t = now(CLOCK_THREAD_CPUTIME_ID);
+
+    if (profile_frame_decode(&dec, buf, len, on_server_frame, args) < 0)
+      args->errors++;
+
+    size_t n = args->started ?
+      history_sender_fill(args->sender, args->store, out, WRITE_SIZE) : 0;
+
+    args->cpu += now(CLOCK_THREAD_CPUTIME_ID) - t;
+
+    if (n > 0) paced_write(args, out, n);
+  }
+
+  free(args->sender);
+  free(out);
+  return NULL;
+}
+
+/******************************************************************************/
+
+static void on_client_frame(uint8_t type,
+                            uint8_t flags,
+                            const uint8_t *payload,
+                            size_t len,
+                            void *udata)
+{
+  static struct ts_record records[PROFILE_FRAME_MAX_PAYLOAD];
+
+  struct client_state *cs = udata;
+  uint8_t frame[PROFILE_FRAME_HEADER_SIZE + HISTORY_ACK_SIZE];
+  uint8_t ack[HISTORY_ACK_SIZE];
+  struct history_pos end;
+  uint32_t sent;
+  int n;
+
+  if (cs->done) return;
+
+  if (type == PROFILE_FRAME_HISTORY_END)
+  {
+    if (history_decode_end(payload, len, &end, &sent) < 0 ||
+        end.time != cs->pos.time || end.skip != cs->pos.skip)
+      cs->errors++;
+
+    cs->done = 1;
+    return;
+  }
+
+  /* as if the link went down, this batch and those in flight are lost */
+  if (cs->stop_after && cs->got >= cs->stop_after)
+  {
+    cs->done = 1;
+    return;
+  }
+
+  n = history_batch_decode(payload, len, records, PROFILE_FRAME_MAX_PAYLOAD);
+
+  if (type != PROFILE_FRAME_HISTORY_BATCH || n < 0)
+  {
+    cs->errors++;
+    cs->done = 1;
+    return;
+  }
+
+  for (int i = 0; i < n; ++i)
+  {
+    if (cs->got + i >= cs->total)
+    {
+      cs->errors++;
+      break;
+    }
+
+    const struct ts_record *e = &cs->expected[cs->got + i];
+
+    if (records[i].time != e->time ||
+        records[i].sensor != e->sensor ||
+        records[i].temperature != e->temperature ||
+        records[i].humidity != e->humidity)
+    {
+      cs->errors++;
+      break;
+    }
+
+    history_pos_advance(&cs->pos, &records[i]);
+  }
+
+  cs->got += n;
+  cs->batches++;
+  cs->bytes += PROFILE_FRAME_HEADER_SIZE + len;
+
+  size_t alen = profile_frame_encode(frame, sizeof(frame),
+    PROFILE_FRAME_HISTORY_ACK, 0, ack, history_encode_ack(ack, &cs->pos));
+
+  if (write(cs->fd, frame, alen) != (ssize_t)alen) cs->errors++;
+}
+
+/******************************************************************************/
+
+static double download(struct client_state *cs,
+                       const struct ts_store *store,
+                       double rate,
+                       double *server_cpu)
+{
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+  {
+    perror("socketpair");
+    exit(1);
+  }
+
+  struct server_args args = { 0 };
+  static struct profile_frame_decoder dec;
+
+  args.fd = sv[0];
+  args.rate = rate;
+  args.store = store;
+
+  cs->fd = sv[1];
+  cs->done = 0;
+  profile_frame_decoder_init(&dec);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, server_thread, &args);
+
+  double start = now(CLOCK_MONOTONIC);
+  uint8_t req[HISTORY_REQUEST_SIZE];
+  uint8_t frame[PROFILE_FRAME_HEADER_SIZE + HISTORY_REQUEST_SIZE];
+  uint8_t buf[16384];
+  ssize_t len;
+
+  size_t flen = profile_frame_encode(frame, sizeof(frame),
+    PROFILE_FRAME_HISTORY_REQUEST, 0, req,
+    history_encode_request(req, &cs->pos, 0));
+
+  if (write(cs->fd, frame, flen) != (ssize_t)flen) cs->errors++;
+
+  while (!cs->done && (len = read(cs->fd, buf, sizeof(buf))) > 0)
+    if (profile_frame_decode(&dec, buf, len, on_client_frame, cs) < 0)
+    {
+      cs->errors++;
+      break;
+    }
+
+  double elapsed = now(CLOCK_MONOTONIC) - start;
+
+  /* the server thread sees the end of its input */
+  shutdown(cs->fd, SHUT_RDWR);
+  pthread_join(thread, NULL);
+  close(sv[0]);
+  close(sv[1]);
+
+  cs->errors += args.errors;
+  *server_cpu += args.cpu;
+  return elapsed;
+}
+
+/******************************************************************************/
+
+static void run(const char *name,
+                const struct ts_store *store,
+                const struct ts_record *expected,
+                size_t total,
+                double rate,
+                int resume)
+{
+  struct client_state cs;
+  double elapsed = 0, cpu = 0;
+  int connections = 0;
+
+  memset(&cs, 0, sizeof(cs));
+  cs.expected = expected;
+  cs.total = total;
+  cs.stop_after = resume ? total / 2 : 0;
+
+  /* the first connection starts at the beginning of the store */
+  for (;;)
+  {
+    elapsed += download(&cs, store, rate, &cpu);
+    connections++;
+
+    if (!cs.stop_after || cs.errors) break;
+
+    /* the next one after the last batch acknowledged */
+    cs.stop_after = 0;
+  }
+
+  if (cs.got != total) cs.errors++;
+
+  printf("%-8s %7.0f %9zu %3d %8lu %10.3f %12.0f %10.3f %s\n",
+         name, rate * 8 / 1000, total, connections, cs.batches,
+         (double)cs.bytes / total, total / elapsed, cpu / total * 1e6,
+         cs.errors ? "ERRORS" : "");
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  char path[] = "/tmp/bench_historyXXXXXX";
+  struct ts_store store;
+  struct ts_record *expected;
+
+  double kbits = argc > 1 ? atof(argv[1]) : 700;
+  long count = argc > 2 ? atol(argv[2]) : SENSORS * 86400 / PERIOD;
+
+  if (kbits < 0 || count <= 0 || count >= TS_RAW_CAPACITY)
+  {
+    fprintf(stderr, "usage: %s [kbit/s] [readings]\n", argv[0]);
+    return 1;
+  }
+
+  int fd = mkstemp(path);
+
+  if (fd < 0 || ts_store_open(&store, path, count + 1, 0, 0) < 0 ||
+      fill_store(&store, count) < 0)
+  {
+    perror(path);
+    return 1;
+  }
+
+  close(fd);
+  unlink(path);
+
+  expected = malloc(count * sizeof(*expected));
+
+  if (ts_store_records(&store, 0, UINT32_MAX, expected, count) !=
+      (size_t)count)
+  {
+    fprintf(stderr, "store incomplete\n");
+    return 1;
+  }
+
+  printf("%ld readings of %d sensors, %zu bytes each as stored\n",
+         count, SENSORS, sizeof(struct ts_record));
+  printf("%-8s %7s %9s %3s %8s %10s %12s %10s\n", "run", "kbit/s",
+         "readings", "con", "batches", "B/reading", "readings/s",
+         "srv us/rd");
+
+  if (kbits > 0) run("link", &store, expected, count, kbits * 1000 / 8, 0);
+
+  run("full", &store, expected, count, 0, 0);
+  run("resumed", &store, expected, count, 0, 1);
+
+  ts_store_close(&store);
+  free(expected);
+  return 0;
+}
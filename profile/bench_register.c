@@ -0,0 +1,250 @@
+/******************************************************************************/
+/* File: bench_register.c
+   Author: N.Kim
+   Abstract: Profile registration benchmark (blocking vs. batched)
+
+   Description:
+     Spawns a private message bus (GTestDBus, requires dbus-daemon) and
+     a stand-in 'org.bluez' ProfileManager1 on its own thread, then
+     registers 1, 10 and 100 profiles, once with a blocking round-trip
+     per profile and once as a single batch via the profile registry. */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "profile_record.h"
+#include "profile_registry.h"
+#include "sdp_record.h"
+
+static const char STANDIN_XML[] =
+  "<node>"
+  "  <interface name='org.bluez.ProfileManager1'>"
+  "    <method name='RegisterProfile'>"
+  "      <arg name='profile' type='o' direction='in'/>"
+  "      <arg name='uuid' type='s' direction='in'/>"
+  "      <arg name='options' type='a{sv}' direction='in'/>"
+  "    </method>"
+  "    <method name='UnregisterProfile'>"
+  "      <arg name='profile' type='o' direction='in'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
+static const gchar *bus_address = NULL;
+
+static GMutex standin_lock;
+static GCond standin_cond;
+static GMainLoop *standin_loop = NULL;
+
+/******************************************************************************/
+/* The stand-in accepts everything, we are only interested in the cost
+   of the round-trips and the record handling on our side */
+
+static void on_standin_method_call(GDBusConnection *con,
+                                   const gchar *sender,
+                                   const gchar *obj_path,
+                                   const gchar *iface_name,
+                                   const gchar *method_name,
+                                   GVariant *params,
+                                   GDBusMethodInvocation *invoc,
+                                   gpointer udata)
+{
+  g_dbus_method_invocation_return_value(invoc, NULL);
+}
+
+/******************************************************************************/
+
+static gpointer standin_thread(gpointer data)
+{
+  GError *err = NULL;
+  GMainContext *ctx = g_main_context_new();
+
+  /* objects registered from here get dispatched in this context */
+  g_main_context_push_thread_default(ctx);
+
+  GDBusConnection *con = g_dbus_connection_new_for_address_sync(
+    bus_address,
+    G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+    G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+    NULL, NULL, &err);
+
+  g_assert(con && err == NULL);
+
+  GVariant *ret = g_dbus_connection_call_sync(con,
+    "org.freedesktop.DBus", "/org/freedesktop/DBus",
+    "org.freedesktop.DBus", "RequestName",
+    g_variant_new("(su)", BLUEZ_BUS_NAME, 0x4),
+    NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &err);
+
+  g_assert(ret && err == NULL);
+  g_variant_unref(ret);
+
+  GDBusNodeInfo *info = g_dbus_node_info_new_for_xml(STANDIN_XML, NULL);
+
+  GDBusInterfaceVTable vtable = { on_standin_method_call, NULL, NULL };
+
+  g_dbus_connection_register_object(con, "/org/bluez",
+    info->interfaces[0], &vtable, NULL, NULL, &err);
+
+  g_assert(err == NULL);
+
+  g_mutex_lock(&standin_lock);
+  standin_loop = g_main_loop_new(ctx, FALSE);
+  g_cond_signal(&standin_cond);
+  g_mutex_unlock(&standin_lock);
+
+  g_main_loop_run(standin_loop);
+
+  g_dbus_node_info_unref(info);
+  g_object_unref(con);
+  g_main_context_pop_thread_default(ctx);
+  g_main_context_unref(ctx);
+  return NULL;
+}
+
+/******************************************************************************/
+
+static void on_batch_done(guint failed, gpointer udata)
+{
+  g_assert(failed == 0);
+  g_main_loop_quit(udata);
+}
+
+/******************************************************************************/
+
+static struct sdp_record *new_record(guint i, gchar **uuid)
+{
+  *uuid = g_strdup_printf(PROFILE_CUSTOM_UUID_FMT, i);
+
+  return sdp_record_new_rfcomm(*uuid, "Benchmark",
+    (i % 30) + 1, PROFILE_VERSION, PROFILE_SERVICE_NAME);
+}
+
+/******************************************************************************/
+/* Baseline: one blocking call per profile, as done by the examples */
+
+static double run_blocking(GDBusConnection *conn, guint count)
+{
+  GError *err = NULL;
+  gint64 start = g_get_monotonic_time();
+
+  for (guint i = 0; i < count; ++i)
+  {
+    gchar *uuid;
+    struct sdp_record *rec = new_record(i, &uuid);
+    gchar *path = g_strdup_printf("%s/bench%u", PROFILE_OBJECT_PATH, i);
+
+    GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(builder, "{sv}", "ServiceRecord",
+      g_variant_new_string(sdp_record_get_xml(rec)));
+
+    GVariant *ret = g_dbus_connection_call_sync(conn,
+      BLUEZ_BUS_NAME, "/org/bluez", BLUEZ_PROF_MAN_IFACE,
+      "RegisterProfile",
+      g_variant_new("(osa{sv})", path, uuid, builder),
+      NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &err);
+
+    g_assert(ret && err == NULL);
+
+    g_variant_unref(ret);
+    g_variant_builder_unref(builder);
+    sdp_record_free(rec);
+    g_free(path);
+    g_free(uuid);
+  }
+
+  return (g_get_monotonic_time() - start) / 1000.0;
+}
+
+/******************************************************************************/
+
+static double run_batched(GDBusConnection *conn,
+                          GMainLoop *loop,
+                          guint count)
+{
+  GError *err = NULL;
+
+  struct profile_registry *reg =
+    profile_registry_new(conn, PROFILE_OBJECT_PATH, &err);
+
+  g_assert(reg && err == NULL);
+
+  gint64 start = g_get_monotonic_time();
+
+  for (guint i = 0; i < count; ++i)
+  {
+    gchar *uuid;
+    struct sdp_record *rec = new_record(i, &uuid);
+    gchar *name = g_strdup_printf("bench%u", i);
+
+    profile_registry_add(reg, name, uuid, "server",
+      (i % 30) + 1, rec, NULL, NULL);
+
+    g_free(name);
+    g_free(uuid);
+  }
+
+  profile_registry_register_all(reg, on_batch_done, loop);
+  g_main_loop_run(loop);
+
+  double elapsed = (g_get_monotonic_time() - start) / 1000.0;
+
+  profile_registry_unregister_all(reg, on_batch_done, loop);
+  g_main_loop_run(loop);
+
+  profile_registry_free(reg);
+  return elapsed;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  GError *err = NULL;
+  const guint counts[] = { 1, 10, 100 };
+
+  GTestDBus *bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+  g_test_dbus_up(bus);
+  bus_address = g_test_dbus_get_bus_address(bus);
+
+  GThread *thread = g_thread_new("standin", standin_thread, NULL);
+
+  g_mutex_lock(&standin_lock);
+  while (!standin_loop) g_cond_wait(&standin_cond, &standin_lock);
+  g_mutex_unlock(&standin_lock);
+
+  GDBusConnection *conn = g_dbus_connection_new_for_address_sync(
+    bus_address,
+    G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+    G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+    NULL, NULL, &err);
+
+  g_assert(conn && err == NULL);
+
+  GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+  g_print("%10s %14s %14s\n", "profiles", "blocking [ms]", "batched [ms]");
+
+  for (guint i = 0; i < G_N_ELEMENTS(counts); ++i)
+  {
+    double blocking = run_blocking(conn, counts[i]);
+    double batched = run_batched(conn, loop, counts[i]);
+
+    g_print("%10u %14.3f %14.3f\n", counts[i], blocking, batched);
+  }
+
+  g_main_loop_quit(standin_loop);
+  g_thread_join(thread);
+
+  g_main_loop_unref(loop);
+  g_object_unref(conn);
+  g_test_dbus_down(bus);
+  g_object_unref(bus);
+  return 0;
+}
@@ -0,0 +1,392 @@
+/******************************************************************************/
+/* File: history_sync.c
+   Author: N.Kim
+   Abstract: Download of stored sensor readings over the profile connection */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "history_sync.h"
+
+/******************************************************************************/
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+/******************************************************************************/
+
+static uint32_t get_u32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/******************************************************************************/
+
+static size_t put_varint(uint8_t *p, uint32_t v)
+{
+  size_t n = 0;
+
+  while (v >= 0x80)
+  {
+    p[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+
+  p[n++] = v;
+  return n;
+}
+
+/******************************************************************************/
+
+static const uint8_t *get_varint(const uint8_t *p,
+                                 const uint8_t *end,
+                                 uint32_t *v)
+{
+  /* no more than 5 bytes, NULL if the batch ends before */
+  *v = 0;
+
+  for (int shift = 0; p < end && shift < 35; shift += 7)
+  {
+    *v |= (uint32_t)(*p & 0x7f) << shift;
+
+    if (!(*p++ & 0x80)) return p;
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+static uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+/******************************************************************************/
+
+static int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/******************************************************************************/
+
+void history_pos_advance(struct history_pos *pos,
+                         const struct ts_record *record)
+{
+  if (record->time == pos->time) pos->skip++;
+  else
+  {
+    pos->time = record->time;
+    pos->skip = 1;
+  }
+}
+
+/******************************************************************************/
+
+size_t history_encode_request(uint8_t *out,
+                              const struct history_pos *from,
+                              uint32_t to)
+{
+  put_u32(out, from->time);
+  put_u32(out + 4, to);
+  put_u32(out + 8, from->skip);
+  return HISTORY_REQUEST_SIZE;
+}
+
+/******************************************************************************/
+
+size_t history_encode_ack(uint8_t *out, const struct history_pos *pos)
+{
+  put_u32(out, pos->time);
+  put_u32(out + 4, pos->skip);
+  return HISTORY_ACK_SIZE;
+}
+
+/******************************************************************************/
+
+size_t history_encode_end(uint8_t *out,
+                          const struct history_pos *pos,
+                          uint32_t records)
+{
+  put_u32(out, pos->time);
+  put_u32(out + 4, pos->skip);
+  put_u32(out + 8, records);
+  return HISTORY_END_SIZE;
+}
+
+/******************************************************************************/
+
+int history_decode_ack(const uint8_t *in, size_t len,
+                       struct history_pos *pos)
+{
+  if (len != HISTORY_ACK_SIZE) return -1;
+
+  pos->time = get_u32(in);
+  pos->skip = get_u32(in + 4);
+  return 0;
+}
+
+/******************************************************************************/
+
+int history_decode_end(const uint8_t *in, size_t len,
+                       struct history_pos *pos, uint32_t *records)
+{
+  if (len != HISTORY_END_SIZE) return -1;
+
+  pos->time = get_u32(in);
+  pos->skip = get_u32(in + 4);
+  *records = get_u32(in + 8);
+  return 0;
+}
+
+/******************************************************************************/
+
+void history_batch_begin(struct history_batch *batch,
+                         uint8_t *out,
+                         size_t cap)
+{
+  batch->out = out;
+  batch->cap = cap;
+  batch->len = HISTORY_BATCH_HEADER_SIZE;
+  batch->count = 0;
+  batch->first = 0;
+  batch->time = 0;
+
+  memset(batch->temperature, 0, sizeof(batch->temperature));
+  memset(batch->humidity, 0, sizeof(batch->humidity));
+}
+
+/******************************************************************************/
+
+int history_batch_add(struct history_batch *batch,
+                      const struct ts_record *record)
+{
+  const unsigned int s = record->sensor;
+  uint8_t *p = batch->out + batch->len;
+  uint8_t tag = s;
+  size_t n = 1;
+
+  /* the count has 16 bits, no reading takes less than a byte */
+  if (batch->cap - batch->len < HISTORY_RECORD_MAX_SIZE ||
+      batch->count == 0xffff)
+    return 0;
+
+  if (batch->count == 0) batch->first = batch->time = record->time;
+
+  if (record->time != batch->time)
+  {
+    tag |= HISTORY_TAG_TIME;
+    n += put_varint(p + n, record->time - batch->time);
+  }
+
+  if (record->temperature != batch->temperature[s] ||
+      record->humidity != batch->humidity[s])
+  {
+    tag |= HISTORY_TAG_VALUES;
+    n += put_varint(p + n,
+      zigzag(record->temperature - batch->temperature[s]));
+    n += put_varint(p + n, zigzag(record->humidity - batch->humidity[s]));
+  }
+
+  p[0] = tag;
+
+  batch->time = record->time;
+  batch->temperature[s] = record->temperature;
+  batch->humidity[s] = record->humidity;
+  batch->len += n;
+  batch->count++;
+  return 1;
+}
+
+/******************************************************************************/
+
+size_t history_batch_end(struct history_batch *batch)
+{
+  put_u32(batch->out, batch->first);
+  batch->out[4] = batch->count & 0xff;
+  batch->out[5] = batch->count >> 8;
+  return batch->len;
+}
+
+/******************************************************************************/
+
+int history_batch_decode(const uint8_t *in,
+                         size_t len,
+                         struct ts_record *out,
+                         size_t max)
+{
+  const uint8_t *end = in + len;
+  const uint8_t *p = in + HISTORY_BATCH_HEADER_SIZE;
+  int16_t temperature[TS_MAX_SENSORS] = { 0 };
+  uint16_t humidity[TS_MAX_SENSORS] = { 0 };
+  uint32_t time;
+  unsigned int count;
+
+  if (len < HISTORY_BATCH_HEADER_SIZE) return -1;
+
+  time = get_u32(in);
+  count = in[4] | (in[5] << 8);
+
+  if (count > max) return -1;
+
+  for (unsigned int i = 0; i < count; ++i)
+  {
+    uint32_t v;
+
+    if (p == end) return -1;
+
+    const uint8_t tag = *p++;
+    const unsigned int s = tag & (TS_MAX_SENSORS - 1);
+
+    if (tag & HISTORY_TAG_TIME)
+    {
+      if (!(p = get_varint(p, end, &v)) || v > UINT32_MAX - time)
+        return -1;
+
+      time += v;
+    }
+
+    if (tag & HISTORY_TAG_VALUES)
+    {
+      int32_t t, h;
+
+      if (!(p = get_varint(p, end, &v))) return -1;
+      t = temperature[s] + unzigzag(v);
+
+      if (!(p = get_varint(p, end, &v))) return -1;
+      h = humidity[s] + unzigzag(v);
+
+      /* as wide as in the store */
+      if (t < INT16_MIN || t > INT16_MAX || h < 0 || h > 1023) return -1;
+
+      temperature[s] = t;
+      humidity[s] = h;
+    }
+
+    out[i].time = time;
+    out[i].temperature = temperature[s];
+    out[i].humidity = humidity[s];
+    out[i].sensor = s;
+  }
+
+  return p == end ? (int)count : -1;
+}
+
+/******************************************************************************/
+
+int history_sender_start(struct history_sender *sender,
+                         const uint8_t *in,
+                         size_t len)
+{
+  if (len != HISTORY_REQUEST_SIZE) return -1;
+
+  sender->pos.time = get_u32(in);
+  sender->to = get_u32(in + 4);
+  sender->pos.skip = get_u32(in + 8);
+
+  if (sender->to == 0) sender->to = UINT32_MAX;
+
+  sender->staged = 0;
+  sender->next = 0;
+  sender->in_flight = 0;
+  sender->finished = 0;
+  sender->acked = sender->pos;
+
+  sender->records = 0;
+  sender->batches = 0;
+  sender->bytes = 0;
+  return 0;
+}
+
+/******************************************************************************/
+
+int history_sender_ack(struct history_sender *sender,
+                       const uint8_t *in,
+                       size_t len)
+{
+  if (history_decode_ack(in, len, &sender->acked) < 0) return -1;
+
+  if (sender->in_flight > 0) sender->in_flight--;
+  return 0;
+}
+
+/******************************************************************************/
+
+static size_t refill(struct history_sender *sender,
+                     const struct ts_store *store)
+{
+  const size_t n = ts_store_records(store, sender->pos.time, sender->to,
+                                    sender->stage, HISTORY_STAGE_SIZE);
+  size_t skip = 0;
+
+  /* the readings of that second sent before */
+  while (skip < n && skip < sender->pos.skip &&
+         sender->stage[skip].time == sender->pos.time)
+    skip++;
+
+  sender->staged = n;
+  sender->next = skip;
+  return n - skip;
+}
+
+/******************************************************************************/
+
+size_t history_sender_fill(struct history_sender *sender,
+                           const struct ts_store *store,
+                           uint8_t *out,
+                           size_t cap)
+{
+  uint8_t payload[PROFILE_FRAME_MAX_PAYLOAD];
+  size_t len = 0;
+
+  if (sender->finished || sender->in_flight > HISTORY_WINDOW / 2) return 0;
+
+  while (sender->in_flight < HISTORY_WINDOW &&
+         cap - len >= PROFILE_FRAME_HEADER_SIZE + PROFILE_FRAME_MAX_PAYLOAD)
+  {
+    struct history_batch batch;
+    size_t plen;
+
+    history_batch_begin(&batch, payload, sizeof(payload));
+
+    for (;;)
+    {
+      if (sender->next == sender->staged && refill(sender, store) == 0)
+        break;
+
+      if (!history_batch_add(&batch, &sender->stage[sender->next])) break;
+
+      history_pos_advance(&sender->pos, &sender->stage[sender->next++]);
+    }
+
+    if (batch.count == 0)
+    {
+      /* the range is through, up to the newest reading at least */
+      plen = history_encode_end(payload, &sender->pos, sender->records);
+
+      len += profile_frame_encode(out + len, cap - len,
+        PROFILE_FRAME_HISTORY_END, 0, payload, plen);
+
+      sender->finished = 1;
+      break;
+    }
+
+    plen = history_batch_end(&batch);
+
+    len += profile_frame_encode(out + len, cap - len,
+      PROFILE_FRAME_HISTORY_BATCH, 0, payload, plen);
+
+    sender->in_flight++;
+    sender->batches++;
+    sender->records += batch.count;
+    sender->bytes += PROFILE_FRAME_HEADER_SIZE + plen;
+  }
+
+  return len;
+}
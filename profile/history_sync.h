@@ -0,0 +1,172 @@
+/******************************************************************************/
+/* File: history_sync.h
+   Author: N.Kim
+   Abstract: Download of stored sensor readings over the profile connection
+
+   Description:
+     A client that was away asks for the readings of a time range (see
+     ts_store.h), the server streams them as batches and the client
+     acknowledges every batch it has stored:
+
+       client                         server
+         HISTORY_REQUEST  -------->
+                          <--------   HISTORY_BATCH  (up to the window)
+         HISTORY_ACK      -------->
+                          <--------   HISTORY_BATCH ...
+                          <--------   HISTORY_END
+
+     Readings are ordered by time, several of them may share a second
+     though. Thus, a position in the stream is a time and the number of
+     readings of that second already passed. Acknowledgements carry the
+     position after their batch, a client reconnecting asks for the range
+     again starting at the last position it stored.
+
+     The server sends no more than HISTORY_WINDOW batches ahead of the
+     acknowledgements and waits for half of them before sending again,
+     so its writes are many batches at once. */
+/******************************************************************************/
+
+#ifndef HISTORY_SYNC_H
+#define HISTORY_SYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "profile_frame.h"
+#include "ts_store.h"
+
+/* a batch is one frame:
+
+     0      4       6
+     +------+-------+-------------+
+     | time | count | records ... |
+     +------+-------+-------------+
+
+   'time' is the one of the first reading, all little endian. Every
+   reading starts with a tag byte: the sensor (bits 0-5), bit 6 set if
+   the time differs from the one of the reading before (followed by the
+   seconds passed as varint) and bit 7 set if temperature or humidity
+   differ from the last reading of the sensor in the batch (followed by
+   both differences, zigzag varints). Batches do not refer to each
+   other, the first reading of a sensor is relative to 0 */
+#define HISTORY_BATCH_HEADER_SIZE 6
+#define HISTORY_RECORD_MAX_SIZE 16
+
+#define HISTORY_TAG_TIME 0x40
+#define HISTORY_TAG_VALUES 0x80
+
+/* batches in flight */
+#define HISTORY_WINDOW 32
+
+/* readings taken from the store at once */
+#define HISTORY_STAGE_SIZE 4096
+
+/* after 'skip' readings of second 'time' */
+struct history_pos {
+  uint32_t time;
+  uint32_t skip;
+};
+
+/* the request is the position to start at and the end of the range
+   (exclusive, 0 for the newest reading), 12 bytes. Acknowledgements
+   are a position, 8 bytes. The end is the position reached followed by
+   the number of readings sent, 12 bytes */
+#define HISTORY_REQUEST_SIZE 12
+#define HISTORY_ACK_SIZE 8
+#define HISTORY_END_SIZE 12
+
+struct history_batch {
+  uint8_t *out;
+  size_t cap;
+  size_t len;
+  unsigned int count;
+
+  /* of the first and of the last reading */
+  uint32_t first;
+  uint32_t time;
+
+  /* last values per sensor */
+  int16_t temperature[TS_MAX_SENSORS];
+  uint16_t humidity[TS_MAX_SENSORS];
+};
+
+/* the sending side of one connection */
+struct history_sender {
+  struct history_pos pos;
+  uint32_t to;
+
+  /* queried but not sent yet */
+  struct ts_record stage[HISTORY_STAGE_SIZE];
+  size_t staged;
+  size_t next;
+
+  unsigned int in_flight;
+  int finished;
+
+  /* the last acknowledged position */
+  struct history_pos acked;
+
+  unsigned long records;
+  unsigned long batches;
+  unsigned long bytes;
+};
+
+void history_pos_advance(struct history_pos *pos,
+                         const struct ts_record *record);
+
+/* the payloads of the control frames */
+size_t history_encode_request(uint8_t *out,
+                              const struct history_pos *from,
+                              uint32_t to);
+
+size_t history_encode_ack(uint8_t *out, const struct history_pos *pos);
+
+size_t history_encode_end(uint8_t *out,
+                          const struct history_pos *pos,
+                          uint32_t records);
+
+int history_decode_ack(const uint8_t *in, size_t len,
+                       struct history_pos *pos);
+
+int history_decode_end(const uint8_t *in, size_t len,
+                       struct history_pos *pos, uint32_t *records);
+
+/* starts a batch in 'out', which should have room for the header */
+void history_batch_begin(struct history_batch *batch,
+                         uint8_t *out,
+                         size_t cap);
+
+/* returns 0 if the reading does not fit anymore */
+int history_batch_add(struct history_batch *batch,
+                      const struct ts_record *record);
+
+/* completes the header, returns the length of the batch */
+size_t history_batch_end(struct history_batch *batch);
+
+/* the readings of a batch, no more than 'max'. Returns their number or
+   -1 if the batch is malformed */
+int history_batch_decode(const uint8_t *in,
+                         size_t len,
+                         struct ts_record *out,
+                         size_t max);
+
+/* takes a request, returns -1 if it is malformed */
+int history_sender_start(struct history_sender *sender,
+                         const uint8_t *in,
+                         size_t len);
+
+/* an acknowledgement came in, returns -1 if it is malformed */
+int history_sender_ack(struct history_sender *sender,
+                       const uint8_t *in,
+                       size_t len);
+
+/* writes the frames to send next to 'out', i.e. batches up to the window
+   and the end once the range is through. Returns their length, 0 if the
+   window is still more than half full or all is sent. The store must not
+   change meanwhile */
+size_t history_sender_fill(struct history_sender *sender,
+                           const struct ts_store *store,
+                           uint8_t *out,
+                           size_t cap);
+
+#endif
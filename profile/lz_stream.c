@@ -0,0 +1,285 @@
+/******************************************************************************/
+/* File: lz_stream.c
+   Author: N.Kim
+   Abstract: Streaming LZ77 compression (LZ4 block format) for frames
+
+   Description:
+     Greedy single-probe hash matcher, i.e. the classic LZ4 fast path.
+     Frames of a connection are small and repetitive (telemetry), thus,
+     the history of previous frames is kept and matches may reference
+     it. Once the history buffer is full the most recent window is moved
+     to the front, compressor and decompressor do so at the same points,
+     since both see the same sequence of plaintext lengths.
+
+     Payload layout:
+
+       0          2
+       +----------+-----------------------------------------+
+       | raw len  | LZ4 sequences, or raw bytes if not less |
+       +----------+-----------------------------------------+ */
+
+/******************************************************************************/
+
+#include <string.h>
+
+#include "lz_stream.h"
+
+#define LZ_MIN_MATCH 4
+
+/* LZ4 end of block rules: the last 5 bytes are literals, the last match
+   starts at least 12 bytes before the end */
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+
+/******************************************************************************/
+
+void lz_stream_init(struct lz_stream *s)
+{
+  memset(s->table, 0, sizeof(s->table));
+  s->fill = 0;
+}
+
+/******************************************************************************/
+
+static uint32_t hash4(const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/******************************************************************************/
+
+static void make_room(struct lz_stream *s, size_t len)
+{
+  if (s->fill + len <= sizeof(s->hist)) return;
+
+  size_t delta = s->fill - LZ_WINDOW_SIZE;
+
+  memmove(s->hist, s->hist + delta, LZ_WINDOW_SIZE);
+  s->fill = LZ_WINDOW_SIZE;
+
+  /* table entries are positions + 1, 0 marks an empty slot */
+  for (size_t i = 0; i < sizeof(s->table) / sizeof(s->table[0]); ++i)
+    s->table[i] = s->table[i] > delta ? s->table[i] - delta : 0;
+}
+
+/******************************************************************************/
+
+static uint8_t *put_length(uint8_t *op, const uint8_t *oend, size_t n)
+{
+  while (n >= 255)
+  {
+    if (op >= oend) return NULL;
+    *op++ = 255;
+    n -= 255;
+  }
+
+  if (op >= oend) return NULL;
+
+  *op++ = n;
+  return op;
+}
+
+/******************************************************************************/
+
+/* a match length of 0 emits the final, literals only sequence */
+static uint8_t *put_sequence(uint8_t *op,
+                             const uint8_t *oend,
+                             const uint8_t *lit,
+                             size_t nlit,
+                             size_t offset,
+                             size_t mlen)
+{
+  if (op >= oend) return NULL;
+
+  uint8_t *token = op++;
+
+  *token = (nlit >= 15 ? 15 : nlit) << 4;
+
+  if (nlit >= 15 && !(op = put_length(op, oend, nlit - 15))) return NULL;
+  if (nlit > (size_t)(oend - op)) return NULL;
+
+  memcpy(op, lit, nlit);
+  op += nlit;
+
+  if (mlen == 0) return op;
+  if (oend - op < 2) return NULL;
+
+  *op++ = offset & 0xff;
+  *op++ = (offset >> 8) & 0xff;
+
+  mlen -= LZ_MIN_MATCH;
+  *token |= mlen >= 15 ? 15 : mlen;
+
+  if (mlen >= 15 && !(op = put_length(op, oend, mlen - 15))) return NULL;
+  return op;
+}
+
+/******************************************************************************/
+
+size_t lz_stream_compress(struct lz_stream *s,
+                          const void *src,
+                          size_t len,
+                          uint8_t *dst,
+                          size_t cap)
+{
+  if (len > LZ_MAX_INPUT || cap < len + 2) return 0;
+
+  make_room(s, len);
+
+  uint8_t *base = s->hist;
+  size_t start = s->fill;
+  size_t end = start + len;
+
+  memcpy(base + start, src, len);
+  s->fill = end;
+
+  dst[0] = len & 0xff;
+  dst[1] = (len >> 8) & 0xff;
+
+  /* anything not smaller than the input is sent as is */
+  uint8_t *op = dst + 2;
+  const uint8_t *oend = dst + 2 + (len ? len - 1 : 0);
+
+  size_t ip = start;
+  size_t anchor = start;
+
+  if (len > LZ_MF_LIMIT)
+  {
+    size_t limit = end - LZ_MF_LIMIT;
+    size_t match_limit = end - LZ_LAST_LITERALS;
+    unsigned int misses = 0;
+
+    while (ip < limit)
+    {
+      uint32_t h = hash4(base + ip);
+      size_t ref = s->table[h];
+
+      s->table[h] = ip + 1;
+
+      if (!ref || memcmp(base + ref - 1, base + ip, LZ_MIN_MATCH))
+      {
+        /* skip faster through data that does not compress */
+        ip += 1 + (misses++ >> 5);
+        continue;
+      }
+
+      ref--;
+
+      size_t mlen = LZ_MIN_MATCH;
+
+      while (ip + mlen < match_limit && base[ref + mlen] == base[ip + mlen])
+        mlen++;
+
+      op = put_sequence(op, oend, base + anchor, ip - anchor, ip - ref, mlen);
+
+      if (!op) goto store;
+
+      ip += mlen;
+      anchor = ip;
+      misses = 0;
+
+      s->table[hash4(base + ip - 2)] = ip - 2 + 1;
+    }
+  }
+
+  op = put_sequence(op, oend, base + anchor, end - anchor, 0, 0);
+
+  if (op) return op - dst;
+
+store:
+  memcpy(dst + 2, src, len);
+  return len + 2;
+}
+
+/******************************************************************************/
+
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *n)
+{
+  uint8_t b;
+
+  do
+  {
+    if (*ip >= iend) return -1;
+
+    b = *(*ip)++;
+    *n += b;
+  }
+  while (b == 255);
+
+  return 0;
+}
+
+/******************************************************************************/
+
+int lz_stream_decompress(struct lz_stream *s,
+                         const uint8_t *src,
+                         size_t len,
+                         const uint8_t **out)
+{
+  if (len < 2) return -1;
+
+  size_t raw = src[0] | (src[1] << 8);
+
+  if (raw > LZ_MAX_INPUT || len - 2 > raw) return -1;
+
+  make_room(s, raw);
+
+  uint8_t *base = s->hist;
+  size_t start = s->fill;
+  size_t op = start;
+  size_t oend = start + raw;
+
+  const uint8_t *ip = src + 2;
+  const uint8_t *iend = src + len;
+
+  if (len - 2 == raw)
+  {
+    memcpy(base + start, ip, raw);
+    op = oend;
+  }
+  else for (;;)
+  {
+    if (ip >= iend) return -1;
+
+    unsigned int token = *ip++;
+    size_t nlit = token >> 4;
+
+    if (nlit == 15 && get_length(&ip, iend, &nlit) < 0) return -1;
+    if (nlit > (size_t)(iend - ip) || nlit > oend - op) return -1;
+
+    memcpy(base + op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+
+    if (ip == iend) break;
+    if (iend - ip < 2) return -1;
+
+    size_t offset = ip[0] | (ip[1] << 8);
+    size_t mlen = token & 15;
+
+    ip += 2;
+
+    /* the history of earlier frames is a valid match source */
+    if (offset == 0 || offset > op) return -1;
+    if (mlen == 15 && get_length(&ip, iend, &mlen) < 0) return -1;
+
+    mlen += LZ_MIN_MATCH;
+
+    if (mlen > oend - op) return -1;
+
+    /* byte wise, matches may overlap the output */
+    for (size_t i = 0; i < mlen; ++i)
+      base[op + i] = base[op - offset + i];
+
+    op += mlen;
+  }
+
+  if (op != oend) return -1;
+
+  s->fill = oend;
+  *out = base + start;
+  return raw;
+}
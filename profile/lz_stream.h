@@ -0,0 +1,49 @@
+/******************************************************************************/
+/* File: lz_stream.h
+   Author: N.Kim
+   Abstract: Streaming LZ77 compression (LZ4 block format) for frames */
+/******************************************************************************/
+
+#ifndef LZ_STREAM_H
+#define LZ_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "profile_frame.h"
+
+/* matches may reach back this far, across frame boundaries. Each side
+   of a connection keeps twice this much history per direction */
+#define LZ_WINDOW_SIZE 16384
+#define LZ_HASH_BITS 12
+
+/* the compressed payload is prefixed by the original length (2 bytes),
+   if compression does not pay off the data is stored as is */
+#define LZ_MAX_INPUT (PROFILE_FRAME_MAX_PAYLOAD - 2)
+
+/* one per direction of a connection. Both ends feed every frame of the
+   stream through it, so their histories stay in sync */
+struct lz_stream {
+  uint32_t table[1 << LZ_HASH_BITS];
+  size_t fill;
+  uint8_t hist[2 * LZ_WINDOW_SIZE];
+};
+
+void lz_stream_init(struct lz_stream *s);
+
+/* compress 'len' (at most LZ_MAX_INPUT) bytes into 'dst', which needs
+   room for 'len' + 2 bytes. Returns the payload length, 0 on error */
+size_t lz_stream_compress(struct lz_stream *s,
+                          const void *src,
+                          size_t len,
+                          uint8_t *dst,
+                          size_t cap);
+
+/* returns the plaintext length and points 'out' to it, the data stays
+   valid until the next call. Returns -1 on corrupt input */
+int lz_stream_decompress(struct lz_stream *s,
+                         const uint8_t *src,
+                         size_t len,
+                         const uint8_t **out);
+
+#endif
@@ -6,13 +6,22 @@
    Description:
      Implementation of a BlueZ profile to be registered on a Bluetooth
      device connected to the ESP to be controlled (which in turn goes
-     to a brushless motor propelling a small plane) */
+     to a brushless motor propelling a small plane)
+
+     Given a store (-s, see ts_store.h), it downloads the readings the
+     server has stored instead, from the newest one it has itself (or
+     -f seconds since the epoch) up to -t, see history_sync.h. Whatever
+     got into the store stays, the next connection resumes there.
+
+     profile_client [-s store [-f from] [-t to]] */
 
 /******************************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
+#include <unistd.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -23,10 +32,29 @@
 #include <gio/gunixfdmessage.h>
 #include <glib.h>
 
+#include "ts_store.h"
+#include "profile_frame.h"
+#include "history_sync.h"
+#include "lz_stream.h"
 #include "profile_record.h"
+#include "sdp_record.h"
 
 static GDBusNodeInfo *introspect_data = NULL;
 static GMainLoop *loop = NULL;
+static struct sdp_record *profile_record = NULL;
+
+/* set up once the server announced compression in its record */
+static struct lz_stream *tx_lz = NULL;
+
+/* the downloaded readings go here (-s), starting after 'history_pos' */
+static struct ts_store *history_store = NULL;
+static struct history_pos history_pos;
+static uint32_t history_to = 0;
+
+static struct profile_frame_decoder history_dec;
+static unsigned long history_records = 0;
+static unsigned long history_bytes = 0;
+static gint64 history_started = 0;
 
 static int loop_done = 0;
 static int data_sent = 0;
@@ -61,6 +89,26 @@ void on_register_complete(GObject *source_object,
   g_print("Profile (un)registered\n");
 }
 
+/******************************************************************************/
+/* The record is built once and its rendered XML cached, thus, registering
+   the profile again (e.g. after bluetoothd restarted) costs nothing */
+
+static struct sdp_record *get_profile_record(void)
+{
+  if (!profile_record)
+  {
+    profile_record = sdp_record_new_rfcomm(PROFILE_UUID16,
+                                           PROFILE_DESC,
+                                           PROFILE_CHANNEL,
+                                           PROFILE_VERSION,
+                                           PROFILE_SERVICE_NAME);
+
+    sdp_record_set_features(profile_record, PROFILE_FEATURES);
+  }
+
+  return profile_record;
+}
+
 /******************************************************************************/
 
 static void register_profile(GDBusConnection *conn,
@@ -82,8 +130,7 @@ static void register_profile(GDBusConnection *conn,
     opv = g_variant_new("o", PROFILE_OBJECT_PATH);
 
     /* argument 2: 128-bit SIG uuid. Use 'InterCom for now */
-    uuid = g_variant_new_string(
-      "00001110-0000-1000-8000-00805f9b34fb");
+    uuid = g_variant_new_string(PROFILE_UUID);
 
     /* argument 3: dictionary, for example, use 'Name' and 
        'RequireAuthentication' */
@@ -99,7 +146,7 @@ static void register_profile(GDBusConnection *conn,
        SDP record registration. Pick a channel (i.e. a RFCOMM
        socket) that you know is free  */
     g_variant_builder_add(builder, "{sv}",
-      "Channel", g_variant_new_uint16(27));
+      "Channel", g_variant_new_uint16(PROFILE_CHANNEL));
 
     g_variant_builder_add(builder, "{sv}",
       "RequireAuthorization", g_variant_new_boolean(TRUE));
@@ -107,19 +154,11 @@ static void register_profile(GDBusConnection *conn,
     g_variant_builder_add(builder, "{sv}",
       "AutoConnect", g_variant_new_boolean(TRUE));
 
-    /* lazy stuff, for now we restrict records to 2047 bytes at
-       most. NOTE, that this is actually not that much and can
-       be easily exceeded */
-    gchar rec[2048] = {0};
-
-    sprintf(rec, MY_INTERCOM_SDP_RECORD,
-      27, 0xdead, "BITZAP-Intercom-Profile", 0);
-
     /* provide a service record to be inserted into the SDP
        database, test with 'sdptool' on your remote device
        whether you can find the record or not */
     g_variant_builder_add(builder, "{sv}", "ServiceRecord",
-      g_variant_new_string(rec));
+      g_variant_new_string(sdp_record_get_xml(get_profile_record())));
 
     dict = g_variant_builder_end(builder);
     g_variant_builder_unref(builder);
@@ -163,10 +202,27 @@ static gboolean data_writer(GIOChannel *channel,
     const gchar *data =
       "Satan oscillate my metallic sonatas";
 
+    /* the server expects framed data, see profile_frame.h */
+    guint8 frame[PROFILE_FRAME_HEADER_SIZE + PROFILE_FRAME_MAX_PAYLOAD];
+    gsize frame_len;
+
+    if (tx_lz)
+    {
+      guint8 packed[PROFILE_FRAME_MAX_PAYLOAD];
+
+      gsize packed_len = lz_stream_compress(tx_lz, data, strlen(data),
+        packed, sizeof(packed));
+
+      frame_len = profile_frame_encode(frame, sizeof(frame),
+        PROFILE_FRAME_TEXT, PROFILE_FRAME_FLAG_LZ, packed, packed_len);
+    }
+    else frame_len = profile_frame_encode(frame, sizeof(frame),
+      PROFILE_FRAME_TEXT, 0, data, strlen(data));
+
     GIOStatus s = g_io_channel_write_chars(
       channel,
-      data,
-      strlen(data) + 1,
+      (const gchar *)frame,
+      frame_len,
       &num_written,
       &err);
 
@@ -197,6 +253,146 @@ static gboolean data_writer(GIOChannel *channel,
 
 /******************************************************************************/
 
+static gboolean write_frame(GIOChannel *channel,
+                            guint8 type,
+                            const guint8 *payload,
+                            gsize len)
+{
+  guint8 frame[PROFILE_FRAME_HEADER_SIZE + PROFILE_FRAME_MAX_PAYLOAD];
+  gsize frame_len = profile_frame_encode(frame, sizeof(frame), type, 0,
+                                         payload, len);
+  gsize num_written;
+
+  return g_io_channel_write_chars(channel, (const gchar *)frame, frame_len,
+                                  &num_written, NULL) == G_IO_STATUS_NORMAL;
+}
+
+/******************************************************************************/
+
+static void on_history_frame(uint8_t type,
+                             uint8_t flags,
+                             const uint8_t *payload,
+                             size_t len,
+                             void *udata)
+{
+  /* no reading takes less than a byte */
+  static struct ts_record records[PROFILE_FRAME_MAX_PAYLOAD];
+
+  GIOChannel *channel = udata;
+  guint8 ack[HISTORY_ACK_SIZE];
+  struct history_pos end;
+  uint32_t sent;
+  int n;
+
+  if (data_sent) return;
+
+  if (type == PROFILE_FRAME_HISTORY_END &&
+      history_decode_end(payload, len, &end, &sent) == 0)
+  {
+    const double secs = (g_get_monotonic_time() - history_started) / 1e6;
+
+    g_print("Downloaded %lu readings in %.3f s", history_records, secs);
+
+    if (history_records > 0)
+      g_print(", %.2f bytes each, %.0f readings/s",
+        (double)history_bytes / history_records, history_records / secs);
+
+    g_print("\n");
+    data_sent = 1;
+    return;
+  }
+
+  if (type != PROFILE_FRAME_HISTORY_BATCH ||
+      (n = history_batch_decode(payload, len, records,
+                                G_N_ELEMENTS(records))) < 0)
+  {
+    g_print("Received a bad history frame (type %u)\n", type);
+    data_sent = 1;
+    return;
+  }
+
+  for (int i = 0; i < n; ++i)
+  {
+    ts_store_append(history_store, &records[i]);
+    history_pos_advance(&history_pos, &records[i]);
+  }
+
+  history_records += n;
+  history_bytes += PROFILE_FRAME_HEADER_SIZE + len;
+
+  /* stored, the server may send the next one */
+  if (!write_frame(channel, PROFILE_FRAME_HISTORY_ACK, ack,
+                   history_encode_ack(ack, &history_pos)))
+  {
+    g_print("Failed acknowledging the batch\n");
+    data_sent = 1;
+  }
+}
+
+/******************************************************************************/
+
+static gboolean history_reader(GIOChannel *channel,
+                               GIOCondition condition,
+                               gpointer user_data)
+{
+  gchar buf[16384];
+  gsize num_read = 0;
+  GIOStatus s = G_IO_STATUS_EOF;
+
+  if (condition & G_IO_IN)
+    s = g_io_channel_read_chars(channel, buf, sizeof(buf), &num_read, NULL);
+
+  if (s == G_IO_STATUS_NORMAL &&
+      profile_frame_decode(&history_dec, buf, num_read, on_history_frame,
+                           channel) < 0)
+  {
+    g_print("Received garbage\n");
+    data_sent = 1;
+  }
+
+  if (s == G_IO_STATUS_NORMAL && !data_sent) return TRUE;
+
+  if (!data_sent) g_print("Disconnected, %lu readings downloaded\n",
+                          history_records);
+
+  /* the rest of the range comes with the next connection */
+  ts_store_sync(history_store);
+  data_sent = 1;
+
+  g_io_channel_shutdown(channel, FALSE, NULL);
+  return FALSE;
+}
+
+/******************************************************************************/
+
+static void request_history(GIOChannel *channel)
+{
+  guint8 req[HISTORY_REQUEST_SIZE];
+
+  profile_frame_decoder_init(&history_dec);
+
+  g_print("  requesting the readings from %u (+%u) up to %u\n",
+    history_pos.time, history_pos.skip, history_to);
+
+  history_started = g_get_monotonic_time();
+
+  if (!write_frame(channel, PROFILE_FRAME_HISTORY_REQUEST, req,
+                   history_encode_request(req, &history_pos, history_to)))
+  {
+    g_print("Failed requesting the history\n");
+    data_sent = 1;
+    return;
+  }
+
+  (void) g_io_add_watch(
+    channel,
+    G_IO_IN | G_IO_HUP | G_IO_NVAL | G_IO_ERR,
+    history_reader,
+    NULL);
+}
+
+/******************************************************************************/
+
 static void on_method_call(GDBusConnection *con,
                            const gchar *sender,
                            const gchar *obj_path,
@@ -247,18 +443,11 @@ static void on_method_call(GDBusConnection *con,
     g_io_channel_set_encoding(channel, NULL, NULL);
     g_io_channel_set_buffered(channel, FALSE);
 
-    (void) g_io_add_watch(
-      channel,      /* channel to watch */
-      G_IO_OUT |    /* watch if we can write data */
-      G_IO_HUP |    /* watch broken sockets */
-      G_IO_NVAL |   /* watch invalid sockets */
-      G_IO_ERR,     /* watch other errors */
-      data_writer,  /* processing callback */
-      NULL);        /* user data */
-
-    g_io_channel_unref(channel);
     g_free(path);
 
+    /* as announced in the server's record, decides what to send */
+    guint16 features = 0;
+
     /* finally, process the dictionary and make valgrind happy */
     g_print("  processing dictionary argument:\n");
 
@@ -272,9 +461,47 @@ static void on_method_call(GDBusConnection *con,
     while (g_variant_iter_loop(&iter, "{sv}", &dict_key, &dict_val))
     {
       g_print("    entry key: %s\n", dict_key);
+
+      /* taken from the server's SDP record */
+      if (strcmp(dict_key, "Features") == 0 &&
+          g_variant_is_of_type(dict_val, G_VARIANT_TYPE_UINT16))
+        features = g_variant_get_uint16(dict_val);
+
       g_variant_unref(dict_val);
     }
 
+    /* only what both of us support */
+    features &= PROFILE_FEATURES;
+
+    if ((features & PROFILE_FEATURE_COMPRESSION) && !tx_lz)
+    {
+      g_print("  compression enabled\n");
+
+      tx_lz = g_new(struct lz_stream, 1);
+      lz_stream_init(tx_lz);
+    }
+
+    if (!history_store)
+    {
+      (void) g_io_add_watch(
+        channel,      /* channel to watch */
+        G_IO_OUT |    /* watch if we can write data */
+        G_IO_HUP |    /* watch broken sockets */
+        G_IO_NVAL |   /* watch invalid sockets */
+        G_IO_ERR,     /* watch other errors */
+        data_writer,  /* processing callback */
+        NULL);        /* user data */
+    }
+    else if (features & PROFILE_FEATURE_HISTORY)
+      request_history(channel);
+    else
+    {
+      g_print("  the server keeps no history\n");
+      data_sent = 1;
+    }
+
+    g_io_channel_unref(channel);
+
     /* the method call is incomplete without a proper receipt */
     g_dbus_method_invocation_return_value(invoc, NULL);
   }
@@ -282,9 +509,59 @@ static void on_method_call(GDBusConnection *con,
 
 /******************************************************************************/
 
+static int open_history(const char *path, uint32_t from)
+{
+  static struct ts_store store;
+  struct ts_record newest;
+
+  if (ts_store_open(&store, path, 0, 0, 0) < 0) return -1;
+
+  history_store = &store;
+  history_pos.time = from;
+  history_pos.skip = 0;
+
+  /* after the readings of the newest second stored here, downloads
+     arrive in order */
+  if (ts_store_newest(&store, &newest) == 0 && newest.time >= from)
+  {
+    struct ts_record *same = g_new(struct ts_record, HISTORY_STAGE_SIZE);
+
+    history_pos.time = newest.time;
+    history_pos.skip = ts_store_records(&store, newest.time,
+      newest.time + 1, same, HISTORY_STAGE_SIZE);
+
+    g_free(same);
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
 int main(int argc, char **argv)
 {
   GError *err = NULL;
+  const char *store_path = NULL;
+  uint32_t from = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:f:t:")) != -1)
+  {
+    if (opt == 's') store_path = optarg;
+    else if (opt == 'f') from = strtoul(optarg, NULL, 10);
+    else if (opt == 't') history_to = strtoul(optarg, NULL, 10);
+    else
+    {
+      g_printerr("usage: %s [-s store [-f from] [-t to]]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (store_path && open_history(store_path, from) < 0)
+  {
+    g_printerr("Failed opening the store %s\n", store_path);
+    return 1;
+  }
 
   GDBusConnection *conn =
     g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &err);
@@ -340,6 +617,9 @@ int main(int argc, char **argv)
   g_dbus_connection_unregister_object(conn, reg_id);
 
 done:
+  if (history_store) ts_store_close(history_store);
+  sdp_record_free(profile_record);
+  g_free(tx_lz);
   g_main_loop_unref(loop);
   g_object_unref(conn);
   return 0;
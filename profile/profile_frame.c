@@ -0,0 +1,110 @@
+/******************************************************************************/
+/* File: profile_frame.c
+   Author: N.Kim
+   Abstract: Framing of the data exchanged over the profile connection */
+/******************************************************************************/
+
+#include <string.h>
+
+#include "profile_frame.h"
+
+/******************************************************************************/
+
+void profile_frame_decoder_init(struct profile_frame_decoder *dec)
+{
+  dec->fill = 0;
+}
+
+/******************************************************************************/
+
+static size_t payload_length(const uint8_t *header)
+{
+  return header[0] | (header[1] << 8);
+}
+
+/******************************************************************************/
+
+int profile_frame_decode(struct profile_frame_decoder *dec,
+                         const void *data,
+                         size_t len,
+                         profile_frame_cb cb,
+                         void *udata)
+{
+  const uint8_t *p = data;
+  int frames = 0;
+
+  while (len > 0)
+  {
+    /* fast path, complete frames straight from the input buffer */
+    if (dec->fill == 0 && len >= PROFILE_FRAME_HEADER_SIZE)
+    {
+      size_t plen = payload_length(p);
+
+      if (plen > PROFILE_FRAME_MAX_PAYLOAD) return -1;
+
+      if (len >= PROFILE_FRAME_HEADER_SIZE + plen)
+      {
+        cb(p[2], p[3], p + PROFILE_FRAME_HEADER_SIZE, plen, udata);
+
+        p += PROFILE_FRAME_HEADER_SIZE + plen;
+        len -= PROFILE_FRAME_HEADER_SIZE + plen;
+        frames++;
+        continue;
+      }
+    }
+
+    /* partial frame, collect the header first, then the payload */
+    size_t need = PROFILE_FRAME_HEADER_SIZE;
+
+    if (dec->fill >= PROFILE_FRAME_HEADER_SIZE)
+      need += payload_length(dec->buf);
+
+    size_t chunk = need - dec->fill;
+
+    if (chunk > len) chunk = len;
+
+    memcpy(dec->buf + dec->fill, p, chunk);
+    dec->fill += chunk;
+    p += chunk;
+    len -= chunk;
+
+    if (dec->fill == PROFILE_FRAME_HEADER_SIZE &&
+        payload_length(dec->buf) > PROFILE_FRAME_MAX_PAYLOAD)
+      return -1;
+
+    if (dec->fill >= PROFILE_FRAME_HEADER_SIZE &&
+        dec->fill == PROFILE_FRAME_HEADER_SIZE + payload_length(dec->buf))
+    {
+      cb(dec->buf[2], dec->buf[3], dec->buf + PROFILE_FRAME_HEADER_SIZE,
+         dec->fill - PROFILE_FRAME_HEADER_SIZE, udata);
+
+      dec->fill = 0;
+      frames++;
+    }
+  }
+
+  return frames;
+}
+
+/******************************************************************************/
+
+size_t profile_frame_encode(void *out,
+                            size_t cap,
+                            uint8_t type,
+                            uint8_t flags,
+                            const void *payload,
+                            size_t len)
+{
+  uint8_t *p = out;
+
+  if (len > PROFILE_FRAME_MAX_PAYLOAD) return 0;
+  if (cap < PROFILE_FRAME_HEADER_SIZE + len) return 0;
+
+  p[0] = len & 0xff;
+  p[1] = (len >> 8) & 0xff;
+  p[2] = type;
+  p[3] = flags;
+
+  memcpy(p + PROFILE_FRAME_HEADER_SIZE, payload, len);
+  return PROFILE_FRAME_HEADER_SIZE + len;
+}
@@ -0,0 +1,73 @@
+/******************************************************************************/
+/* File: profile_frame.h
+   Author: N.Kim
+   Abstract: Framing of the data exchanged over the profile connection */
+/******************************************************************************/
+
+#ifndef PROFILE_FRAME_H
+#define PROFILE_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* RFCOMM is a byte stream, thus, messages are framed by a small header:
+
+     0      2      3       4
+     +------+------+-------+---------------+
+     | len  | type | flags | payload (len) |
+     +------+------+-------+---------------+
+
+   'len' is little endian and does not include the header itself */
+
+#define PROFILE_FRAME_HEADER_SIZE 4
+#define PROFILE_FRAME_MAX_PAYLOAD 4096
+
+/* ping frames are echoed back as they are by the server, once all
+   frames sent before have been processed. The payload is up to the
+   sender, e.g. a sequence number to measure the latency. The history
+   frames download stored readings, see history_sync.h */
+enum profile_frame_type {
+  PROFILE_FRAME_TEXT = 1,
+  PROFILE_FRAME_TELEMETRY = 2,
+  PROFILE_FRAME_PING = 3,
+  PROFILE_FRAME_HISTORY_REQUEST = 4,
+  PROFILE_FRAME_HISTORY_BATCH = 5,
+  PROFILE_FRAME_HISTORY_ACK = 6,
+  PROFILE_FRAME_HISTORY_END = 7
+};
+
+/* the payload went through the connection's compression stream, see
+   lz_stream.h */
+#define PROFILE_FRAME_FLAG_LZ 0x01
+
+typedef void (*profile_frame_cb)(uint8_t type,
+                                 uint8_t flags,
+                                 const uint8_t *payload,
+                                 size_t len,
+                                 void *udata);
+
+/* reassembles frames split across reads, one per connection */
+struct profile_frame_decoder {
+  size_t fill;
+  uint8_t buf[PROFILE_FRAME_HEADER_SIZE + PROFILE_FRAME_MAX_PAYLOAD];
+};
+
+void profile_frame_decoder_init(struct profile_frame_decoder *dec);
+
+/* feed received bytes, 'cb' is invoked for every completed frame.
+   Returns the number of frames or -1 if the stream is malformed */
+int profile_frame_decode(struct profile_frame_decoder *dec,
+                         const void *data,
+                         size_t len,
+                         profile_frame_cb cb,
+                         void *udata);
+
+/* returns the number of bytes written to 'out', 0 if it does not fit */
+size_t profile_frame_encode(void *out,
+                            size_t cap,
+                            uint8_t type,
+                            uint8_t flags,
+                            const void *payload,
+                            size_t len);
+
+#endif
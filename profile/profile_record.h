@@ -49,54 +49,27 @@ static const char INTROSPECT_XML[] =
    and in case of custom ports, MAKE SURE they are available, otherwise
    'probe-device' fails. */
 
-static const gchar *MY_INTERCOM_SDP_RECORD =
-  "<?xml version='1.0' encoding='UTF-8' ?>"
-  "  <record>"
-  ""
-  "    <attribute id='0x0001' name='ServiceClassID'>"
-  "      <sequence>"
-  "        <uuid value='0x1110' desc='Intercom Profile'/>"
-  "      </sequence>"
-  "    </attribute>"
-  ""
-  "    <attribute id='0x0004' desc='ProtocolDescList'>"
-  "      <sequence>"
-  "        <sequence>"
-  "          <uuid value='0x0100' desc='L2CAP'/>"
-  "        </sequence>"
-  "        <sequence>"
-  "          <uuid value='0x0003' desc='RFComm'/>"
-  "          <uint8 value='0x%02x' desc='Channel'/> "
-  "        </sequence>"
-  "      </sequence>"
-  "    </attribute>"
-  ""
-  "    <attribute id='0x0005' desc='BrowseGroupList'>"
-  "      <sequence>"
-  "        <uuid value='0x1002' name='PublicBrowseGroup'/>"
-  "      </sequence>"
-  "    </attribute>"
-  ""
-  "    <attribute id='0x0008' desc='ServiceAvailability'>"
-  "      <uint8 value='0xff'/>"
-  "    </attribute>"
-  ""
-  "    <attribute id='0x0009' desc='ProfileDescList'>"
-  "      <sequence>"
-  "        <sequence>"
-  "          <uuid value='0x1110' desc='Intercom'/>"
-  "          <uint16 value='0x%04x' desc='Version'/>"
-  "        </sequence>"
-  "      </sequence>"
-  "    </attribute>"
-  ""
-  "    <attribute id='0x0100' desc='ServiceName'>"
-  "      <text value='%s'/>"
-  "    </attribute>"
-  ""
-  "    <attribute id='0x0311' desc='Features'>"
-  "      <uint16 value='0x%04x'/>"
-  "    </attribute>"
-  "  </record>";
+/* parameters of the service record, the record itself is composed via
+   the SDP record builder (see sdp_record.h) */
+#define PROFILE_UUID16 "0x1110"
+#define PROFILE_DESC "Intercom"
+#define PROFILE_CHANNEL 27
+#define PROFILE_VERSION 0xdead
+#define PROFILE_SERVICE_NAME "BITZAP-Intercom-Profile"
+
+/* bits of the SDP 'SupportedFeatures' attribute (0x0311). BlueZ passes
+   the remote's value as 'Features' to NewConnection, a client only
+   compresses frames if the server announced it, and asks for stored
+   readings only if it serves them */
+#define PROFILE_FEATURE_COMPRESSION 0x0001
+#define PROFILE_FEATURE_HISTORY 0x0002
+#define PROFILE_FEATURES \
+  (PROFILE_FEATURE_COMPRESSION | PROFILE_FEATURE_HISTORY)
+
+/* additional custom profiles exported by the same process. Each one gets
+   its own 128-bit uuid (index in the last group) and its own RFCOMM
+   channel, counting down from PROFILE_CHANNEL */
+#define PROFILE_CUSTOM_UUID_FMT "b17a2a70-5e1f-4c0d-9b1f-2a7e0000%04x"
+#define PROFILE_MAX_COUNT 20
 
 #endif
@@ -0,0 +1,403 @@
+/******************************************************************************/
+/* File: profile_registry.c
+   Author: N.Kim
+   Abstract: Many BlueZ profiles exported from one process/connection
+
+   Description:
+     Instead of registering one object per profile, a single subtree is
+     exported below the registry root. BlueZ calls into '<root>/<name>'
+     and the node name is used to route 'NewConnection' to the handler
+     of the respective profile. */
+
+/******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gunixfdlist.h>
+
+#include "profile_registry.h"
+#include "profile_record.h"
+
+/******************************************************************************/
+
+static void profile_entry_free(gpointer data)
+{
+  struct profile_entry *prof = data;
+
+  g_free(prof->name);
+  g_free(prof->path);
+  g_free(prof->uuid);
+  g_free(prof->role);
+  sdp_record_free(prof->record);
+  g_free(prof);
+}
+
+/******************************************************************************/
+
+static void on_profile_method_call(GDBusConnection *con,
+                                   const gchar *sender,
+                                   const gchar *obj_path,
+                                   const gchar *iface_name,
+                                   const gchar *method_name,
+                                   GVariant *params,
+                                   GDBusMethodInvocation *invoc,
+                                   gpointer udata)
+{
+  /* the dispatcher below hands us the entry the call was routed to */
+  struct profile_entry *prof = udata;
+
+  if (strcmp(method_name, "NewConnection") == 0)
+  {
+    GError *err = NULL;
+    GVariant *dict = NULL;
+
+    gint fd_index;
+    gchar *device;
+
+    g_variant_get(params, "(oh@a{sv})", &device, &fd_index, &dict);
+
+    GUnixFDList *fd_list = g_dbus_message_get_unix_fd_list(
+      g_dbus_method_invocation_get_message(invoc));
+
+    gint fd = -1;
+
+    if (fd_list && fd_index < g_unix_fd_list_get_length(fd_list))
+      fd = g_unix_fd_list_get(fd_list, fd_index, &err);
+
+    if (fd < 0)
+    {
+      g_dbus_method_invocation_return_dbus_error(invoc,
+        "org.bluez.Error.Rejected", "Invalid file descriptor");
+
+      g_clear_error(&err);
+    }
+    else
+    {
+      if (prof->on_connection)
+        prof->on_connection(prof, device, fd, dict, prof->udata);
+      else close(fd);
+
+      g_dbus_method_invocation_return_value(invoc, NULL);
+    }
+
+    g_variant_unref(dict);
+    g_free(device);
+  }
+  else
+  {
+    /* 'RequestDisconnection' and 'Release', nothing to clean up here,
+       the connection handler owns the file descriptor */
+    g_print("Profile '%s': %s\n", prof->name, method_name);
+    g_dbus_method_invocation_return_value(invoc, NULL);
+  }
+}
+
+static const GDBusInterfaceVTable profile_vtable = {
+  on_profile_method_call,
+  NULL,
+  NULL
+};
+
+/******************************************************************************/
+/* Subtree callbacks, list, describe and dispatch the child nodes */
+
+static gchar **on_subtree_enumerate(GDBusConnection *con,
+                                    const gchar *sender,
+                                    const gchar *obj_path,
+                                    gpointer udata)
+{
+  struct profile_registry *reg = udata;
+
+  GHashTableIter iter;
+  gpointer key;
+  guint i = 0;
+
+  gchar **nodes = g_new(gchar *, g_hash_table_size(reg->profiles) + 1);
+
+  g_hash_table_iter_init(&iter, reg->profiles);
+
+  while (g_hash_table_iter_next(&iter, &key, NULL))
+    nodes[i++] = g_strdup(key);
+
+  nodes[i] = NULL;
+  return nodes;
+}
+
+/******************************************************************************/
+
+static GDBusInterfaceInfo **on_subtree_introspect(GDBusConnection *con,
+                                                  const gchar *sender,
+                                                  const gchar *obj_path,
+                                                  const gchar *node,
+                                                  gpointer udata)
+{
+  struct profile_registry *reg = udata;
+
+  /* the root itself does not implement anything */
+  if (!node || !g_hash_table_contains(reg->profiles, node)) return NULL;
+
+  GDBusInterfaceInfo **infos = g_new(GDBusInterfaceInfo *, 2);
+
+  infos[0] = g_dbus_interface_info_ref(reg->iface_info);
+  infos[1] = NULL;
+
+  return infos;
+}
+
+/******************************************************************************/
+
+static const GDBusInterfaceVTable *on_subtree_dispatch(
+  GDBusConnection *con,
+  const gchar *sender,
+  const gchar *obj_path,
+  const gchar *iface_name,
+  const gchar *node,
+  gpointer *out_udata,
+  gpointer udata)
+{
+  struct profile_registry *reg = udata;
+
+  if (!node || g_strcmp0(iface_name, "org.bluez.Profile1") != 0)
+    return NULL;
+
+  struct profile_entry *prof = g_hash_table_lookup(reg->profiles, node);
+
+  if (!prof) return NULL;
+
+  *out_udata = prof;
+  return &profile_vtable;
+}
+
+static const GDBusSubtreeVTable subtree_vtable = {
+  on_subtree_enumerate,
+  on_subtree_introspect,
+  on_subtree_dispatch
+};
+
+/******************************************************************************/
+
+struct profile_registry *profile_registry_new(GDBusConnection *conn,
+                                              const gchar *root,
+                                              GError **err)
+{
+  struct profile_registry *reg = g_new0(struct profile_registry, 1);
+
+  reg->conn = g_object_ref(conn);
+  reg->root = g_strdup(root);
+
+  reg->profiles = g_hash_table_new_full(
+    g_str_hash, g_str_equal, NULL, profile_entry_free);
+
+  reg->introspect_data =
+    g_dbus_node_info_new_for_xml(INTROSPECT_XML, NULL);
+
+  g_assert(reg->introspect_data != NULL);
+
+  reg->iface_info = g_dbus_node_info_lookup_interface(
+    reg->introspect_data, "org.bluez.Profile1");
+
+  g_assert(reg->iface_info && "Invalid interface info object");
+
+  reg->subtree_id = g_dbus_connection_register_subtree(
+    conn,
+    root,
+    &subtree_vtable,
+    G_DBUS_SUBTREE_FLAGS_NONE,
+    reg,
+    NULL,
+    err);
+
+  if (reg->subtree_id == 0)
+  {
+    profile_registry_free(reg);
+    return NULL;
+  }
+
+  return reg;
+}
+
+/******************************************************************************/
+
+void profile_registry_free(struct profile_registry *reg)
+{
+  if (!reg) return;
+
+  if (reg->subtree_id)
+    g_dbus_connection_unregister_subtree(reg->conn, reg->subtree_id);
+
+  g_hash_table_destroy(reg->profiles);
+  g_dbus_node_info_unref(reg->introspect_data);
+  g_object_unref(reg->conn);
+  g_free(reg->root);
+  g_free(reg);
+}
+
+/******************************************************************************/
+
+struct profile_entry *profile_registry_add(struct profile_registry *reg,
+                                           const gchar *name,
+                                           const gchar *uuid,
+                                           const gchar *role,
+                                           guint16 channel,
+                                           struct sdp_record *record,
+                                           profile_connection_cb cb,
+                                           gpointer udata)
+{
+  /* the record is ours either way */
+  if (g_hash_table_contains(reg->profiles, name))
+  {
+    sdp_record_free(record);
+    return NULL;
+  }
+
+  struct profile_entry *prof = g_new0(struct profile_entry, 1);
+
+  prof->name = g_strdup(name);
+  prof->path = g_strdup_printf("%s/%s", reg->root, name);
+  prof->uuid = g_strdup(uuid);
+  prof->role = g_strdup(role);
+  prof->channel = channel;
+  prof->record = record;
+  prof->on_connection = cb;
+  prof->udata = udata;
+  prof->registry = reg;
+
+  /* the key is owned by the entry */
+  g_hash_table_insert(reg->profiles, prof->name, prof);
+  return prof;
+}
+
+/******************************************************************************/
+
+static GVariant *get_register_args(struct profile_entry *prof)
+{
+  GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+
+  g_variant_builder_add(builder, "{sv}",
+    "Name", g_variant_new_string(prof->name));
+
+  g_variant_builder_add(builder, "{sv}",
+    "Role", g_variant_new_string(prof->role));
+
+  g_variant_builder_add(builder, "{sv}",
+    "Channel", g_variant_new_uint16(prof->channel));
+
+  g_variant_builder_add(builder, "{sv}",
+    "RequireAuthorization", g_variant_new_boolean(TRUE));
+
+  g_variant_builder_add(builder, "{sv}",
+    "AutoConnect", g_variant_new_boolean(TRUE));
+
+  if (prof->record)
+    g_variant_builder_add(builder, "{sv}", "ServiceRecord",
+      g_variant_new_string(sdp_record_get_xml(prof->record)));
+
+  GVariant *dict = g_variant_builder_end(builder);
+  g_variant_builder_unref(builder);
+
+  GVariant *params[3] = {
+    g_variant_new_object_path(prof->path),
+    g_variant_new_string(prof->uuid),
+    dict
+  };
+
+  return g_variant_new_tuple(params, 3);
+}
+
+/******************************************************************************/
+
+static void on_batch_call_complete(GObject *source_object,
+                                   GAsyncResult *res,
+                                   gpointer user_data)
+{
+  struct profile_entry *prof = user_data;
+  struct profile_registry *reg = prof->registry;
+
+  GError *err = NULL;
+  GVariant *ret = g_dbus_connection_call_finish(
+    G_DBUS_CONNECTION(source_object), res, &err);
+
+  if (ret) g_variant_unref(ret);
+
+  if (err)
+  {
+    g_print("Profile '%s' failed: %s\n", prof->name, err->message);
+    g_error_free(err);
+    reg->failed++;
+  }
+  else prof->registered = reg->batch_enable;
+
+  if (--reg->pending == 0 && reg->on_batch_done)
+    reg->on_batch_done(reg->failed, reg->batch_udata);
+}
+
+/******************************************************************************/
+
+static void run_batch(struct profile_registry *reg,
+                      gboolean enable,
+                      profile_batch_cb done,
+                      gpointer udata)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_assert(reg->pending == 0 && "Registration batch already running");
+
+  reg->failed = 0;
+  reg->batch_enable = enable;
+  reg->on_batch_done = done;
+  reg->batch_udata = udata;
+
+  g_hash_table_iter_init(&iter, reg->profiles);
+
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    struct profile_entry *prof = value;
+
+    /* skip profiles which are already in the requested state */
+    if (prof->registered == enable) continue;
+
+    GVariant *args = enable ?
+      get_register_args(prof) :
+      g_variant_new("(o)", prof->path);
+
+    reg->pending++;
+
+    /* no waiting for the reply, all calls go out back to back */
+    g_dbus_connection_call(
+      reg->conn,
+      BLUEZ_BUS_NAME,
+      "/org/bluez",
+      BLUEZ_PROF_MAN_IFACE,
+      enable ? "RegisterProfile" : "UnregisterProfile",
+      args,
+      NULL,
+      G_DBUS_CALL_FLAGS_NONE,
+      G_MAXINT,
+      NULL,
+      on_batch_call_complete,
+      prof);
+  }
+
+  if (reg->pending == 0 && done) done(0, udata);
+}
+
+/******************************************************************************/
+
+void profile_registry_register_all(struct profile_registry *reg,
+                                   profile_batch_cb done,
+                                   gpointer udata)
+{
+  run_batch(reg, TRUE, done, udata);
+}
+
+/******************************************************************************/
+
+void profile_registry_unregister_all(struct profile_registry *reg,
+                                     profile_batch_cb done,
+                                     gpointer udata)
+{
+  run_batch(reg, FALSE, done, udata);
+}
@@ -0,0 +1,94 @@
+/******************************************************************************/
+/* File: profile_registry.h
+   Author: N.Kim
+   Abstract: Many BlueZ profiles exported from one process/connection */
+/******************************************************************************/
+
+#ifndef PROFILE_REGISTRY_H
+#define PROFILE_REGISTRY_H
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "sdp_record.h"
+
+struct profile_entry;
+
+/* invoked for 'NewConnection' on the profile object the connection was
+   routed to. The file descriptor is owned by the callee */
+typedef void (*profile_connection_cb)(struct profile_entry *prof,
+                                      const gchar *device,
+                                      gint fd,
+                                      GVariant *fd_props,
+                                      gpointer udata);
+
+/* invoked once all calls of a (un)registration batch have completed,
+   'failed' holds the number of rejected calls */
+typedef void (*profile_batch_cb)(guint failed, gpointer udata);
+
+struct profile_entry {
+  gchar *name;     /* node name below the registry root */
+  gchar *path;     /* full object path, i.e. <root>/<name> */
+  gchar *uuid;     /* 128-bit uuid string */
+  gchar *role;     /* 'server' or 'client' */
+  guint16 channel;
+
+  /* owned by the entry, its rendered XML is cached (see sdp_record.h) */
+  struct sdp_record *record;
+
+  profile_connection_cb on_connection;
+  gpointer udata;
+
+  gboolean registered;
+  struct profile_registry *registry;
+};
+
+struct profile_registry {
+  GDBusConnection *conn;
+  gchar *root;
+
+  /* node name -> struct profile_entry, all profiles are exported
+     through one subtree registration */
+  GHashTable *profiles;
+
+  GDBusNodeInfo *introspect_data;
+  GDBusInterfaceInfo *iface_info;
+  guint subtree_id;
+
+  /* state of the currently running (un)registration batch */
+  guint pending;
+  guint failed;
+  gboolean batch_enable;
+  profile_batch_cb on_batch_done;
+  gpointer batch_udata;
+};
+
+struct profile_registry *profile_registry_new(GDBusConnection *conn,
+                                              const gchar *root,
+                                              GError **err);
+
+void profile_registry_free(struct profile_registry *reg);
+
+/* add a profile to the exported subtree. Takes ownership of 'record',
+   also if it fails. Returns NULL if 'name' is already taken */
+struct profile_entry *profile_registry_add(struct profile_registry *reg,
+                                           const gchar *name,
+                                           const gchar *uuid,
+                                           const gchar *role,
+                                           guint16 channel,
+                                           struct sdp_record *record,
+                                           profile_connection_cb cb,
+                                           gpointer udata);
+
+/* issue 'RegisterProfile' for all profiles at once. Calls are pipelined
+   on the connection instead of waiting for each round-trip, 'done' is
+   invoked from the main context once all replies are in */
+void profile_registry_register_all(struct profile_registry *reg,
+                                   profile_batch_cb done,
+                                   gpointer udata);
+
+void profile_registry_unregister_all(struct profile_registry *reg,
+                                     profile_batch_cb done,
+                                     gpointer udata);
+
+#endif
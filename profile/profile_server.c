@@ -7,13 +7,30 @@
      This handles the profile registraction on the server side.
      By registering the profile with "Role=server" the profile gets
      attached to the local adapter ('probe') which becomes visible
-     to remotes upon connecting/pairing. */
+     to remotes upon connecting/pairing.
+
+     Any number of profiles (up to PROFILE_MAX_COUNT) can be exported
+     from this process, see profile_registry.h
+
+     For load testing, connections may come in through local stand-ins
+     of the RFCOMM link as well (-l unix-stream://path or tcp://:port,
+     see sock_url.h). Those work without BlueZ, or any system bus.
+
+     Given the store the sensor writes to (-s, see ../dht11/monitor.c),
+     remotes download the readings they missed, see history_sync.h
+
+     profile_server [-q] [-l url]... [-s store] [count] */
 
 /******************************************************************************/
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
@@ -22,16 +39,90 @@
 #include <gio/gio.h>
 #include <gio/gnetworking.h>
 #include <glib.h>
-
+#include <glib-unix.h>
+
+#include "crc32.h"
+#include "io_loop.h"
+#include "work_pool.h"
+#include "ts_store.h"
+#include "profile_frame.h"
+#include "history_sync.h"
+#include "lz_stream.h"
 #include "profile_record.h"
+#include "profile_registry.h"
+#include "sdp_record.h"
+#include "sock_url.h"
+
+/* stand-in listeners (-l) */
+#define MAX_LISTENERS 8
+
+/* connections served at the same time, any beyond are refused. Sized
+   for load tests through the stand-ins rather than for BlueZ */
+#define MAX_CONNECTIONS 4096
+
+/* a window of history batches goes out with a single write */
+#define HISTORY_WRITE_SIZE \
+  (HISTORY_WINDOW * (PROFILE_FRAME_HEADER_SIZE + PROFILE_FRAME_MAX_PAYLOAD))
+
+/* replies a remote may leave unread before it is dropped */
+#define OUTPUT_MAX_SIZE (2 * HISTORY_WRITE_SIZE)
 
-static GDBusNodeInfo *introspect_data = NULL;
 static GMainLoop *loop = NULL;
+static struct profile_registry *registry = NULL;
 static GDBusConnection *conn = NULL;
 
+/* accepted connections, kept open until the remote hangs up or we
+   are done. Incoming data is received through the I/O loop, which in
+   turn is driven by the main loop. The I/O thread only splits the
+   stream into frames, processing them is up to the worker pool */
+struct profile_conn {
+  gint fd;
+  struct profile_entry *prof;
+  struct work_strand *strand;
+  struct profile_frame_decoder decoder;
+
+  /* created with the first compressed frame, only touched by the
+     strand. Once out of sync the rest of the stream is dropped */
+  struct lz_stream *lz;
+  gboolean lz_broken;
+
+  /* created with the first history request, only touched by the strand */
+  struct history_sender *history;
+  guint8 *history_buf;
+  gint64 history_started;
+
+  /* replies the socket did not take right away, sent from the main loop
+     once it is writable again. Filled by the strand */
+  GMutex out_lock;
+  GByteArray *out;
+  guint out_watch;
+};
+
+/* 'num_connections' includes the closed ones still to be freed */
+static GSList *connections = NULL;
+static guint num_connections = 0;
+static struct io_loop *io = NULL;
+static struct work_pool *pool = NULL;
+
+/* the readings to download (-s). Shared by the strands, which refresh it
+   before reading as the sensor keeps appending */
+static struct ts_store store = { .fd = -1 };
+static GMutex store_lock;
+
 /* global event processing flags */
 static int loop_done = 0;
 
+/* suppress the per frame output (-q), used for load testing */
+static int quiet = 0;
+
+/* connections through the stand-ins have no profile object of their
+   own, they all share this one */
+static struct profile_entry stand_in_profile = { .name = "stand-in" };
+
+static struct sock_url stand_ins[MAX_LISTENERS];
+static int stand_in_fds[MAX_LISTENERS];
+static guint num_stand_ins = 0;
+
 /******************************************************************************/
 
 void on_signal_received(int signo)
@@ -55,110 +146,437 @@ static gboolean on_loop_idle(gpointer udata)
 
 /******************************************************************************/
 
-void on_register_complete(GObject *source_object,
-                          GAsyncResult *res,
-                          gpointer user_data)
+static void on_batch_complete(guint failed, gpointer udata)
 {
-  g_print("Profile (un)registered\n");
+  gint64 *started = udata;
+
+  g_print("Profiles (un)registered, %u failed, took %.3f ms\n",
+    failed, (g_get_monotonic_time() - *started) / 1000.0);
+
+  /* the unregistration at exit runs a main loop of its own */
+  if (loop_done) g_main_loop_quit(loop);
+}
+
+/******************************************************************************/
+/* The socket takes more again, sends what the strand left behind */
+
+static gboolean on_profile_writable(gint fd,
+                                    GIOCondition condition,
+                                    gpointer udata)
+{
+  struct profile_conn *pc = udata;
+  gboolean more;
+
+  g_mutex_lock(&pc->out_lock);
+
+  ssize_t n = send(fd, pc->out->data, pc->out->len, MSG_NOSIGNAL);
+
+  if (n > 0) g_byte_array_remove_range(pc->out, 0, n);
+
+  /* gone, the hangup shows up on the receiving side */
+  else if (n < 0 && errno != EAGAIN && errno != EINTR)
+    g_byte_array_set_size(pc->out, 0);
+
+  more = pc->out->len > 0;
+
+  if (!more) pc->out_watch = 0;
+
+  g_mutex_unlock(&pc->out_lock);
+
+  return more ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
 }
 
 /******************************************************************************/
+/* Runs on a worker thread, which never waits for the remote. Whatever
+   the socket does not take is queued behind the replies before */
 
-static void register_profile(gboolean enable)
+static void send_all(struct profile_conn *pc,
+                     const guint8 *data,
+                     gsize len)
 {
-  GVariant *args;
-  const gchar *method_name;
+  gsize pos = 0;
 
-  if (enable)
+  g_mutex_lock(&pc->out_lock);
+
+  if (pc->out->len == 0)
   {
-    GVariant *opv;
-    GVariant *uuid;
-    GVariant *dict;
-    GVariantBuilder *builder;
+    while (pos < len)
+    {
+      ssize_t n = send(pc->fd, data + pos, len - pos, MSG_NOSIGNAL);
 
-    method_name = "RegisterProfile";
+      if (n >= 0) pos += n;
+      else if (errno != EINTR) break;
+    }
 
-    /* argument 1: path to my object/profile implementation */
-    opv = g_variant_new("o", PROFILE_OBJECT_PATH);
+    /* gone, the hangup shows up on the receiving side */
+    if (pos < len && errno != EAGAIN) pos = len;
+  }
 
-    /* argument 2: 128-bit SIG uuid. Use 'InterCom for now */
-    uuid = g_variant_new_string(
-      "00001110-0000-1000-8000-00805f9b34fb");
+  if (pos < len && pc->out->len + len - pos > OUTPUT_MAX_SIZE)
+  {
+    /* the remote does not read, the I/O loop sees the end of the stream
+       and closes the connection */
+    g_print("Profile '%s' does not read its replies, dropped\n",
+      pc->prof->name);
 
-    /* argument 3: dictionary, for example, use 'Name' and 
-       'RequireAuthentication' */
-    builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+    g_byte_array_set_size(pc->out, 0);
+    shutdown(pc->fd, SHUT_RDWR);
+  }
+  else if (pos < len)
+  {
+    g_byte_array_append(pc->out, data + pos, len - pos);
 
-    g_variant_builder_add(builder, "{sv}",
-      "Name", g_variant_new_string("BITZAP InterCom"));
+    if (!pc->out_watch)
+      pc->out_watch = g_unix_fd_add(pc->fd, G_IO_OUT,
+                                    on_profile_writable, pc);
+  }
 
-    g_variant_builder_add(builder, "{sv}",
-      "Role", g_variant_new_string("server"));
+  g_mutex_unlock(&pc->out_lock);
+}
 
-    /* this is essential for the internal profile probing, i.e.
-       SDP record registration. Pick a channel (i.e. a RFCOMM
-       socket) that you know is free  */
-    g_variant_builder_add(builder, "{sv}",
-      "Channel", g_variant_new_uint16(27));
+/******************************************************************************/
 
-    g_variant_builder_add(builder, "{sv}",
-      "RequireAuthorization", g_variant_new_boolean(TRUE));
+static void send_frame(struct profile_conn *pc,
+                       guint8 type,
+                       const gchar *payload,
+                       gsize len)
+{
+  guint8 frame[PROFILE_FRAME_HEADER_SIZE + PROFILE_FRAME_MAX_PAYLOAD];
+  gsize frame_len = profile_frame_encode(frame, sizeof(frame), type, 0,
+                                         payload, len);
 
-    g_variant_builder_add(builder, "{sv}",
-      "AutoConnect", g_variant_new_boolean(TRUE));
+  send_all(pc, frame, frame_len);
+}
 
-    /* provide a service record to be inserted into the SDP
-       database, test with 'sdptool' on your remote device
-       whether you can find the record or not */
-    g_variant_builder_add(builder, "{sv}", "ServiceRecord",
-      g_variant_new_string(g_strdup_printf(
-        MY_INTERCOM_SDP_RECORD, 27, 0xdead,
-        "BITZAP-Intercom-Profile", 0)));
+/******************************************************************************/
+/* Runs on a worker thread, sends what the window allows */
 
-    dict = g_variant_builder_end(builder);
-    g_variant_builder_unref(builder);
+static void send_history(struct profile_conn *pc)
+{
+  struct history_sender *hs = pc->history;
+  gsize len;
 
-    GVariant *params[3] = { opv, uuid, dict };
-    args = g_variant_new_tuple(params, 3);
+  g_mutex_lock(&store_lock);
+  ts_store_refresh(&store);
+  len = history_sender_fill(hs, &store, pc->history_buf,
+                            HISTORY_WRITE_SIZE);
+  g_mutex_unlock(&store_lock);
+
+  if (len > 0) send_all(pc, pc->history_buf, len);
+
+  /* all batches stored by the remote */
+  if (hs->finished && hs->in_flight == 0 && hs->records > 0 && !quiet)
+  {
+    const double secs =
+      (g_get_monotonic_time() - pc->history_started) / 1e6;
+
+    g_print("Profile '%s' downloaded %lu readings in %lu batches, "
+      "%.2f bytes each, %.0f readings/s\n", pc->prof->name, hs->records,
+      hs->batches, (double)hs->bytes / hs->records, hs->records / secs);
   }
-  else
+}
+
+/******************************************************************************/
+
+static void process_history(struct profile_conn *pc,
+                            guint8 type,
+                            const guint8 *payload,
+                            gsize plen)
+{
+  if (type == PROFILE_FRAME_HISTORY_ACK)
+  {
+    if (pc->history && history_sender_ack(pc->history, payload, plen) == 0)
+      send_history(pc);
+
+    return;
+  }
+
+  if (store.fd < 0)
   {
-    method_name = "UnregisterProfile";
-    args = g_variant_new("(o)", PROFILE_OBJECT_PATH);
+    /* nothing stored here, the range ends right where it starts */
+    struct history_pos pos = { 0, 0 };
+    guint8 end[HISTORY_END_SIZE];
+
+    send_frame(pc, PROFILE_FRAME_HISTORY_END, (const gchar *)end,
+               history_encode_end(end, &pos, 0));
+    return;
   }
 
-  /* off we go */
-  g_dbus_connection_call(
-    conn,
-    "org.bluez",
-    "/org/bluez",
-    "org.bluez.ProfileManager1",
-    method_name,
-    args,
-    NULL,
-    G_DBUS_CALL_FLAGS_NONE,
-    G_MAXINT,
-    NULL,
-    on_register_complete,
-    NULL);
+  if (!pc->history)
+  {
+    pc->history = g_new(struct history_sender, 1);
+    pc->history_buf = g_malloc(HISTORY_WRITE_SIZE);
+  }
+
+  if (history_sender_start(pc->history, payload, plen) < 0)
+  {
+    g_print("Profile '%s' sent a bad history request\n", pc->prof->name);
+    return;
+  }
+
+  pc->history_started = g_get_monotonic_time();
+  send_history(pc);
 }
 
 /******************************************************************************/
+/* Runs on a worker thread, frames of one connection never overlap and
+   arrive in order. The frame as handed over is type, flags, payload */
 
-static void on_method_call(GDBusConnection *con,
-                           const gchar *sender,
-                           const gchar *obj_path,
-                           const gchar *iface_name,
-                           const gchar *method_name,
-                           GVariant *params,
-                           GDBusMethodInvocation *invoc,
-                           gpointer udata)
+static void process_frame(struct work_strand *strand,
+                          const char *data,
+                          size_t len,
+                          void *udata)
 {
-  g_print("Calling method '%s'\n", method_name);
+  struct profile_conn *pc = udata;
+
+  const guint8 type = data[0];
+  const guint8 flags = data[1];
+  const gchar *payload = data + 2;
+  gsize plen = len - 2;
 
-  if (strcmp(method_name, "NewConnection") == 0) {
-    g_print("  connected...\n");
+  if (flags & PROFILE_FRAME_FLAG_LZ)
+  {
+    const uint8_t *plain;
+    int n = -1;
+
+    if (!pc->lz)
+    {
+      pc->lz = g_new(struct lz_stream, 1);
+      lz_stream_init(pc->lz);
+    }
+
+    if (!pc->lz_broken)
+      n = lz_stream_decompress(pc->lz, (const uint8_t *)payload, plen, &plain);
+
+    if (n < 0)
+    {
+      if (!pc->lz_broken)
+        g_print("Profile '%s' sent a corrupt compressed frame\n",
+          pc->prof->name);
+
+      pc->lz_broken = TRUE;
+      return;
+    }
+
+    payload = (const gchar *)plain;
+    plen = n;
   }
+
+  /* everything before has been processed by now */
+  if (type == PROFILE_FRAME_PING)
+  {
+    send_frame(pc, type, payload, plen);
+    return;
+  }
+
+  if (type == PROFILE_FRAME_HISTORY_REQUEST ||
+      type == PROFILE_FRAME_HISTORY_ACK)
+  {
+    process_history(pc, type, (const guint8 *)payload, plen);
+    return;
+  }
+
+  if (quiet) return;
+
+  g_print("Profile '%s' frame type %u, %zu bytes, crc32 %08x\n",
+    pc->prof->name, type, plen, crc32_update(0, payload, plen));
+
+  if (type == PROFILE_FRAME_TEXT)
+    g_print("  '%.*s'\n", (int)plen, payload);
+}
+
+/******************************************************************************/
+
+static void on_frame(uint8_t type,
+                     uint8_t flags,
+                     const uint8_t *payload,
+                     size_t len,
+                     void *udata)
+{
+  struct profile_conn *pc = udata;
+  guint8 frame[2 + PROFILE_FRAME_MAX_PAYLOAD];
+
+  frame[0] = type;
+  frame[1] = flags;
+  memcpy(frame + 2, payload, len);
+
+  work_pool_submit(pc->strand, frame, len + 2);
+}
+
+/******************************************************************************/
+
+static void free_connection(struct profile_conn *pc)
+{
+  if (pc->out_watch) g_source_remove(pc->out_watch);
+  close(pc->fd);
+
+  g_byte_array_unref(pc->out);
+  g_mutex_clear(&pc->out_lock);
+  g_free(pc->lz);
+  g_free(pc->history);
+  g_free(pc->history_buf);
+  g_free(pc);
+}
+
+/******************************************************************************/
+
+static gboolean on_connection_closed(gpointer udata)
+{
+  free_connection(udata);
+  num_connections--;
+  return G_SOURCE_REMOVE;
+}
+
+/******************************************************************************/
+/* Runs on a worker thread, the strand is through */
+
+static void on_strand_closed(void *udata)
+{
+  /* as urgent as the I/O, an idle might never run while the listener
+     keeps failing for want of the very descriptors this frees */
+  g_idle_add_full(G_PRIORITY_DEFAULT, on_connection_closed, udata, NULL);
+}
+
+/******************************************************************************/
+
+static void close_connection(struct profile_conn *pc)
+{
+  io_loop_remove(io, pc->fd);
+  connections = g_slist_remove(connections, pc);
+
+  /* the frames still queued for this connection may answer, thus, the
+     socket is closed once they are through */
+  work_pool_strand_close(pc->strand, on_strand_closed, pc);
+}
+
+/******************************************************************************/
+
+static void on_profile_recv(struct io_loop *loop,
+                            int fd,
+                            const char *data,
+                            ssize_t len,
+                            void *udata)
+{
+  struct profile_conn *pc = udata;
+
+  if (len > 0 &&
+      profile_frame_decode(&pc->decoder, data, len, on_frame, pc) >= 0)
+    return;
+
+  if (len > 0) g_print("Profile '%s' sent garbage\n", pc->prof->name);
+
+  if (!quiet)
+    g_print("Profile '%s' disconnected (fd %d)\n", pc->prof->name, fd);
+  close_connection(pc);
+}
+
+/******************************************************************************/
+
+static gboolean on_io_ready(gint fd, GIOCondition condition, gpointer udata)
+{
+  /* never block here, only dispatch what is already pending */
+  io_loop_run_once(io, 0);
+  return G_SOURCE_CONTINUE;
+}
+
+/******************************************************************************/
+
+static void on_new_connection(struct profile_entry *prof,
+                              const gchar *device,
+                              gint fd,
+                              GVariant *fd_props,
+                              gpointer udata)
+{
+  struct profile_conn *pc = g_new0(struct profile_conn, 1);
+
+  /* one strand per connection, the pool has MAX_CONNECTIONS of them */
+  pc->strand = work_pool_strand_new(pool, process_frame, pc);
+
+  if (!pc->strand)
+  {
+    g_print("Profile '%s' refused %s, too many connections\n",
+      prof->name, device);
+    close(fd);
+    g_free(pc);
+    return;
+  }
+
+  if (!quiet)
+    g_print("Profile '%s' connected to %s (fd %d)\n",
+      prof->name, device, fd);
+
+  pc->fd = fd;
+  pc->prof = prof;
+  pc->out = g_byte_array_new();
+  g_mutex_init(&pc->out_lock);
+  profile_frame_decoder_init(&pc->decoder);
+
+  if (io_loop_add(io, fd, on_profile_recv, pc) < 0)
+  {
+    g_print("  failed watching the connection\n");
+    work_pool_strand_free(pc->strand);
+    free_connection(pc);
+    return;
+  }
+
+  connections = g_slist_prepend(connections, pc);
+  num_connections++;
+}
+
+/******************************************************************************/
+
+static void on_stand_in_accept(struct io_loop *loop,
+                               int lfd,
+                               int fd,
+                               void *udata)
+{
+  char name[SOCK_URL_PATH_MAX + 32];
+
+  /* as if BlueZ handed over an RFCOMM connection */
+  on_new_connection(&stand_in_profile,
+                    sock_url_name(udata, name, sizeof(name)), fd, NULL, NULL);
+}
+
+/******************************************************************************/
+/* Build the records for all profiles. The first one is the InterCom
+   profile, all further ones are custom uuids sharing the same record
+   layout. The record of the InterCom profile serves as a template, so
+   only the uuids and the channel are replaced */
+
+static void add_profiles(guint count)
+{
+  struct sdp_record *base = sdp_record_new_rfcomm(PROFILE_UUID16,
+                                                  PROFILE_DESC,
+                                                  PROFILE_CHANNEL,
+                                                  PROFILE_VERSION,
+                                                  PROFILE_SERVICE_NAME);
+
+  /* history only with a store to read from */
+  sdp_record_set_features(base, store.fd >= 0 ? PROFILE_FEATURES :
+                          PROFILE_FEATURES & ~PROFILE_FEATURE_HISTORY);
+
+  for (guint i = 1; i < count; ++i)
+  {
+    gchar *name = g_strdup_printf("custom%02u", i);
+    gchar *uuid = g_strdup_printf(PROFILE_CUSTOM_UUID_FMT, i);
+
+    struct sdp_record *rec = sdp_record_copy(base);
+
+    sdp_record_clear_service_classes(rec);
+    sdp_record_clear_profiles(rec);
+    sdp_record_add_service_class(rec, uuid, name);
+    sdp_record_add_profile(rec, uuid, name, PROFILE_VERSION);
+    sdp_record_set_rfcomm_channel(rec, PROFILE_CHANNEL - i);
+
+    profile_registry_add(registry, name, uuid, "server",
+      PROFILE_CHANNEL - i, rec, on_new_connection, NULL);
+
+    g_free(name);
+    g_free(uuid);
+  }
+
+  profile_registry_add(registry, "intercom", PROFILE_UUID, "server",
+    PROFILE_CHANNEL, base, on_new_connection, NULL);
 }
 
 /******************************************************************************/
@@ -166,62 +584,136 @@ static void on_method_call(GDBusConnection *con,
 int main(int argc, char **argv)
 {
   GError *err = NULL;
+  guint count = 1;
+  gint64 started;
+  gchar name[SOCK_URL_PATH_MAX + 32];
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ql:s:")) != -1)
+  {
+    if (opt == 'q') quiet = 1;
+    else if (opt == 'l' && num_stand_ins < MAX_LISTENERS &&
+             sock_url_parse(optarg, &stand_ins[num_stand_ins]) == 0)
+      num_stand_ins++;
+    else if (opt == 's' && store.fd < 0 &&
+             g_file_test(optarg, G_FILE_TEST_IS_REGULAR) &&
+             ts_store_open(&store, optarg, 0, 0, 0) == 0)
+      g_print("Serving the history of %s\n", optarg);
+    else
+    {
+      g_printerr("usage: %s [-q] [-l url]... [-s store] [count]\n",
+                 argv[0]);
+      return 1;
+    }
+  }
+
+  /* optional argument: number of profiles to export */
+  if (optind < argc) count = CLAMP(atoi(argv[optind]), 1, PROFILE_MAX_COUNT);
 
   conn = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &err);
 
-  if (!conn || err != NULL) return 0;
+  if (!conn || err != NULL)
+  {
+    if (num_stand_ins == 0) return 0;
 
-  introspect_data =
-    g_dbus_node_info_new_for_xml(INTROSPECT_XML, NULL);
+    /* the stand-ins do not need it */
+    g_print("No system bus, serving the stand-ins only\n");
+    g_clear_error(&err);
+    g_clear_object(&conn);
+  }
+  else
+  {
+    g_print("Exporting %u profile object(s)...", count);
 
-  g_assert(introspect_data != NULL);
+    registry = profile_registry_new(conn, PROFILE_OBJECT_PATH, &err);
 
-  GDBusInterfaceInfo *iface_info =
-    g_dbus_node_info_lookup_interface(
-      introspect_data, "org.bluez.Profile1");
+    if (err != NULL) {
+      g_print("failed\n");
+      goto done;
+    } else g_print("ok\n");
 
-  g_assert(iface_info && "Invalid interface info object");
+    add_profiles(count);
+  }
 
-  GDBusInterfaceVTable interface_vtable;
-  interface_vtable.method_call = on_method_call;
-  interface_vtable.get_property = NULL;
-  interface_vtable.set_property = NULL;
+  /* the backend is picked via the IO_BACKEND environment variable,
+     i.e. 'epoll' (default) or 'uring' */
+  io = io_loop_new(NULL, MAX_CONNECTIONS);
 
-  g_print("Exporting profile object...");
+  g_assert(io && "Failed creating the I/O loop");
+  g_print("Using %s I/O backend\n", io_loop_backend_name(io));
 
-  guint reg_id =
-    g_dbus_connection_register_object(conn,
-                                      PROFILE_OBJECT_PATH,
-                                      iface_info,
-                                      &interface_vtable,
-                                      NULL,
-                                      NULL,
-                                      &err);
+  g_unix_fd_add(io_loop_get_fd(io), G_IO_IN, on_io_ready, NULL);
 
+  for (guint i = 0; i < num_stand_ins; ++i)
+  {
+    sock_url_name(&stand_ins[i], name, sizeof(name));
+
+    stand_in_fds[i] = sock_url_listen(&stand_ins[i], SOMAXCONN);
+
+    if (stand_in_fds[i] < 0 ||
+        io_loop_add_listener(io, stand_in_fds[i], on_stand_in_accept,
+                             &stand_ins[i]) < 0)
+    {
+      g_printerr("Failed listening on %s: %s\n", name, g_strerror(errno));
+      return 1;
+    }
 
-  if (err != NULL) {
-    g_print("failed\n");
-    goto done;
-  } else g_print("ok\n");
+    g_print("Listening on %s\n", name);
+  }
+
+  /* one worker per CPU, one strand per possible connection */
+  pool = work_pool_new(0, MAX_CONNECTIONS);
 
-  g_print("Registering profile\n");
-  register_profile(TRUE);
+  g_assert(pool && "Failed creating the worker pool");
+
+  loop = g_main_loop_new(NULL, FALSE);
+
+  if (registry)
+  {
+    g_print("Registering profiles\n");
+    started = g_get_monotonic_time();
+    profile_registry_register_all(registry, on_batch_complete, &started);
+  }
 
   signal(SIGINT, on_signal_received);
 
   /* kick off the main loop now. Be careful not to have anything
      blocking in 'on_loop_idle' */
-  loop = g_main_loop_new(NULL, FALSE);
   g_idle_add(on_loop_idle, NULL);
   g_main_loop_run(loop);
 
-  /* we are done, tear everything down now */
-  g_print("\nUnregistering profile\n");
-  register_profile(FALSE);
+  /* we are done, tear everything down now. Wait for the replies, so the
+     profiles are really gone before we drop the connection */
+  if (registry)
+  {
+    g_print("\nUnregistering profiles\n");
+    started = g_get_monotonic_time();
+    profile_registry_unregister_all(registry, on_batch_complete, &started);
+
+    if (registry->pending > 0) g_main_loop_run(loop);
+  }
+
+  while (connections) close_connection(connections->data);
+
+  for (guint i = 0; i < num_stand_ins; ++i)
+  {
+    io_loop_remove(io, stand_in_fds[i]);
+    close(stand_in_fds[i]);
+    sock_url_unlink(&stand_ins[i]);
+  }
+
+  /* the strands are through afterwards, the connections still have to
+     be freed on this thread */
+  work_pool_free(pool);
+
+  while (num_connections > 0) g_main_context_iteration(NULL, TRUE);
+
+  io_loop_free(io);
 
 done:
-  g_main_loop_unref(loop);
-  g_object_unref(conn);
+  ts_store_close(&store);
+  profile_registry_free(registry);
+  if (loop) g_main_loop_unref(loop);
+  if (conn) g_object_unref(conn);
   return 0;
 }
-
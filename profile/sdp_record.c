@@ -0,0 +1,335 @@
+/******************************************************************************/
+/* File: sdp_record.c
+   Author: N.Kim
+   Abstract: Builder for BlueZ SDP service records (XML format)
+
+   Description:
+     Records are rendered into a growable GString rather than a fixed
+     size buffer, so the number of service classes, profiles, or the
+     length of the service name are not limited. */
+
+/******************************************************************************/
+
+#include "sdp_record.h"
+
+/* initial size of the render buffer, a typical single service record
+   is well below this, so usually there is no reallocation at all */
+#define SDP_RECORD_INITIAL_SIZE 1024
+
+/******************************************************************************/
+
+static struct sdp_uuid_entry *uuid_entry_new(const gchar *uuid,
+                                             const gchar *desc,
+                                             guint16 version)
+{
+  struct sdp_uuid_entry *entry = g_new0(struct sdp_uuid_entry, 1);
+
+  entry->uuid = g_strdup(uuid);
+  entry->desc = g_strdup(desc);
+  entry->version = version;
+
+  return entry;
+}
+
+/******************************************************************************/
+
+static void uuid_entry_free(gpointer data)
+{
+  struct sdp_uuid_entry *entry = data;
+
+  g_free(entry->uuid);
+  g_free(entry->desc);
+  g_free(entry);
+}
+
+/******************************************************************************/
+
+struct sdp_record *sdp_record_new(const gchar *service_name)
+{
+  struct sdp_record *rec = g_new0(struct sdp_record, 1);
+
+  rec->service_classes = g_ptr_array_new_with_free_func(uuid_entry_free);
+  rec->profiles = g_ptr_array_new_with_free_func(uuid_entry_free);
+
+  rec->l2cap_psm = -1;
+  rec->rfcomm_channel = -1;
+  rec->availability = 0xff;
+  rec->features = -1;
+
+  rec->service_name = g_strdup(service_name);
+
+  rec->xml = g_string_sized_new(SDP_RECORD_INITIAL_SIZE);
+  rec->dirty = TRUE;
+
+  return rec;
+}
+
+/******************************************************************************/
+
+struct sdp_record *sdp_record_copy(const struct sdp_record *rec)
+{
+  struct sdp_record *copy = sdp_record_new(rec->service_name);
+
+  for (guint i = 0; i < rec->service_classes->len; ++i)
+  {
+    struct sdp_uuid_entry *e = g_ptr_array_index(rec->service_classes, i);
+    sdp_record_add_service_class(copy, e->uuid, e->desc);
+  }
+
+  for (guint i = 0; i < rec->profiles->len; ++i)
+  {
+    struct sdp_uuid_entry *e = g_ptr_array_index(rec->profiles, i);
+    sdp_record_add_profile(copy, e->uuid, e->desc, e->version);
+  }
+
+  copy->l2cap_psm = rec->l2cap_psm;
+  copy->rfcomm_channel = rec->rfcomm_channel;
+  copy->availability = rec->availability;
+  copy->features = rec->features;
+
+  return copy;
+}
+
+/******************************************************************************/
+
+void sdp_record_free(struct sdp_record *rec)
+{
+  if (!rec) return;
+
+  g_ptr_array_unref(rec->service_classes);
+  g_ptr_array_unref(rec->profiles);
+  g_free(rec->service_name);
+  g_string_free(rec->xml, TRUE);
+  g_free(rec);
+}
+
+/******************************************************************************/
+
+struct sdp_record *sdp_record_new_rfcomm(const gchar *uuid,
+                                         const gchar *desc,
+                                         guint8 channel,
+                                         guint16 version,
+                                         const gchar *service_name)
+{
+  struct sdp_record *rec = sdp_record_new(service_name);
+
+  sdp_record_add_service_class(rec, uuid, desc);
+  sdp_record_add_profile(rec, uuid, desc, version);
+  sdp_record_set_rfcomm_channel(rec, channel);
+
+  return rec;
+}
+
+/******************************************************************************/
+
+void sdp_record_add_service_class(struct sdp_record *rec,
+                                  const gchar *uuid,
+                                  const gchar *desc)
+{
+  g_ptr_array_add(rec->service_classes, uuid_entry_new(uuid, desc, 0));
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+
+void sdp_record_clear_service_classes(struct sdp_record *rec)
+{
+  g_ptr_array_set_size(rec->service_classes, 0);
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+
+void sdp_record_add_profile(struct sdp_record *rec,
+                            const gchar *uuid,
+                            const gchar *desc,
+                            guint16 version)
+{
+  g_ptr_array_add(rec->profiles, uuid_entry_new(uuid, desc, version));
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+
+void sdp_record_clear_profiles(struct sdp_record *rec)
+{
+  g_ptr_array_set_size(rec->profiles, 0);
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+
+void sdp_record_set_l2cap_psm(struct sdp_record *rec, guint16 psm)
+{
+  rec->l2cap_psm = psm;
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+
+void sdp_record_set_rfcomm_channel(struct sdp_record *rec, guint8 channel)
+{
+  rec->rfcomm_channel = channel;
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+
+void sdp_record_set_availability(struct sdp_record *rec, guint8 value)
+{
+  rec->availability = value;
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+
+void sdp_record_set_features(struct sdp_record *rec, guint16 features)
+{
+  rec->features = features;
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+
+void sdp_record_set_service_name(struct sdp_record *rec, const gchar *name)
+{
+  g_free(rec->service_name);
+  rec->service_name = g_strdup(name);
+  rec->dirty = TRUE;
+}
+
+/******************************************************************************/
+/* Append a single uuid element, the description is optional */
+
+static void append_uuid(GString *xml,
+                        const gchar *uuid,
+                        const gchar *desc)
+{
+  if (desc)
+  {
+    gchar *esc = g_markup_escape_text(desc, -1);
+
+    g_string_append_printf(xml,
+      "<uuid value='%s' desc='%s'/>", uuid, esc);
+
+    g_free(esc);
+  }
+  else g_string_append_printf(xml, "<uuid value='%s'/>", uuid);
+}
+
+/******************************************************************************/
+
+static void render(struct sdp_record *rec)
+{
+  GString *xml = rec->xml;
+
+  g_string_truncate(xml, 0);
+  g_string_append(xml,
+    "<?xml version='1.0' encoding='UTF-8' ?>"
+    "<record>");
+
+  if (rec->service_classes->len > 0)
+  {
+    g_string_append_printf(xml,
+      "<attribute id='0x%04x'><sequence>",
+      SDP_ATTR_SERVICE_CLASS_ID_LIST);
+
+    for (guint i = 0; i < rec->service_classes->len; ++i)
+    {
+      struct sdp_uuid_entry *e = g_ptr_array_index(rec->service_classes, i);
+      append_uuid(xml, e->uuid, e->desc);
+    }
+
+    g_string_append(xml, "</sequence></attribute>");
+  }
+
+  /* L2CAP is always the bottom layer of the protocol stack. The PSM is
+     only required when not running RFCOMM on top of it */
+  if (rec->l2cap_psm >= 0 || rec->rfcomm_channel >= 0)
+  {
+    g_string_append_printf(xml,
+      "<attribute id='0x%04x'><sequence><sequence>",
+      SDP_ATTR_PROTOCOL_DESC_LIST);
+
+    append_uuid(xml, SDP_UUID_L2CAP, "L2CAP");
+
+    if (rec->l2cap_psm >= 0)
+      g_string_append_printf(xml,
+        "<uint16 value='0x%04x' desc='PSM'/>", rec->l2cap_psm);
+
+    g_string_append(xml, "</sequence>");
+
+    if (rec->rfcomm_channel >= 0)
+    {
+      g_string_append(xml, "<sequence>");
+      append_uuid(xml, SDP_UUID_RFCOMM, "RFComm");
+
+      g_string_append_printf(xml,
+        "<uint8 value='0x%02x' desc='Channel'/>", rec->rfcomm_channel);
+
+      g_string_append(xml, "</sequence>");
+    }
+
+    g_string_append(xml, "</sequence></attribute>");
+  }
+
+  g_string_append_printf(xml,
+    "<attribute id='0x%04x'><sequence>", SDP_ATTR_BROWSE_GROUP_LIST);
+
+  append_uuid(xml, SDP_UUID_PUBLIC_BROWSE_GROUP, "PublicBrowseGroup");
+  g_string_append(xml, "</sequence></attribute>");
+
+  g_string_append_printf(xml,
+    "<attribute id='0x%04x'><uint8 value='0x%02x'/></attribute>",
+    SDP_ATTR_SERVICE_AVAILABILITY, rec->availability);
+
+  if (rec->profiles->len > 0)
+  {
+    g_string_append_printf(xml,
+      "<attribute id='0x%04x'><sequence>", SDP_ATTR_PROFILE_DESC_LIST);
+
+    for (guint i = 0; i < rec->profiles->len; ++i)
+    {
+      struct sdp_uuid_entry *e = g_ptr_array_index(rec->profiles, i);
+
+      g_string_append(xml, "<sequence>");
+      append_uuid(xml, e->uuid, e->desc);
+
+      g_string_append_printf(xml,
+        "<uint16 value='0x%04x' desc='Version'/></sequence>", e->version);
+    }
+
+    g_string_append(xml, "</sequence></attribute>");
+  }
+
+  if (rec->service_name)
+  {
+    gchar *esc = g_markup_escape_text(rec->service_name, -1);
+
+    g_string_append_printf(xml,
+      "<attribute id='0x%04x'><text value='%s'/></attribute>",
+      SDP_ATTR_SERVICE_NAME, esc);
+
+    g_free(esc);
+  }
+
+  if (rec->features >= 0)
+    g_string_append_printf(xml,
+      "<attribute id='0x%04x'><uint16 value='0x%04x'/></attribute>",
+      SDP_ATTR_SUPPORTED_FEATURES, rec->features);
+
+  g_string_append(xml, "</record>");
+}
+
+/******************************************************************************/
+
+const gchar *sdp_record_get_xml(struct sdp_record *rec)
+{
+  if (rec->dirty)
+  {
+    render(rec);
+    rec->dirty = FALSE;
+  }
+
+  return rec->xml->str;
+}
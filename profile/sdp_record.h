@@ -0,0 +1,92 @@
+/******************************************************************************/
+/* File: sdp_record.h
+   Author: N.Kim
+   Abstract: Builder for BlueZ SDP service records (XML format) */
+/******************************************************************************/
+
+#ifndef SDP_RECORD_H
+#define SDP_RECORD_H
+
+#include <glib.h>
+
+/* SDP attribute ids as used in the BlueZ XML record format */
+#define SDP_ATTR_SERVICE_CLASS_ID_LIST 0x0001
+#define SDP_ATTR_PROTOCOL_DESC_LIST 0x0004
+#define SDP_ATTR_BROWSE_GROUP_LIST 0x0005
+#define SDP_ATTR_SERVICE_AVAILABILITY 0x0008
+#define SDP_ATTR_PROFILE_DESC_LIST 0x0009
+#define SDP_ATTR_SERVICE_NAME 0x0100
+#define SDP_ATTR_SUPPORTED_FEATURES 0x0311
+
+/* protocol uuids (16 bit short forms) */
+#define SDP_UUID_L2CAP "0x0100"
+#define SDP_UUID_RFCOMM "0x0003"
+#define SDP_UUID_PUBLIC_BROWSE_GROUP "0x1002"
+
+/* a record is composed from typed attributes instead of a format string.
+   Unset numeric attributes (-1) are simply left out of the XML. The
+   rendered XML is cached and only rebuilt after an attribute changed,
+   thus, handing the same record to BlueZ repeatedly (e.g. on every
+   re-registration) does not cost any formatting */
+
+struct sdp_record {
+  GPtrArray *service_classes;  /* struct sdp_uuid_entry */
+  GPtrArray *profiles;         /* struct sdp_uuid_entry */
+
+  gint l2cap_psm;
+  gint rfcomm_channel;
+  gint availability;
+  gint features;
+
+  gchar *service_name;
+
+  /* growable render buffer, reused across re-renders */
+  GString *xml;
+  gboolean dirty;
+};
+
+struct sdp_uuid_entry {
+  gchar *uuid;
+  gchar *desc;
+  guint16 version;
+};
+
+struct sdp_record *sdp_record_new(const gchar *service_name);
+struct sdp_record *sdp_record_copy(const struct sdp_record *rec);
+void sdp_record_free(struct sdp_record *rec);
+
+/* convenience constructor for the common 'serial port like' shape, i.e.
+   one service class, L2CAP + RFCOMM on the given channel and one profile
+   descriptor using the same uuid */
+struct sdp_record *sdp_record_new_rfcomm(const gchar *uuid,
+                                         const gchar *desc,
+                                         guint8 channel,
+                                         guint16 version,
+                                         const gchar *service_name);
+
+/* uuids are passed in the BlueZ XML notation, i.e. either 16 bit short
+   forms ('0x1110') or full 128 bit strings */
+void sdp_record_add_service_class(struct sdp_record *rec,
+                                  const gchar *uuid,
+                                  const gchar *desc);
+
+void sdp_record_clear_service_classes(struct sdp_record *rec);
+
+void sdp_record_add_profile(struct sdp_record *rec,
+                            const gchar *uuid,
+                            const gchar *desc,
+                            guint16 version);
+
+void sdp_record_clear_profiles(struct sdp_record *rec);
+
+void sdp_record_set_l2cap_psm(struct sdp_record *rec, guint16 psm);
+void sdp_record_set_rfcomm_channel(struct sdp_record *rec, guint8 channel);
+void sdp_record_set_availability(struct sdp_record *rec, guint8 value);
+void sdp_record_set_features(struct sdp_record *rec, guint16 features);
+void sdp_record_set_service_name(struct sdp_record *rec, const gchar *name);
+
+/* returns the cached XML, owned by the record. Valid until the next
+   modification of the record */
+const gchar *sdp_record_get_xml(struct sdp_record *rec);
+
+#endif